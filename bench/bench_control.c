@@ -0,0 +1,614 @@
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/latency.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#define K10_BENCH_DEFAULT_CONNECTIONS 4
+#define K10_BENCH_DEFAULT_IN_FLIGHT 8
+#define K10_BENCH_DEFAULT_SECONDS 5
+#define K10_BENCH_DEFAULT_SIGNALS 1000
+#define K10_BENCH_MAX_CONNECTIONS 1024
+#define K10_BENCH_MAX_IN_FLIGHT 1024
+#define K10_BENCH_SIGNAL_TIMEOUT_NS (5ULL * 1000000000ULL)
+#define K10_BENCH_BAR_WIDTH 40
+/* The runtime key SetConfig writes: nothing on the emulated side restarts for it. */
+#define K10_BENCH_CONFIG_KEY "save_delay_ms"
+
+/*
+ * Load generator for the control interface of a running k10-barrel-emulatord,
+ * meant for a private dbus-daemon reached through DBUS_SYSTEM_BUS_ADDRESS.
+ *
+ * By default N connections each keep K calls in flight, cycling through
+ * GetStatus, GetConfig and SetConfig (or the --methods given) for a fixed time.
+ * SetConfig writes the current save_delay_ms back, so it runs the whole
+ * validate/apply/persist path without changing anything. Per method it prints
+ * throughput and a latency histogram, and it prints how busy the daemon's
+ * single-threaded loop was.
+ *
+ * With --listeners M, M connections subscribe to the Config interface's
+ * PropertiesChanged instead, and save_delay_ms is toggled one SetConfig at a
+ * time. For each change it times the SetConfig reply and the signal reaching
+ * the first and the last listener, and divides the CPU time of the daemon and
+ * of dbus-daemon by the number of signals. The original value is put back.
+ */
+
+enum k10_bench_method {
+    K10_BENCH_GET_STATUS = 0,
+    K10_BENCH_GET_CONFIG,
+    K10_BENCH_SET_CONFIG,
+    K10_BENCH_METHOD_COUNT,
+};
+
+struct k10_bench_method_info {
+    const char *name;
+    const char *interface;
+};
+
+static const struct k10_bench_method_info k10_bench_methods[K10_BENCH_METHOD_COUNT] = {
+    [K10_BENCH_GET_STATUS] = {"GetStatus", K10_DBUS_IFACE_BARREL},
+    [K10_BENCH_GET_CONFIG] = {"GetConfig", K10_DBUS_IFACE_CONFIG},
+    [K10_BENCH_SET_CONFIG] = {"SetConfig", K10_DBUS_IFACE_CONFIG},
+};
+
+struct k10_bench_ctx;
+
+struct k10_bench_method_stats {
+    uint64_t calls;
+    uint64_t errors;
+    struct k10_latency latency;
+};
+
+/* One of the K calls a connection keeps in flight; re-sent from its own reply. */
+struct k10_bench_call {
+    struct k10_bench_ctx *ctx;
+    sd_bus *bus;
+    enum k10_bench_method method;
+    uint64_t sent_ns;
+};
+
+struct k10_bench_listener {
+    struct k10_bench_ctx *ctx;
+    sd_bus *bus;
+    uint64_t round;
+};
+
+struct k10_bench_ctx {
+    sd_event *event;
+    sd_bus *bus;
+    unsigned int connections;
+    unsigned int in_flight_per_connection;
+    unsigned int seconds;
+    unsigned int listener_count;
+    unsigned long signals;
+    enum k10_bench_method methods[K10_BENCH_METHOD_COUNT];
+    size_t method_count;
+    uint32_t config_value;
+    uint32_t coalesce_ms;
+    sd_bus **buses;
+    struct k10_bench_call *calls;
+    size_t in_flight;
+    uint64_t next_method;
+    bool stopping;
+    struct k10_bench_method_stats stats[K10_BENCH_METHOD_COUNT];
+    struct k10_bench_listener *listeners;
+    uint64_t round;
+    uint64_t round_start_ns;
+    unsigned int delivered;
+    bool replied;
+    struct k10_latency set_config;
+    struct k10_latency first_listener;
+    struct k10_latency last_listener;
+};
+
+/* Time a process has spent on a CPU; schedstat counts ns, stat only clock ticks. */
+static int k10_bench_cpu_ns(pid_t pid, uint64_t *out) {
+    char path[64];
+    char buffer[1024];
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    const char *fields = NULL;
+    FILE *file = NULL;
+    size_t length = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)pid);
+    file = fopen(path, "re");
+    if (file != NULL) {
+        int n = fscanf(file, "%llu", &utime);
+
+        fclose(file);
+        if (n == 1) {
+            *out = utime;
+            return 0;
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    file = fopen(path, "re");
+    if (file == NULL) {
+        return -errno;
+    }
+    length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+
+    fields = strrchr(buffer, ')');
+    if (fields == NULL ||
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime,
+               &stime) != 2) {
+        return -EBADMSG;
+    }
+
+    *out = (utime + stime) * (1000000000ULL / (unsigned long long)sysconf(_SC_CLK_TCK));
+    return 0;
+}
+
+/* 0 when the bus will not say, e.g. for dbus-daemon itself on older versions. */
+static pid_t k10_bench_name_pid(sd_bus *bus, const char *name) {
+    sd_bus_message *reply = NULL;
+    uint32_t pid = 0;
+
+    if (sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                           "org.freedesktop.DBus", "GetConnectionUnixProcessID", NULL, &reply,
+                           "s", name) >= 0 &&
+        sd_bus_message_read(reply, "u", &pid) < 0) {
+        pid = 0;
+    }
+
+    sd_bus_message_unref(reply);
+    return (pid_t)pid;
+}
+
+static int k10_bench_open(struct k10_bench_ctx *ctx, sd_bus **out) {
+    int r = 0;
+
+    r = sd_bus_open_system(out);
+    if (r >= 0) {
+        r = sd_bus_attach_event(*out, ctx->event, 0);
+    }
+
+    return r;
+}
+
+/* Power-of-two bands of the latency histogram, in microseconds. */
+static void k10_bench_print_histogram(const struct k10_latency *latency) {
+    uint64_t bands[40] = {0};
+    uint64_t peak = 0;
+
+    for (unsigned int bucket = 0; bucket < K10_LATENCY_BUCKETS; bucket++) {
+        unsigned int band = bucket < 16 ? 0 : 4 + (bucket - 16) / 8;
+
+        bands[band] += latency->buckets[bucket];
+    }
+
+    for (unsigned int band = 0; band < 40; band++) {
+        if (bands[band] > peak) {
+            peak = bands[band];
+        }
+    }
+
+    for (unsigned int band = 0; band < 40 && peak > 0; band++) {
+        char bar[K10_BENCH_BAR_WIDTH + 1];
+        size_t width = (size_t)(bands[band] * K10_BENCH_BAR_WIDTH / peak);
+
+        if (bands[band] == 0) {
+            continue;
+        }
+
+        memset(bar, '#', width);
+        bar[width] = '\0';
+        /* Band 0 holds everything under 16 ns. */
+        printf("    %10.2f - %10.2f us %10llu %5.1f%% %s\n",
+               band == 0 ? 0.0 : (double)(1ULL << band) / 1e3,
+               band == 0 ? 0.016 : (double)(2ULL << band) / 1e3,
+               (unsigned long long)bands[band],
+               100.0 * (double)bands[band] / (double)latency->count, bar);
+    }
+}
+
+static void k10_bench_print_latency(const char *label, const struct k10_latency *latency) {
+    printf("%-16s avg %8.1f us  p50 %8.1f us  p99 %8.1f us  max %9.1f us\n", label,
+           (double)k10_latency_average(latency) / 1e3,
+           (double)k10_latency_percentile(latency, 50) / 1e3,
+           (double)k10_latency_percentile(latency, 99) / 1e3, (double)latency->max_ns / 1e3);
+}
+
+static int k10_bench_send(struct k10_bench_call *call);
+
+static int k10_bench_on_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_call *call = userdata;
+    struct k10_bench_ctx *ctx = call->ctx;
+    struct k10_bench_method_stats *stats = &ctx->stats[call->method];
+    int r = 0;
+
+    (void)ret_error;
+
+    ctx->in_flight--;
+    stats->calls++;
+    if (sd_bus_message_is_method_error(m, NULL)) {
+        stats->errors++;
+    }
+    k10_latency_record(&stats->latency, k10_latency_now_ns() - call->sent_ns);
+
+    if (!ctx->stopping) {
+        r = k10_bench_send(call);
+        if (r < 0) {
+            fprintf(stderr, "Failed to send %s: %s\n", k10_bench_methods[call->method].name,
+                    strerror(-r));
+            ctx->stopping = true;
+        }
+    }
+
+    return 0;
+}
+
+static int k10_bench_send(struct k10_bench_call *call) {
+    struct k10_bench_ctx *ctx = call->ctx;
+    const struct k10_bench_method_info *info = NULL;
+    sd_bus_message *m = NULL;
+    int r = 0;
+
+    call->method = ctx->methods[ctx->next_method++ % ctx->method_count];
+    info = &k10_bench_methods[call->method];
+
+    r = sd_bus_message_new_method_call(call->bus, &m, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+                                       info->interface, info->name);
+    if (r >= 0 && call->method == K10_BENCH_SET_CONFIG) {
+        r = sd_bus_message_append(m, "a{sv}", 1, K10_BENCH_CONFIG_KEY, "u", ctx->config_value);
+    }
+    if (r >= 0) {
+        call->sent_ns = k10_latency_now_ns();
+        r = sd_bus_call_async(call->bus, NULL, m, k10_bench_on_reply, call, 0);
+    }
+    if (r >= 0) {
+        ctx->in_flight++;
+    }
+
+    sd_bus_message_unref(m);
+    return r;
+}
+
+static int k10_bench_load(struct k10_bench_ctx *ctx, pid_t daemon) {
+    size_t total = (size_t)ctx->connections * ctx->in_flight_per_connection;
+    uint64_t deadline = 0;
+    uint64_t start = 0;
+    uint64_t elapsed = 0;
+    uint64_t cpu_start = 0;
+    uint64_t cpu_end = 0;
+    bool cpu = false;
+    int r = 0;
+
+    ctx->buses = calloc(ctx->connections, sizeof(*ctx->buses));
+    ctx->calls = calloc(total, sizeof(*ctx->calls));
+    if (ctx->buses == NULL || ctx->calls == NULL) {
+        return -ENOMEM;
+    }
+
+    for (unsigned int i = 0; r >= 0 && i < ctx->connections; i++) {
+        r = k10_bench_open(ctx, &ctx->buses[i]);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    cpu = daemon > 0 && k10_bench_cpu_ns(daemon, &cpu_start) >= 0;
+    start = k10_latency_now_ns();
+    deadline = start + (uint64_t)ctx->seconds * 1000000000ULL;
+
+    for (size_t i = 0; r >= 0 && i < total; i++) {
+        ctx->calls[i].ctx = ctx;
+        ctx->calls[i].bus = ctx->buses[i / ctx->in_flight_per_connection];
+        r = k10_bench_send(&ctx->calls[i]);
+    }
+
+    /* Past the deadline nothing new is sent; what is in flight is still waited for. */
+    while (r >= 0 && (!ctx->stopping || ctx->in_flight > 0)) {
+        if (!ctx->stopping && k10_latency_now_ns() >= deadline) {
+            ctx->stopping = true;
+        }
+        r = sd_event_run(ctx->event, 100000);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    elapsed = k10_latency_now_ns() - start;
+    cpu = cpu && k10_bench_cpu_ns(daemon, &cpu_end) >= 0;
+
+    printf("%u connections x %u in flight for %.2f s\n", ctx->connections,
+           ctx->in_flight_per_connection, (double)elapsed / 1e9);
+    for (size_t i = 0; i < ctx->method_count; i++) {
+        enum k10_bench_method method = ctx->methods[i];
+        const struct k10_bench_method_stats *stats = &ctx->stats[method];
+
+        printf("%-16s %9llu calls %9.0f calls/s %6llu errors\n", k10_bench_methods[method].name,
+               (unsigned long long)stats->calls, (double)stats->calls * 1e9 / (double)elapsed,
+               (unsigned long long)stats->errors);
+        k10_bench_print_latency("", &stats->latency);
+        k10_bench_print_histogram(&stats->latency);
+    }
+
+    if (cpu) {
+        printf("daemon loop busy %.1f%% of one CPU\n",
+               100.0 * (double)(cpu_end - cpu_start) / (double)elapsed);
+    }
+
+    return 0;
+}
+
+static int k10_bench_on_signal(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_listener *listener = userdata;
+    struct k10_bench_ctx *ctx = listener->ctx;
+    uint64_t elapsed = k10_latency_now_ns() - ctx->round_start_ns;
+
+    (void)m;
+    (void)ret_error;
+
+    /* A round's change may arrive twice if an earlier flush was still pending. */
+    if (listener->round == ctx->round) {
+        return 0;
+    }
+
+    listener->round = ctx->round;
+    ctx->delivered++;
+    if (ctx->delivered == 1) {
+        k10_latency_record(&ctx->first_listener, elapsed);
+    }
+    if (ctx->delivered == ctx->listener_count) {
+        k10_latency_record(&ctx->last_listener, elapsed);
+    }
+
+    return 0;
+}
+
+static int k10_bench_on_set_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+
+    (void)ret_error;
+
+    if (error != NULL) {
+        fprintf(stderr, "SetConfig: %s\n", error->message != NULL ? error->message : error->name);
+    }
+
+    k10_latency_record(&ctx->set_config, k10_latency_now_ns() - ctx->round_start_ns);
+    ctx->replied = true;
+    return 0;
+}
+
+static int k10_bench_set_config(struct k10_bench_ctx *ctx, uint32_t value) {
+    return sd_bus_call_method_async(ctx->bus, NULL, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+                                    K10_DBUS_IFACE_CONFIG, "SetConfig", k10_bench_on_set_config,
+                                    ctx, "a{sv}", 1, K10_BENCH_CONFIG_KEY, "u", value);
+}
+
+/* One change at a time, so change signals never coalesce across rounds. */
+static int k10_bench_round(struct k10_bench_ctx *ctx, uint32_t value) {
+    int r = 0;
+
+    ctx->round++;
+    ctx->delivered = 0;
+    ctx->replied = false;
+    ctx->round_start_ns = k10_latency_now_ns();
+
+    r = k10_bench_set_config(ctx, value);
+    while (r >= 0 && (!ctx->replied || ctx->delivered < ctx->listener_count)) {
+        if (k10_latency_now_ns() - ctx->round_start_ns > K10_BENCH_SIGNAL_TIMEOUT_NS) {
+            fprintf(stderr, "Timed out: %u of %u listeners got the change\n", ctx->delivered,
+                    ctx->listener_count);
+            return -ETIMEDOUT;
+        }
+        r = sd_event_run(ctx->event, 100000);
+    }
+
+    return r;
+}
+
+static int k10_bench_fanout(struct k10_bench_ctx *ctx, pid_t daemon, pid_t broker) {
+    char match[512];
+    uint64_t cpu_start[2] = {0, 0};
+    uint64_t cpu_end[2] = {0, 0};
+    pid_t pids[2] = {daemon, broker};
+    const char *names[2] = {"daemon", "dbus-daemon"};
+    bool cpu[2] = {false, false};
+    /* Any other valid value: 0-10000. */
+    uint32_t alternate = ctx->config_value > 0 ? ctx->config_value - 1 : 1;
+    unsigned long rounds = 0;
+    int r = 0;
+
+    ctx->listeners = calloc(ctx->listener_count, sizeof(*ctx->listeners));
+    if (ctx->listeners == NULL) {
+        return -ENOMEM;
+    }
+
+    snprintf(match, sizeof(match),
+             "type='signal',sender='%s',path='%s',interface='%s',member='PropertiesChanged',"
+             "arg0='%s'",
+             K10_DBUS_SERVICE, K10_DBUS_OBJECT, K10_DBUS_IFACE_PROPERTIES, K10_DBUS_IFACE_CONFIG);
+
+    for (unsigned int i = 0; r >= 0 && i < ctx->listener_count; i++) {
+        struct k10_bench_listener *listener = &ctx->listeners[i];
+
+        listener->ctx = ctx;
+        r = k10_bench_open(ctx, &listener->bus);
+        if (r >= 0) {
+            r = sd_bus_add_match(listener->bus, NULL, match, k10_bench_on_signal, listener);
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    if (ctx->coalesce_ms > 0) {
+        printf("notify_coalesce_ms is %u: every signal is held back that long\n",
+               ctx->coalesce_ms);
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        cpu[i] = pids[i] > 0 && k10_bench_cpu_ns(pids[i], &cpu_start[i]) >= 0;
+    }
+
+    for (rounds = 0; r >= 0 && rounds < ctx->signals; rounds++) {
+        r = k10_bench_round(ctx, rounds % 2 == 0 ? alternate : ctx->config_value);
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        cpu[i] = cpu[i] && k10_bench_cpu_ns(pids[i], &cpu_end[i]) >= 0;
+    }
+
+    /* An even number of rounds already ends on the original value. */
+    if (rounds % 2 != 0) {
+        int restore = k10_bench_round(ctx, ctx->config_value);
+
+        if (r >= 0) {
+            r = restore;
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    printf("%u listeners, %lu changes\n", ctx->listener_count, rounds);
+    k10_bench_print_latency("SetConfig", &ctx->set_config);
+    k10_bench_print_latency("first listener", &ctx->first_listener);
+    k10_bench_print_latency("last listener", &ctx->last_listener);
+    k10_bench_print_histogram(&ctx->last_listener);
+    for (size_t i = 0; i < 2; i++) {
+        if (cpu[i]) {
+            printf("%-16s %8.1f us CPU per change\n", names[i],
+                   (double)(cpu_end[i] - cpu_start[i]) / 1e3 / (double)rounds);
+        }
+    }
+
+    return 0;
+}
+
+static int k10_bench_parse_methods(struct k10_bench_ctx *ctx, const char *list) {
+    char buffer[128];
+    char *save = NULL;
+
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    ctx->method_count = 0;
+
+    for (char *name = strtok_r(buffer, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        size_t i = 0;
+
+        while (i < K10_BENCH_METHOD_COUNT && strcmp(name, k10_bench_methods[i].name) != 0) {
+            i++;
+        }
+        if (i == K10_BENCH_METHOD_COUNT || ctx->method_count == K10_BENCH_METHOD_COUNT) {
+            return -EINVAL;
+        }
+        ctx->methods[ctx->method_count++] = (enum k10_bench_method)i;
+    }
+
+    return ctx->method_count > 0 ? 0 : -EINVAL;
+}
+
+static int k10_bench_usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--connections N] [--in-flight K] [--seconds S]\n"
+            "       [--methods GetStatus,GetConfig,SetConfig]\n"
+            "       %s --listeners M [--signals COUNT]\n",
+            argv0, argv0);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    struct k10_bench_ctx ctx;
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    pid_t daemon = 0;
+    int r = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.connections = K10_BENCH_DEFAULT_CONNECTIONS;
+    ctx.in_flight_per_connection = K10_BENCH_DEFAULT_IN_FLIGHT;
+    ctx.seconds = K10_BENCH_DEFAULT_SECONDS;
+    ctx.signals = K10_BENCH_DEFAULT_SIGNALS;
+    (void)k10_bench_parse_methods(&ctx, "GetStatus,GetConfig,SetConfig");
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        unsigned long number = value != NULL ? strtoul(value, NULL, 10) : 0;
+
+        if (value == NULL) {
+            return k10_bench_usage(argv[0]);
+        }
+
+        if (strcmp(argv[i], "--connections") == 0) {
+            ctx.connections = (unsigned int)number;
+        } else if (strcmp(argv[i], "--in-flight") == 0) {
+            ctx.in_flight_per_connection = (unsigned int)number;
+        } else if (strcmp(argv[i], "--seconds") == 0) {
+            ctx.seconds = (unsigned int)number;
+        } else if (strcmp(argv[i], "--listeners") == 0) {
+            ctx.listener_count = (unsigned int)number;
+        } else if (strcmp(argv[i], "--signals") == 0) {
+            ctx.signals = number;
+        } else if (strcmp(argv[i], "--methods") != 0 || k10_bench_parse_methods(&ctx, value) < 0) {
+            return k10_bench_usage(argv[0]);
+        }
+        i++;
+    }
+
+    if (ctx.connections == 0 || ctx.connections > K10_BENCH_MAX_CONNECTIONS ||
+        ctx.in_flight_per_connection == 0 ||
+        ctx.in_flight_per_connection > K10_BENCH_MAX_IN_FLIGHT || ctx.seconds == 0 ||
+        ctx.listener_count > K10_BENCH_MAX_CONNECTIONS || ctx.signals == 0) {
+        return k10_bench_usage(argv[0]);
+    }
+
+    r = sd_event_new(&ctx.event);
+    if (r >= 0) {
+        r = k10_bench_open(&ctx, &ctx.bus);
+    }
+    if (r >= 0) {
+        r = sd_bus_get_property_trivial(ctx.bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+                                        K10_DBUS_IFACE_CONFIG, K10_BENCH_CONFIG_KEY, &error, 'u',
+                                        &ctx.config_value);
+    }
+    if (r >= 0) {
+        r = sd_bus_get_property_trivial(ctx.bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+                                        K10_DBUS_IFACE_CONFIG, "notify_coalesce_ms", &error, 'u',
+                                        &ctx.coalesce_ms);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to reach %s: %s\n", K10_DBUS_SERVICE,
+                error.message != NULL ? error.message : strerror(-r));
+        goto cleanup;
+    }
+
+    daemon = k10_bench_name_pid(ctx.bus, K10_DBUS_SERVICE);
+    if (ctx.listener_count > 0) {
+        r = k10_bench_fanout(&ctx, daemon, k10_bench_name_pid(ctx.bus, "org.freedesktop.DBus"));
+    } else {
+        r = k10_bench_load(&ctx, daemon);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+    }
+
+cleanup:
+    for (unsigned int i = 0; ctx.buses != NULL && i < ctx.connections; i++) {
+        sd_bus_flush_close_unref(ctx.buses[i]);
+    }
+    for (unsigned int i = 0; ctx.listeners != NULL && i < ctx.listener_count; i++) {
+        sd_bus_flush_close_unref(ctx.listeners[i].bus);
+    }
+    free(ctx.buses);
+    free(ctx.calls);
+    free(ctx.listeners);
+    sd_bus_flush_close_unref(ctx.bus);
+    sd_event_unref(ctx.event);
+    sd_bus_error_free(&error);
+    return r < 0 ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+#include "k10_barrel/config.h"
+#include "k10_barrel/daemon.h"
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/dbus_marshal.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <systemd/sd-bus.h>
+
+#define K10_BENCH_DEFAULT_ITERATIONS 200000UL
+#define K10_BENCH_LIVE_ITERATIONS 20000UL
+
+/*
+ * Compares building GetStatus/GetConfig reply bodies from scratch against
+ * copying a sealed, pre-marshalled snapshot with sd_bus_message_copy(), and
+ * (with --live) measures round trips against a running daemon, including the
+ * generation property pollers can check before fetching the full dictionary.
+ */
+
+typedef int (*k10_bench_fill_fn)(sd_bus_message *reply, void *userdata);
+
+struct k10_bench_ctx {
+    struct k10_daemon_state state;
+    sd_bus_message *status_snapshot;
+    sd_bus_message *config_snapshot;
+};
+
+static double k10_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void k10_bench_report(const char *label, unsigned long iterations, double elapsed) {
+    printf("%-22s %10lu calls %9.3f s %12.0f calls/s %9.1f ns/call\n", label, iterations, elapsed,
+           (double)iterations / elapsed, elapsed * 1e9 / (double)iterations);
+}
+
+static int k10_bench_snapshot(sd_bus *bus, sd_bus_message **out, int status,
+                              const struct k10_daemon_state *state) {
+    sd_bus_message *body = NULL;
+    int r = 0;
+
+    r = sd_bus_message_new_signal(bus, &body, K10_DBUS_OBJECT, K10_DBUS_IFACE_CONFIG, "Snapshot");
+    if (r < 0) {
+        return r;
+    }
+
+    r = status ? k10_dbus_append_status(body, state) : k10_dbus_append_config(body, &state->config);
+    if (r >= 0) {
+        r = sd_bus_message_seal(body, 1, 0);
+    }
+
+    if (r < 0) {
+        sd_bus_message_unref(body);
+        return r;
+    }
+
+    *out = body;
+    return 0;
+}
+
+static int k10_bench_copy(sd_bus_message *reply, sd_bus_message *snapshot) {
+    int r = sd_bus_message_rewind(snapshot, 1);
+
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_copy(reply, snapshot, 1);
+}
+
+static int k10_fill_status_rebuild(sd_bus_message *reply, void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    return k10_dbus_append_status(reply, &ctx->state);
+}
+
+static int k10_fill_status_snapshot(sd_bus_message *reply, void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    return k10_bench_copy(reply, ctx->status_snapshot);
+}
+
+static int k10_fill_config_rebuild(sd_bus_message *reply, void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    return k10_dbus_append_config(reply, &ctx->state.config);
+}
+
+static int k10_fill_config_snapshot(sd_bus_message *reply, void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    return k10_bench_copy(reply, ctx->config_snapshot);
+}
+
+static int k10_bench_marshal(const char *label, sd_bus_message *call, unsigned long iterations,
+                             k10_bench_fill_fn fill, void *userdata) {
+    double start = k10_bench_now();
+
+    for (unsigned long i = 0; i < iterations; i++) {
+        sd_bus_message *reply = NULL;
+        int r = sd_bus_message_new_method_return(call, &reply);
+
+        if (r >= 0) {
+            r = fill(reply, userdata);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_seal(reply, i + 2, 0);
+        }
+
+        sd_bus_message_unref(reply);
+        if (r < 0) {
+            fprintf(stderr, "%s: %s\n", label, strerror(-r));
+            return r;
+        }
+    }
+
+    k10_bench_report(label, iterations, k10_bench_now() - start);
+    return 0;
+}
+
+static int k10_bench_live(sd_bus *bus, const char *label, const char *interface,
+                          const char *method, const char *property, unsigned long iterations) {
+    double start = k10_bench_now();
+
+    for (unsigned long i = 0; i < iterations; i++) {
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        sd_bus_message *reply = NULL;
+        int r = 0;
+
+        if (property != NULL) {
+            r = sd_bus_get_property(bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT, interface, property,
+                                    &error, &reply, "t");
+        } else {
+            r = sd_bus_call_method(bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT, interface, method,
+                                   &error, &reply, "");
+        }
+
+        sd_bus_message_unref(reply);
+        if (r < 0) {
+            fprintf(stderr, "%s: %s\n", label, error.message ? error.message : strerror(-r));
+            sd_bus_error_free(&error);
+            return r;
+        }
+    }
+
+    k10_bench_report(label, iterations, k10_bench_now() - start);
+    return 0;
+}
+
+static int k10_bench_run_live(sd_bus *bus, unsigned long iterations) {
+    int r = 0;
+
+    r = k10_bench_live(bus, "live GetStatus", K10_DBUS_IFACE_BARREL, "GetStatus", NULL,
+                       iterations);
+    if (r >= 0) {
+        r = k10_bench_live(bus, "live GetConfig", K10_DBUS_IFACE_CONFIG, "GetConfig", NULL,
+                           iterations);
+    }
+    if (r >= 0) {
+        r = k10_bench_live(bus, "live Get(generation)", K10_DBUS_IFACE_BARREL, NULL, "generation",
+                           iterations);
+    }
+
+    return r;
+}
+
+int main(int argc, char **argv) {
+    struct k10_bench_ctx ctx;
+    unsigned long iterations = 0;
+    bool live = false;
+    sd_bus *bus = NULL;
+    sd_bus_message *call = NULL;
+    int r = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--live") == 0) {
+            live = true;
+        } else {
+            iterations = strtoul(argv[i], NULL, 10);
+        }
+    }
+
+    if (iterations == 0) {
+        iterations = live ? K10_BENCH_LIVE_ITERATIONS : K10_BENCH_DEFAULT_ITERATIONS;
+    }
+
+    /* Honors DBUS_SYSTEM_BUS_ADDRESS, so a private dbus-daemon works too. */
+    r = sd_bus_open_system(&bus);
+    if (r < 0) {
+        fprintf(stderr, "Failed to connect to system bus: %s\n", strerror(-r));
+        return 1;
+    }
+
+    if (live) {
+        r = k10_bench_run_live(bus, iterations);
+        sd_bus_unref(bus);
+        return r < 0 ? 1 : 0;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    k10_config_load(NULL, &ctx.state.config);
+    ctx.state.running = true;
+    ctx.state.mode = K10_MODE_BARREL;
+
+    r = sd_bus_message_new_method_call(bus, &call, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+                                       K10_DBUS_IFACE_CONFIG, "GetConfig");
+    if (r >= 0) {
+        r = sd_bus_message_seal(call, 1, 0);
+    }
+    if (r >= 0) {
+        r = k10_bench_snapshot(bus, &ctx.status_snapshot, 1, &ctx.state);
+    }
+    if (r >= 0) {
+        r = k10_bench_snapshot(bus, &ctx.config_snapshot, 0, &ctx.state);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to prepare messages: %s\n", strerror(-r));
+        goto cleanup;
+    }
+
+    r = k10_bench_marshal("status rebuild", call, iterations, k10_fill_status_rebuild, &ctx);
+    if (r >= 0) {
+        r = k10_bench_marshal("status snapshot copy", call, iterations, k10_fill_status_snapshot,
+                              &ctx);
+    }
+    if (r >= 0) {
+        r = k10_bench_marshal("config rebuild", call, iterations, k10_fill_config_rebuild, &ctx);
+    }
+    if (r >= 0) {
+        r = k10_bench_marshal("config snapshot copy", call, iterations, k10_fill_config_snapshot,
+                              &ctx);
+    }
+
+cleanup:
+    sd_bus_message_unref(ctx.config_snapshot);
+    sd_bus_message_unref(ctx.status_snapshot);
+    sd_bus_message_unref(call);
+    sd_bus_unref(bus);
+    return r < 0 ? 1 : 0;
+}
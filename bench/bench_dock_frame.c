@@ -0,0 +1,186 @@
+#include "k10_barrel/config.h"
+#include "k10_barrel/dock_frame.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define K10_BENCH_DEFAULT_ITERATIONS 2000000UL
+#define K10_BENCH_CORPUS_MAX 4096
+#define K10_BENCH_FRAME_MAX 64
+
+/* H4 type, ACL header and L2CAP header come first; then ATT opcode, handle and value. */
+#define K10_BENCH_ATT_OPCODE 9
+#define K10_BENCH_ATT_VALUE 12
+#define K10_BENCH_ATT_WRITE_REQ 0x12
+#define K10_BENCH_ATT_WRITE_CMD 0x52
+
+/*
+ * Parses and answers a corpus of app frames in a loop and reports the cost
+ * per frame. The corpus is a built-in mix, or every write that starts with
+ * the frame magic in a btsnoop file written by capture_enabled
+ * (k10-bench-dock-frame [iterations] [capture.btsnoop]).
+ */
+
+struct k10_bench_frame {
+    size_t length;
+    uint8_t data[K10_BENCH_FRAME_MAX];
+};
+
+struct k10_bench_corpus {
+    struct k10_bench_frame frames[K10_BENCH_CORPUS_MAX];
+    size_t count;
+};
+
+static double k10_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void k10_bench_add(struct k10_bench_corpus *corpus, const uint8_t *data, size_t length) {
+    struct k10_bench_frame *frame = NULL;
+
+    if (corpus->count == K10_BENCH_CORPUS_MAX) {
+        return;
+    }
+
+    frame = &corpus->frames[corpus->count++];
+    frame->length = length < sizeof(frame->data) ? length : sizeof(frame->data);
+    memcpy(frame->data, data, frame->length);
+}
+
+static void k10_bench_builtin(struct k10_bench_corpus *corpus) {
+    static const uint8_t get_info[] = {0x57, 0x02};
+    static const uint8_t action[] = {0x57, 0x01, 0x01};
+    static const uint8_t set_time[] = {0x57, 0x09, 0x65, 0x8f, 0x3a, 0x10};
+    static const uint8_t get_state[] = {0x57, 0x0f, 0x01};
+    static const uint8_t set_mode[] = {0x57, 0x0f, 0x02, 0x03};
+    static const uint8_t unknown[] = {0x57, 0x40, 0x00, 0x00};
+    static const uint8_t garbage[] = {0x01, 0x02, 0x03};
+
+    k10_bench_add(corpus, get_info, sizeof(get_info));
+    k10_bench_add(corpus, get_state, sizeof(get_state));
+    k10_bench_add(corpus, action, sizeof(action));
+    k10_bench_add(corpus, get_info, sizeof(get_info));
+    k10_bench_add(corpus, set_time, sizeof(set_time));
+    k10_bench_add(corpus, get_state, sizeof(get_state));
+    k10_bench_add(corpus, set_mode, sizeof(set_mode));
+    k10_bench_add(corpus, unknown, sizeof(unknown));
+    k10_bench_add(corpus, garbage, sizeof(garbage));
+}
+
+static uint32_t k10_bench_be32(const uint8_t *data) {
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 |
+           (uint32_t)data[3];
+}
+
+static int k10_bench_load_btsnoop(struct k10_bench_corpus *corpus, const char *path) {
+    uint8_t header[24];
+    uint8_t packet[K10_BENCH_ATT_VALUE + 512];
+    FILE *file = fopen(path, "rb");
+    int r = 0;
+
+    if (file == NULL) {
+        return -errno;
+    }
+
+    if (fread(header, 1, 16, file) != 16 || memcmp(header, "btsnoop", 8) != 0) {
+        r = -EBADMSG;
+        goto done;
+    }
+
+    while (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        uint32_t length = k10_bench_be32(header + 4);
+        const uint8_t *value = packet + K10_BENCH_ATT_VALUE;
+
+        if (length > sizeof(packet)) {
+            r = -EBADMSG;
+            goto done;
+        }
+
+        if (fread(packet, 1, length, file) != length) {
+            break;
+        }
+
+        if (length <= K10_BENCH_ATT_VALUE) {
+            continue;
+        }
+
+        if (packet[K10_BENCH_ATT_OPCODE] != K10_BENCH_ATT_WRITE_REQ &&
+            packet[K10_BENCH_ATT_OPCODE] != K10_BENCH_ATT_WRITE_CMD) {
+            continue;
+        }
+
+        if (value[0] == K10_DOCK_FRAME_MAGIC) {
+            k10_bench_add(corpus, value, length - K10_BENCH_ATT_VALUE);
+        }
+    }
+
+done:
+    fclose(file);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    static struct k10_bench_corpus corpus;
+    struct k10_dock_codec codec;
+    struct k10_config config;
+    unsigned long iterations = K10_BENCH_DEFAULT_ITERATIONS;
+    unsigned long answered = 0;
+    unsigned long rejected = 0;
+    unsigned long status_sum = 0;
+    double start = 0;
+    double elapsed = 0;
+    int r = 0;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+    }
+
+    if (argc > 2) {
+        r = k10_bench_load_btsnoop(&corpus, argv[2]);
+        if (r < 0) {
+            fprintf(stderr, "Failed to read %s: %s\n", argv[2], strerror(-r));
+            return 1;
+        }
+    } else {
+        k10_bench_builtin(&corpus);
+    }
+
+    if (corpus.count == 0 || iterations == 0) {
+        fprintf(stderr, "No frames to replay\n");
+        return 1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.fw_major = 1;
+    config.fw_minor = 4;
+    k10_dock_codec_init(&codec, &config);
+
+    start = k10_bench_now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        const struct k10_bench_frame *frame = &corpus.frames[i % corpus.count];
+        const struct k10_dock_response *response = NULL;
+        struct k10_dock_frame parsed;
+
+        if (k10_dock_frame_parse(frame->data, frame->length, &parsed) < 0) {
+            rejected++;
+            continue;
+        }
+
+        response = k10_dock_codec_answer(&codec, &parsed);
+        status_sum += response->data[0];
+        answered++;
+    }
+    elapsed = k10_bench_now() - start;
+
+    printf("corpus %zu frames, %lu answered, %lu rejected (status sum %lu)\n", corpus.count,
+           answered, rejected, status_sum);
+    printf("%-22s %10lu frames %9.3f s %12.0f frames/s %9.1f ns/frame\n", "parse+answer",
+           iterations, elapsed, (double)iterations / elapsed, elapsed * 1e9 / (double)iterations);
+    return 0;
+}
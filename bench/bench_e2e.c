@@ -0,0 +1,665 @@
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/gatt_app.h"
+#include "k10_barrel/latency.h"
+
+#include "mock_bluez.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#define K10_BENCH_DEFAULT_FRAMES 20000UL
+/* How long the daemon gets to claim its name, register, or answer a frame. */
+#define K10_BENCH_TIMEOUT_NS (10ULL * 1000000000ULL)
+#define K10_BENCH_REPLY_TIMEOUT_MS 5000
+#define K10_BENCH_EXIT_REGRESSION 2
+
+extern char **environ;
+
+/*
+ * Runs k10-barrel-emulatord end to end against the mock org.bluez from
+ * mock_bluez.c. The bench starts its own dbus-daemon and hands its address to
+ * the emulator as DBUS_SYSTEM_BUS_ADDRESS, serves org.bluez once the emulator
+ * owns its name, and calls Start. It then plays a connected sweeper: GET_INFO
+ * frames are written to CBA20002 and the dock codec's answer is awaited on
+ * CBA20003, first through WriteValue and PropertiesChanged, then over
+ * acquired sockets. Reported are the time from spawning the emulator to its
+ * advertisement being registered, write->notify p50/p99/p999, and the
+ * emulator's CPU time per 1000 frames. A --max-* limit that is exceeded,
+ * checked against the socket path, makes the bench exit with 2.
+ * The emulator runs on its installed config and rules.
+ */
+
+struct k10_bench_limits {
+    double advertise_ms;
+    double p99_us;
+    double p999_us;
+    double cpu_ms;
+};
+
+struct k10_bench_ctx {
+    sd_event *event;
+    sd_bus *bus;
+    struct k10_mock_bluez *mock;
+    char bus_dir[64];
+    char bus_address[128];
+    pid_t bus_pid;
+    pid_t daemon_pid;
+    uint64_t spawned_ns;
+    uint64_t named_ns;
+    sd_bus_message *start_reply;
+    const char *owner;
+    const char *write_path;
+    const char *notify_path;
+    bool notified;
+    size_t notified_length;
+    double *samples;
+};
+
+struct k10_bench_result {
+    double p99_us;
+    double p999_us;
+    double cpu_ms;
+};
+
+static const uint8_t k10_bench_frame[] = {0x57, 0x02};
+
+static int k10_bench_compare(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Time the emulator has spent on a CPU; schedstat counts ns, stat only clock ticks. */
+static int k10_bench_cpu_ns(pid_t pid, uint64_t *out) {
+    char path[64];
+    char buffer[1024];
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    const char *fields = NULL;
+    FILE *file = NULL;
+    size_t length = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)pid);
+    file = fopen(path, "re");
+    if (file != NULL) {
+        int n = fscanf(file, "%llu", &utime);
+
+        fclose(file);
+        if (n == 1) {
+            *out = utime;
+            return 0;
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    file = fopen(path, "re");
+    if (file == NULL) {
+        return -errno;
+    }
+    length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+
+    /* The command name may hold spaces and parentheses; fields resume after the last ')'. */
+    fields = strrchr(buffer, ')');
+    if (fields == NULL ||
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime,
+               &stime) != 2) {
+        return -EBADMSG;
+    }
+
+    *out = (utime + stime) * (1000000000ULL / (unsigned long long)sysconf(_SC_CLK_TCK));
+    return 0;
+}
+
+static int k10_bench_spawn(char *const argv[], bool quiet, pid_t *out) {
+    posix_spawn_file_actions_t actions;
+    int r = 0;
+
+    r = posix_spawn_file_actions_init(&actions);
+    if (r != 0) {
+        return -r;
+    }
+
+    if (quiet) {
+        r = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        if (r == 0) {
+            r = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+        }
+    }
+    if (r == 0) {
+        r = posix_spawnp(out, argv[0], &actions, NULL, argv, environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    return -r;
+}
+
+static void k10_bench_reap(pid_t pid) {
+    if (pid <= 0) {
+        return;
+    }
+
+    (void)kill(pid, SIGTERM);
+    (void)waitpid(pid, NULL, 0);
+}
+
+/* A throwaway session-policy bus, so the mock may own org.bluez whatever the host runs. */
+static int k10_bench_open_bus(struct k10_bench_ctx *ctx) {
+    char address_arg[160];
+    char *argv[] = {"dbus-daemon", "--session", "--nofork", "--nopidfile", address_arg, NULL};
+    int r = 0;
+
+    snprintf(ctx->bus_dir, sizeof(ctx->bus_dir), "/tmp/k10-bench-e2e-XXXXXX");
+    if (mkdtemp(ctx->bus_dir) == NULL) {
+        ctx->bus_dir[0] = '\0';
+        return -errno;
+    }
+
+    snprintf(ctx->bus_address, sizeof(ctx->bus_address), "unix:path=%s/bus", ctx->bus_dir);
+    snprintf(address_arg, sizeof(address_arg), "--address=%s", ctx->bus_address);
+    if (setenv("DBUS_SYSTEM_BUS_ADDRESS", ctx->bus_address, 1) < 0) {
+        return -errno;
+    }
+
+    r = k10_bench_spawn(argv, true, &ctx->bus_pid);
+    if (r < 0) {
+        return r;
+    }
+
+    /* The socket appears once dbus-daemon is listening. */
+    for (unsigned int attempt = 0; attempt < 500; attempt++) {
+        r = sd_bus_open_system(&ctx->bus);
+        if (r >= 0) {
+            return sd_bus_attach_event(ctx->bus, ctx->event, 0);
+        }
+        usleep(10000);
+    }
+
+    return r;
+}
+
+static void k10_bench_close_bus(struct k10_bench_ctx *ctx) {
+    char path[96];
+
+    ctx->bus = sd_bus_flush_close_unref(ctx->bus);
+    k10_bench_reap(ctx->bus_pid);
+    ctx->bus_pid = 0;
+
+    if (ctx->bus_dir[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/bus", ctx->bus_dir);
+        (void)unlink(path);
+        (void)rmdir(ctx->bus_dir);
+    }
+}
+
+/* Runs the loop until *done, giving up after K10_BENCH_TIMEOUT_NS. */
+static int k10_bench_wait(struct k10_bench_ctx *ctx, const bool *done, const char *what) {
+    uint64_t deadline = k10_latency_now_ns() + K10_BENCH_TIMEOUT_NS;
+    int r = 0;
+
+    while (!*done) {
+        if (k10_latency_now_ns() > deadline) {
+            fprintf(stderr, "Timed out waiting for %s\n", what);
+            return -ETIMEDOUT;
+        }
+
+        r = sd_event_run(ctx->event, 100000);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+static int k10_bench_on_name(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+    const char *name = NULL;
+    const char *old_owner = NULL;
+    const char *new_owner = NULL;
+
+    (void)ret_error;
+
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0 &&
+        strcmp(name, K10_DBUS_SERVICE) == 0 && new_owner[0] != '\0' && ctx->named_ns == 0) {
+        ctx->named_ns = k10_latency_now_ns();
+    }
+
+    return 0;
+}
+
+static int k10_bench_on_started(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    (void)ret_error;
+
+    ctx->start_reply = sd_bus_message_ref(m);
+    return 0;
+}
+
+/* The mock has to serve the adapter the emulator is configured for. */
+static int k10_bench_read_adapter(struct k10_bench_ctx *ctx, char *out, size_t size) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    const char *key = NULL;
+    const char *value = NULL;
+    int r = 0;
+
+    r = sd_bus_call_method(ctx->bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT, K10_DBUS_IFACE_CONFIG,
+                           "GetConfig", &error, &reply, "");
+    if (r < 0) {
+        fprintf(stderr, "GetConfig: %s\n", error.message != NULL ? error.message : strerror(-r));
+        goto finish;
+    }
+
+    r = sd_bus_message_enter_container(reply, 'a', "{sv}");
+    while (r >= 0 && value == NULL && (r = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(reply, "s", &key);
+        if (r >= 0 && strcmp(key, "adapter") == 0) {
+            r = sd_bus_message_read(reply, "v", "s", &value);
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(reply, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(reply);
+        }
+    }
+
+    if (r >= 0 && value == NULL) {
+        r = -ENODATA;
+    }
+    if (r >= 0) {
+        snprintf(out, size, "%s", value);
+    }
+
+finish:
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+/* Spawn, wait for the bus name, serve org.bluez, then Start until both registrations land. */
+static int k10_bench_start(struct k10_bench_ctx *ctx, const char *daemon) {
+    char *argv[] = {(char *)daemon, NULL};
+    const struct k10_mock_bluez_app *app = NULL;
+    const sd_bus_error *error = NULL;
+    char adapter[32];
+    bool registered = false;
+    uint64_t start_ns = 0;
+    int r = 0;
+
+    r = sd_bus_match_signal(ctx->bus, NULL, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                            "org.freedesktop.DBus", "NameOwnerChanged", k10_bench_on_name, ctx);
+    if (r >= 0) {
+        ctx->spawned_ns = k10_latency_now_ns();
+        r = k10_bench_spawn(argv, true, &ctx->daemon_pid);
+    }
+    while (r >= 0 && ctx->named_ns == 0) {
+        int status = 0;
+
+        if (waitpid(ctx->daemon_pid, &status, WNOHANG) == ctx->daemon_pid) {
+            ctx->daemon_pid = 0;
+            fprintf(stderr, "%s exited before claiming %s\n", daemon, K10_DBUS_SERVICE);
+            return -ECHILD;
+        }
+        if (k10_latency_now_ns() - ctx->spawned_ns > K10_BENCH_TIMEOUT_NS) {
+            fprintf(stderr, "Timed out waiting for %s\n", K10_DBUS_SERVICE);
+            return -ETIMEDOUT;
+        }
+        r = sd_event_run(ctx->event, 100000);
+    }
+
+    if (r >= 0) {
+        r = k10_bench_read_adapter(ctx, adapter, sizeof(adapter));
+    }
+    if (r >= 0) {
+        r = k10_mock_bluez_new(ctx->bus, adapter, &ctx->mock);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    app = k10_mock_bluez_app(ctx->mock);
+    start_ns = k10_latency_now_ns();
+    r = sd_bus_call_method_async(ctx->bus, NULL, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+                                 K10_DBUS_IFACE_BARREL, "Start", k10_bench_on_started, ctx, "");
+    while (r >= 0 && !registered) {
+        if (ctx->start_reply != NULL && sd_bus_message_is_method_error(ctx->start_reply, NULL)) {
+            break;
+        }
+        if (k10_latency_now_ns() - start_ns > K10_BENCH_TIMEOUT_NS) {
+            fprintf(stderr, "Timed out waiting for the application and advertisement\n");
+            return -ETIMEDOUT;
+        }
+
+        r = sd_event_run(ctx->event, 100000);
+        registered =
+            ctx->start_reply != NULL && app->application_ns != 0 && app->advertisement_ns != 0;
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    error = sd_bus_message_get_error(ctx->start_reply);
+    if (error != NULL) {
+        fprintf(stderr, "Start: %s\n", error->message != NULL ? error->message : error->name);
+        return -EIO;
+    }
+
+    ctx->owner = app->owner;
+    ctx->write_path = app->chrc_paths[K10_GATT_CHRC_DOCK_WRITE];
+    ctx->notify_path = app->chrc_paths[K10_GATT_CHRC_DOCK_NOTIFY];
+    if (ctx->write_path[0] == '\0' || ctx->notify_path[0] == '\0') {
+        fprintf(stderr, "The registered application has no CBA20002/CBA20003\n");
+        return -ENOENT;
+    }
+
+    printf("startup  bus name %8.2f ms  application %8.2f ms  advertising %8.2f ms"
+           "  (Start->advertising %.2f ms, local name \"%s\")\n",
+           (double)(ctx->named_ns - ctx->spawned_ns) / 1e6,
+           (double)(app->application_ns - ctx->spawned_ns) / 1e6,
+           (double)(app->advertisement_ns - ctx->spawned_ns) / 1e6,
+           (double)(app->advertisement_ns - start_ns) / 1e6, app->local_name);
+    return 0;
+}
+
+static void k10_bench_report(const char *label, const struct k10_bench_ctx *ctx,
+                             unsigned long frames, uint64_t elapsed_ns, uint64_t cpu_ns,
+                             struct k10_bench_result *out) {
+    double *samples = ctx->samples;
+
+    qsort(samples, frames, sizeof(*samples), k10_bench_compare);
+    out->p99_us = samples[frames * 99 / 100] * 1e6;
+    out->p999_us = samples[frames * 999 / 1000] * 1e6;
+    out->cpu_ms = (double)cpu_ns / 1e6 * 1000.0 / (double)frames;
+
+    printf("%-8s %7lu frames %8.0f frames/s  p50 %7.1f us  p99 %7.1f us  p999 %7.1f us  "
+           "max %8.1f us  cpu %6.2f ms/1k frames\n",
+           label, frames, (double)frames * 1e9 / (double)elapsed_ns, samples[frames / 2] * 1e6,
+           out->p99_us, out->p999_us, samples[frames - 1] * 1e6, out->cpu_ms);
+}
+
+static int k10_bench_on_value(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+    const char *name = NULL;
+    const void *data = NULL;
+    size_t length = 0;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_skip(m, "s");
+    if (r >= 0) {
+        r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    }
+    while (r >= 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "Value") == 0) {
+            r = sd_bus_message_enter_container(m, 'v', "ay");
+            if (r >= 0) {
+                r = sd_bus_message_read_array(m, 'y', &data, &length);
+            }
+            if (r >= 0) {
+                ctx->notified = true;
+                ctx->notified_length = length;
+                r = sd_bus_message_exit_container(m);
+            }
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+    }
+
+    return 0;
+}
+
+static int k10_bench_write_value(struct k10_bench_ctx *ctx) {
+    sd_bus_message *m = NULL;
+    int r = 0;
+
+    r = sd_bus_message_new_method_call(ctx->bus, &m, ctx->owner, ctx->write_path,
+                                       K10_BLUEZ_IFACE_GATT_CHRC, "WriteValue");
+    if (r >= 0) {
+        r = sd_bus_message_append_array(m, 'y', k10_bench_frame, sizeof(k10_bench_frame));
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append(m, "a{sv}", 1, "type", "s", "request");
+    }
+    if (r >= 0) {
+        r = sd_bus_send(ctx->bus, m, NULL);
+    }
+
+    sd_bus_message_unref(m);
+    return r;
+}
+
+/* The path BlueZ takes for writes with response and without AcquireNotify. */
+static int k10_bench_dbus(struct k10_bench_ctx *ctx, unsigned long frames,
+                          struct k10_bench_result *out) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_slot *match = NULL;
+    uint64_t cpu_start = 0;
+    uint64_t cpu_end = 0;
+    uint64_t start = 0;
+    int r = 0;
+
+    r = sd_bus_match_signal(ctx->bus, &match, ctx->owner, ctx->notify_path,
+                            K10_DBUS_IFACE_PROPERTIES, "PropertiesChanged", k10_bench_on_value,
+                            ctx);
+    if (r >= 0) {
+        r = sd_bus_call_method(ctx->bus, ctx->owner, ctx->notify_path, K10_BLUEZ_IFACE_GATT_CHRC,
+                               "StartNotify", &error, NULL, "");
+    }
+    if (r >= 0) {
+        r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_start);
+    }
+
+    start = k10_latency_now_ns();
+    for (unsigned long i = 0; r >= 0 && i < frames; i++) {
+        uint64_t t0 = k10_latency_now_ns();
+
+        ctx->notified = false;
+        r = k10_bench_write_value(ctx);
+        if (r >= 0) {
+            r = k10_bench_wait(ctx, &ctx->notified, "a CBA20003 notification");
+        }
+        ctx->samples[i] = (double)(k10_latency_now_ns() - t0) / 1e9;
+    }
+
+    if (r >= 0) {
+        r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_end);
+    }
+    if (r >= 0) {
+        k10_bench_report("dbus", ctx, frames, k10_latency_now_ns() - start, cpu_end - cpu_start,
+                         out);
+        r = sd_bus_call_method(ctx->bus, ctx->owner, ctx->notify_path,
+                               K10_BLUEZ_IFACE_GATT_CHRC, "StopNotify", &error, NULL, "");
+    }
+    if (r < 0 && sd_bus_error_is_set(&error)) {
+        fprintf(stderr, "%s\n", error.message != NULL ? error.message : error.name);
+    }
+
+    sd_bus_slot_unref(match);
+    sd_bus_error_free(&error);
+    return r;
+}
+
+/* What a connected sweeper uses: write-without-response and notifications over sockets. */
+static int k10_bench_sockets(struct k10_bench_ctx *ctx, unsigned long frames,
+                             struct k10_bench_result *out) {
+    uint8_t buffer[K10_GATT_VALUE_MAX];
+    struct pollfd pfd = {.fd = -1, .events = POLLIN};
+    uint64_t cpu_start = 0;
+    uint64_t cpu_end = 0;
+    uint64_t start = 0;
+    int write_fd = -1;
+    int r = 0;
+
+    r = k10_mock_bluez_acquire(ctx->mock, ctx->owner, ctx->write_path, true, &write_fd);
+    if (r >= 0) {
+        r = k10_mock_bluez_acquire(ctx->mock, ctx->owner, ctx->notify_path, false, &pfd.fd);
+    }
+    if (r >= 0) {
+        r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_start);
+    }
+
+    start = k10_latency_now_ns();
+    for (unsigned long i = 0; r >= 0 && i < frames; i++) {
+        uint64_t t0 = k10_latency_now_ns();
+
+        if (send(write_fd, k10_bench_frame, sizeof(k10_bench_frame), MSG_NOSIGNAL) < 0) {
+            r = -errno;
+            break;
+        }
+
+        r = poll(&pfd, 1, K10_BENCH_REPLY_TIMEOUT_MS);
+        if (r == 0) {
+            fprintf(stderr, "Timed out waiting for a CBA20003 notification\n");
+            r = -ETIMEDOUT;
+        } else if (r > 0 && recv(pfd.fd, buffer, sizeof(buffer), MSG_DONTWAIT) <= 0) {
+            r = -EPIPE;
+        } else if (r < 0) {
+            r = -errno;
+        }
+        ctx->samples[i] = (double)(k10_latency_now_ns() - t0) / 1e9;
+    }
+
+    if (r >= 0) {
+        r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_end);
+    }
+    if (r >= 0) {
+        k10_bench_report("socket", ctx, frames, k10_latency_now_ns() - start,
+                         cpu_end - cpu_start, out);
+    }
+
+    if (write_fd >= 0) {
+        close(write_fd);
+    }
+    if (pfd.fd >= 0) {
+        close(pfd.fd);
+    }
+    return r;
+}
+
+static bool k10_bench_check(const char *name, double value, double limit, const char *unit) {
+    if (limit <= 0 || value <= limit) {
+        return true;
+    }
+
+    fprintf(stderr, "Regression: %s %.2f %s over the limit of %.2f %s\n", name, value, unit,
+            limit, unit);
+    return false;
+}
+
+static int k10_bench_usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--max-advertise-ms N] [--max-p99-us N] [--max-p999-us N]\n"
+            "       [--max-cpu-ms N] <k10-barrel-emulatord> [frames]\n",
+            argv0);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    struct k10_bench_ctx ctx;
+    struct k10_bench_limits limits = {0};
+    struct k10_bench_result dbus;
+    struct k10_bench_result sockets;
+    const char *daemon = NULL;
+    unsigned long frames = K10_BENCH_DEFAULT_FRAMES;
+    double advertise_ms = 0;
+    bool passed = true;
+    int positional = 0;
+    int r = 0;
+
+    for (int i = 1; i < argc; i++) {
+        double *limit = NULL;
+
+        if (strcmp(argv[i], "--max-advertise-ms") == 0) {
+            limit = &limits.advertise_ms;
+        } else if (strcmp(argv[i], "--max-p99-us") == 0) {
+            limit = &limits.p99_us;
+        } else if (strcmp(argv[i], "--max-p999-us") == 0) {
+            limit = &limits.p999_us;
+        } else if (strcmp(argv[i], "--max-cpu-ms") == 0) {
+            limit = &limits.cpu_ms;
+        } else if (argv[i][0] == '-') {
+            return k10_bench_usage(argv[0]);
+        } else if (positional++ == 0) {
+            daemon = argv[i];
+        } else if (positional == 2) {
+            frames = strtoul(argv[i], NULL, 10);
+        } else {
+            return k10_bench_usage(argv[0]);
+        }
+
+        if (limit != NULL) {
+            if (++i == argc) {
+                return k10_bench_usage(argv[0]);
+            }
+            *limit = strtod(argv[i], NULL);
+        }
+    }
+    if (daemon == NULL || frames == 0) {
+        return k10_bench_usage(argv[0]);
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.samples = calloc(frames, sizeof(*ctx.samples));
+    if (ctx.samples == NULL) {
+        return 1;
+    }
+
+    r = sd_event_new(&ctx.event);
+    if (r >= 0) {
+        r = k10_bench_open_bus(&ctx);
+    }
+    if (r >= 0) {
+        r = k10_bench_start(&ctx, daemon);
+    }
+    if (r >= 0) {
+        advertise_ms =
+            (double)(k10_mock_bluez_app(ctx.mock)->advertisement_ns - ctx.spawned_ns) / 1e6;
+        r = k10_bench_dbus(&ctx, frames, &dbus);
+    }
+    if (r >= 0) {
+        r = k10_bench_sockets(&ctx, frames, &sockets);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+    } else {
+        fflush(stdout);
+        passed = k10_bench_check("time to advertising", advertise_ms, limits.advertise_ms, "ms");
+        passed &= k10_bench_check("socket p99", sockets.p99_us, limits.p99_us, "us");
+        passed &= k10_bench_check("socket p999", sockets.p999_us, limits.p999_us, "us");
+        passed &= k10_bench_check("socket cpu per 1k frames", sockets.cpu_ms, limits.cpu_ms, "ms");
+    }
+
+    k10_mock_bluez_free(ctx.mock);
+    sd_bus_message_unref(ctx.start_reply);
+    k10_bench_reap(ctx.daemon_pid);
+    k10_bench_close_bus(&ctx);
+    sd_event_unref(ctx.event);
+    free(ctx.samples);
+
+    if (r < 0) {
+        return 1;
+    }
+    return passed ? 0 : K10_BENCH_EXIT_REGRESSION;
+}
@@ -0,0 +1,434 @@
+#include "k10_barrel/chrc_dock.h"
+#include "k10_barrel/config.h"
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/gatt_app.h"
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#define K10_BENCH_DEFAULT_FRAMES 20000UL
+#define K10_BENCH_WRITE_PATH K10_DBUS_GATT_OBJECT "/service0/char0"
+#define K10_BENCH_NOTIFY_PATH K10_DBUS_GATT_OBJECT "/service0/char1"
+#define K10_BENCH_MTU 247
+
+/*
+ * Plays the BlueZ side against the GATT application in one process: two
+ * connections to the same bus share one event loop, and the application
+ * echoes every CBA20002 write back as a CBA20003 notification. Each frame's
+ * write->notify latency is measured over WriteValue + PropertiesChanged and
+ * then over the AcquireWrite/AcquireNotify sockets. A final burst writes
+ * without reading notifications to exercise the CBA20003 queue under the
+ * configured overflow policy. Run it against a private dbus-daemon through
+ * DBUS_SYSTEM_BUS_ADDRESS.
+ */
+
+struct k10_bench_ctx {
+    sd_event *event;
+    sd_bus *app_bus;
+    sd_bus *client_bus;
+    struct k10_gatt *gatt;
+    struct k10_chrc_dock *dock;
+    const char *app_name;
+    sd_bus_message *reply;
+    bool replied;
+    bool notified;
+    int write_fd;
+    int notify_fd;
+    double *samples;
+};
+
+static const uint8_t k10_bench_frame[] = {0x57, 0x0f, 0x31, 0x01, 0x02, 0x03,
+                                          0x04, 0x05, 0x06, 0x07, 0x08, 0x09};
+
+static double k10_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int k10_bench_compare(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void k10_bench_report(const char *label, double *samples, unsigned long frames,
+                             double elapsed) {
+    qsort(samples, frames, sizeof(*samples), k10_bench_compare);
+    printf("%-14s %8lu frames %9.0f frames/s  p50 %7.1f us  p99 %7.1f us  max %7.1f us\n", label,
+           frames, (double)frames / elapsed, samples[frames / 2] * 1e6,
+           samples[frames * 99 / 100] * 1e6, samples[frames - 1] * 1e6);
+}
+
+static void k10_bench_echo(enum k10_gatt_chrc chrc, const uint8_t *data, size_t length,
+                           void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    if (chrc == K10_GATT_CHRC_DOCK_WRITE) {
+        (void)k10_chrc_dock_notify(ctx->dock, data, length);
+    }
+}
+
+static int k10_bench_on_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    (void)ret_error;
+
+    ctx->reply = sd_bus_message_ref(m);
+    ctx->replied = true;
+    return 0;
+}
+
+static int k10_bench_on_changed(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    (void)m;
+    (void)ret_error;
+
+    ctx->notified = true;
+    return 0;
+}
+
+static int k10_bench_wait(struct k10_bench_ctx *ctx, const bool *flag) {
+    int r = 0;
+
+    while (!*flag) {
+        r = sd_event_run(ctx->event, UINT64_MAX);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+/* Sends a call built by the caller and spins the shared loop until the reply is in. */
+static int k10_bench_call(struct k10_bench_ctx *ctx, sd_bus_message *call) {
+    const sd_bus_error *error = NULL;
+    int r = 0;
+
+    ctx->reply = sd_bus_message_unref(ctx->reply);
+    ctx->replied = false;
+
+    r = sd_bus_call_async(ctx->client_bus, NULL, call, k10_bench_on_reply, ctx, 0);
+    sd_bus_message_unref(call);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_bench_wait(ctx, &ctx->replied);
+    if (r < 0) {
+        return r;
+    }
+
+    error = sd_bus_message_get_error(ctx->reply);
+    if (error != NULL) {
+        fprintf(stderr, "%s\n", error->message != NULL ? error->message : error->name);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int k10_bench_new_call(struct k10_bench_ctx *ctx, const char *path, const char *member,
+                              sd_bus_message **out) {
+    return sd_bus_message_new_method_call(ctx->client_bus, out, ctx->app_name, path,
+                                          K10_BLUEZ_IFACE_GATT_CHRC, member);
+}
+
+static int k10_bench_write_value(struct k10_bench_ctx *ctx) {
+    sd_bus_message *call = NULL;
+    int r = 0;
+
+    r = k10_bench_new_call(ctx, K10_BENCH_WRITE_PATH, "WriteValue", &call);
+    if (r >= 0) {
+        r = sd_bus_message_append_array(call, 'y', k10_bench_frame, sizeof(k10_bench_frame));
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append(call, "a{sv}", 1, "type", "s", "command");
+    }
+    if (r < 0) {
+        sd_bus_message_unref(call);
+        return r;
+    }
+
+    return k10_bench_call(ctx, call);
+}
+
+static int k10_bench_dbus(struct k10_bench_ctx *ctx, unsigned long frames) {
+    sd_bus_message *call = NULL;
+    sd_bus_slot *match = NULL;
+    double start = 0;
+    int r = 0;
+
+    r = sd_bus_match_signal(ctx->client_bus, &match, ctx->app_name, K10_BENCH_NOTIFY_PATH,
+                            "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                            k10_bench_on_changed, ctx);
+    if (r >= 0) {
+        r = k10_bench_new_call(ctx, K10_BENCH_NOTIFY_PATH, "StartNotify", &call);
+    }
+    if (r >= 0) {
+        r = k10_bench_call(ctx, call);
+    }
+    if (r < 0) {
+        goto done;
+    }
+
+    ctx->notified = false;
+    start = k10_bench_now();
+    for (unsigned long i = 0; i < frames; i++) {
+        double t0 = k10_bench_now();
+
+        /* Like BlueZ, wait for the WriteValue reply as well as the notification. */
+        r = k10_bench_write_value(ctx);
+        if (r >= 0) {
+            r = k10_bench_wait(ctx, &ctx->notified);
+        }
+        if (r < 0) {
+            goto done;
+        }
+
+        ctx->samples[i] = k10_bench_now() - t0;
+        ctx->notified = false;
+    }
+    k10_bench_report("dbus", ctx->samples, frames, k10_bench_now() - start);
+
+    r = k10_bench_new_call(ctx, K10_BENCH_NOTIFY_PATH, "StopNotify", &call);
+    if (r >= 0) {
+        r = k10_bench_call(ctx, call);
+    }
+
+done:
+    sd_bus_slot_unref(match);
+    return r;
+}
+
+static int k10_bench_acquire(struct k10_bench_ctx *ctx, const char *path, const char *member,
+                             int *out_fd) {
+    sd_bus_message *call = NULL;
+    uint16_t mtu = 0;
+    int fd = -1;
+    int r = 0;
+
+    r = k10_bench_new_call(ctx, path, member, &call);
+    if (r >= 0) {
+        r = sd_bus_message_append(call, "a{sv}", 1, "mtu", "q", (uint16_t)K10_BENCH_MTU);
+    }
+    if (r < 0) {
+        sd_bus_message_unref(call);
+        return r;
+    }
+
+    r = k10_bench_call(ctx, call);
+    if (r >= 0) {
+        r = sd_bus_message_read(ctx->reply, "hq", &fd, &mtu);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    /* The descriptor belongs to the reply message. */
+    *out_fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    return *out_fd < 0 ? -errno : 0;
+}
+
+static int k10_bench_socket(struct k10_bench_ctx *ctx, unsigned long frames) {
+    uint8_t buffer[K10_BENCH_MTU];
+    double start = 0;
+    int r = 0;
+
+    r = k10_bench_acquire(ctx, K10_BENCH_WRITE_PATH, "AcquireWrite", &ctx->write_fd);
+    if (r >= 0) {
+        r = k10_bench_acquire(ctx, K10_BENCH_NOTIFY_PATH, "AcquireNotify", &ctx->notify_fd);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    start = k10_bench_now();
+    for (unsigned long i = 0; i < frames; i++) {
+        double t0 = k10_bench_now();
+
+        if (send(ctx->write_fd, k10_bench_frame, sizeof(k10_bench_frame), MSG_NOSIGNAL) < 0) {
+            return -errno;
+        }
+
+        while (recv(ctx->notify_fd, buffer, sizeof(buffer), MSG_DONTWAIT) < 0) {
+            if (errno != EAGAIN) {
+                return -errno;
+            }
+
+            r = sd_event_run(ctx->event, UINT64_MAX);
+            if (r < 0) {
+                return r;
+            }
+        }
+
+        ctx->samples[i] = k10_bench_now() - t0;
+    }
+    k10_bench_report("socket", ctx->samples, frames, k10_bench_now() - start);
+    return 0;
+}
+
+static unsigned long k10_bench_drain(struct k10_bench_ctx *ctx) {
+    uint8_t buffer[K10_BENCH_MTU];
+    unsigned long received = 0;
+
+    while (recv(ctx->notify_fd, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0) {
+        received++;
+    }
+
+    return received;
+}
+
+/* Writes every frame before reading any notification back, as a stalled phone would. */
+static int k10_bench_burst(struct k10_bench_ctx *ctx, const struct k10_config *config,
+                           unsigned long frames) {
+    struct k10_chrc_dock_stats before;
+    struct k10_chrc_dock_stats after;
+    unsigned long received = 0;
+    unsigned long sent = 0;
+    int r = 0;
+
+    k10_chrc_dock_get_stats(ctx->dock, &before);
+
+    while (sent < frames) {
+        if (send(ctx->write_fd, k10_bench_frame, sizeof(k10_bench_frame),
+                 MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+            sent++;
+            continue;
+        }
+        if (errno != EAGAIN) {
+            return -errno;
+        }
+
+        /* With the block policy the app stops reading; only the phone can unstick it. */
+        r = sd_event_run(ctx->event, 0);
+        if (r < 0) {
+            return r;
+        }
+        if (r == 0) {
+            received += k10_bench_drain(ctx);
+        }
+    }
+
+    do {
+        r = sd_event_run(ctx->event, 0);
+        if (r < 0) {
+            return r;
+        }
+        received += k10_bench_drain(ctx);
+        k10_chrc_dock_get_stats(ctx->dock, &after);
+    } while (r > 0 || after.length > 0);
+
+    printf("burst %-11s%8lu frames %8lu received  dropped %llu  high water %u/%u  stalls %llu\n",
+           config->notify_queue_policy, sent, received,
+           (unsigned long long)(after.dropped - before.dropped), after.high_water, after.depth,
+           (unsigned long long)(after.stalls - before.stalls));
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct k10_bench_ctx ctx;
+    struct k10_config config;
+    unsigned long frames = K10_BENCH_DEFAULT_FRAMES;
+    int r = 0;
+
+    if (argc > 1) {
+        frames = strtoul(argv[1], NULL, 10);
+    }
+    if (frames == 0 || argc > 3) {
+        fprintf(stderr, "Usage: %s [frames] [notify-queue-policy]\n", argv[0]);
+        return 1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.write_fd = -1;
+    ctx.notify_fd = -1;
+    ctx.samples = calloc(frames, sizeof(*ctx.samples));
+    if (ctx.samples == NULL) {
+        return 1;
+    }
+
+    k10_config_load(NULL, &config);
+    snprintf(config.service_uuids[0], sizeof(config.service_uuids[0]), "%s",
+             "CBA20D00-224D-11E6-9FB8-0002A5D5C51B");
+    config.service_uuid_count = 1;
+    if (argc > 2) {
+        snprintf(config.notify_queue_policy, sizeof(config.notify_queue_policy), "%s", argv[2]);
+    }
+
+    /* Same async journal path as the daemon. */
+    (void)k10_log_open();
+
+    r = sd_event_new(&ctx.event);
+    if (r >= 0) {
+        r = sd_bus_open_system(&ctx.app_bus);
+    }
+    if (r >= 0) {
+        r = sd_bus_open_system(&ctx.client_bus);
+    }
+    if (r >= 0) {
+        r = sd_bus_attach_event(ctx.app_bus, ctx.event, 0);
+    }
+    if (r >= 0) {
+        r = sd_bus_attach_event(ctx.client_bus, ctx.event, 0);
+    }
+    if (r >= 0) {
+        r = sd_bus_get_unique_name(ctx.app_bus, &ctx.app_name);
+    }
+    if (r >= 0) {
+        r = k10_gatt_new(ctx.app_bus, K10_DBUS_OBJECT, &ctx.gatt);
+    }
+    if (r >= 0) {
+        r = k10_chrc_dock_new(ctx.gatt, &config, &ctx.dock);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to set up: %s\n", strerror(-r));
+        goto cleanup;
+    }
+
+    k10_gatt_update(ctx.gatt, &config, 1);
+    k10_gatt_set_write_handler(ctx.gatt, k10_bench_echo, &ctx);
+
+    r = k10_bench_dbus(&ctx, frames);
+    if (r >= 0) {
+        r = k10_bench_socket(&ctx, frames);
+    }
+    if (r >= 0) {
+        r = k10_bench_burst(&ctx, &config, frames);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+    }
+
+cleanup:
+    if (ctx.write_fd >= 0) {
+        close(ctx.write_fd);
+    }
+    if (ctx.notify_fd >= 0) {
+        close(ctx.notify_fd);
+    }
+    sd_bus_message_unref(ctx.reply);
+    k10_chrc_dock_free(ctx.dock);
+    k10_gatt_free(ctx.gatt);
+    sd_bus_flush_close_unref(ctx.client_bus);
+    sd_bus_flush_close_unref(ctx.app_bus);
+    sd_event_unref(ctx.event);
+    free(ctx.samples);
+    k10_log_close();
+    return r < 0 ? 1 : 0;
+}
@@ -0,0 +1,525 @@
+#include "k10_barrel/config.h"
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/latency.h"
+
+#include "mock_bluez.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#define K10_BENCH_DEFAULT_INSTANCES (K10_INSTANCE_MAX - 1)
+#define K10_BENCH_TIMEOUT_NS (10ULL * 1000000000ULL)
+#define K10_BENCH_IDLE_NS 1000000000ULL
+#define K10_BENCH_EXIT_REGRESSION 2
+
+extern char **environ;
+
+/*
+ * Measures what one more emulator instance costs. Like bench_e2e.c, it runs
+ * k10-barrel-emulatord on a private dbus-daemon against the mock org.bluez,
+ * but with a config file of its own: the primary instance on hci0 is started
+ * first, then [instance.dockN] sections on hciN are appended one at a time,
+ * each followed by Reload and Start on the new instance's object. After every
+ * step the emulator's resident memory (VmRSS), the time and CPU the
+ * instance took to come up, and the CPU burnt over a second of idling with
+ * every instance advertising are reported. A --max-* limit on the average
+ * per-instance cost that is exceeded makes the bench exit with 2.
+ */
+
+struct k10_bench_limits {
+    double rss_kb;
+    double cpu_ms;
+};
+
+struct k10_bench_ctx {
+    sd_event *event;
+    sd_bus *bus;
+    struct k10_mock_bluez *mocks[K10_INSTANCE_MAX];
+    char bus_dir[64];
+    char bus_address[128];
+    char config_path[96];
+    pid_t bus_pid;
+    pid_t daemon_pid;
+    bool named;
+    sd_bus_message *start_reply;
+};
+
+/* Time the emulator has spent on a CPU; schedstat counts ns, stat only clock ticks. */
+static int k10_bench_cpu_ns(pid_t pid, uint64_t *out) {
+    char path[64];
+    char buffer[1024];
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    const char *fields = NULL;
+    FILE *file = NULL;
+    size_t length = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)pid);
+    file = fopen(path, "re");
+    if (file != NULL) {
+        int n = fscanf(file, "%llu", &utime);
+
+        fclose(file);
+        if (n == 1) {
+            *out = utime;
+            return 0;
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    file = fopen(path, "re");
+    if (file == NULL) {
+        return -errno;
+    }
+    length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+
+    /* The command name may hold spaces and parentheses; fields resume after the last ')'. */
+    fields = strrchr(buffer, ')');
+    if (fields == NULL ||
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime,
+               &stime) != 2) {
+        return -EBADMSG;
+    }
+
+    *out = (utime + stime) * (1000000000ULL / (unsigned long long)sysconf(_SC_CLK_TCK));
+    return 0;
+}
+
+static int k10_bench_rss_kb(pid_t pid, unsigned long *out) {
+    char path[64];
+    char line[256];
+    FILE *file = NULL;
+    int r = -ENODATA;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    file = fopen(path, "re");
+    if (file == NULL) {
+        return -errno;
+    }
+
+    while (r < 0 && fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "VmRSS: %lu kB", out) == 1) {
+            r = 0;
+        }
+    }
+
+    fclose(file);
+    return r;
+}
+
+static int k10_bench_spawn(char *const argv[], bool quiet, pid_t *out) {
+    posix_spawn_file_actions_t actions;
+    int r = 0;
+
+    r = posix_spawn_file_actions_init(&actions);
+    if (r != 0) {
+        return -r;
+    }
+
+    if (quiet) {
+        r = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        if (r == 0) {
+            r = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+        }
+    }
+    if (r == 0) {
+        r = posix_spawnp(out, argv[0], &actions, NULL, argv, environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    return -r;
+}
+
+static void k10_bench_reap(pid_t pid) {
+    if (pid <= 0) {
+        return;
+    }
+
+    (void)kill(pid, SIGTERM);
+    (void)waitpid(pid, NULL, 0);
+}
+
+/* A throwaway session-policy bus, so the mock may own org.bluez whatever the host runs. */
+static int k10_bench_open_bus(struct k10_bench_ctx *ctx) {
+    char address_arg[160];
+    char *argv[] = {"dbus-daemon", "--session", "--nofork", "--nopidfile", address_arg, NULL};
+    int r = 0;
+
+    snprintf(ctx->bus_dir, sizeof(ctx->bus_dir), "/tmp/k10-bench-instances-XXXXXX");
+    if (mkdtemp(ctx->bus_dir) == NULL) {
+        ctx->bus_dir[0] = '\0';
+        return -errno;
+    }
+
+    snprintf(ctx->bus_address, sizeof(ctx->bus_address), "unix:path=%s/bus", ctx->bus_dir);
+    snprintf(ctx->config_path, sizeof(ctx->config_path), "%s/config.toml", ctx->bus_dir);
+    snprintf(address_arg, sizeof(address_arg), "--address=%s", ctx->bus_address);
+    if (setenv("DBUS_SYSTEM_BUS_ADDRESS", ctx->bus_address, 1) < 0) {
+        return -errno;
+    }
+
+    r = k10_bench_spawn(argv, true, &ctx->bus_pid);
+    if (r < 0) {
+        return r;
+    }
+
+    /* The socket appears once dbus-daemon is listening. */
+    for (unsigned int attempt = 0; attempt < 500; attempt++) {
+        r = sd_bus_open_system(&ctx->bus);
+        if (r >= 0) {
+            return sd_bus_attach_event(ctx->bus, ctx->event, 0);
+        }
+        usleep(10000);
+    }
+
+    return r;
+}
+
+static void k10_bench_close_bus(struct k10_bench_ctx *ctx) {
+    char path[96];
+
+    ctx->bus = sd_bus_flush_close_unref(ctx->bus);
+    k10_bench_reap(ctx->bus_pid);
+    ctx->bus_pid = 0;
+
+    if (ctx->bus_dir[0] != '\0') {
+        (void)unlink(ctx->config_path);
+        snprintf(path, sizeof(path), "%s/bus", ctx->bus_dir);
+        (void)unlink(path);
+        (void)rmdir(ctx->bus_dir);
+    }
+}
+
+/* The primary instance plus dock1..dock<count>, replaced whole like an editor would. */
+static int k10_bench_write_config(const struct k10_bench_ctx *ctx, unsigned int count) {
+    char path[128];
+    FILE *file = NULL;
+    int r = 0;
+
+    snprintf(path, sizeof(path), "%s.tmp", ctx->config_path);
+    file = fopen(path, "we");
+    if (file == NULL) {
+        return -errno;
+    }
+
+    fprintf(file, "adapter = \"hci0\"\ncapture_enabled = false\n");
+    for (unsigned int i = 1; i <= count; i++) {
+        fprintf(file, "\n[instance.dock%u]\nadapter = \"hci%u\"\n", i, i);
+    }
+
+    if (fclose(file) != 0 || rename(path, ctx->config_path) < 0) {
+        r = -errno;
+        (void)unlink(path);
+    }
+    return r;
+}
+
+static int k10_bench_on_name(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+    const char *name = NULL;
+    const char *old_owner = NULL;
+    const char *new_owner = NULL;
+
+    (void)ret_error;
+
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0 &&
+        strcmp(name, K10_DBUS_SERVICE) == 0 && new_owner[0] != '\0') {
+        ctx->named = true;
+    }
+
+    return 0;
+}
+
+static int k10_bench_on_started(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    (void)ret_error;
+
+    ctx->start_reply = sd_bus_message_ref(m);
+    return 0;
+}
+
+static int k10_bench_spawn_daemon(struct k10_bench_ctx *ctx, const char *daemon) {
+    char *argv[] = {(char *)daemon, "--config", ctx->config_path, NULL};
+    uint64_t spawned_ns = 0;
+    int r = 0;
+
+    r = k10_bench_write_config(ctx, 0);
+    if (r >= 0) {
+        r = sd_bus_match_signal(ctx->bus, NULL, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                "org.freedesktop.DBus", "NameOwnerChanged", k10_bench_on_name,
+                                ctx);
+    }
+    if (r >= 0) {
+        spawned_ns = k10_latency_now_ns();
+        r = k10_bench_spawn(argv, true, &ctx->daemon_pid);
+    }
+    while (r >= 0 && !ctx->named) {
+        int status = 0;
+
+        if (waitpid(ctx->daemon_pid, &status, WNOHANG) == ctx->daemon_pid) {
+            ctx->daemon_pid = 0;
+            fprintf(stderr, "%s exited before claiming %s\n", daemon, K10_DBUS_SERVICE);
+            return -ECHILD;
+        }
+        if (k10_latency_now_ns() - spawned_ns > K10_BENCH_TIMEOUT_NS) {
+            fprintf(stderr, "Timed out waiting for %s\n", K10_DBUS_SERVICE);
+            return -ETIMEDOUT;
+        }
+        r = sd_event_run(ctx->event, 100000);
+    }
+
+    return r;
+}
+
+/* Serves hci<index>, then Starts the instance at path until both registrations land. */
+static int k10_bench_start(struct k10_bench_ctx *ctx, unsigned int index, const char *path) {
+    const struct k10_mock_bluez_app *app = NULL;
+    const sd_bus_error *error = NULL;
+    char adapter[16];
+    bool registered = false;
+    uint64_t start_ns = 0;
+    int r = 0;
+
+    snprintf(adapter, sizeof(adapter), "hci%u", index);
+    r = k10_mock_bluez_new(ctx->bus, adapter, &ctx->mocks[index]);
+    if (r < 0) {
+        return r;
+    }
+
+    app = k10_mock_bluez_app(ctx->mocks[index]);
+    ctx->start_reply = sd_bus_message_unref(ctx->start_reply);
+    start_ns = k10_latency_now_ns();
+    r = sd_bus_call_method_async(ctx->bus, NULL, K10_DBUS_SERVICE, path, K10_DBUS_IFACE_BARREL,
+                                 "Start", k10_bench_on_started, ctx, "");
+    while (r >= 0 && !registered) {
+        if (ctx->start_reply != NULL && sd_bus_message_is_method_error(ctx->start_reply, NULL)) {
+            break;
+        }
+        if (k10_latency_now_ns() - start_ns > K10_BENCH_TIMEOUT_NS) {
+            fprintf(stderr, "Timed out waiting for %s to register\n", path);
+            return -ETIMEDOUT;
+        }
+
+        r = sd_event_run(ctx->event, 100000);
+        registered =
+            ctx->start_reply != NULL && app->application_ns != 0 && app->advertisement_ns != 0;
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    error = sd_bus_message_get_error(ctx->start_reply);
+    if (error != NULL) {
+        fprintf(stderr, "Start %s: %s\n", path,
+                error->message != NULL ? error->message : error->name);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int k10_bench_reload(struct k10_bench_ctx *ctx, unsigned int count) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    int ok = 0;
+    int r = 0;
+
+    r = k10_bench_write_config(ctx, count);
+    if (r >= 0) {
+        r = sd_bus_call_method(ctx->bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT, K10_DBUS_IFACE_CONFIG,
+                               "Reload", &error, &reply, "");
+    }
+    if (r >= 0) {
+        r = sd_bus_message_read(reply, "b", &ok);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Reload: %s\n", error.message != NULL ? error.message : strerror(-r));
+    } else if (!ok) {
+        fprintf(stderr, "Reload refused %s\n", ctx->config_path);
+        r = -EIO;
+    }
+
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+/* Keeps serving the mocks, so anything the instances do while idle is counted. */
+static int k10_bench_idle(struct k10_bench_ctx *ctx, uint64_t *out_cpu_ns) {
+    uint64_t deadline = k10_latency_now_ns() + K10_BENCH_IDLE_NS;
+    uint64_t cpu_start = 0;
+    uint64_t cpu_end = 0;
+    int r = 0;
+
+    r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_start);
+    while (r >= 0 && k10_latency_now_ns() < deadline) {
+        r = sd_event_run(ctx->event, 100000);
+    }
+    if (r >= 0) {
+        r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_end);
+    }
+    if (r >= 0) {
+        *out_cpu_ns = cpu_end - cpu_start;
+    }
+
+    return r;
+}
+
+/* Brings up instance index (0 is the primary) and prints what the daemon looks like after. */
+static int k10_bench_step(struct k10_bench_ctx *ctx, unsigned int index, unsigned long *rss_kb,
+                          uint64_t *cpu_ns) {
+    char path[K10_DBUS_OBJECT_MAX];
+    uint64_t begin_ns = k10_latency_now_ns();
+    uint64_t up_ns = 0;
+    uint64_t cpu_begin = 0;
+    uint64_t cpu_up = 0;
+    uint64_t idle_ns = 0;
+    int r = 0;
+
+    if (index == 0) {
+        snprintf(path, sizeof(path), "%s", K10_DBUS_OBJECT);
+    } else {
+        snprintf(path, sizeof(path), "%s/dock%u", K10_DBUS_OBJECT, index);
+    }
+
+    r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_begin);
+    if (r >= 0 && index > 0) {
+        r = k10_bench_reload(ctx, index);
+    }
+    if (r >= 0) {
+        r = k10_bench_start(ctx, index, path);
+    }
+    if (r >= 0) {
+        up_ns = k10_latency_now_ns() - begin_ns;
+        r = k10_bench_cpu_ns(ctx->daemon_pid, &cpu_up);
+    }
+    if (r >= 0) {
+        r = k10_bench_idle(ctx, &idle_ns);
+    }
+    if (r >= 0) {
+        r = k10_bench_rss_kb(ctx->daemon_pid, rss_kb);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    *cpu_ns = cpu_up - cpu_begin;
+    printf("%u instance%s  rss %7lu kB  bring-up %7.2f ms  cpu %6.2f ms  idle cpu %6.2f ms/s\n",
+           index + 1, index == 0 ? " " : "s", *rss_kb, (double)up_ns / 1e6,
+           (double)*cpu_ns / 1e6, (double)idle_ns / 1e6);
+    return 0;
+}
+
+static bool k10_bench_check(const char *name, double value, double limit, const char *unit) {
+    if (limit <= 0 || value <= limit) {
+        return true;
+    }
+
+    fprintf(stderr, "Regression: %s %.2f %s over the limit of %.2f %s\n", name, value, unit,
+            limit, unit);
+    return false;
+}
+
+static int k10_bench_usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--max-rss-kb N] [--max-cpu-ms N] <k10-barrel-emulatord> [instances]\n",
+            argv0);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    struct k10_bench_ctx ctx;
+    struct k10_bench_limits limits = {0};
+    const char *daemon = NULL;
+    unsigned long instances = K10_BENCH_DEFAULT_INSTANCES;
+    unsigned long base_rss = 0;
+    unsigned long rss = 0;
+    uint64_t added_cpu_ns = 0;
+    uint64_t cpu_ns = 0;
+    bool passed = true;
+    int positional = 0;
+    int r = 0;
+
+    for (int i = 1; i < argc; i++) {
+        double *limit = NULL;
+
+        if (strcmp(argv[i], "--max-rss-kb") == 0) {
+            limit = &limits.rss_kb;
+        } else if (strcmp(argv[i], "--max-cpu-ms") == 0) {
+            limit = &limits.cpu_ms;
+        } else if (argv[i][0] == '-') {
+            return k10_bench_usage(argv[0]);
+        } else if (positional++ == 0) {
+            daemon = argv[i];
+        } else if (positional == 2) {
+            instances = strtoul(argv[i], NULL, 10);
+        } else {
+            return k10_bench_usage(argv[0]);
+        }
+
+        if (limit != NULL) {
+            if (++i == argc) {
+                return k10_bench_usage(argv[0]);
+            }
+            *limit = strtod(argv[i], NULL);
+        }
+    }
+    if (daemon == NULL || instances == 0 || instances >= K10_INSTANCE_MAX) {
+        return k10_bench_usage(argv[0]);
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    r = sd_event_new(&ctx.event);
+    if (r >= 0) {
+        r = k10_bench_open_bus(&ctx);
+    }
+    if (r >= 0) {
+        r = k10_bench_spawn_daemon(&ctx, daemon);
+    }
+    if (r >= 0) {
+        r = k10_bench_step(&ctx, 0, &base_rss, &cpu_ns);
+    }
+    for (unsigned int i = 1; r >= 0 && i <= instances; i++) {
+        r = k10_bench_step(&ctx, i, &rss, &cpu_ns);
+        added_cpu_ns += cpu_ns;
+    }
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+    } else {
+        double rss_kb = (double)(rss - base_rss) / (double)instances;
+        double cpu_ms = (double)added_cpu_ns / 1e6 / (double)instances;
+
+        printf("per added instance  rss %7.1f kB  bring-up cpu %6.2f ms\n", rss_kb, cpu_ms);
+        fflush(stdout);
+        passed = k10_bench_check("rss per instance", rss_kb, limits.rss_kb, "kB");
+        passed &= k10_bench_check("bring-up cpu per instance", cpu_ms, limits.cpu_ms, "ms");
+    }
+
+    for (unsigned int i = 0; i < K10_INSTANCE_MAX; i++) {
+        k10_mock_bluez_free(ctx.mocks[i]);
+    }
+    sd_bus_message_unref(ctx.start_reply);
+    k10_bench_reap(ctx.daemon_pid);
+    k10_bench_close_bus(&ctx);
+    sd_event_unref(ctx.event);
+
+    if (r < 0) {
+        return 1;
+    }
+    return passed ? 0 : K10_BENCH_EXIT_REGRESSION;
+}
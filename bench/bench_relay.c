@@ -0,0 +1,336 @@
+#include "k10_barrel/chrc_dock.h"
+#include "k10_barrel/config.h"
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/gatt_app.h"
+#include "k10_barrel/log.h"
+#include "k10_barrel/relay.h"
+
+#include "mock_bluez.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#define K10_BENCH_DEFAULT_FRAMES 20000UL
+#define K10_BENCH_WRITE_PATH K10_DBUS_GATT_OBJECT "/service0/char0"
+#define K10_BENCH_NOTIFY_PATH K10_DBUS_GATT_OBJECT "/service0/char1"
+#define K10_BENCH_DOCK_ADDRESS "C0:FF:EE:00:00:01"
+/* Byte the rewrite hook stamps into every frame on its way to the dock. */
+#define K10_BENCH_REWRITE_TAG 0xa5
+
+/*
+ * Relays between a simulated sweeper and a simulated dock in one process.
+ * The mock org.bluez from mock_bluez.c, on a second connection to a private
+ * dbus-daemon, stands in for both ends: it plays BlueZ towards the GATT
+ * application (acquiring its CBA20002/CBA20003 sockets, as for a connected
+ * sweeper) and exports a real dock's Device1 and GATT characteristics for the
+ * relay to connect to. The mock dock echoes each write on CBA20002 as a
+ * CBA20003 notification, so every frame crosses the relay twice. Round trips
+ * are timed over acquired sockets, again with a rewrite hook installed, and
+ * once more with the dock refusing AcquireWrite/AcquireNotify so the relay
+ * falls back to WriteValue and PropertiesChanged. Run it against a private
+ * dbus-daemon through DBUS_SYSTEM_BUS_ADDRESS (k10-bench-relay [frames]).
+ */
+
+struct k10_bench_ctx {
+    sd_event *event;
+    sd_bus *app_bus;
+    sd_bus *mock_bus;
+    const char *app_name;
+    struct k10_gatt *gatt;
+    struct k10_chrc_dock *dock;
+    struct k10_relay *relay;
+    struct k10_mock_bluez *mock;
+    uint64_t dock_received;
+    uint8_t dock_last[K10_GATT_VALUE_MAX];
+    size_t dock_last_length;
+    int write_fd;
+    int notify_fd;
+    double *samples;
+};
+
+static const uint8_t k10_bench_frame[] = {0x57, 0x0f, 0x31, 0x01, 0x02, 0x03,
+                                          0x04, 0x05, 0x06, 0x07, 0x08, 0x09};
+
+static double k10_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int k10_bench_compare(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void k10_bench_report(const char *label, const struct k10_bench_ctx *ctx,
+                             unsigned long frames, double elapsed) {
+    struct k10_relay_stats stats;
+    const struct k10_relay_hop_stats *to_dock = &stats.hops[K10_RELAY_TO_DOCK];
+    const struct k10_relay_hop_stats *to_sweeper = &stats.hops[K10_RELAY_TO_SWEEPER];
+    double *samples = ctx->samples;
+
+    k10_relay_get_stats(ctx->relay, &stats);
+    qsort(samples, frames, sizeof(*samples), k10_bench_compare);
+    printf("%-8s %7lu frames %8.0f frames/s  round trip p50 %6.1f us  p99 %6.1f us  "
+           "max %7.1f us\n",
+           label, frames, (double)frames / elapsed, samples[frames / 2] * 1e6,
+           samples[frames * 99 / 100] * 1e6, samples[frames - 1] * 1e6);
+    printf("%-8s relay to dock    p50 %6.2f us  p99 %6.2f us  max %7.2f us  "
+           "(%llu frames, %llu rewritten, %llu dropped)\n",
+           "", (double)to_dock->latency_p50_ns / 1e3, (double)to_dock->latency_p99_ns / 1e3,
+           (double)to_dock->latency_max_ns / 1e3, (unsigned long long)to_dock->frames,
+           (unsigned long long)to_dock->rewritten, (unsigned long long)to_dock->dropped);
+    printf("%-8s relay to sweeper p50 %6.2f us  p99 %6.2f us  max %7.2f us  "
+           "(%llu frames, %llu rewritten, %llu dropped)\n",
+           "", (double)to_sweeper->latency_p50_ns / 1e3,
+           (double)to_sweeper->latency_p99_ns / 1e3, (double)to_sweeper->latency_max_ns / 1e3,
+           (unsigned long long)to_sweeper->frames, (unsigned long long)to_sweeper->rewritten,
+           (unsigned long long)to_sweeper->dropped);
+}
+
+/* The dock answers every CBA20002 write with the same bytes on CBA20003. */
+static void k10_bench_dock_write(const uint8_t *data, size_t length, void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    ctx->dock_received++;
+    memcpy(ctx->dock_last, data, length);
+    ctx->dock_last_length = length;
+    k10_mock_bluez_dock_notify(ctx->mock, data, length);
+}
+
+/* Plays the sweeper's BlueZ towards the GATT application: forward whatever it writes. */
+static void k10_bench_on_write(enum k10_gatt_chrc chrc, const uint8_t *data, size_t length,
+                               void *userdata) {
+    struct k10_bench_ctx *ctx = userdata;
+
+    k10_relay_forward(ctx->relay, chrc, data, length);
+}
+
+static bool k10_bench_rewrite(struct k10_relay_frame *frame, void *userdata) {
+    (void)userdata;
+
+    if (frame->hop != K10_RELAY_TO_DOCK || frame->length > frame->scratch_size) {
+        return true;
+    }
+
+    memcpy(frame->scratch, frame->data, frame->length);
+    frame->scratch[frame->length - 1] = K10_BENCH_REWRITE_TAG;
+    frame->data = frame->scratch;
+    return true;
+}
+
+/* A fresh relay per run, so its latency histograms cover only that run. */
+static int k10_bench_relay(struct k10_bench_ctx *ctx, bool sockets, k10_relay_rewrite_fn rewrite) {
+    struct k10_relay_stats stats;
+    int r = 0;
+
+    k10_relay_free(ctx->relay);
+    ctx->relay = NULL;
+    k10_mock_bluez_dock_reset(ctx->mock);
+    k10_mock_bluez_dock_set_sockets(ctx->mock, sockets);
+
+    r = k10_relay_new(ctx->app_bus, ctx->gatt, ctx->dock, &ctx->relay);
+    if (r >= 0) {
+        r = k10_relay_start(ctx->relay, "hci0", K10_BENCH_DOCK_ADDRESS);
+    }
+    if (r < 0) {
+        return r;
+    }
+    k10_relay_set_rewrite(ctx->relay, rewrite, ctx);
+
+    do {
+        r = sd_event_run(ctx->event, UINT64_MAX);
+        k10_relay_get_stats(ctx->relay, &stats);
+    } while (r >= 0 && !stats.connected);
+
+    /* Let the sockets or the subscription land before traffic starts. */
+    while (r > 0) {
+        r = sd_event_run(ctx->event, 10000);
+    }
+
+    return r;
+}
+
+static int k10_bench_round_trips(struct k10_bench_ctx *ctx, const char *label,
+                                 unsigned long frames) {
+    uint8_t buffer[K10_GATT_VALUE_MAX];
+    uint64_t received = ctx->dock_received;
+    double start = 0;
+    ssize_t length = 0;
+    int r = 0;
+
+    start = k10_bench_now();
+    for (unsigned long i = 0; i < frames; i++) {
+        double t0 = k10_bench_now();
+
+        if (send(ctx->write_fd, k10_bench_frame, sizeof(k10_bench_frame), MSG_NOSIGNAL) < 0) {
+            return -errno;
+        }
+
+        while ((length = recv(ctx->notify_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) < 0) {
+            if (errno != EAGAIN) {
+                return -errno;
+            }
+
+            r = sd_event_run(ctx->event, UINT64_MAX);
+            if (r < 0) {
+                return r;
+            }
+        }
+
+        ctx->samples[i] = k10_bench_now() - t0;
+        if ((size_t)length != sizeof(k10_bench_frame) ||
+            memcmp(buffer, ctx->dock_last, ctx->dock_last_length) != 0) {
+            fprintf(stderr, "%s: frame %lu came back changed\n", label, i);
+            return -EBADMSG;
+        }
+    }
+
+    k10_bench_report(label, ctx, frames, k10_bench_now() - start);
+    if (ctx->dock_received - received != frames) {
+        fprintf(stderr, "%s: dock saw %llu of %lu frames\n", label,
+                (unsigned long long)(ctx->dock_received - received), frames);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int k10_bench_run(struct k10_bench_ctx *ctx, unsigned long frames) {
+    int r = 0;
+
+    r = k10_mock_bluez_acquire(ctx->mock, ctx->app_name, K10_BENCH_WRITE_PATH, true,
+                               &ctx->write_fd);
+    if (r >= 0) {
+        r = k10_mock_bluez_acquire(ctx->mock, ctx->app_name, K10_BENCH_NOTIFY_PATH, false,
+                                   &ctx->notify_fd);
+    }
+
+    if (r >= 0) {
+        r = k10_bench_relay(ctx, true, NULL);
+    }
+    if (r >= 0) {
+        r = k10_bench_round_trips(ctx, "socket", frames);
+    }
+
+    if (r >= 0) {
+        r = k10_bench_relay(ctx, true, k10_bench_rewrite);
+    }
+    if (r >= 0) {
+        r = k10_bench_round_trips(ctx, "rewrite", frames);
+    }
+    if (r >= 0 && ctx->dock_last[ctx->dock_last_length - 1] != K10_BENCH_REWRITE_TAG) {
+        fprintf(stderr, "rewrite: the dock got the original frame\n");
+        r = -EBADMSG;
+    }
+
+    if (r >= 0) {
+        r = k10_bench_relay(ctx, false, NULL);
+    }
+    if (r >= 0) {
+        r = k10_bench_round_trips(ctx, "dbus", frames);
+    }
+
+    return r;
+}
+
+int main(int argc, char **argv) {
+    struct k10_bench_ctx ctx;
+    struct k10_config config;
+    unsigned long frames = K10_BENCH_DEFAULT_FRAMES;
+    int r = 0;
+
+    if (argc > 1) {
+        frames = strtoul(argv[1], NULL, 10);
+    }
+    if (frames == 0 || argc > 2) {
+        fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.write_fd = -1;
+    ctx.notify_fd = -1;
+    ctx.samples = calloc(frames, sizeof(*ctx.samples));
+    if (ctx.samples == NULL) {
+        return 1;
+    }
+
+    k10_config_load(NULL, &config);
+    snprintf(config.service_uuids[0], sizeof(config.service_uuids[0]), "%s",
+             "CBA20D00-224D-11E6-9FB8-0002A5D5C51B");
+    config.service_uuid_count = 1;
+
+    (void)k10_log_open();
+
+    r = sd_event_new(&ctx.event);
+    if (r >= 0) {
+        r = sd_bus_open_system(&ctx.app_bus);
+    }
+    if (r >= 0) {
+        r = sd_bus_open_system(&ctx.mock_bus);
+    }
+    if (r >= 0) {
+        r = sd_bus_attach_event(ctx.app_bus, ctx.event, 0);
+    }
+    if (r >= 0) {
+        r = sd_bus_attach_event(ctx.mock_bus, ctx.event, 0);
+    }
+    if (r >= 0) {
+        r = sd_bus_get_unique_name(ctx.app_bus, &ctx.app_name);
+    }
+    if (r >= 0) {
+        r = k10_mock_bluez_new(ctx.mock_bus, "hci0", &ctx.mock);
+    }
+    if (r >= 0) {
+        r = k10_mock_bluez_add_dock(ctx.mock, K10_BENCH_DOCK_ADDRESS, k10_bench_dock_write, &ctx);
+    }
+    if (r >= 0) {
+        r = k10_gatt_new(ctx.app_bus, K10_DBUS_OBJECT, &ctx.gatt);
+    }
+    if (r >= 0) {
+        r = k10_chrc_dock_new(ctx.gatt, &config, &ctx.dock);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to set up: %s\n", strerror(-r));
+        goto cleanup;
+    }
+
+    k10_gatt_update(ctx.gatt, &config, 1);
+    k10_gatt_set_write_handler(ctx.gatt, k10_bench_on_write, &ctx);
+
+    r = k10_bench_run(&ctx, frames);
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+    }
+
+cleanup:
+    if (ctx.write_fd >= 0) {
+        close(ctx.write_fd);
+    }
+    if (ctx.notify_fd >= 0) {
+        close(ctx.notify_fd);
+    }
+    k10_relay_free(ctx.relay);
+    k10_mock_bluez_free(ctx.mock);
+    k10_chrc_dock_free(ctx.dock);
+    k10_gatt_free(ctx.gatt);
+    sd_bus_flush_close_unref(ctx.mock_bus);
+    sd_bus_flush_close_unref(ctx.app_bus);
+    sd_event_unref(ctx.event);
+    free(ctx.samples);
+    k10_log_close();
+    return r < 0 ? 1 : 0;
+}
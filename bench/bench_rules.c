@@ -0,0 +1,216 @@
+#include "k10_barrel/rules.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define K10_BENCH_DEFAULT_ITERATIONS 2000000UL
+#define K10_BENCH_CORPUS_MAX 1024
+#define K10_BENCH_FRAME_MAX 20
+
+/*
+ * Compiles synthetic rule sets of growing size and matches a fixed corpus of
+ * app frames against each, next to a linear scan of the same rules, so the
+ * trie's cost per frame can be checked to stay flat as the rule count grows
+ * (k10-bench-rules [iterations] [max-rules]).
+ */
+
+struct k10_bench_frame {
+    size_t length;
+    uint8_t data[K10_BENCH_FRAME_MAX];
+};
+
+static double k10_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t k10_bench_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * Every fourth rule masks out a byte (a sequence number or checksum position);
+ * the rest are exact prefixes of three to eight bytes behind the frame magic.
+ */
+static void k10_bench_rule(struct k10_rule *rule, size_t index, uint32_t *seed) {
+    memset(rule, 0, sizeof(*rule));
+    snprintf(rule->name, sizeof(rule->name), "rule-%zu", index);
+    rule->chrc = index % 8 == 7 ? K10_GATT_CHRC_SWEEPER_B001 : K10_GATT_CHRC_DOCK_WRITE;
+    rule->length = (uint8_t)(3 + k10_bench_random(seed) % 6);
+    rule->match[0] = 0x57;
+    rule->mask[0] = 0xff;
+    for (unsigned int b = 1; b < rule->length; b++) {
+        rule->match[b] = (uint8_t)k10_bench_random(seed);
+        rule->mask[b] = 0xff;
+    }
+
+    if (index % 4 == 3) {
+        rule->mask[1 + k10_bench_random(seed) % (rule->length - 1U)] = 0x00;
+    }
+
+    rule->reply_length = 2;
+    rule->reply[0] = 0x01;
+    rule->reply[1] = (uint8_t)index;
+}
+
+/* Half the corpus hits a rule (with noise under masked bytes and in the tail), half misses. */
+static size_t k10_bench_corpus(struct k10_bench_frame *corpus, const struct k10_rule *rules,
+                               size_t count, uint32_t *seed) {
+    for (size_t i = 0; i < K10_BENCH_CORPUS_MAX; i++) {
+        const struct k10_rule *rule = &rules[k10_bench_random(seed) % count];
+        struct k10_bench_frame *frame = &corpus[i];
+
+        frame->length = rule->length + k10_bench_random(seed) % (K10_BENCH_FRAME_MAX - 8U);
+        for (size_t b = 0; b < frame->length; b++) {
+            frame->data[b] = (uint8_t)k10_bench_random(seed);
+        }
+        frame->data[0] = 0x57;
+
+        if (i % 2 == 0) {
+            for (unsigned int b = 0; b < rule->length; b++) {
+                frame->data[b] = (uint8_t)((frame->data[b] & ~rule->mask[b]) | rule->match[b]);
+            }
+        }
+    }
+
+    return K10_BENCH_CORPUS_MAX;
+}
+
+/* What the responder would do without a compiled matcher: try every rule in file order. */
+static const struct k10_rule *k10_bench_linear(const struct k10_rule *rules, size_t count,
+                                               enum k10_gatt_chrc chrc, const uint8_t *data,
+                                               size_t length) {
+    const struct k10_rule *best = NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct k10_rule *rule = &rules[i];
+        unsigned int b = 0;
+
+        if (rule->chrc != chrc || rule->length > length ||
+            (best != NULL && rule->length <= best->length)) {
+            continue;
+        }
+
+        while (b < rule->length && (data[b] & rule->mask[b]) == (rule->match[b] & rule->mask[b])) {
+            b++;
+        }
+        if (b == rule->length) {
+            best = rule;
+        }
+    }
+
+    return best;
+}
+
+static int k10_bench_run(size_t count, unsigned long iterations) {
+    static struct k10_bench_frame corpus[K10_BENCH_CORPUS_MAX];
+    struct k10_rules *compiled = NULL;
+    struct k10_rule *rules = NULL;
+    unsigned long hits = 0;
+    unsigned long linear_hits = 0;
+    uint32_t seed = 0x6b313021;
+    double start = 0;
+    double compile = 0;
+    double trie = 0;
+    double linear = 0;
+    size_t frames = 0;
+    int r = 0;
+
+    rules = calloc(count, sizeof(*rules));
+    if (rules == NULL) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        k10_bench_rule(&rules[i], i, &seed);
+    }
+    frames = k10_bench_corpus(corpus, rules, count, &seed);
+
+    start = k10_bench_now();
+    r = k10_rules_compile(rules, count, &compiled);
+    compile = k10_bench_now() - start;
+    if (r < 0) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        const struct k10_rule *expected = k10_bench_linear(rules, count, K10_GATT_CHRC_DOCK_WRITE,
+                                                           corpus[i].data, corpus[i].length);
+        const struct k10_rule *got = k10_rules_match(compiled, K10_GATT_CHRC_DOCK_WRITE,
+                                                     corpus[i].data, corpus[i].length);
+
+        if ((expected == NULL) != (got == NULL) ||
+            (got != NULL && strcmp(expected->name, got->name) != 0)) {
+            fprintf(stderr, "frame %zu: trie picked %s, linear scan %s\n", i,
+                    got != NULL ? got->name : "nothing",
+                    expected != NULL ? expected->name : "nothing");
+            r = -EBADMSG;
+            goto done;
+        }
+    }
+
+    start = k10_bench_now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        const struct k10_bench_frame *frame = &corpus[i % frames];
+
+        hits += k10_rules_match(compiled, K10_GATT_CHRC_DOCK_WRITE, frame->data,
+                                frame->length) != NULL;
+    }
+    trie = k10_bench_now() - start;
+
+    start = k10_bench_now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        const struct k10_bench_frame *frame = &corpus[i % frames];
+
+        linear_hits += k10_bench_linear(rules, count, K10_GATT_CHRC_DOCK_WRITE, frame->data,
+                                        frame->length) != NULL;
+    }
+    linear = k10_bench_now() - start;
+
+    printf("%6zu rules %8zu nodes %9.2f ms compile %8.1f ns/frame trie %10.1f ns/frame linear "
+           "(%lu/%lu hits)\n",
+           count, k10_rules_node_count(compiled), compile * 1e3,
+           trie * 1e9 / (double)iterations, linear * 1e9 / (double)iterations, hits, linear_hits);
+
+done:
+    k10_rules_free(compiled);
+    free(rules);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = K10_BENCH_DEFAULT_ITERATIONS;
+    size_t max_rules = 8192;
+    int r = 0;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+    }
+
+    if (argc > 2) {
+        max_rules = strtoul(argv[2], NULL, 10);
+    }
+
+    if (iterations == 0 || max_rules == 0) {
+        fprintf(stderr, "Nothing to match\n");
+        return 1;
+    }
+
+    for (size_t count = 16; count <= max_rules; count *= 4) {
+        r = k10_bench_run(count, iterations);
+        if (r < 0) {
+            fprintf(stderr, "%zu rules: %s\n", count, strerror(-r));
+            return 1;
+        }
+    }
+
+    return 0;
+}
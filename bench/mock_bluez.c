@@ -0,0 +1,752 @@
+#include "mock_bluez.h"
+
+#include "k10_barrel/dbus_defs.h"
+#include "k10_barrel/latency.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <systemd/sd-event.h>
+
+#define K10_MOCK_MTU 247
+#define K10_MOCK_ADDRESS "00:00:5E:00:53:10"
+
+/* A GattManager1 or LEAdvertisingManager1 registration. */
+struct k10_mock_registration {
+    struct k10_mock_bluez *mock;
+    bool advertisement;
+    char owner[64];
+    char path[128];
+    /* The Register call, answered once the tree or properties have been read. */
+    sd_bus_message *pending;
+    sd_bus_slot *read_slot;
+    bool registered;
+};
+
+/* One characteristic of the mock dock. */
+struct k10_mock_chrc {
+    struct k10_mock_bluez *mock;
+    enum k10_gatt_chrc chrc;
+    char path[160];
+    const char *const *flags;
+    /* Our ends of the sockets handed out by AcquireWrite/AcquireNotify. */
+    int write_fd;
+    sd_event_source *write_source;
+    int notify_fd;
+    bool notifying;
+    uint8_t value[K10_GATT_VALUE_MAX];
+    size_t value_length;
+};
+
+struct k10_mock_bluez {
+    sd_bus *bus;
+    sd_event *event;
+    char adapter_path[64];
+    sd_bus_slot *slots[4];
+    struct k10_mock_registration application;
+    struct k10_mock_registration advertisement;
+    struct k10_mock_bluez_app app;
+    bool dock;
+    char dock_address[18];
+    char dock_path[96];
+    bool dock_connected;
+    bool dock_sockets;
+    k10_mock_dock_write_fn dock_write;
+    void *dock_userdata;
+    struct k10_mock_chrc chrcs[K10_GATT_CHRC_COUNT];
+    sd_bus_message *reply;
+    bool replied;
+};
+
+static const char *const k10_mock_flags_write[] = {"write-without-response", "write", NULL};
+static const char *const k10_mock_flags_notify[] = {"notify", NULL};
+static const char *const k10_mock_flags_sweeper[] = {"read", "write-without-response", "write",
+                                                     "notify", NULL};
+
+static int k10_mock_property_string(sd_bus_message *reply, const char *value) {
+    return sd_bus_message_append(reply, "s", value);
+}
+
+static int k10_mock_adapter_property(sd_bus *bus, const char *path, const char *interface,
+                                     const char *property, sd_bus_message *reply, void *userdata,
+                                     sd_bus_error *ret_error) {
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)userdata;
+    (void)ret_error;
+
+    if (strcmp(property, "Address") == 0) {
+        return k10_mock_property_string(reply, K10_MOCK_ADDRESS);
+    }
+    if (strcmp(property, "Name") == 0 || strcmp(property, "Alias") == 0) {
+        return k10_mock_property_string(reply, "k10-mock");
+    }
+    if (strcmp(property, "Powered") == 0) {
+        return sd_bus_message_append(reply, "b", 1);
+    }
+    if (strcmp(property, "ActiveInstances") == 0) {
+        struct k10_mock_bluez *mock = userdata;
+
+        return sd_bus_message_append(reply, "y", (uint8_t)mock->advertisement.registered);
+    }
+
+    return sd_bus_message_append(reply, "y", (uint8_t)4);
+}
+
+/* GetManagedObjects of the registered tree: only characteristic UUIDs are looked at. */
+static int k10_mock_read_chrc(struct k10_mock_bluez *mock, sd_bus_message *m, const char *path) {
+    const char *name = NULL;
+    const char *uuid = NULL;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    while (r >= 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "UUID") == 0) {
+            r = sd_bus_message_read(m, "v", "s", &uuid);
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    for (size_t i = 0; uuid != NULL && i < K10_GATT_CHRC_COUNT; i++) {
+        if (strcasecmp(uuid, k10_gatt_chrc_uuid((enum k10_gatt_chrc)i)) == 0) {
+            snprintf(mock->app.chrc_paths[i], sizeof(mock->app.chrc_paths[i]), "%s", path);
+        }
+    }
+
+    return sd_bus_message_exit_container(m);
+}
+
+static int k10_mock_read_objects(struct k10_mock_bluez *mock, sd_bus_message *m) {
+    const char *path = NULL;
+    const char *interface = NULL;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(m, 'a', "{oa{sa{sv}}}");
+    while (r >= 0 && (r = sd_bus_message_enter_container(m, 'e', "oa{sa{sv}}")) > 0) {
+        r = sd_bus_message_read(m, "o", &path);
+        if (r >= 0) {
+            r = sd_bus_message_enter_container(m, 'a', "{sa{sv}}");
+        }
+        while (r >= 0 && (r = sd_bus_message_enter_container(m, 'e', "sa{sv}")) > 0) {
+            r = sd_bus_message_read(m, "s", &interface);
+            if (r >= 0 && strcmp(interface, K10_BLUEZ_IFACE_GATT_CHRC) == 0) {
+                r = k10_mock_read_chrc(mock, m, path);
+            } else if (r >= 0) {
+                r = sd_bus_message_skip(m, "a{sv}");
+            }
+            if (r >= 0) {
+                r = sd_bus_message_exit_container(m);
+            }
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+    }
+
+    return r < 0 ? r : sd_bus_message_exit_container(m);
+}
+
+static int k10_mock_read_advertisement(struct k10_mock_bluez *mock, sd_bus_message *m) {
+    const char *name = NULL;
+    const char *value = NULL;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    while (r >= 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "LocalName") == 0) {
+            r = sd_bus_message_read(m, "v", "s", &value);
+            if (r >= 0) {
+                snprintf(mock->app.local_name, sizeof(mock->app.local_name), "%s", value);
+            }
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+    }
+
+    return r < 0 ? r : sd_bus_message_exit_container(m);
+}
+
+static void k10_mock_registration_clear(struct k10_mock_registration *registration) {
+    registration->read_slot = sd_bus_slot_unref(registration->read_slot);
+    registration->pending = sd_bus_message_unref(registration->pending);
+    registration->registered = false;
+    registration->owner[0] = '\0';
+    registration->path[0] = '\0';
+}
+
+static int k10_mock_on_read(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_mock_registration *registration = userdata;
+    struct k10_mock_bluez *mock = registration->mock;
+    sd_bus_message *pending = registration->pending;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+    int r = 0;
+
+    (void)ret_error;
+
+    registration->read_slot = sd_bus_slot_unref(registration->read_slot);
+    registration->pending = NULL;
+
+    if (error == NULL) {
+        r = registration->advertisement ? k10_mock_read_advertisement(mock, m)
+                                        : k10_mock_read_objects(mock, m);
+    }
+
+    if (error != NULL || r < 0) {
+        (void)sd_bus_reply_method_errorf(pending, "org.bluez.Error.Failed",
+                                         "Failed to read %s", registration->path);
+        k10_mock_registration_clear(registration);
+    } else {
+        registration->registered = true;
+        snprintf(mock->app.owner, sizeof(mock->app.owner), "%s", registration->owner);
+        *(registration->advertisement ? &mock->app.advertisement_ns
+                                      : &mock->app.application_ns) = k10_latency_now_ns();
+        (void)sd_bus_reply_method_return(pending, "");
+    }
+
+    sd_bus_message_unref(pending);
+    return 0;
+}
+
+/* Like BlueZ, a registration is only answered after reading what was registered. */
+static int k10_mock_register(sd_bus_message *m, struct k10_mock_registration *registration) {
+    struct k10_mock_bluez *mock = registration->mock;
+    const char *path = NULL;
+    int r = 0;
+
+    r = sd_bus_message_read(m, "o", &path);
+    if (r < 0) {
+        return r;
+    }
+
+    if (registration->registered || registration->pending != NULL) {
+        return sd_bus_reply_method_errorf(m, "org.bluez.Error.AlreadyExists", "Already Exists");
+    }
+
+    snprintf(registration->owner, sizeof(registration->owner), "%s", sd_bus_message_get_sender(m));
+    snprintf(registration->path, sizeof(registration->path), "%s", path);
+
+    if (registration->advertisement) {
+        r = sd_bus_call_method_async(mock->bus, &registration->read_slot, registration->owner,
+                                     path, K10_DBUS_IFACE_PROPERTIES, "GetAll", k10_mock_on_read,
+                                     registration, "s", K10_BLUEZ_IFACE_ADVERTISEMENT);
+    } else {
+        memset(mock->app.chrc_paths, 0, sizeof(mock->app.chrc_paths));
+        r = sd_bus_call_method_async(mock->bus, &registration->read_slot, registration->owner,
+                                     path, K10_DBUS_IFACE_OBJECT_MANAGER, "GetManagedObjects",
+                                     k10_mock_on_read, registration, "");
+    }
+    if (r < 0) {
+        k10_mock_registration_clear(registration);
+        return r;
+    }
+
+    registration->pending = sd_bus_message_ref(m);
+    return 1;
+}
+
+static int k10_mock_unregister(sd_bus_message *m, struct k10_mock_registration *registration) {
+    const char *path = NULL;
+    int r = 0;
+
+    r = sd_bus_message_read(m, "o", &path);
+    if (r < 0) {
+        return r;
+    }
+
+    if (strcmp(path, registration->path) != 0 ||
+        strcmp(sd_bus_message_get_sender(m), registration->owner) != 0) {
+        return sd_bus_reply_method_errorf(m, "org.bluez.Error.DoesNotExist", "Does Not Exist");
+    }
+
+    if (registration->pending != NULL) {
+        (void)sd_bus_reply_method_errorf(registration->pending, "org.bluez.Error.Failed",
+                                         "Unregistered");
+    }
+    k10_mock_registration_clear(registration);
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_mock_register_application(sd_bus_message *m, void *userdata,
+                                         sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)ret_error;
+
+    return k10_mock_register(m, &mock->application);
+}
+
+static int k10_mock_unregister_application(sd_bus_message *m, void *userdata,
+                                           sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)ret_error;
+
+    return k10_mock_unregister(m, &mock->application);
+}
+
+static int k10_mock_register_advertisement(sd_bus_message *m, void *userdata,
+                                           sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)ret_error;
+
+    return k10_mock_register(m, &mock->advertisement);
+}
+
+static int k10_mock_unregister_advertisement(sd_bus_message *m, void *userdata,
+                                             sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)ret_error;
+
+    return k10_mock_unregister(m, &mock->advertisement);
+}
+
+static const sd_bus_vtable k10_mock_adapter_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_PROPERTY("Address", "s", k10_mock_adapter_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Name", "s", k10_mock_adapter_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Alias", "s", k10_mock_adapter_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Powered", "b", k10_mock_adapter_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_VTABLE_END};
+
+static const sd_bus_vtable k10_mock_gatt_manager_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("RegisterApplication", "oa{sv}", "", k10_mock_register_application, 0),
+    SD_BUS_METHOD("UnregisterApplication", "o", "", k10_mock_unregister_application, 0),
+    SD_BUS_VTABLE_END};
+
+static const sd_bus_vtable k10_mock_adv_manager_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("RegisterAdvertisement", "oa{sv}", "", k10_mock_register_advertisement, 0),
+    SD_BUS_METHOD("UnregisterAdvertisement", "o", "", k10_mock_unregister_advertisement, 0),
+    SD_BUS_PROPERTY("ActiveInstances", "y", k10_mock_adapter_property, 0, 0),
+    SD_BUS_PROPERTY("SupportedInstances", "y", k10_mock_adapter_property, 0,
+                    SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_VTABLE_END};
+
+int k10_mock_bluez_new(sd_bus *bus, const char *adapter, struct k10_mock_bluez **out) {
+    struct k10_mock_bluez *mock = NULL;
+    int r = 0;
+
+    mock = calloc(1, sizeof(*mock));
+    if (mock == NULL) {
+        return -ENOMEM;
+    }
+
+    mock->bus = sd_bus_ref(bus);
+    mock->event = sd_event_ref(sd_bus_get_event(bus));
+    mock->dock_sockets = true;
+    mock->application.mock = mock;
+    mock->advertisement.mock = mock;
+    mock->advertisement.advertisement = true;
+    snprintf(mock->adapter_path, sizeof(mock->adapter_path), K10_BLUEZ_PATH_PREFIX "%s", adapter);
+
+    for (size_t i = 0; i < K10_GATT_CHRC_COUNT; i++) {
+        mock->chrcs[i].mock = mock;
+        mock->chrcs[i].chrc = (enum k10_gatt_chrc)i;
+        mock->chrcs[i].write_fd = -1;
+        mock->chrcs[i].notify_fd = -1;
+    }
+
+    if (mock->event == NULL) {
+        r = -EINVAL;
+    }
+    if (r >= 0) {
+        r = sd_bus_add_object_manager(bus, &mock->slots[0], "/");
+    }
+    if (r >= 0) {
+        r = sd_bus_add_object_vtable(bus, &mock->slots[1], mock->adapter_path,
+                                     K10_BLUEZ_IFACE_ADAPTER, k10_mock_adapter_vtable, mock);
+    }
+    if (r >= 0) {
+        r = sd_bus_add_object_vtable(bus, &mock->slots[2], mock->adapter_path,
+                                     K10_BLUEZ_IFACE_GATT_MANAGER, k10_mock_gatt_manager_vtable,
+                                     mock);
+    }
+    if (r >= 0) {
+        r = sd_bus_add_object_vtable(bus, &mock->slots[3], mock->adapter_path,
+                                     K10_BLUEZ_IFACE_ADV_MANAGER, k10_mock_adv_manager_vtable,
+                                     mock);
+    }
+    if (r >= 0) {
+        /* Several adapters may be served from one connection. */
+        r = sd_bus_request_name(bus, K10_BLUEZ_SERVICE, 0);
+        if (r == -EALREADY) {
+            r = 0;
+        }
+    }
+    if (r < 0) {
+        k10_mock_bluez_free(mock);
+        return r;
+    }
+
+    *out = mock;
+    return 0;
+}
+
+void k10_mock_bluez_free(struct k10_mock_bluez *mock) {
+    if (mock == NULL) {
+        return;
+    }
+
+    k10_mock_bluez_dock_reset(mock);
+    k10_mock_registration_clear(&mock->application);
+    k10_mock_registration_clear(&mock->advertisement);
+    for (size_t i = 0; i < sizeof(mock->slots) / sizeof(mock->slots[0]); i++) {
+        sd_bus_slot_unref(mock->slots[i]);
+    }
+    sd_bus_message_unref(mock->reply);
+    (void)sd_bus_release_name(mock->bus, K10_BLUEZ_SERVICE);
+    sd_event_unref(mock->event);
+    sd_bus_unref(mock->bus);
+    free(mock);
+}
+
+const struct k10_mock_bluez_app *k10_mock_bluez_app(const struct k10_mock_bluez *mock) {
+    return &mock->app;
+}
+
+static int k10_mock_on_acquired(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)ret_error;
+
+    mock->reply = sd_bus_message_ref(m);
+    mock->replied = true;
+    return 0;
+}
+
+/* Asynchronous underneath, so it also works when the application shares this loop. */
+int k10_mock_bluez_acquire(struct k10_mock_bluez *mock, const char *destination,
+                           const char *path, bool write, int *out_fd) {
+    const char *member = write ? "AcquireWrite" : "AcquireNotify";
+    const sd_bus_error *error = NULL;
+    uint16_t mtu = 0;
+    int fd = -1;
+    int r = 0;
+
+    mock->reply = sd_bus_message_unref(mock->reply);
+    mock->replied = false;
+
+    r = sd_bus_call_method_async(mock->bus, NULL, destination, path, K10_BLUEZ_IFACE_GATT_CHRC,
+                                 member, k10_mock_on_acquired, mock, "a{sv}", 1, "mtu", "q",
+                                 (uint16_t)K10_MOCK_MTU);
+    while (r >= 0 && !mock->replied) {
+        r = sd_event_run(mock->event, UINT64_MAX);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    error = sd_bus_message_get_error(mock->reply);
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", member, error->message != NULL ? error->message : error->name);
+        return -EIO;
+    }
+
+    r = sd_bus_message_read(mock->reply, "hq", &fd, &mtu);
+    if (r < 0) {
+        return r;
+    }
+
+    /* The descriptor belongs to the reply message. */
+    *out_fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    return *out_fd < 0 ? -errno : 0;
+}
+
+static void k10_mock_dock_received(struct k10_mock_chrc *chrc, const uint8_t *data,
+                                   size_t length) {
+    struct k10_mock_bluez *mock = chrc->mock;
+
+    if (chrc->chrc == K10_GATT_CHRC_DOCK_WRITE && mock->dock_write != NULL) {
+        mock->dock_write(data, length, mock->dock_userdata);
+    }
+}
+
+static int k10_mock_on_write_socket(sd_event_source *source, int fd, uint32_t revents,
+                                    void *userdata) {
+    struct k10_mock_chrc *chrc = userdata;
+    uint8_t buffer[K10_GATT_VALUE_MAX];
+    ssize_t length = 0;
+
+    (void)source;
+    (void)revents;
+
+    while ((length = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        k10_mock_dock_received(chrc, buffer, (size_t)length);
+    }
+
+    if (length == 0) {
+        chrc->write_source = sd_event_source_unref(chrc->write_source);
+        close(chrc->write_fd);
+        chrc->write_fd = -1;
+    }
+
+    return 0;
+}
+
+static int k10_mock_dock_acquire(sd_bus_message *m, struct k10_mock_chrc *chrc, bool write,
+                                 sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = chrc->mock;
+    int fds[2] = {-1, -1};
+    int r = 0;
+
+    if (!mock->dock_sockets) {
+        return sd_bus_error_set(ret_error, "org.bluez.Error.NotSupported", "Not supported");
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        return -errno;
+    }
+
+    if (write) {
+        r = sd_event_add_io(mock->event, &chrc->write_source, fds[0], EPOLLIN,
+                            k10_mock_on_write_socket, chrc);
+        chrc->write_fd = fds[0];
+    } else {
+        chrc->notify_fd = fds[0];
+    }
+
+    if (r >= 0) {
+        r = sd_bus_reply_method_return(m, "hq", fds[1], (uint16_t)K10_MOCK_MTU);
+    }
+    close(fds[1]);
+    return r;
+}
+
+static int k10_mock_dock_acquire_write(sd_bus_message *m, void *userdata,
+                                       sd_bus_error *ret_error) {
+    return k10_mock_dock_acquire(m, userdata, true, ret_error);
+}
+
+static int k10_mock_dock_acquire_notify(sd_bus_message *m, void *userdata,
+                                        sd_bus_error *ret_error) {
+    return k10_mock_dock_acquire(m, userdata, false, ret_error);
+}
+
+static int k10_mock_dock_write_value(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_mock_chrc *chrc = userdata;
+    const void *data = NULL;
+    size_t length = 0;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_read_array(m, 'y', &data, &length);
+    if (r < 0) {
+        return r;
+    }
+
+    if (length <= K10_GATT_VALUE_MAX) {
+        k10_mock_dock_received(chrc, data, length);
+    }
+
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_mock_dock_start_notify(sd_bus_message *m, void *userdata,
+                                      sd_bus_error *ret_error) {
+    struct k10_mock_chrc *chrc = userdata;
+
+    (void)ret_error;
+
+    chrc->notifying = true;
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_mock_dock_stop_notify(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_mock_chrc *chrc = userdata;
+
+    (void)ret_error;
+
+    chrc->notifying = false;
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_mock_dock_chrc_property(sd_bus *bus, const char *path, const char *interface,
+                                       const char *property, sd_bus_message *reply,
+                                       void *userdata, sd_bus_error *ret_error) {
+    struct k10_mock_chrc *chrc = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)ret_error;
+
+    if (strcmp(property, "UUID") == 0) {
+        return k10_mock_property_string(reply, k10_gatt_chrc_uuid(chrc->chrc));
+    }
+    if (strcmp(property, "Flags") == 0) {
+        return sd_bus_message_append_strv(reply, (char **)chrc->flags);
+    }
+
+    return sd_bus_message_append_array(reply, 'y', chrc->value, chrc->value_length);
+}
+
+static const sd_bus_vtable k10_mock_dock_chrc_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("AcquireWrite", "a{sv}", "hq", k10_mock_dock_acquire_write, 0),
+    SD_BUS_METHOD("AcquireNotify", "a{sv}", "hq", k10_mock_dock_acquire_notify, 0),
+    SD_BUS_METHOD("WriteValue", "aya{sv}", "", k10_mock_dock_write_value, 0),
+    SD_BUS_METHOD("StartNotify", "", "", k10_mock_dock_start_notify, 0),
+    SD_BUS_METHOD("StopNotify", "", "", k10_mock_dock_stop_notify, 0),
+    SD_BUS_PROPERTY("UUID", "s", k10_mock_dock_chrc_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Flags", "as", k10_mock_dock_chrc_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Value", "ay", k10_mock_dock_chrc_property, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_VTABLE_END};
+
+static int k10_mock_dock_connect(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)ret_error;
+
+    if (mock->dock_connected) {
+        return sd_bus_reply_method_errorf(m, "org.bluez.Error.AlreadyConnected",
+                                          "Already Connected");
+    }
+
+    mock->dock_connected = true;
+    (void)sd_bus_emit_properties_changed(mock->bus, mock->dock_path, K10_BLUEZ_IFACE_DEVICE,
+                                         "Connected", "ServicesResolved", NULL);
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_mock_dock_property(sd_bus *bus, const char *path, const char *interface,
+                                  const char *property, sd_bus_message *reply, void *userdata,
+                                  sd_bus_error *ret_error) {
+    struct k10_mock_bluez *mock = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)ret_error;
+
+    if (strcmp(property, "Address") == 0) {
+        return k10_mock_property_string(reply, mock->dock_address);
+    }
+    if (strcmp(property, "Adapter") == 0) {
+        return sd_bus_message_append(reply, "o", mock->adapter_path);
+    }
+
+    return sd_bus_message_append(reply, "b", mock->dock_connected);
+}
+
+static const sd_bus_vtable k10_mock_device_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Connect", "", "", k10_mock_dock_connect, 0),
+    SD_BUS_PROPERTY("Address", "s", k10_mock_dock_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Adapter", "o", k10_mock_dock_property, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Connected", "b", k10_mock_dock_property, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("ServicesResolved", "b", k10_mock_dock_property, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_VTABLE_END};
+
+/* Device1 under the adapter, with CBA20002/CBA20003 and B001..B004 below it. */
+int k10_mock_bluez_add_dock(struct k10_mock_bluez *mock, const char *address,
+                            k10_mock_dock_write_fn write, void *userdata) {
+    int r = 0;
+
+    if (mock->dock || strlen(address) != sizeof(mock->dock_address) - 1) {
+        return -EINVAL;
+    }
+
+    snprintf(mock->dock_address, sizeof(mock->dock_address), "%s", address);
+    snprintf(mock->dock_path, sizeof(mock->dock_path), "%s/dev_%s", mock->adapter_path, address);
+    for (char *c = mock->dock_path + strlen(mock->adapter_path); *c != '\0'; c++) {
+        if (*c == ':') {
+            *c = '_';
+        }
+    }
+
+    mock->dock_write = write;
+    mock->dock_userdata = userdata;
+
+    r = sd_bus_add_object_vtable(mock->bus, NULL, mock->dock_path, K10_BLUEZ_IFACE_DEVICE,
+                                 k10_mock_device_vtable, mock);
+
+    for (size_t i = 0; r >= 0 && i < K10_GATT_CHRC_COUNT; i++) {
+        struct k10_mock_chrc *chrc = &mock->chrcs[i];
+
+        if (chrc->chrc == K10_GATT_CHRC_FIRMWARE) {
+            continue;
+        }
+
+        chrc->flags = chrc->chrc == K10_GATT_CHRC_DOCK_WRITE    ? k10_mock_flags_write
+                      : chrc->chrc == K10_GATT_CHRC_DOCK_NOTIFY ? k10_mock_flags_notify
+                                                                : k10_mock_flags_sweeper;
+        snprintf(chrc->path, sizeof(chrc->path), "%s/service%04x/char%04zx", mock->dock_path,
+                 i < 2 ? 0x0c : 0x20, 0x0d + 2 * i);
+        r = sd_bus_add_object_vtable(mock->bus, NULL, chrc->path, K10_BLUEZ_IFACE_GATT_CHRC,
+                                     k10_mock_dock_chrc_vtable, chrc);
+    }
+
+    mock->dock = r >= 0;
+    return r;
+}
+
+/* Sends on CBA20003 the way the client subscribed: socket first, else PropertiesChanged. */
+void k10_mock_bluez_dock_notify(struct k10_mock_bluez *mock, const uint8_t *data, size_t length) {
+    struct k10_mock_chrc *notify = &mock->chrcs[K10_GATT_CHRC_DOCK_NOTIFY];
+
+    if (length > sizeof(notify->value)) {
+        return;
+    }
+
+    if (notify->notify_fd >= 0) {
+        (void)send(notify->notify_fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } else if (notify->notifying) {
+        memcpy(notify->value, data, length);
+        notify->value_length = length;
+        (void)sd_bus_emit_properties_changed(mock->bus, notify->path, K10_BLUEZ_IFACE_GATT_CHRC,
+                                             "Value", NULL);
+    }
+}
+
+void k10_mock_bluez_dock_set_sockets(struct k10_mock_bluez *mock, bool sockets) {
+    mock->dock_sockets = sockets;
+}
+
+void k10_mock_bluez_dock_reset(struct k10_mock_bluez *mock) {
+    for (size_t i = 0; i < K10_GATT_CHRC_COUNT; i++) {
+        struct k10_mock_chrc *chrc = &mock->chrcs[i];
+
+        chrc->write_source = sd_event_source_unref(chrc->write_source);
+        if (chrc->write_fd >= 0) {
+            close(chrc->write_fd);
+            chrc->write_fd = -1;
+        }
+        if (chrc->notify_fd >= 0) {
+            close(chrc->notify_fd);
+            chrc->notify_fd = -1;
+        }
+        chrc->notifying = false;
+    }
+
+    mock->dock_connected = false;
+}
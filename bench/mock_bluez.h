@@ -0,0 +1,51 @@
+#ifndef K10_BENCH_MOCK_BLUEZ_H
+#define K10_BENCH_MOCK_BLUEZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <systemd/sd-bus.h>
+
+#include "k10_barrel/gatt_app.h"
+
+/*
+ * Just enough of org.bluez for the benchmarks, served from the connection's
+ * event loop: an adapter with Adapter1, GattManager1 and LEAdvertisingManager1
+ * for the emulator to register with, and optionally a remote dock (Device1
+ * plus CBA20002/CBA20003 and B001..B004) for the relay to connect to.
+ * Registrations are read back the way BlueZ does before they are answered.
+ */
+
+/* What the peripheral side registered; times are CLOCK_MONOTONIC ns, 0 until answered. */
+struct k10_mock_bluez_app {
+    char owner[64];
+    uint64_t application_ns;
+    uint64_t advertisement_ns;
+    /* Our characteristics in the registered tree, matched by UUID; empty when missing. */
+    char chrc_paths[K10_GATT_CHRC_COUNT][128];
+    char local_name[32];
+};
+
+/* Gets every frame written to the mock dock's CBA20002. */
+typedef void (*k10_mock_dock_write_fn)(const uint8_t *data, size_t length, void *userdata);
+
+struct k10_mock_bluez;
+
+int k10_mock_bluez_new(sd_bus *bus, const char *adapter, struct k10_mock_bluez **out);
+void k10_mock_bluez_free(struct k10_mock_bluez *mock);
+const struct k10_mock_bluez_app *k10_mock_bluez_app(const struct k10_mock_bluez *mock);
+
+/* Plays a connected central: runs the loop until destination answers AcquireWrite/Notify. */
+int k10_mock_bluez_acquire(struct k10_mock_bluez *mock, const char *destination,
+                           const char *path, bool write, int *out_fd);
+
+int k10_mock_bluez_add_dock(struct k10_mock_bluez *mock, const char *address,
+                            k10_mock_dock_write_fn write, void *userdata);
+void k10_mock_bluez_dock_notify(struct k10_mock_bluez *mock, const uint8_t *data, size_t length);
+/* Cleared to make the dock refuse AcquireWrite/AcquireNotify. */
+void k10_mock_bluez_dock_set_sockets(struct k10_mock_bluez *mock, bool sockets);
+/* Drops the dock's link, sockets and subscriptions so the next client starts from scratch. */
+void k10_mock_bluez_dock_reset(struct k10_mock_bluez *mock);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef K10_BARREL_ADVERTISING_H
+#define K10_BARREL_ADVERTISING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <systemd/sd-bus.h>
+
+#include "k10_barrel/config.h"
+
+/* Legacy (non-extended) advertising data and scan response are 31 bytes each. */
+#define K10_ADV_LEGACY_MAX 31
+#define K10_ADV_FD3D_UUID "fd3d"
+
+/*
+ * Binary form of the advertising-related config keys, decoded once per
+ * config generation. 16-bit UUIDs, manufacturer data, fd3d service data and
+ * TX power go into the advertising data; 32/128-bit UUIDs and the local name
+ * go into the scan response.
+ */
+struct k10_adv_payload {
+    uint16_t company_id;
+    uint8_t manufacturer_data[K10_ADV_LEGACY_MAX];
+    size_t manufacturer_data_length;
+    uint8_t service_data[K10_ADV_LEGACY_MAX];
+    size_t service_data_length;
+    bool has_service_data;
+    char adv_uuids[K10_MAX_UUIDS][37];
+    unsigned int adv_uuid_count;
+    char scan_uuids[K10_MAX_UUIDS][37];
+    unsigned int scan_uuid_count;
+    bool include_tx_power;
+    char local_name[64];
+    size_t adv_length;
+    size_t scan_length;
+};
+
+struct k10_adv;
+
+int k10_adv_payload_build(const struct k10_config *config, struct k10_adv_payload *out);
+
+int k10_adv_new(sd_bus *bus, const char *instance_path, struct k10_adv **out);
+void k10_adv_free(struct k10_adv *adv);
+
+int k10_adv_update(struct k10_adv *adv, const struct k10_config *config, uint64_t generation);
+int k10_adv_register(struct k10_adv *adv, const char *adapter);
+int k10_adv_unregister(struct k10_adv *adv);
+const struct k10_adv_payload *k10_adv_payload(const struct k10_adv *adv);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef K10_BARREL_CAPTURE_H
+#define K10_BARREL_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "k10_barrel/config.h"
+
+/* Largest ATT attribute value; longer payloads are truncated in the capture. */
+#define K10_CAPTURE_PAYLOAD_MAX 512
+
+/* ATT opcodes written to the capture. */
+#define K10_ATT_OP_READ_REQ 0x0a
+#define K10_ATT_OP_READ_RSP 0x0b
+#define K10_ATT_OP_READ_BLOB_REQ 0x0c
+#define K10_ATT_OP_READ_BLOB_RSP 0x0d
+#define K10_ATT_OP_WRITE_REQ 0x12
+#define K10_ATT_OP_HANDLE_NOTIFY 0x1b
+#define K10_ATT_OP_WRITE_CMD 0x52
+
+enum k10_capture_direction {
+    /* From the central (phone) to us. */
+    K10_CAPTURE_RECEIVED = 0,
+    K10_CAPTURE_SENT,
+};
+
+struct k10_capture;
+
+struct k10_capture_stats {
+    uint64_t records;
+    uint64_t overruns;
+    uint64_t written;
+    uint64_t files;
+    /* Drained while the file could not be opened or written. */
+    uint64_t lost;
+    unsigned int ring_size;
+    bool running;
+};
+
+int k10_capture_new(struct k10_capture **out);
+void k10_capture_free(struct k10_capture *capture);
+int k10_capture_configure(struct k10_capture *capture, const struct k10_config *config);
+
+bool k10_capture_active(const struct k10_capture *capture);
+void k10_capture_att(struct k10_capture *capture, const char *device,
+                     enum k10_capture_direction direction, uint8_t opcode, uint16_t handle,
+                     const uint8_t *payload, size_t length);
+void k10_capture_get_stats(const struct k10_capture *capture, struct k10_capture_stats *out);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef K10_BARREL_CHRC_DOCK_H
+#define K10_BARREL_CHRC_DOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "k10_barrel/config.h"
+#include "k10_barrel/gatt_app.h"
+
+struct k10_chrc_dock;
+
+struct k10_chrc_dock_stats {
+    uint64_t queued;
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t stalls;
+    /* App frames answered and writes that were not a frame. */
+    uint64_t frames;
+    uint64_t rejected;
+    unsigned int length;
+    unsigned int high_water;
+    unsigned int depth;
+};
+
+int k10_chrc_dock_new(struct k10_gatt *gatt, const struct k10_config *config,
+                      struct k10_chrc_dock **out);
+void k10_chrc_dock_free(struct k10_chrc_dock *dock);
+int k10_chrc_dock_configure(struct k10_chrc_dock *dock, const struct k10_config *config);
+
+void k10_chrc_dock_write(struct k10_chrc_dock *dock, const uint8_t *data, size_t length);
+int k10_chrc_dock_notify(struct k10_chrc_dock *dock, const uint8_t *frame, size_t length);
+void k10_chrc_dock_get_stats(const struct k10_chrc_dock *dock, struct k10_chrc_dock_stats *out);
+
+#endif
@@ -2,9 +2,20 @@
 #define K10_BARREL_CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define K10_MAX_UUIDS 8
 
+/* Values of notify_queue_policy. */
+#define K10_NOTIFY_POLICY_DROP_NEWEST "drop-newest"
+#define K10_NOTIFY_POLICY_DROP_OLDEST "drop-oldest"
+#define K10_NOTIFY_POLICY_BLOCK "block"
+
+/* Values of capture_format. */
+#define K10_CAPTURE_FORMAT_BTSNOOP "btsnoop"
+#define K10_CAPTURE_FORMAT_PCAPNG "pcapng"
+
 struct k10_config {
     char adapter[16];
     char local_name[64];
@@ -16,9 +27,44 @@ struct k10_config {
     bool include_tx_power;
     unsigned int fw_major;
     unsigned int fw_minor;
+    unsigned int notify_coalesce_ms;
+    unsigned int save_delay_ms;
+    unsigned int notify_queue_depth;
+    char notify_queue_policy[16];
+    bool capture_enabled;
+    char capture_format[16];
+    char capture_path[128];
+    unsigned int capture_ring_size;
+    unsigned int capture_file_size_kb;
+    unsigned int capture_file_count;
+    char relay_dock_address[18];
+};
+
+/* Emulated docks per daemon, counting the primary one. */
+#define K10_INSTANCE_MAX 8
+#define K10_INSTANCE_NAME_MAX 32
+
+/*
+ * Every instance in one config file. Entry 0 is the primary instance, set by
+ * the top-level keys, and has an empty name; each [instance.<name>] table
+ * adds another that starts from the top-level values.
+ */
+struct k10_config_set {
+    unsigned int count;
+    char names[K10_INSTANCE_MAX][K10_INSTANCE_NAME_MAX];
+    struct k10_config configs[K10_INSTANCE_MAX];
 };
 
 int k10_config_load(const char *path, struct k10_config *out_config);
-int k10_config_save(const char *path, const struct k10_config *config);
+int k10_config_load_set(const char *path, struct k10_config_set *out_set);
+int k10_config_load_hashed(const char *path, struct k10_config_set *out_set, uint64_t *out_hash);
+int k10_config_parse(const char *data, size_t size, const char *origin,
+                     struct k10_config_set *out_set);
+uint64_t k10_config_content_hash(const char *data, size_t length);
+int k10_config_save(const char *path, const struct k10_config_set *set);
+int k10_config_render(const struct k10_config_set *set, char **out_data, size_t *out_length);
+int k10_config_set_find(const struct k10_config_set *set, const char *name);
+bool k10_config_instance_name_valid(const char *name, size_t length);
+int k10_config_write(const char *path, const char *data, size_t length);
 
 #endif
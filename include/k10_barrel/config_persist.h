@@ -0,0 +1,30 @@
+#ifndef K10_BARREL_CONFIG_PERSIST_H
+#define K10_BARREL_CONFIG_PERSIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <systemd/sd-event.h>
+
+#include "k10_barrel/config.h"
+
+struct k10_config_persist;
+
+/* Runs on the event loop thread once the requested state is on disk (result 0) or failed. */
+typedef void (*k10_config_persist_done_fn)(int result, void *userdata);
+
+int k10_config_persist_open(sd_event *event, const char *path, struct k10_config_persist **out);
+void k10_config_persist_close(struct k10_config_persist *persist);
+
+int k10_config_persist_schedule(struct k10_config_persist *persist,
+                                const struct k10_config_set *set);
+int k10_config_persist_flush(struct k10_config_persist *persist, k10_config_persist_done_fn done,
+                             void *userdata);
+
+bool k10_config_persist_busy(const struct k10_config_persist *persist);
+bool k10_config_persist_wrote(const struct k10_config_persist *persist, uint64_t hash);
+
+uint64_t k10_config_persist_writes(const struct k10_config_persist *persist);
+uint64_t k10_config_persist_coalesced(const struct k10_config_persist *persist);
+
+#endif
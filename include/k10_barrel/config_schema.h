@@ -0,0 +1,96 @@
+#ifndef K10_BARREL_CONFIG_SCHEMA_H
+#define K10_BARREL_CONFIG_SCHEMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "k10_barrel/config.h"
+
+#define K10_CONFIG_FIELD_MAX 64
+
+enum k10_config_type {
+    K10_CONFIG_STRING = 0,
+    K10_CONFIG_UINT,
+    K10_CONFIG_BOOL,
+    K10_CONFIG_STRING_LIST,
+};
+
+enum k10_config_field_flags {
+    K10_CONFIG_FLAG_HEX = 1u << 0,
+    /* Readable over D-Bus but only set from the file, which only root can write. */
+    K10_CONFIG_FLAG_FILE_ONLY = 1u << 1,
+};
+
+/*
+ * What has to be redone when a field changes. Advertising changes only
+ * re-register the advertisement; GATT changes re-register the application
+ * (and the advertisement, which carries the service UUIDs); an adapter
+ * change restarts everything on the new controller.
+ */
+enum k10_config_scope {
+    K10_CONFIG_SCOPE_NONE = 0,
+    K10_CONFIG_SCOPE_ADVERTISING = 1u << 0,
+    K10_CONFIG_SCOPE_GATT = 1u << 1,
+    K10_CONFIG_SCOPE_ADAPTER = 1u << 2,
+};
+
+struct k10_config_field;
+
+typedef int (*k10_config_validate_fn)(const struct k10_config *config,
+                                      const struct k10_config_field *field);
+
+/*
+ * One entry per config key. offset/size locate the value inside struct
+ * k10_config; for string lists size is the element size and count_offset
+ * locates the element count.
+ */
+struct k10_config_field {
+    const char *name;
+    enum k10_config_type type;
+    unsigned int scope;
+    unsigned int flags;
+    size_t offset;
+    size_t size;
+    size_t count_offset;
+    unsigned int max_count;
+    k10_config_validate_fn validate;
+};
+
+typedef uint64_t k10_config_mask;
+
+extern const struct k10_config_field k10_config_fields[];
+extern const size_t k10_config_field_count;
+
+const struct k10_config_field *k10_config_field_lookup(const char *name, size_t length);
+size_t k10_config_field_index(const struct k10_config_field *field);
+const char *k10_config_type_signature(enum k10_config_type type);
+
+const char *k10_config_get_string(const struct k10_config *config,
+                                  const struct k10_config_field *field);
+unsigned int k10_config_get_uint(const struct k10_config *config,
+                                 const struct k10_config_field *field);
+bool k10_config_get_bool(const struct k10_config *config, const struct k10_config_field *field);
+unsigned int k10_config_get_list_count(const struct k10_config *config,
+                                       const struct k10_config_field *field);
+const char *k10_config_get_list_item(const struct k10_config *config,
+                                     const struct k10_config_field *field, unsigned int index);
+
+int k10_config_set_string(struct k10_config *config, const struct k10_config_field *field,
+                          const char *value, size_t length);
+int k10_config_set_uint(struct k10_config *config, const struct k10_config_field *field,
+                        unsigned long value);
+int k10_config_set_bool(struct k10_config *config, const struct k10_config_field *field,
+                        bool value);
+void k10_config_clear_list(struct k10_config *config, const struct k10_config_field *field);
+int k10_config_append_list(struct k10_config *config, const struct k10_config_field *field,
+                           const char *value, size_t length);
+
+int k10_config_field_validate(const struct k10_config *config,
+                              const struct k10_config_field *field);
+bool k10_config_field_equal(const struct k10_config_field *field, const struct k10_config *a,
+                            const struct k10_config *b);
+k10_config_mask k10_config_diff(const struct k10_config *a, const struct k10_config *b);
+unsigned int k10_config_scope(k10_config_mask mask);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef K10_BARREL_CONFIG_WATCH_H
+#define K10_BARREL_CONFIG_WATCH_H
+
+#include <systemd/sd-event.h>
+
+#include "k10_barrel/config.h"
+#include "k10_barrel/config_persist.h"
+
+struct k10_config_watch;
+
+/* Called on the event loop with the freshly parsed file once its content really changed. */
+typedef void (*k10_config_watch_fn)(const struct k10_config_set *set, void *userdata);
+
+/* Called on the event loop once a sibling file settled after a change; it is not parsed here. */
+typedef void (*k10_config_watch_sibling_fn)(void *userdata);
+
+int k10_config_watch_open(sd_event *event, const char *path, struct k10_config_persist *persist,
+                          k10_config_watch_fn changed, void *userdata,
+                          struct k10_config_watch **out);
+int k10_config_watch_add_sibling(struct k10_config_watch *watch, const char *name,
+                                 k10_config_watch_sibling_fn changed, void *userdata);
+void k10_config_watch_close(struct k10_config_watch *watch);
+
+#endif
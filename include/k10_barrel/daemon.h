@@ -2,18 +2,73 @@
 #define K10_BARREL_DAEMON_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
 
 #include "k10_barrel/config.h"
+#include "k10_barrel/dbus_defs.h"
+
+struct k10_adv;
+struct k10_capture;
+struct k10_chrc_dock;
+struct k10_config_persist;
+struct k10_gatt;
+struct k10_relay;
+struct k10_responder;
+struct k10_config_watch;
+struct k10_daemon;
+struct k10_dbus_context;
+struct k10_rules;
 
 enum k10_emulator_mode { K10_MODE_NONE = 0, K10_MODE_SWEEPER, K10_MODE_BARREL };
 
+/* One emulated dock: its config section, D-Bus object, advertisement and GATT application. */
 struct k10_daemon_state {
+    struct k10_daemon *daemon;
+    /* Empty for the primary instance, which keeps the top-level keys and K10_DBUS_OBJECT. */
+    char name[K10_INSTANCE_NAME_MAX];
+    char path[K10_DBUS_OBJECT_MAX];
     struct k10_config config;
-    char config_path[256];
     bool running;
     enum k10_emulator_mode mode;
+    struct k10_dbus_context *dbus;
+    struct k10_adv *adv;
+    struct k10_gatt *gatt;
+    struct k10_chrc_dock *dock;
+    struct k10_capture *capture;
+    struct k10_responder *responder;
+    struct k10_relay *relay;
+    uint64_t config_generation;
+};
+
+/* What every instance shares: the loop, the bus connection, the config file and the rules. */
+struct k10_daemon {
+    char config_path[256];
+    /* rules.toml next to config_path. */
+    char rules_path[256 + 16];
+    sd_event *event;
+    sd_bus *bus;
+    struct k10_config_persist *persist;
+    struct k10_config_watch *watch;
+    struct k10_rules *rules;
+    /*
+     * The file as last loaded, including sections that have no instance
+     * (a repeated adapter, or a failed start); saves start from it.
+     */
+    struct k10_config_set *loaded;
+    /* In config file order; the primary instance is always first. */
+    struct k10_daemon_state *instances[K10_INSTANCE_MAX];
+    unsigned int instance_count;
 };
 
-int k10_daemon_run(void);
+int k10_daemon_run(const char *config_path);
+int k10_daemon_apply_config(struct k10_daemon_state *state, const struct k10_config *config);
+int k10_daemon_start(struct k10_daemon_state *state, enum k10_emulator_mode mode);
+void k10_daemon_stop(struct k10_daemon_state *state);
+int k10_daemon_reload(struct k10_daemon *daemon);
+int k10_daemon_save_config(struct k10_daemon *daemon);
+bool k10_daemon_adapter_taken(const struct k10_daemon_state *state, const char *adapter);
 
 #endif
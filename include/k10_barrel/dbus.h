@@ -1,8 +1,16 @@
 #ifndef K10_BARREL_DBUS_H
 #define K10_BARREL_DBUS_H
 
+#include <systemd/sd-bus.h>
+
 #include "k10_barrel/daemon.h"
 
-int k10_dbus_run(struct k10_daemon_state *state);
+struct k10_dbus_context;
+
+int k10_dbus_connect(sd_event *event, sd_bus **out_bus);
+void k10_dbus_disconnect(sd_bus *bus);
+int k10_dbus_open(sd_bus *bus, struct k10_daemon_state *state, struct k10_dbus_context **out_ctx);
+void k10_dbus_close(struct k10_dbus_context *ctx);
+void k10_dbus_state_changed(struct k10_dbus_context *ctx);
 
 #endif
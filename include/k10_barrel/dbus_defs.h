@@ -7,4 +7,25 @@
 #define K10_DBUS_IFACE_BARREL "com.switchbot.SwitchbotBleEmulator.SweeperMiniBarrel"
 #define K10_DBUS_IFACE_CONFIG "com.switchbot.SwitchbotBleEmulator.Config"
 
+/* Children of an instance's object; named instances live at K10_DBUS_OBJECT "/<name>". */
+#define K10_DBUS_ADV_CHILD "/advertisement0"
+#define K10_DBUS_GATT_CHILD "/gatt"
+#define K10_DBUS_OBJECT_MAX 128
+
+#define K10_DBUS_ADV_OBJECT K10_DBUS_OBJECT K10_DBUS_ADV_CHILD
+#define K10_DBUS_GATT_OBJECT K10_DBUS_OBJECT K10_DBUS_GATT_CHILD
+
+#define K10_BLUEZ_SERVICE "org.bluez"
+#define K10_BLUEZ_PATH_PREFIX "/org/bluez/"
+#define K10_BLUEZ_IFACE_ADAPTER "org.bluez.Adapter1"
+#define K10_BLUEZ_IFACE_ADV_MANAGER "org.bluez.LEAdvertisingManager1"
+#define K10_BLUEZ_IFACE_ADVERTISEMENT "org.bluez.LEAdvertisement1"
+#define K10_BLUEZ_IFACE_GATT_MANAGER "org.bluez.GattManager1"
+#define K10_BLUEZ_IFACE_GATT_SERVICE "org.bluez.GattService1"
+#define K10_BLUEZ_IFACE_GATT_CHRC "org.bluez.GattCharacteristic1"
+#define K10_BLUEZ_IFACE_DEVICE "org.bluez.Device1"
+
+#define K10_DBUS_IFACE_PROPERTIES "org.freedesktop.DBus.Properties"
+#define K10_DBUS_IFACE_OBJECT_MANAGER "org.freedesktop.DBus.ObjectManager"
+
 #endif
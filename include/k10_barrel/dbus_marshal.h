@@ -0,0 +1,25 @@
+#ifndef K10_BARREL_DBUS_MARSHAL_H
+#define K10_BARREL_DBUS_MARSHAL_H
+
+#include <stdint.h>
+
+#include <systemd/sd-bus.h>
+
+#include "k10_barrel/config.h"
+#include "k10_barrel/config_schema.h"
+#include "k10_barrel/daemon.h"
+#include "k10_barrel/relay.h"
+#include "k10_barrel/replay.h"
+
+const char *k10_mode_to_string(enum k10_emulator_mode mode);
+
+int k10_dbus_append_status(sd_bus_message *msg, const struct k10_daemon_state *state);
+int k10_dbus_append_config(sd_bus_message *msg, const struct k10_config *config);
+int k10_dbus_append_config_value(sd_bus_message *msg, const struct k10_config *config,
+                                 const struct k10_config_field *field);
+int k10_dbus_append_replay_stats(sd_bus_message *msg, const struct k10_replay_stats *stats);
+int k10_dbus_append_relay_stats(sd_bus_message *msg, const struct k10_relay_stats *stats);
+int k10_dbus_read_config_value(sd_bus_message *msg, struct k10_config *config,
+                               const struct k10_config_field *field);
+
+#endif
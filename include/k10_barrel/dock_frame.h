@@ -0,0 +1,68 @@
+#ifndef K10_BARREL_DOCK_FRAME_H
+#define K10_BARREL_DOCK_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "k10_barrel/config.h"
+
+/*
+ * App frames on CBA20002 follow the SwitchBot BLE command layout:
+ * 0x57, a command byte, then command specific bytes. Extended commands put a
+ * sub-command in the first payload byte. Responses on CBA20003 start with a
+ * status byte.
+ */
+#define K10_DOCK_FRAME_MAGIC 0x57
+
+/* Responses fit a default-MTU notification (23 - 3). */
+#define K10_DOCK_RESPONSE_MAX 20
+
+#define K10_DOCK_CMD_ACTION 0x01
+#define K10_DOCK_CMD_GET_INFO 0x02
+#define K10_DOCK_CMD_SET_TIME 0x09
+#define K10_DOCK_CMD_EXTENDED 0x0f
+
+#define K10_DOCK_EXT_GET_STATE 0x01
+#define K10_DOCK_EXT_SET_MODE 0x02
+
+#define K10_DOCK_STATUS_OK 0x01
+#define K10_DOCK_STATUS_ERROR 0x02
+#define K10_DOCK_STATUS_UNSUPPORTED 0x05
+
+/* A parsed frame; payload points into the buffer that was parsed. */
+struct k10_dock_frame {
+    uint8_t command;
+    /* First payload byte of an extended command, 0 otherwise. */
+    uint8_t subcommand;
+    const uint8_t *payload;
+    size_t payload_length;
+};
+
+struct k10_dock_response {
+    uint8_t length;
+    uint8_t data[K10_DOCK_RESPONSE_MAX];
+};
+
+enum k10_dock_template {
+    K10_DOCK_TEMPLATE_ACK = 0,
+    K10_DOCK_TEMPLATE_ERROR,
+    K10_DOCK_TEMPLATE_UNSUPPORTED,
+    K10_DOCK_TEMPLATE_INFO,
+    K10_DOCK_TEMPLATE_STATE,
+    K10_DOCK_TEMPLATE_COUNT,
+};
+
+/* Every response the dock can send, encoded ahead of time. */
+struct k10_dock_codec {
+    struct k10_dock_response templates[K10_DOCK_TEMPLATE_COUNT];
+};
+
+int k10_dock_frame_parse(const uint8_t *data, size_t length, struct k10_dock_frame *out);
+const char *k10_dock_frame_name(const struct k10_dock_frame *frame);
+
+void k10_dock_codec_init(struct k10_dock_codec *codec, const struct k10_config *config);
+void k10_dock_codec_configure(struct k10_dock_codec *codec, const struct k10_config *config);
+const struct k10_dock_response *k10_dock_codec_answer(const struct k10_dock_codec *codec,
+                                                      const struct k10_dock_frame *frame);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef K10_BARREL_EVENT_H
+#define K10_BARREL_EVENT_H
+
+#include <stdint.h>
+
+#include <systemd/sd-event.h>
+
+/* Lower values dispatch first when several sources are pending in one iteration. */
+#define K10_EVENT_PRIORITY_SIGNAL SD_EVENT_PRIORITY_IMPORTANT
+#define K10_EVENT_PRIORITY_BLE (SD_EVENT_PRIORITY_NORMAL - 10)
+#define K10_EVENT_PRIORITY_DBUS SD_EVENT_PRIORITY_NORMAL
+#define K10_EVENT_PRIORITY_IDLE SD_EVENT_PRIORITY_IDLE
+
+#define K10_EVENT_ACCURACY_FINE_USEC 1000ULL
+#define K10_EVENT_ACCURACY_DEFAULT_USEC 50000ULL
+
+int k10_event_add_timer(sd_event *event, sd_event_source **out_source, uint64_t delay_usec,
+                        uint64_t accuracy_usec, int64_t priority, sd_event_time_handler_t handler,
+                        void *userdata, const char *description);
+int k10_event_add_io(sd_event *event, sd_event_source **out_source, int fd, uint32_t events,
+                     int64_t priority, sd_event_io_handler_t handler, void *userdata,
+                     const char *description);
+int k10_event_add_signals(sd_event *event);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef K10_BARREL_FILE_H
+#define K10_BARREL_FILE_H
+
+#include <stddef.h>
+
+int k10_file_read(int fd, size_t max_size, char **out_data, size_t *out_size);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef K10_BARREL_GATT_APP_H
+#define K10_BARREL_GATT_APP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <systemd/sd-bus.h>
+
+#include "k10_barrel/config.h"
+
+/* Largest attribute value allowed by the ATT protocol. */
+#define K10_GATT_VALUE_MAX 512
+
+enum k10_gatt_chrc {
+    K10_GATT_CHRC_DOCK_WRITE = 0,
+    K10_GATT_CHRC_DOCK_NOTIFY,
+    K10_GATT_CHRC_SWEEPER_B001,
+    K10_GATT_CHRC_SWEEPER_B002,
+    K10_GATT_CHRC_SWEEPER_B003,
+    K10_GATT_CHRC_SWEEPER_B004,
+    K10_GATT_CHRC_FIRMWARE,
+    K10_GATT_CHRC_COUNT,
+};
+
+struct k10_capture;
+struct k10_gatt;
+
+/* Runs for every value a central writes, whether it came over WriteValue or an acquired socket. */
+typedef void (*k10_gatt_write_fn)(enum k10_gatt_chrc chrc, const uint8_t *data, size_t length,
+                                  void *userdata);
+/* Runs when a notify path may take data again: new subscriber, or a full socket drained. */
+typedef void (*k10_gatt_ready_fn)(enum k10_gatt_chrc chrc, void *userdata);
+
+const char *k10_gatt_chrc_uuid(enum k10_gatt_chrc chrc);
+
+int k10_gatt_new(sd_bus *bus, const char *instance_path, struct k10_gatt **out);
+void k10_gatt_free(struct k10_gatt *gatt);
+
+int k10_gatt_update(struct k10_gatt *gatt, const struct k10_config *config, uint64_t generation);
+int k10_gatt_register(struct k10_gatt *gatt, const char *adapter);
+int k10_gatt_unregister(struct k10_gatt *gatt);
+
+void k10_gatt_set_write_handler(struct k10_gatt *gatt, k10_gatt_write_fn handler, void *userdata);
+void k10_gatt_set_ready_handler(struct k10_gatt *gatt, k10_gatt_ready_fn handler, void *userdata);
+void k10_gatt_set_capture(struct k10_gatt *gatt, struct k10_capture *capture);
+int k10_gatt_notify(struct k10_gatt *gatt, enum k10_gatt_chrc chrc, const uint8_t *data,
+                    size_t length);
+int k10_gatt_notify_batch(struct k10_gatt *gatt, enum k10_gatt_chrc chrc,
+                          const struct iovec *frames, size_t count);
+size_t k10_gatt_notify_limit(const struct k10_gatt *gatt, enum k10_gatt_chrc chrc);
+int k10_gatt_replay(struct k10_gatt *gatt, const char *device, uint8_t opcode, uint16_t handle,
+                    const uint8_t *data, size_t length);
+void k10_gatt_pause_writes(struct k10_gatt *gatt, enum k10_gatt_chrc chrc, bool paused);
+
+#endif
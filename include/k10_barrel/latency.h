@@ -0,0 +1,22 @@
+#ifndef K10_BARREL_LATENCY_H
+#define K10_BARREL_LATENCY_H
+
+#include <stdint.h>
+
+/* Eight buckets per power of two above 16 ns; the last one catches everything past ~64 s. */
+#define K10_LATENCY_BUCKETS (16 + 8 * 32)
+
+/* Fixed-size log-linear histogram, cheap enough to update on every frame. */
+struct k10_latency {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[K10_LATENCY_BUCKETS];
+};
+
+uint64_t k10_latency_now_ns(void);
+void k10_latency_record(struct k10_latency *latency, uint64_t ns);
+uint64_t k10_latency_average(const struct k10_latency *latency);
+uint64_t k10_latency_percentile(const struct k10_latency *latency, unsigned int percent);
+
+#endif
@@ -1,7 +1,106 @@
 #ifndef K10_BARREL_LOG_H
 #define K10_BARREL_LOG_H
 
-void k10_log_info(const char *format, ...);
-void k10_log_error(const char *format, ...);
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Define before including this header to file a source file's messages under a subsystem. */
+#ifndef K10_LOG_SUBSYSTEM
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_DAEMON
+#endif
+
+/*
+ * Most verbose level compiled in (0 error .. 3 trace). Calls above it are
+ * removed by the compiler; release packages build with debug.
+ */
+#ifndef K10_LOG_MAX_LEVEL
+#define K10_LOG_MAX_LEVEL 3
+#endif
+
+/* MESSAGE_IDs for events worth filtering on (journalctl MESSAGE_ID=...). */
+#define K10_LOG_ID_GATT_WRITE "5b0e3c2a9d4f4e7a8c61f2d7a3b9e014"
+#define K10_LOG_ID_GATT_SUBSCRIBE "c7a41d0e6b2f4c93a5e8d1f60b7c2a45"
+#define K10_LOG_ID_GATT_LINK "2e9f6b71c0d84a5fb3e7a9c1d4f60b82"
+#define K10_LOG_ID_SUPPRESSED "9d3c5a7e1f0b4e6c8a2d7b9f3e1c5a60"
+
+enum k10_log_level {
+    K10_LOG_ERROR = 0,
+    K10_LOG_INFO,
+    K10_LOG_DEBUG,
+    K10_LOG_TRACE,
+};
+
+enum k10_log_subsystem {
+    K10_LOG_SUBSYSTEM_DAEMON = 0,
+    K10_LOG_SUBSYSTEM_DBUS,
+    K10_LOG_SUBSYSTEM_CONFIG,
+    K10_LOG_SUBSYSTEM_ADV,
+    K10_LOG_SUBSYSTEM_GATT,
+    K10_LOG_SUBSYSTEM_GATT_DOCK,
+    K10_LOG_SUBSYSTEM_GATT_SWEEPER,
+    K10_LOG_SUBSYSTEM_CAPTURE,
+    K10_LOG_SUBSYSTEM_RELAY,
+    K10_LOG_SUBSYSTEM_COUNT,
+};
+
+/* Runtime level per subsystem; read by the macros below before any argument is evaluated. */
+extern atomic_int k10_log_levels[K10_LOG_SUBSYSTEM_COUNT];
+
+/* Optional structured fields; NULL members are left out. */
+struct k10_log_fields {
+    const char *message_id;
+    const char *char_uuid;
+    const char *device;
+};
+
+/* Per call site state for the rate limiter; defined by the K10_LOG() macro. */
+struct k10_log_site {
+    const char *file;
+    int line;
+    _Atomic uint64_t window_start;
+    atomic_uint count;
+    atomic_uint suppressed;
+};
+
+int k10_log_open(void);
+void k10_log_close(void);
+
+const char *k10_log_level_name(enum k10_log_level level);
+int k10_log_level_from_string(const char *name, enum k10_log_level *out_level);
+const char *k10_log_subsystem_name(enum k10_log_subsystem subsystem);
+int k10_log_subsystem_from_string(const char *name, enum k10_log_subsystem *out_subsystem);
+int k10_log_set_level(enum k10_log_subsystem subsystem, enum k10_log_level level);
+
+void k10_log_write(struct k10_log_site *site, enum k10_log_subsystem subsystem,
+                   enum k10_log_level level, const struct k10_log_fields *fields,
+                   const char *format, ...) __attribute__((format(printf, 5, 6)));
+
+#define K10_LOG_ENABLED(subsystem, level)                                                          \
+    ((level) <= K10_LOG_MAX_LEVEL &&                                                               \
+     (int)(level) <= atomic_load_explicit(&k10_log_levels[subsystem], memory_order_relaxed))
+
+#define K10_LOG(subsystem, level, fields, ...)                                                     \
+    do {                                                                                           \
+        if (K10_LOG_ENABLED(subsystem, level)) {                                                   \
+            static struct k10_log_site k10_log_site_ = {__FILE__, __LINE__, 0, 0, 0};              \
+            k10_log_write(&k10_log_site_, subsystem, level, fields, __VA_ARGS__);                  \
+        }                                                                                          \
+    } while (0)
+
+#define k10_log_error(...) K10_LOG(K10_LOG_SUBSYSTEM, K10_LOG_ERROR, NULL, __VA_ARGS__)
+#define k10_log_info(...) K10_LOG(K10_LOG_SUBSYSTEM, K10_LOG_INFO, NULL, __VA_ARGS__)
+#define k10_log_debug(...) K10_LOG(K10_LOG_SUBSYSTEM, K10_LOG_DEBUG, NULL, __VA_ARGS__)
+#define k10_log_trace(...) K10_LOG(K10_LOG_SUBSYSTEM, K10_LOG_TRACE, NULL, __VA_ARGS__)
+
+/* Explicit subsystem and structured fields, for files that log on behalf of several. */
+#define k10_log_error_at(subsystem, fields, ...)                                                   \
+    K10_LOG(subsystem, K10_LOG_ERROR, fields, __VA_ARGS__)
+#define k10_log_info_at(subsystem, fields, ...)                                                    \
+    K10_LOG(subsystem, K10_LOG_INFO, fields, __VA_ARGS__)
+#define k10_log_debug_at(subsystem, fields, ...)                                                   \
+    K10_LOG(subsystem, K10_LOG_DEBUG, fields, __VA_ARGS__)
+#define k10_log_trace_at(subsystem, fields, ...)                                                   \
+    K10_LOG(subsystem, K10_LOG_TRACE, fields, __VA_ARGS__)
 
 #endif
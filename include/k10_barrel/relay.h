@@ -0,0 +1,72 @@
+#ifndef K10_BARREL_RELAY_H
+#define K10_BARREL_RELAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <systemd/sd-bus.h>
+
+#include "k10_barrel/chrc_dock.h"
+#include "k10_barrel/gatt_app.h"
+
+enum k10_relay_hop {
+    /* Written by the sweeper to us, forwarded as a write to the real dock. */
+    K10_RELAY_TO_DOCK = 0,
+    /* Notified by the real dock, forwarded as a notification to the sweeper. */
+    K10_RELAY_TO_SWEEPER,
+    K10_RELAY_HOP_COUNT,
+};
+
+/*
+ * A frame in flight. data points at the receive buffer it arrived in; a
+ * rewrite hook that changes it builds the new frame in scratch and points
+ * data there.
+ */
+struct k10_relay_frame {
+    enum k10_relay_hop hop;
+    enum k10_gatt_chrc chrc;
+    const uint8_t *data;
+    size_t length;
+    uint8_t *scratch;
+    size_t scratch_size;
+};
+
+/* Runs for every frame before it is handed on; returning false drops it. */
+typedef bool (*k10_relay_rewrite_fn)(struct k10_relay_frame *frame, void *userdata);
+
+struct k10_relay_hop_stats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t rewritten;
+    /* Dropped by the hook, while the other end was down, or because it was full. */
+    uint64_t dropped;
+    /* Time from the frame reaching the relay to the handoff returning. */
+    uint64_t latency_avg_ns;
+    uint64_t latency_p50_ns;
+    uint64_t latency_p99_ns;
+    uint64_t latency_max_ns;
+};
+
+struct k10_relay_stats {
+    bool enabled;
+    bool connected;
+    uint64_t connects;
+    struct k10_relay_hop_stats hops[K10_RELAY_HOP_COUNT];
+};
+
+struct k10_relay;
+
+int k10_relay_new(sd_bus *bus, struct k10_gatt *gatt, struct k10_chrc_dock *dock,
+                  struct k10_relay **out);
+void k10_relay_free(struct k10_relay *relay);
+int k10_relay_start(struct k10_relay *relay, const char *adapter, const char *address);
+void k10_relay_stop(struct k10_relay *relay);
+bool k10_relay_enabled(const struct k10_relay *relay);
+void k10_relay_set_rewrite(struct k10_relay *relay, k10_relay_rewrite_fn rewrite,
+                           void *userdata);
+void k10_relay_forward(struct k10_relay *relay, enum k10_gatt_chrc chrc, const uint8_t *data,
+                       size_t length);
+void k10_relay_get_stats(const struct k10_relay *relay, struct k10_relay_stats *out);
+
+#endif
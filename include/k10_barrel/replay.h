@@ -0,0 +1,80 @@
+#ifndef K10_BARREL_REPLAY_H
+#define K10_BARREL_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <systemd/sd-event.h>
+
+#include "k10_barrel/capture.h"
+#include "k10_barrel/gatt_app.h"
+
+/* One ATT PDU from a capture; payload points into the mapped file. */
+struct k10_replay_record {
+    uint64_t timestamp_usec;
+    enum k10_capture_direction direction;
+    uint8_t opcode;
+    uint16_t handle;
+    const uint8_t *payload;
+    size_t length;
+};
+
+/* Reads the btsnoop and pcapng files k10_capture writes, straight out of a read-only mapping. */
+struct k10_replay_file {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool pcapng;
+    /* pcapng section written on a host of the other byte order. */
+    bool swapped;
+};
+
+int k10_replay_file_open(struct k10_replay_file *file, int fd);
+void k10_replay_file_close(struct k10_replay_file *file);
+int k10_replay_file_next(struct k10_replay_file *file, struct k10_replay_record *out);
+
+enum k10_replay_direction {
+    /* Writes from the central go through the GATT write path. */
+    K10_REPLAY_WRITES = 1u << 0,
+    /* Our notifications go out to subscribers again. */
+    K10_REPLAY_NOTIFY = 1u << 1,
+    K10_REPLAY_ALL = K10_REPLAY_WRITES | K10_REPLAY_NOTIFY,
+};
+
+struct k10_replay_options {
+    /* Multiple of the captured pace; 0 replays as fast as the loop allows. */
+    double speed;
+    unsigned int directions;
+};
+
+struct k10_replay_stats {
+    uint64_t records;
+    uint64_t dispatched;
+    /* Reads, subscriptions and handles this build does not export. */
+    uint64_t skipped;
+    uint64_t failed;
+    uint64_t elapsed_usec;
+    uint64_t handler_avg_ns;
+    uint64_t handler_p50_ns;
+    uint64_t handler_p99_ns;
+    uint64_t handler_max_ns;
+    /* Worst delay behind the scaled capture timeline. */
+    uint64_t lag_max_usec;
+    bool cancelled;
+};
+
+struct k10_replay;
+
+/* Runs once from the loop when the file is exhausted, fails, or the replay is cancelled. */
+typedef void (*k10_replay_done_fn)(struct k10_replay *replay, int result, void *userdata);
+
+int k10_replay_start(sd_event *event, struct k10_gatt *gatt, int fd,
+                     const struct k10_replay_options *options, k10_replay_done_fn done,
+                     void *userdata, struct k10_replay **out);
+void k10_replay_cancel(struct k10_replay *replay);
+void k10_replay_free(struct k10_replay *replay);
+void k10_replay_get_stats(const struct k10_replay *replay, struct k10_replay_stats *out);
+int k10_replay_direction_from_string(const char *value, unsigned int *out);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef K10_BARREL_RESPONDER_H
+#define K10_BARREL_RESPONDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <systemd/sd-event.h>
+
+#include "k10_barrel/chrc_dock.h"
+#include "k10_barrel/gatt_app.h"
+
+struct k10_relay;
+struct k10_responder;
+struct k10_rules;
+
+struct k10_responder_stats {
+    uint64_t matched;
+    uint64_t replied;
+    /* Delayed replies refused because every pending slot was taken. */
+    uint64_t dropped;
+    size_t rules;
+};
+
+int k10_responder_new(sd_event *event, struct k10_gatt *gatt, struct k10_chrc_dock *dock,
+                      struct k10_responder **out);
+void k10_responder_free(struct k10_responder *responder);
+void k10_responder_set_rules(struct k10_responder *responder, struct k10_rules *rules);
+void k10_responder_set_relay(struct k10_responder *responder, struct k10_relay *relay);
+void k10_responder_get_stats(const struct k10_responder *responder,
+                             struct k10_responder_stats *out);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef K10_BARREL_RULES_H
+#define K10_BARREL_RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "k10_barrel/gatt_app.h"
+
+#define K10_RULE_NAME_MAX 48
+#define K10_RULE_MATCH_MAX 32
+/* Largest notification payload with the largest LE MTU BlueZ negotiates (247 - 3). */
+#define K10_RULE_REPLY_MAX 244
+
+/*
+ * "When a write to chrc starts with match (under mask), notify reply after
+ * delay_ms." match already has mask applied.
+ */
+struct k10_rule {
+    char name[K10_RULE_NAME_MAX];
+    enum k10_gatt_chrc chrc;
+    uint8_t length;
+    uint8_t match[K10_RULE_MATCH_MAX];
+    uint8_t mask[K10_RULE_MATCH_MAX];
+    uint16_t reply_length;
+    uint8_t reply[K10_RULE_REPLY_MAX];
+    unsigned int delay_ms;
+};
+
+struct k10_rules;
+
+int k10_rules_load(const char *path, struct k10_rules **out);
+int k10_rules_parse(const char *data, size_t size, const char *origin, struct k10_rules **out);
+int k10_rules_compile(const struct k10_rule *rules, size_t count, struct k10_rules **out);
+struct k10_rules *k10_rules_ref(struct k10_rules *rules);
+void k10_rules_free(struct k10_rules *rules);
+
+size_t k10_rules_count(const struct k10_rules *rules);
+size_t k10_rules_node_count(const struct k10_rules *rules);
+const struct k10_rule *k10_rules_match(const struct k10_rules *rules, enum k10_gatt_chrc chrc,
+                                       const uint8_t *data, size_t length);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef K10_BARREL_TOML_H
+#define K10_BARREL_TOML_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define K10_TOML_MAX_DEPTH 8
+
+enum k10_toml_type {
+    K10_TOML_STRING = 0,
+    K10_TOML_INTEGER,
+    K10_TOML_BOOL,
+    K10_TOML_ARRAY,
+    K10_TOML_TABLE,
+};
+
+/* Points into the parsed buffer; nothing is copied or NUL-terminated. */
+struct k10_toml_slice {
+    const char *start;
+    size_t length;
+};
+
+/* Table header segments followed by the dotted key, e.g. [instance.a] name -> 3 parts. */
+struct k10_toml_path {
+    struct k10_toml_slice parts[K10_TOML_MAX_DEPTH];
+    unsigned int depth;
+};
+
+/*
+ * STRING values keep the raw body between the quotes; when escaped is set
+ * the caller must run it through k10_toml_string_decode() first. index is the
+ * element position inside the enclosing array, or -1 outside arrays.
+ */
+struct k10_toml_value {
+    enum k10_toml_type type;
+    struct k10_toml_slice raw;
+    bool escaped;
+    bool multiline;
+    int64_t integer;
+    bool boolean;
+    int index;
+    unsigned int line;
+    unsigned int column;
+};
+
+/*
+ * Callbacks run in document order during the single pass. Arrays and inline
+ * tables are bracketed by begin/end with the key path they are assigned to.
+ * A negative return aborts the parse and is returned from k10_toml_parse().
+ */
+struct k10_toml_handler {
+    int (*table)(void *userdata, const struct k10_toml_path *path);
+    int (*value)(void *userdata, const struct k10_toml_path *path,
+                 const struct k10_toml_value *value);
+    int (*begin)(void *userdata, const struct k10_toml_path *path,
+                 const struct k10_toml_value *value);
+    int (*end)(void *userdata, const struct k10_toml_path *path,
+               const struct k10_toml_value *value);
+};
+
+struct k10_toml_error {
+    unsigned int line;
+    unsigned int column;
+    char message[96];
+};
+
+int k10_toml_parse(const char *data, size_t size, const struct k10_toml_handler *handler,
+                   void *userdata, struct k10_toml_error *out_error);
+int k10_toml_string_decode(const struct k10_toml_value *value, char *out, size_t out_size,
+                           size_t *out_length);
+bool k10_toml_slice_equal(struct k10_toml_slice slice, const char *text);
+
+#endif
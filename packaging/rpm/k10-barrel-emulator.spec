@@ -26,7 +26,7 @@ A minimal RPM skeleton for the SwitchBot K10 barrel emulator.
 %setup -q
 
 %build
-%cmake .
+%cmake . -DK10_LOG_MAX_LEVEL=debug
 %cmake_build
 
 %install
@@ -34,6 +34,8 @@ A minimal RPM skeleton for the SwitchBot K10 barrel emulator.
 
 install -D -m 0644 config/k10-barrel-emulator.toml \
     %{buildroot}%{_sysconfdir}/k10-barrel-emulator/config.toml
+install -D -m 0644 config/k10-barrel-emulator.rules.toml \
+    %{buildroot}%{_sysconfdir}/k10-barrel-emulator/rules.toml
 install -D -m 0644 packaging/systemd/k10-barrel-emulator.service \
     %{buildroot}%{_unitdir}/k10-barrel-emulator.service
 install -D -m 0644 packaging/dbus/ro.vilt.SwitchbotBleEmulator.conf \
@@ -42,6 +44,7 @@ install -D -m 0644 packaging/dbus/ro.vilt.SwitchbotBleEmulator.conf \
 %files
 %doc README.md docs/ARCHITECTURE.md
 %config(noreplace) %{_sysconfdir}/k10-barrel-emulator/config.toml
+%config(noreplace) %{_sysconfdir}/k10-barrel-emulator/rules.toml
 %{_bindir}/k10-barrel-emulatord
 %{_bindir}/k10-barrel-emulatorctl
 %{_unitdir}/k10-barrel-emulator.service
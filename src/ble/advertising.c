@@ -0,0 +1,522 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_ADV
+
+#include "k10_barrel/advertising.h"
+
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "k10_barrel/dbus_defs.h"
+
+/* BlueZ always prepends a 3-byte Flags structure to the advertising data. */
+#define K10_ADV_FLAGS_LENGTH 3
+/* Each AD structure costs a length byte and a type byte. */
+#define K10_ADV_HEADER_LENGTH 2
+
+struct k10_adv {
+    sd_bus *bus;
+    sd_bus_slot *vtable_slot;
+    sd_bus_slot *call_slot;
+    struct k10_adv_payload payload;
+    uint64_t generation;
+    bool built;
+    bool registered;
+    char adapter_path[64];
+    char path[K10_DBUS_OBJECT_MAX + sizeof(K10_DBUS_ADV_CHILD)];
+};
+
+static int k10_adv_hex_nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+/* Accepts "0102ab" and "01:02:AB"; the schema validator has already checked the format. */
+static int k10_adv_decode_hex(const char *hex, uint8_t *out, size_t out_size, size_t *out_length) {
+    size_t used = 0;
+
+    while (*hex != '\0') {
+        int high = 0;
+        int low = 0;
+
+        if (*hex == ':') {
+            hex++;
+            continue;
+        }
+
+        high = k10_adv_hex_nibble(hex[0]);
+        low = high < 0 ? -1 : k10_adv_hex_nibble(hex[1]);
+        if (low < 0) {
+            return -EINVAL;
+        }
+
+        if (used == out_size) {
+            return -EMSGSIZE;
+        }
+
+        out[used++] = (uint8_t)((high << 4) | low);
+        hex += 2;
+    }
+
+    *out_length = used;
+    return 0;
+}
+
+int k10_adv_payload_build(const struct k10_config *config, struct k10_adv_payload *out) {
+    size_t uuid32 = 0;
+    size_t uuid128 = 0;
+    size_t name_length = 0;
+    int r = 0;
+
+    memset(out, 0, sizeof(*out));
+
+    out->company_id = (uint16_t)config->company_id;
+    r = k10_adv_decode_hex(config->manufacturer_mac_label, out->manufacturer_data,
+                           sizeof(out->manufacturer_data), &out->manufacturer_data_length);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_adv_decode_hex(config->fd3d_service_data_hex, out->service_data,
+                           sizeof(out->service_data), &out->service_data_length);
+    if (r < 0) {
+        return r;
+    }
+    out->has_service_data = out->service_data_length > 0;
+
+    for (unsigned int i = 0; i < config->service_uuid_count; i++) {
+        const char *uuid = config->service_uuids[i];
+        size_t length = strlen(uuid);
+
+        /* The config field is wider than any UUID; schema validation keeps it to 36. */
+        if (length >= sizeof(out->scan_uuids[0])) {
+            return -EINVAL;
+        }
+
+        if (length == 4) {
+            memcpy(out->adv_uuids[out->adv_uuid_count++], uuid, length + 1);
+            continue;
+        }
+
+        if (length == 8) {
+            uuid32++;
+        } else {
+            uuid128++;
+        }
+
+        memcpy(out->scan_uuids[out->scan_uuid_count++], uuid, length + 1);
+    }
+
+    out->include_tx_power = config->include_tx_power;
+    snprintf(out->local_name, sizeof(out->local_name), "%s", config->local_name);
+    name_length = strlen(out->local_name);
+
+    out->adv_length = K10_ADV_FLAGS_LENGTH;
+    out->adv_length += K10_ADV_HEADER_LENGTH + 2 + out->manufacturer_data_length;
+    if (out->has_service_data) {
+        out->adv_length += K10_ADV_HEADER_LENGTH + 2 + out->service_data_length;
+    }
+    if (out->adv_uuid_count > 0) {
+        out->adv_length += K10_ADV_HEADER_LENGTH + 2 * out->adv_uuid_count;
+    }
+    if (out->include_tx_power) {
+        out->adv_length += K10_ADV_HEADER_LENGTH + 1;
+    }
+
+    if (uuid32 > 0) {
+        out->scan_length += K10_ADV_HEADER_LENGTH + 4 * uuid32;
+    }
+    if (uuid128 > 0) {
+        out->scan_length += K10_ADV_HEADER_LENGTH + 16 * uuid128;
+    }
+    if (name_length > 0) {
+        out->scan_length += K10_ADV_HEADER_LENGTH + name_length;
+    }
+
+    if (out->adv_length > K10_ADV_LEGACY_MAX || out->scan_length > K10_ADV_LEGACY_MAX) {
+        return -EMSGSIZE;
+    }
+
+    return 0;
+}
+
+static int k10_adv_append_uuids(sd_bus_message *reply, char (*uuids)[37], unsigned int count) {
+    int r = 0;
+
+    r = sd_bus_message_open_container(reply, 'a', "s");
+    if (r < 0) {
+        return r;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        r = sd_bus_message_append_basic(reply, 's', uuids[i]);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return sd_bus_message_close_container(reply);
+}
+
+static int k10_adv_property_type(sd_bus *bus, const char *path, const char *interface,
+                                 const char *property, sd_bus_message *reply, void *userdata,
+                                 sd_bus_error *ret_error) {
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)userdata;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "s", "peripheral");
+}
+
+static int k10_adv_property_service_uuids(sd_bus *bus, const char *path, const char *interface,
+                                          const char *property, sd_bus_message *reply,
+                                          void *userdata, sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return k10_adv_append_uuids(reply, adv->payload.adv_uuids, adv->payload.adv_uuid_count);
+}
+
+static int k10_adv_property_scan_uuids(sd_bus *bus, const char *path, const char *interface,
+                                       const char *property, sd_bus_message *reply,
+                                       void *userdata, sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return k10_adv_append_uuids(reply, adv->payload.scan_uuids, adv->payload.scan_uuid_count);
+}
+
+static int k10_adv_property_manufacturer_data(sd_bus *bus, const char *path,
+                                              const char *interface, const char *property,
+                                              sd_bus_message *reply, void *userdata,
+                                              sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+    int r = 0;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    r = sd_bus_message_open_container(reply, 'a', "{qv}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'e', "qv");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(reply, "q", adv->payload.company_id);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'v', "ay");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append_array(reply, 'y', adv->payload.manufacturer_data,
+                                    adv->payload.manufacturer_data_length);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_close_container(reply);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_close_container(reply);
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_close_container(reply);
+}
+
+static int k10_adv_property_service_data(sd_bus *bus, const char *path, const char *interface,
+                                         const char *property, sd_bus_message *reply,
+                                         void *userdata, sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+    int r = 0;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    r = sd_bus_message_open_container(reply, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    if (adv->payload.has_service_data) {
+        r = sd_bus_message_open_container(reply, 'e', "sv");
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_append(reply, "s", K10_ADV_FD3D_UUID);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_open_container(reply, 'v', "ay");
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_append_array(reply, 'y', adv->payload.service_data,
+                                        adv->payload.service_data_length);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return sd_bus_message_close_container(reply);
+}
+
+static int k10_adv_property_includes(sd_bus *bus, const char *path, const char *interface,
+                                     const char *property, sd_bus_message *reply, void *userdata,
+                                     sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+    int r = 0;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    r = sd_bus_message_open_container(reply, 'a', "s");
+    if (r < 0) {
+        return r;
+    }
+
+    if (adv->payload.include_tx_power) {
+        r = sd_bus_message_append(reply, "s", "tx-power");
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return sd_bus_message_close_container(reply);
+}
+
+static int k10_adv_property_local_name(sd_bus *bus, const char *path, const char *interface,
+                                       const char *property, sd_bus_message *reply,
+                                       void *userdata, sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "s", adv->payload.local_name);
+}
+
+static int k10_adv_method_release(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+
+    (void)ret_error;
+
+    adv->registered = false;
+    k10_log_info("advertisement released by bluez");
+    return sd_bus_reply_method_return(m, "");
+}
+
+/*
+ * Getters only copy bytes decoded by k10_adv_update(); nothing is parsed
+ * when BlueZ reads the properties at registration time.
+ */
+static const sd_bus_vtable k10_adv_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Release", "", "", k10_adv_method_release, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_PROPERTY("Type", "s", k10_adv_property_type, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("ServiceUUIDs", "as", k10_adv_property_service_uuids, 0, 0),
+    SD_BUS_PROPERTY("ScanResponseServiceUUIDs", "as", k10_adv_property_scan_uuids, 0, 0),
+    SD_BUS_PROPERTY("ManufacturerData", "a{qv}", k10_adv_property_manufacturer_data, 0, 0),
+    SD_BUS_PROPERTY("ServiceData", "a{sv}", k10_adv_property_service_data, 0, 0),
+    SD_BUS_PROPERTY("Includes", "as", k10_adv_property_includes, 0, 0),
+    SD_BUS_PROPERTY("LocalName", "s", k10_adv_property_local_name, 0, 0),
+    SD_BUS_VTABLE_END};
+
+/* The advertisement is exported below the owning instance's object. */
+int k10_adv_new(sd_bus *bus, const char *instance_path, struct k10_adv **out) {
+    struct k10_adv *adv = NULL;
+    int r = 0;
+
+    if (bus == NULL || instance_path == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    adv = calloc(1, sizeof(*adv));
+    if (adv == NULL) {
+        return -ENOMEM;
+    }
+
+    adv->bus = sd_bus_ref(bus);
+    snprintf(adv->path, sizeof(adv->path), "%s" K10_DBUS_ADV_CHILD, instance_path);
+
+    r = sd_bus_add_object_vtable(bus, &adv->vtable_slot, adv->path,
+                                 K10_BLUEZ_IFACE_ADVERTISEMENT, k10_adv_vtable, adv);
+    if (r < 0) {
+        k10_adv_free(adv);
+        return r;
+    }
+
+    *out = adv;
+    return 0;
+}
+
+void k10_adv_free(struct k10_adv *adv) {
+    if (adv == NULL) {
+        return;
+    }
+
+    k10_adv_unregister(adv);
+    sd_bus_slot_unref(adv->vtable_slot);
+    sd_bus_unref(adv->bus);
+    free(adv);
+}
+
+/* Returns 1 when the cached payload was rebuilt, 0 when the generation was already current. */
+int k10_adv_update(struct k10_adv *adv, const struct k10_config *config, uint64_t generation) {
+    struct k10_adv_payload payload;
+    int r = 0;
+
+    if (adv->built && adv->generation == generation) {
+        return 0;
+    }
+
+    r = k10_adv_payload_build(config, &payload);
+    if (r == -EMSGSIZE) {
+        k10_log_error("advertising payload too large: data %zu/%d, scan response %zu/%d bytes",
+                      payload.adv_length, K10_ADV_LEGACY_MAX, payload.scan_length,
+                      K10_ADV_LEGACY_MAX);
+        return r;
+    }
+    if (r < 0) {
+        k10_log_error("advertising payload invalid: %s", strerror(-r));
+        return r;
+    }
+
+    adv->payload = payload;
+    adv->generation = generation;
+    adv->built = true;
+    return 1;
+}
+
+static int k10_adv_on_registered(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_adv *adv = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+
+    (void)ret_error;
+
+    adv->call_slot = sd_bus_slot_unref(adv->call_slot);
+
+    if (error != NULL) {
+        k10_log_error("advertisement register on %s failed: %s", adv->adapter_path,
+                      error->message != NULL ? error->message : error->name);
+        return 0;
+    }
+
+    adv->registered = true;
+    k10_log_info("advertisement registered on %s", adv->adapter_path);
+    return 0;
+}
+
+/* (Re-)registers the cached payload; BlueZ only reads the properties at registration. */
+int k10_adv_register(struct k10_adv *adv, const char *adapter) {
+    int r = 0;
+
+    if (!adv->built) {
+        return -ENODATA;
+    }
+
+    k10_adv_unregister(adv);
+    snprintf(adv->adapter_path, sizeof(adv->adapter_path), K10_BLUEZ_PATH_PREFIX "%s", adapter);
+
+    r = sd_bus_call_method_async(adv->bus, &adv->call_slot, K10_BLUEZ_SERVICE, adv->adapter_path,
+                                 K10_BLUEZ_IFACE_ADV_MANAGER, "RegisterAdvertisement",
+                                 k10_adv_on_registered, adv, "oa{sv}", adv->path, 0);
+    if (r < 0) {
+        k10_log_error("advertisement register call failed: %s", strerror(-r));
+    }
+
+    return r;
+}
+
+/*
+ * A registration still in flight is withdrawn as well: BlueZ tracks the
+ * advertisement from the moment it sees RegisterAdvertisement, and our calls
+ * reach it in order, so the Unregister lands after it and fails it.
+ */
+int k10_adv_unregister(struct k10_adv *adv) {
+    bool pending = adv->call_slot != NULL;
+    int r = 0;
+
+    /* The reply no longer matters; its outcome is overridden below. */
+    adv->call_slot = sd_bus_slot_unref(adv->call_slot);
+
+    if (!adv->registered && !pending) {
+        return 0;
+    }
+
+    adv->registered = false;
+    r = sd_bus_call_method_async(adv->bus, NULL, K10_BLUEZ_SERVICE, adv->adapter_path,
+                                 K10_BLUEZ_IFACE_ADV_MANAGER, "UnregisterAdvertisement", NULL,
+                                 NULL, "o", adv->path);
+    if (r < 0) {
+        k10_log_error("advertisement unregister failed: %s", strerror(-r));
+    }
+
+    return r;
+}
+
+const struct k10_adv_payload *k10_adv_payload(const struct k10_adv *adv) {
+    return adv->built ? &adv->payload : NULL;
+}
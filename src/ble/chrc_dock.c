@@ -0,0 +1,274 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_GATT_DOCK
+
+#include "k10_barrel/chrc_dock.h"
+
+#include "k10_barrel/dock_frame.h"
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define K10_CHRC_DOCK_FLUSH_BATCH 16
+
+enum k10_chrc_dock_policy {
+    K10_CHRC_DOCK_DROP_NEWEST = 0,
+    K10_CHRC_DOCK_DROP_OLDEST,
+    K10_CHRC_DOCK_BLOCK,
+};
+
+struct k10_chrc_dock_entry {
+    uint16_t length;
+    uint8_t data[K10_GATT_VALUE_MAX];
+};
+
+/*
+ * CBA20003 notifications waiting for BlueZ to take them. The ring is
+ * allocated once per configured depth, so an app that floods commands costs
+ * drops (or, with the block policy, a paused CBA20002 socket) rather than
+ * memory.
+ */
+struct k10_chrc_dock {
+    struct k10_gatt *gatt;
+    enum k10_chrc_dock_policy policy;
+    struct k10_chrc_dock_entry *ring;
+    unsigned int depth;
+    unsigned int head;
+    unsigned int length;
+    bool paused;
+    struct k10_dock_codec codec;
+    struct k10_chrc_dock_stats stats;
+};
+
+static enum k10_chrc_dock_policy k10_chrc_dock_policy_parse(const char *name) {
+    if (strcmp(name, K10_NOTIFY_POLICY_DROP_NEWEST) == 0) {
+        return K10_CHRC_DOCK_DROP_NEWEST;
+    }
+
+    if (strcmp(name, K10_NOTIFY_POLICY_BLOCK) == 0) {
+        return K10_CHRC_DOCK_BLOCK;
+    }
+
+    return K10_CHRC_DOCK_DROP_OLDEST;
+}
+
+static void k10_chrc_dock_pop(struct k10_chrc_dock *dock, unsigned int count) {
+    dock->head = (dock->head + count) % dock->depth;
+    dock->length -= count;
+}
+
+static void k10_chrc_dock_pause(struct k10_chrc_dock *dock, bool paused) {
+    if (dock->paused == paused) {
+        return;
+    }
+
+    dock->paused = paused;
+    if (paused) {
+        dock->stats.stalls++;
+    }
+    k10_log_debug("dock writes %s, %u of %u queued", paused ? "paused" : "resumed", dock->length,
+                  dock->depth);
+
+    k10_gatt_pause_writes(dock->gatt, K10_GATT_CHRC_DOCK_WRITE, paused);
+}
+
+static void k10_chrc_dock_flush(struct k10_chrc_dock *dock) {
+    struct iovec frames[K10_CHRC_DOCK_FLUSH_BATCH];
+    int sent = 0;
+
+    while (dock->length > 0) {
+        unsigned int count = dock->length;
+
+        if (count > K10_CHRC_DOCK_FLUSH_BATCH) {
+            count = K10_CHRC_DOCK_FLUSH_BATCH;
+        }
+
+        for (unsigned int i = 0; i < count; i++) {
+            struct k10_chrc_dock_entry *entry = &dock->ring[(dock->head + i) % dock->depth];
+
+            frames[i].iov_base = entry->data;
+            frames[i].iov_len = entry->length;
+        }
+
+        sent = k10_gatt_notify_batch(dock->gatt, K10_GATT_CHRC_DOCK_NOTIFY, frames, count);
+        if (sent == -EAGAIN) {
+            break;
+        }
+
+        /* Nobody is subscribed any more; what is queued was meant for them. */
+        if (sent == -ENOTCONN) {
+            dock->stats.dropped += dock->length;
+            dock->head = 0;
+            dock->length = 0;
+            break;
+        }
+
+        if (sent < 0) {
+            k10_log_error("dock notify failed: %s", strerror(-sent));
+            k10_chrc_dock_pop(dock, 1);
+            dock->stats.dropped++;
+            continue;
+        }
+
+        k10_chrc_dock_pop(dock, (unsigned int)sent);
+        dock->stats.sent += (uint64_t)sent;
+    }
+
+    if (dock->paused &&
+        (dock->policy != K10_CHRC_DOCK_BLOCK || dock->length <= dock->depth / 2)) {
+        k10_chrc_dock_pause(dock, false);
+    }
+}
+
+static void k10_chrc_dock_on_ready(enum k10_gatt_chrc chrc, void *userdata) {
+    if (chrc == K10_GATT_CHRC_DOCK_NOTIFY) {
+        k10_chrc_dock_flush(userdata);
+    }
+}
+
+/* Answers an app frame written to CBA20002 from a prebuilt response template. */
+void k10_chrc_dock_write(struct k10_chrc_dock *dock, const uint8_t *data, size_t length) {
+    const struct k10_dock_response *response = NULL;
+    struct k10_dock_frame frame;
+    int r = 0;
+
+    r = k10_dock_frame_parse(data, length, &frame);
+    if (r < 0) {
+        dock->stats.rejected++;
+        k10_log_debug("dock frame rejected, %zu bytes", length);
+        return;
+    }
+
+    dock->stats.frames++;
+    response = k10_dock_codec_answer(&dock->codec, &frame);
+    k10_log_trace("dock %s (0x%02x) answered with status 0x%02x", k10_dock_frame_name(&frame),
+                  frame.command, response->data[0]);
+
+    r = k10_chrc_dock_notify(dock, response->data, response->length);
+    if (r < 0) {
+        k10_log_debug("dock %s response not queued: %s", k10_dock_frame_name(&frame),
+                      strerror(-r));
+    }
+}
+
+/* Queues a CBA20003 notification and sends whatever the socket takes right away. */
+int k10_chrc_dock_notify(struct k10_chrc_dock *dock, const uint8_t *frame, size_t length) {
+    struct k10_chrc_dock_entry *entry = NULL;
+
+    if (length > k10_gatt_notify_limit(dock->gatt, K10_GATT_CHRC_DOCK_NOTIFY)) {
+        return -EMSGSIZE;
+    }
+
+    if (dock->length == dock->depth) {
+        switch (dock->policy) {
+        case K10_CHRC_DOCK_DROP_OLDEST:
+            k10_chrc_dock_pop(dock, 1);
+            dock->stats.dropped++;
+            break;
+        case K10_CHRC_DOCK_BLOCK:
+            dock->stats.dropped++;
+            return -EAGAIN;
+        default:
+            dock->stats.dropped++;
+            return -ENOBUFS;
+        }
+    }
+
+    entry = &dock->ring[(dock->head + dock->length) % dock->depth];
+    memcpy(entry->data, frame, length);
+    entry->length = (uint16_t)length;
+    dock->length++;
+    dock->stats.queued++;
+    if (dock->length > dock->stats.high_water) {
+        dock->stats.high_water = dock->length;
+    }
+
+    k10_chrc_dock_flush(dock);
+
+    if (dock->policy == K10_CHRC_DOCK_BLOCK && dock->length == dock->depth) {
+        k10_chrc_dock_pause(dock, true);
+    }
+
+    return 0;
+}
+
+/* Applies notify_queue_depth/notify_queue_policy; a smaller ring keeps the newest entries. */
+int k10_chrc_dock_configure(struct k10_chrc_dock *dock, const struct k10_config *config) {
+    struct k10_chrc_dock_entry *ring = NULL;
+    unsigned int depth = config->notify_queue_depth > 0 ? config->notify_queue_depth : 1;
+    unsigned int keep = 0;
+
+    dock->policy = k10_chrc_dock_policy_parse(config->notify_queue_policy);
+    k10_dock_codec_configure(&dock->codec, config);
+
+    if (depth != dock->depth) {
+        ring = calloc(depth, sizeof(*ring));
+        if (ring == NULL) {
+            return -ENOMEM;
+        }
+
+        keep = dock->length < depth ? dock->length : depth;
+        if (dock->length > keep) {
+            dock->stats.dropped += dock->length - keep;
+            k10_chrc_dock_pop(dock, dock->length - keep);
+        }
+
+        for (unsigned int i = 0; i < keep; i++) {
+            ring[i] = dock->ring[(dock->head + i) % dock->depth];
+        }
+
+        free(dock->ring);
+        dock->ring = ring;
+        dock->depth = depth;
+        dock->head = 0;
+        dock->length = keep;
+    }
+
+    k10_chrc_dock_flush(dock);
+    return 0;
+}
+
+int k10_chrc_dock_new(struct k10_gatt *gatt, const struct k10_config *config,
+                      struct k10_chrc_dock **out) {
+    struct k10_chrc_dock *dock = NULL;
+    int r = 0;
+
+    if (gatt == NULL || config == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    dock = calloc(1, sizeof(*dock));
+    if (dock == NULL) {
+        return -ENOMEM;
+    }
+
+    dock->gatt = gatt;
+    k10_dock_codec_init(&dock->codec, config);
+
+    r = k10_chrc_dock_configure(dock, config);
+    if (r < 0) {
+        free(dock);
+        return r;
+    }
+
+    k10_gatt_set_ready_handler(gatt, k10_chrc_dock_on_ready, dock);
+    *out = dock;
+    return 0;
+}
+
+void k10_chrc_dock_free(struct k10_chrc_dock *dock) {
+    if (dock == NULL) {
+        return;
+    }
+
+    k10_gatt_set_ready_handler(dock->gatt, NULL, NULL);
+    free(dock->ring);
+    free(dock);
+}
+
+void k10_chrc_dock_get_stats(const struct k10_chrc_dock *dock, struct k10_chrc_dock_stats *out) {
+    *out = dock->stats;
+    out->length = dock->length;
+    out->depth = dock->depth;
+}
@@ -0,0 +1,149 @@
+#include "k10_barrel/dock_frame.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* Byte offsets patched in place when the config changes. */
+#define K10_DOCK_INFO_FW_MAJOR 2
+#define K10_DOCK_INFO_FW_MINOR 3
+
+typedef const struct k10_dock_response *(*k10_dock_handler_fn)(
+    const struct k10_dock_codec *codec, const struct k10_dock_frame *frame);
+
+struct k10_dock_opcode {
+    const char *name;
+    /* Payload bytes after the command byte (and sub-command) the handler relies on. */
+    uint8_t min_payload;
+    k10_dock_handler_fn handler;
+};
+
+static const struct k10_dock_response *k10_dock_reply_ack(const struct k10_dock_codec *codec,
+                                                          const struct k10_dock_frame *frame) {
+    (void)frame;
+    return &codec->templates[K10_DOCK_TEMPLATE_ACK];
+}
+
+static const struct k10_dock_response *k10_dock_reply_info(const struct k10_dock_codec *codec,
+                                                           const struct k10_dock_frame *frame) {
+    (void)frame;
+    return &codec->templates[K10_DOCK_TEMPLATE_INFO];
+}
+
+static const struct k10_dock_response *k10_dock_reply_state(const struct k10_dock_codec *codec,
+                                                            const struct k10_dock_frame *frame) {
+    (void)frame;
+    return &codec->templates[K10_DOCK_TEMPLATE_STATE];
+}
+
+static const struct k10_dock_response *k10_dock_reply_extended(const struct k10_dock_codec *codec,
+                                                               const struct k10_dock_frame *frame);
+
+/* Indexed by command byte; unlisted commands get the unsupported response. */
+static const struct k10_dock_opcode k10_dock_commands[256] = {
+    [K10_DOCK_CMD_ACTION] = {"action", 0, k10_dock_reply_ack},
+    [K10_DOCK_CMD_GET_INFO] = {"get-info", 0, k10_dock_reply_info},
+    [K10_DOCK_CMD_SET_TIME] = {"set-time", 4, k10_dock_reply_ack},
+    [K10_DOCK_CMD_EXTENDED] = {"extended", 1, k10_dock_reply_extended},
+};
+
+/* Indexed by sub-command of K10_DOCK_CMD_EXTENDED. */
+static const struct k10_dock_opcode k10_dock_extended[256] = {
+    [K10_DOCK_EXT_GET_STATE] = {"get-state", 0, k10_dock_reply_state},
+    [K10_DOCK_EXT_SET_MODE] = {"set-mode", 1, k10_dock_reply_ack},
+};
+
+static const struct k10_dock_response *k10_dock_dispatch(const struct k10_dock_codec *codec,
+                                                         const struct k10_dock_opcode *opcode,
+                                                         const struct k10_dock_frame *frame,
+                                                         size_t payload_length) {
+    if (opcode->handler == NULL) {
+        return &codec->templates[K10_DOCK_TEMPLATE_UNSUPPORTED];
+    }
+
+    if (payload_length < opcode->min_payload) {
+        return &codec->templates[K10_DOCK_TEMPLATE_ERROR];
+    }
+
+    return opcode->handler(codec, frame);
+}
+
+static const struct k10_dock_response *k10_dock_reply_extended(const struct k10_dock_codec *codec,
+                                                               const struct k10_dock_frame *frame) {
+    return k10_dock_dispatch(codec, &k10_dock_extended[frame->subcommand], frame,
+                             frame->payload_length - 1);
+}
+
+/* Fills out with views into data; nothing is copied. */
+int k10_dock_frame_parse(const uint8_t *data, size_t length, struct k10_dock_frame *out) {
+    if (data == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    if (length < 2 || data[0] != K10_DOCK_FRAME_MAGIC) {
+        return -EBADMSG;
+    }
+
+    out->command = data[1];
+    out->payload = data + 2;
+    out->payload_length = length - 2;
+    out->subcommand = 0;
+    if (out->command == K10_DOCK_CMD_EXTENDED && out->payload_length > 0) {
+        out->subcommand = out->payload[0];
+    }
+
+    return 0;
+}
+
+const char *k10_dock_frame_name(const struct k10_dock_frame *frame) {
+    const struct k10_dock_opcode *opcode = &k10_dock_commands[frame->command];
+
+    if (frame->command == K10_DOCK_CMD_EXTENDED && frame->payload_length > 0 &&
+        k10_dock_extended[frame->subcommand].name != NULL) {
+        opcode = &k10_dock_extended[frame->subcommand];
+    }
+
+    return opcode->name != NULL ? opcode->name : "unknown";
+}
+
+static void k10_dock_template_set(struct k10_dock_codec *codec, enum k10_dock_template id,
+                                  const uint8_t *data, size_t length) {
+    struct k10_dock_response *response = &codec->templates[id];
+
+    memcpy(response->data, data, length);
+    response->length = (uint8_t)length;
+}
+
+/* Encodes every response once; k10_dock_codec_configure() only patches bytes after that. */
+void k10_dock_codec_init(struct k10_dock_codec *codec, const struct k10_config *config) {
+    static const uint8_t ack[] = {K10_DOCK_STATUS_OK};
+    static const uint8_t error[] = {K10_DOCK_STATUS_ERROR};
+    static const uint8_t unsupported[] = {K10_DOCK_STATUS_UNSUPPORTED};
+    /* status, battery %, fw major, fw minor, docked */
+    static const uint8_t info[] = {K10_DOCK_STATUS_OK, 100, 0, 0, 1};
+    /* status, state (idle), dust bag %, error code */
+    static const uint8_t state[] = {K10_DOCK_STATUS_OK, 0, 0, 0};
+
+    memset(codec, 0, sizeof(*codec));
+    k10_dock_template_set(codec, K10_DOCK_TEMPLATE_ACK, ack, sizeof(ack));
+    k10_dock_template_set(codec, K10_DOCK_TEMPLATE_ERROR, error, sizeof(error));
+    k10_dock_template_set(codec, K10_DOCK_TEMPLATE_UNSUPPORTED, unsupported,
+                          sizeof(unsupported));
+    k10_dock_template_set(codec, K10_DOCK_TEMPLATE_INFO, info, sizeof(info));
+    k10_dock_template_set(codec, K10_DOCK_TEMPLATE_STATE, state, sizeof(state));
+
+    k10_dock_codec_configure(codec, config);
+}
+
+void k10_dock_codec_configure(struct k10_dock_codec *codec, const struct k10_config *config) {
+    struct k10_dock_response *info = &codec->templates[K10_DOCK_TEMPLATE_INFO];
+
+    info->data[K10_DOCK_INFO_FW_MAJOR] = (uint8_t)config->fw_major;
+    info->data[K10_DOCK_INFO_FW_MINOR] = (uint8_t)config->fw_minor;
+}
+
+/* The returned response belongs to the codec and stays valid until the next configure. */
+const struct k10_dock_response *k10_dock_codec_answer(const struct k10_dock_codec *codec,
+                                                      const struct k10_dock_frame *frame) {
+    return k10_dock_dispatch(codec, &k10_dock_commands[frame->command], frame,
+                             frame->payload_length);
+}
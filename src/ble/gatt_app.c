@@ -0,0 +1,1374 @@
+/* recvmmsg() */
+#define _GNU_SOURCE
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_GATT
+
+#include "k10_barrel/gatt_app.h"
+
+#include "k10_barrel/capture.h"
+#include "k10_barrel/event.h"
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "k10_barrel/dbus_defs.h"
+
+#define K10_GATT_UUID_BASE "-0000-1000-8000-00805f9b34fb"
+#define K10_GATT_UUID16(uuid) "0000" uuid K10_GATT_UUID_BASE
+
+#define K10_GATT_OBJECT_MAX 16
+#define K10_GATT_LOG_BYTES 64
+#define K10_GATT_RECV_BATCH 16
+#define K10_GATT_SEND_BATCH 16
+/* Opcode and handle in front of every notification. */
+#define K10_GATT_NOTIFY_HEADER 3
+/* ATT_MTU before any exchange; used when BlueZ does not pass one. */
+#define K10_GATT_DEFAULT_MTU 23
+
+#define K10_BLUEZ_ERROR_NOT_PERMITTED "org.bluez.Error.NotPermitted"
+#define K10_BLUEZ_ERROR_NOT_SUPPORTED "org.bluez.Error.NotSupported"
+#define K10_BLUEZ_ERROR_INVALID_OFFSET "org.bluez.Error.InvalidOffset"
+#define K10_BLUEZ_ERROR_INVALID_LENGTH "org.bluez.Error.InvalidValueLength"
+
+enum k10_gatt_source {
+    K10_GATT_SOURCE_NONE = 0,
+    K10_GATT_SOURCE_FIRMWARE,
+};
+
+struct k10_gatt_chrc_def {
+    enum k10_gatt_chrc id;
+    const char *uuid;
+    const char *const *flags;
+    enum k10_gatt_source source;
+    /* Offers AcquireWrite/AcquireNotify so BlueZ can move values over a socket. */
+    bool acquire;
+};
+
+struct k10_gatt_service_def {
+    const char *uuid;
+    /* Exported even when the UUID is not listed in service_uuids. */
+    bool always;
+    const struct k10_gatt_chrc_def *chrcs;
+    size_t chrc_count;
+    enum k10_log_subsystem log_subsystem;
+};
+
+static const char *const k10_gatt_flags_dock_write[] = {"write-without-response", "write", NULL};
+static const char *const k10_gatt_flags_dock_notify[] = {"notify", NULL};
+static const char *const k10_gatt_flags_sweeper[] = {"read", "write-without-response", "write",
+                                                     "notify", NULL};
+static const char *const k10_gatt_flags_read[] = {"read", NULL};
+
+static const struct k10_gatt_chrc_def k10_gatt_dock_chrcs[] = {
+    {K10_GATT_CHRC_DOCK_WRITE, "cba20002-224d-11e6-9fb8-0002a5d5c51b", k10_gatt_flags_dock_write,
+     K10_GATT_SOURCE_NONE, true},
+    {K10_GATT_CHRC_DOCK_NOTIFY, "cba20003-224d-11e6-9fb8-0002a5d5c51b",
+     k10_gatt_flags_dock_notify, K10_GATT_SOURCE_NONE, true},
+};
+
+/* Placeholders until the robot<->dock frames are understood; writes are kept and read back. */
+static const struct k10_gatt_chrc_def k10_gatt_sweeper_chrcs[] = {
+    {K10_GATT_CHRC_SWEEPER_B001, K10_GATT_UUID16("b001"), k10_gatt_flags_sweeper,
+     K10_GATT_SOURCE_NONE, false},
+    {K10_GATT_CHRC_SWEEPER_B002, K10_GATT_UUID16("b002"), k10_gatt_flags_sweeper,
+     K10_GATT_SOURCE_NONE, false},
+    {K10_GATT_CHRC_SWEEPER_B003, K10_GATT_UUID16("b003"), k10_gatt_flags_sweeper,
+     K10_GATT_SOURCE_NONE, false},
+    {K10_GATT_CHRC_SWEEPER_B004, K10_GATT_UUID16("b004"), k10_gatt_flags_sweeper,
+     K10_GATT_SOURCE_NONE, false},
+};
+
+static const struct k10_gatt_chrc_def k10_gatt_device_info_chrcs[] = {
+    {K10_GATT_CHRC_FIRMWARE, K10_GATT_UUID16("2a26"), k10_gatt_flags_read,
+     K10_GATT_SOURCE_FIRMWARE, false},
+};
+
+static const struct k10_gatt_service_def k10_gatt_services[] = {
+    {"cba20d00-224d-11e6-9fb8-0002a5d5c51b", false, k10_gatt_dock_chrcs,
+     sizeof(k10_gatt_dock_chrcs) / sizeof(k10_gatt_dock_chrcs[0]), K10_LOG_SUBSYSTEM_GATT_DOCK},
+    {K10_GATT_UUID16("b000"), false, k10_gatt_sweeper_chrcs,
+     sizeof(k10_gatt_sweeper_chrcs) / sizeof(k10_gatt_sweeper_chrcs[0]),
+     K10_LOG_SUBSYSTEM_GATT_SWEEPER},
+    {K10_GATT_UUID16("180a"), true, k10_gatt_device_info_chrcs,
+     sizeof(k10_gatt_device_info_chrcs) / sizeof(k10_gatt_device_info_chrcs[0]),
+     K10_LOG_SUBSYSTEM_GATT},
+};
+
+#define K10_GATT_SERVICE_COUNT (sizeof(k10_gatt_services) / sizeof(k10_gatt_services[0]))
+
+/* Our end of a socketpair handed to BlueZ by AcquireWrite/AcquireNotify. */
+struct k10_gatt_link {
+    struct k10_gatt_object *object;
+    sd_event_source *source;
+    int fd;
+    uint16_t mtu;
+    char device[64];
+};
+
+/*
+ * One exported service or characteristic. Everything BlueZ asks for (paths,
+ * UUIDs, flags, static values) is filled in by k10_gatt_new() and
+ * k10_gatt_update(), so GetManagedObjects and ReadValue only copy it out.
+ */
+struct k10_gatt_object {
+    struct k10_gatt *gatt;
+    sd_bus_slot *slot;
+    /* The application path plus "/serviceN/charN". */
+    char path[K10_DBUS_OBJECT_MAX + 48];
+    const char *uuid;
+    /* Set for a service, NULL for a characteristic. */
+    const struct k10_gatt_service_def *def;
+    /* NULL for a service. */
+    const char *const *flags;
+    enum k10_gatt_source source;
+    enum k10_gatt_chrc id;
+    size_t service;
+    enum k10_log_subsystem log_subsystem;
+    /* Made-up ATT handle (declaration for a service, value for a characteristic) for captures. */
+    uint16_t handle;
+    bool enabled;
+    bool acquire;
+    bool readable;
+    bool writable;
+    bool notifiable;
+    bool notifying;
+    bool writes_paused;
+    uint8_t value[K10_GATT_VALUE_MAX];
+    size_t value_length;
+    struct k10_gatt_link write_link;
+    struct k10_gatt_link notify_link;
+};
+
+struct k10_gatt {
+    sd_bus *bus;
+    sd_event *event;
+    sd_bus_slot *app_slot;
+    sd_bus_slot *call_slot;
+    struct k10_gatt_object objects[K10_GATT_OBJECT_MAX];
+    size_t object_count;
+    struct k10_gatt_object *chrcs[K10_GATT_CHRC_COUNT];
+    k10_gatt_write_fn write_handler;
+    void *write_userdata;
+    k10_gatt_ready_fn ready_handler;
+    void *ready_userdata;
+    struct k10_capture *capture;
+    uint8_t recv_buffers[K10_GATT_RECV_BATCH][K10_GATT_VALUE_MAX];
+    uint64_t generation;
+    bool built;
+    bool registered;
+    char adapter_path[64];
+    /* The application object; services and characteristics hang below it. */
+    char path[K10_DBUS_OBJECT_MAX];
+};
+
+struct k10_gatt_request {
+    uint16_t offset;
+    uint16_t mtu;
+    const char *device;
+    /* Write without response. */
+    bool command;
+};
+
+static bool k10_gatt_has_flag(const char *const *flags, const char *flag) {
+    for (; *flags != NULL; flags++) {
+        if (strcmp(*flags, flag) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool k10_gatt_listed(const struct k10_config *config, const char *uuid) {
+    char full[sizeof("00000000" K10_GATT_UUID_BASE)];
+
+    for (unsigned int i = 0; i < config->service_uuid_count; i++) {
+        const char *listed = config->service_uuids[i];
+        size_t length = strlen(listed);
+
+        /* Short forms expand onto the Bluetooth base UUID; anything else is compared as is. */
+        if (length == 4) {
+            snprintf(full, sizeof(full), "0000%.4s" K10_GATT_UUID_BASE, listed);
+            listed = full;
+        } else if (length == 8) {
+            snprintf(full, sizeof(full), "%.8s" K10_GATT_UUID_BASE, listed);
+            listed = full;
+        }
+
+        if (strcasecmp(listed, uuid) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void k10_gatt_format_hex(const uint8_t *data, size_t length, char *out, size_t size) {
+    size_t shown = length < K10_GATT_LOG_BYTES ? length : K10_GATT_LOG_BYTES;
+    size_t used = 0;
+
+    out[0] = '\0';
+    for (size_t i = 0; i < shown && used + 3 < size; i++) {
+        used += (size_t)snprintf(out + used, size - used, "%02x", data[i]);
+    }
+
+    if (shown < length && used + 4 < size) {
+        snprintf(out + used, size - used, "...");
+    }
+}
+
+/* Per-packet trace; the hex dump is only built when trace is on for the object's subsystem. */
+static void k10_gatt_trace(const struct k10_gatt_object *object, const char *what,
+                           const char *device, const uint8_t *data, size_t length) {
+    char hex[2 * K10_GATT_LOG_BYTES + 4];
+
+    if (!K10_LOG_ENABLED(object->log_subsystem, K10_LOG_TRACE)) {
+        return;
+    }
+
+    k10_gatt_format_hex(data, length, hex, sizeof(hex));
+    k10_log_trace_at(object->log_subsystem, NULL, "gatt %s %s %s len=%zu: %s", what, object->uuid,
+                     device != NULL && device[0] != '\0' ? device : "-", length, hex);
+}
+
+static int k10_gatt_read_request(sd_bus_message *m, struct k10_gatt_request *request) {
+    const char *type = NULL;
+    const char *key = NULL;
+    int r = 0;
+
+    memset(request, 0, sizeof(*request));
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &key);
+        if (r < 0) {
+            return r;
+        }
+
+        if (strcmp(key, "offset") == 0) {
+            r = sd_bus_message_read(m, "v", "q", &request->offset);
+        } else if (strcmp(key, "mtu") == 0) {
+            r = sd_bus_message_read(m, "v", "q", &request->mtu);
+        } else if (strcmp(key, "device") == 0) {
+            r = sd_bus_message_read(m, "v", "o", &request->device);
+        } else if (strcmp(key, "type") == 0) {
+            r = sd_bus_message_read(m, "v", "s", &type);
+            request->command = r >= 0 && strcmp(type, "command") == 0;
+        } else {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_exit_container(m);
+        if (r < 0) {
+            return r;
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_exit_container(m);
+}
+
+static int k10_gatt_append_flags(sd_bus_message *reply, const char *const *flags) {
+    return sd_bus_message_append_strv(reply, (char **)flags);
+}
+
+static int k10_gatt_append_object(sd_bus_message *reply, const struct k10_gatt_object *object) {
+    const struct k10_gatt *gatt = object->gatt;
+    bool service = object->flags == NULL;
+    int r = 0;
+
+    r = sd_bus_message_open_container(reply, 'e', "oa{sa{sv}}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(reply, "o", object->path);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'a', "{sa{sv}}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'e', "sa{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(reply, "s",
+                              service ? K10_BLUEZ_IFACE_GATT_SERVICE : K10_BLUEZ_IFACE_GATT_CHRC);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(reply, "{sv}", "UUID", "s", object->uuid);
+    if (r < 0) {
+        return r;
+    }
+
+    if (service) {
+        r = sd_bus_message_append(reply, "{sv}", "Primary", "b", 1);
+        if (r < 0) {
+            return r;
+        }
+    } else {
+        r = sd_bus_message_append(reply, "{sv}", "Service", "o",
+                                  gatt->objects[object->service].path);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_open_container(reply, 'e', "sv");
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_append(reply, "s", "Flags");
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_open_container(reply, 'v', "as");
+        if (r < 0) {
+            return r;
+        }
+
+        r = k10_gatt_append_flags(reply, object->flags);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0) {
+            return r;
+        }
+
+        if (object->notifiable) {
+            r = sd_bus_message_append(reply, "{sv}", "Notifying", "b", object->notifying);
+            if (r < 0) {
+                return r;
+            }
+        }
+
+        /* BlueZ only tries AcquireWrite/AcquireNotify when these properties are present. */
+        if (object->acquire && object->writable) {
+            r = sd_bus_message_append(reply, "{sv}", "WriteAcquired", "b",
+                                      object->write_link.fd >= 0);
+            if (r < 0) {
+                return r;
+            }
+        }
+
+        if (object->acquire && object->notifiable) {
+            r = sd_bus_message_append(reply, "{sv}", "NotifyAcquired", "b",
+                                      object->notify_link.fd >= 0);
+            if (r < 0) {
+                return r;
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        r = sd_bus_message_close_container(reply);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * ObjectManager cannot be added as a vtable, so GetManagedObjects is answered
+ * from a plain object callback on the application root. BlueZ calls it on
+ * every registration, including after each adapter power cycle.
+ */
+static int k10_gatt_on_app_message(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_gatt *gatt = userdata;
+    sd_bus_message *reply = NULL;
+    int r = 0;
+
+    (void)ret_error;
+
+    if (!sd_bus_message_is_method_call(m, "org.freedesktop.DBus.ObjectManager",
+                                       "GetManagedObjects")) {
+        return 0;
+    }
+
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'a', "{oa{sa{sv}}}");
+    if (r < 0) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < gatt->object_count; i++) {
+        if (!gatt->objects[i].enabled) {
+            continue;
+        }
+
+        r = k10_gatt_append_object(reply, &gatt->objects[i]);
+        if (r < 0) {
+            goto done;
+        }
+    }
+
+    r = sd_bus_message_close_container(reply);
+    if (r < 0) {
+        goto done;
+    }
+
+    r = sd_bus_send(NULL, reply, NULL);
+
+done:
+    sd_bus_message_unref(reply);
+    return r < 0 ? r : 1;
+}
+
+static int k10_gatt_property_uuid(sd_bus *bus, const char *path, const char *interface,
+                                  const char *property, sd_bus_message *reply, void *userdata,
+                                  sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "s", object->uuid);
+}
+
+static int k10_gatt_property_primary(sd_bus *bus, const char *path, const char *interface,
+                                     const char *property, sd_bus_message *reply, void *userdata,
+                                     sd_bus_error *ret_error) {
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)userdata;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "b", 1);
+}
+
+static int k10_gatt_property_service(sd_bus *bus, const char *path, const char *interface,
+                                     const char *property, sd_bus_message *reply, void *userdata,
+                                     sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "o", object->gatt->objects[object->service].path);
+}
+
+static int k10_gatt_property_flags(sd_bus *bus, const char *path, const char *interface,
+                                   const char *property, sd_bus_message *reply, void *userdata,
+                                   sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return k10_gatt_append_flags(reply, object->flags);
+}
+
+static int k10_gatt_property_notifying(sd_bus *bus, const char *path, const char *interface,
+                                       const char *property, sd_bus_message *reply,
+                                       void *userdata, sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "b", object->notifying);
+}
+
+static int k10_gatt_property_value(sd_bus *bus, const char *path, const char *interface,
+                                   const char *property, sd_bus_message *reply, void *userdata,
+                                   sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append_array(reply, 'y', object->value, object->value_length);
+}
+
+static int k10_gatt_property_write_acquired(sd_bus *bus, const char *path, const char *interface,
+                                            const char *property, sd_bus_message *reply,
+                                            void *userdata, sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "b", object->write_link.fd >= 0);
+}
+
+static int k10_gatt_property_notify_acquired(sd_bus *bus, const char *path, const char *interface,
+                                             const char *property, sd_bus_message *reply,
+                                             void *userdata, sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "b", object->notify_link.fd >= 0);
+}
+
+static void k10_gatt_ready(struct k10_gatt_object *object) {
+    struct k10_gatt *gatt = object->gatt;
+
+    if (gatt->ready_handler != NULL) {
+        gatt->ready_handler(object->id, gatt->ready_userdata);
+    }
+}
+
+/* A CCC descriptor write, which is what StartNotify/AcquireNotify stand for on the air. */
+static void k10_gatt_capture_subscription(struct k10_gatt_object *object, const char *device,
+                                          bool on) {
+    const uint8_t value[2] = {on ? 0x01 : 0x00, 0x00};
+
+    k10_capture_att(object->gatt->capture, device, K10_CAPTURE_RECEIVED, K10_ATT_OP_WRITE_REQ,
+                    (uint16_t)(object->handle + 1), value, sizeof(value));
+}
+
+/* While a capture runs it is the per-packet record; the journal only gets a line without one. */
+static void k10_gatt_dispatch_write(struct k10_gatt_object *object, const char *device,
+                                    uint8_t opcode, uint16_t offset, const uint8_t *data,
+                                    size_t length) {
+    struct k10_gatt *gatt = object->gatt;
+    struct k10_log_fields fields = {K10_LOG_ID_GATT_WRITE, object->uuid, device};
+    char hex[2 * K10_GATT_LOG_BYTES + 4];
+
+    if (k10_capture_active(gatt->capture)) {
+        k10_capture_att(gatt->capture, device, K10_CAPTURE_RECEIVED, opcode, object->handle, data,
+                        length);
+    } else if (K10_LOG_ENABLED(object->log_subsystem, K10_LOG_INFO)) {
+        k10_gatt_format_hex(data, length, hex, sizeof(hex));
+        k10_log_info_at(object->log_subsystem, &fields,
+                        "gatt write %s from %s offset=%u len=%zu: %s", object->uuid,
+                        device != NULL && device[0] != '\0' ? device : "-", offset, length, hex);
+    }
+
+    if (object->readable) {
+        memcpy(object->value + offset, data, length);
+        object->value_length = offset + length;
+    }
+
+    if (gatt->write_handler != NULL) {
+        gatt->write_handler(object->id, data, length, gatt->write_userdata);
+    }
+}
+
+static void k10_gatt_link_close(struct k10_gatt_link *link) {
+    link->source = sd_event_source_unref(link->source);
+    if (link->fd >= 0) {
+        close(link->fd);
+        link->fd = -1;
+    }
+}
+
+static void k10_gatt_link_release(struct k10_gatt_link *link, const char *property) {
+    struct k10_gatt_object *object = link->object;
+    struct k10_log_fields fields = {K10_LOG_ID_GATT_LINK, object->uuid, link->device};
+
+    k10_gatt_link_close(link);
+    if (link == &object->notify_link) {
+        k10_gatt_capture_subscription(object, link->device, false);
+    }
+    k10_log_info_at(object->log_subsystem, &fields, "gatt %s %s released", object->uuid, property);
+    (void)sd_bus_emit_properties_changed(object->gatt->bus, object->path,
+                                         K10_BLUEZ_IFACE_GATT_CHRC, property, NULL);
+}
+
+/*
+ * Drains the socket in batches of K10_GATT_RECV_BATCH packets per syscall.
+ * SEQPACKET keeps ATT write boundaries, so each packet is one value.
+ */
+static int k10_gatt_on_write_link(sd_event_source *source, int fd, uint32_t revents,
+                                  void *userdata) {
+    struct k10_gatt_link *link = userdata;
+    struct k10_gatt *gatt = link->object->gatt;
+    struct mmsghdr messages[K10_GATT_RECV_BATCH];
+    struct iovec iov[K10_GATT_RECV_BATCH];
+    int count = 0;
+
+    (void)source;
+
+    for (;;) {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < K10_GATT_RECV_BATCH; i++) {
+            iov[i].iov_base = gatt->recv_buffers[i];
+            iov[i].iov_len = sizeof(gatt->recv_buffers[i]);
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        count = recvmmsg(fd, messages, K10_GATT_RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+
+            k10_log_error_at(link->object->log_subsystem, NULL, "gatt %s write socket failed: %s",
+                             link->object->uuid, strerror(errno));
+            k10_gatt_link_release(link, "WriteAcquired");
+            return 0;
+        }
+
+        for (int i = 0; i < count; i++) {
+            /* A zero-length read is the peer's orderly shutdown. */
+            if (messages[i].msg_len == 0) {
+                k10_gatt_link_release(link, "WriteAcquired");
+                return 0;
+            }
+
+            k10_gatt_dispatch_write(link->object, link->device, K10_ATT_OP_WRITE_CMD, 0,
+                                    gatt->recv_buffers[i], messages[i].msg_len);
+            if (link->fd < 0) {
+                return 0;
+            }
+        }
+
+        if (count < K10_GATT_RECV_BATCH || link->object->writes_paused) {
+            break;
+        }
+    }
+
+    if (revents & (EPOLLHUP | EPOLLERR)) {
+        k10_gatt_link_release(link, "WriteAcquired");
+    }
+
+    return 0;
+}
+
+/*
+ * BlueZ never writes to a notify socket; it only becomes readable when BlueZ
+ * drops it. EPOLLOUT is armed only after a send hit a full socket.
+ */
+static int k10_gatt_on_notify_link(sd_event_source *source, int fd, uint32_t revents,
+                                   void *userdata) {
+    struct k10_gatt_link *link = userdata;
+    uint8_t discard[K10_GATT_DEFAULT_MTU];
+    ssize_t length = 0;
+
+    if (revents & EPOLLIN) {
+        do {
+            length = recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+        } while (length > 0);
+
+        if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR)) {
+            k10_gatt_link_release(link, "NotifyAcquired");
+            return 0;
+        }
+    }
+
+    if (revents & (EPOLLHUP | EPOLLERR)) {
+        k10_gatt_link_release(link, "NotifyAcquired");
+        return 0;
+    }
+
+    if (revents & EPOLLOUT) {
+        (void)sd_event_source_set_io_events(source, EPOLLIN);
+        k10_gatt_ready(link->object);
+    }
+
+    return 0;
+}
+
+static int k10_gatt_acquire(sd_bus_message *m, struct k10_gatt_link *link, const char *property,
+                            sd_event_io_handler_t handler) {
+    struct k10_gatt_object *object = link->object;
+    struct k10_log_fields fields = {K10_LOG_ID_GATT_LINK, object->uuid, NULL};
+    struct k10_gatt_request request;
+    int fds[2] = {-1, -1};
+    int r = 0;
+
+    r = k10_gatt_read_request(m, &request);
+    if (r < 0) {
+        return r;
+    }
+
+    if (request.mtu == 0) {
+        request.mtu = K10_GATT_DEFAULT_MTU;
+    }
+
+    /* BlueZ acquires again after a reconnect; the old socket is dead by then. */
+    k10_gatt_link_close(link);
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        return -errno;
+    }
+
+    r = k10_event_add_io(object->gatt->event, &link->source, fds[0], EPOLLIN,
+                         K10_EVENT_PRIORITY_BLE, handler, link, "gatt-link");
+    if (r < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return r;
+    }
+
+    link->fd = fds[0];
+    link->mtu = request.mtu;
+    snprintf(link->device, sizeof(link->device), "%s",
+             request.device != NULL ? request.device : "");
+
+    /* sd-bus duplicates the descriptor into the message. */
+    r = sd_bus_reply_method_return(m, "hq", fds[1], request.mtu);
+    close(fds[1]);
+    if (r < 0) {
+        k10_gatt_link_close(link);
+        return r;
+    }
+
+    fields.device = link->device;
+    k10_log_info_at(object->log_subsystem, &fields, "gatt %s %s by %s mtu=%u", object->uuid,
+                    property, link->device[0] != '\0' ? link->device : "-", link->mtu);
+    (void)sd_bus_emit_properties_changed(object->gatt->bus, object->path,
+                                         K10_BLUEZ_IFACE_GATT_CHRC, property, NULL);
+
+    if (link == &object->write_link && object->writes_paused) {
+        (void)sd_event_source_set_enabled(link->source, SD_EVENT_OFF);
+    } else if (link == &object->notify_link) {
+        k10_gatt_capture_subscription(object, link->device, true);
+        k10_gatt_ready(object);
+    }
+
+    return r;
+}
+
+static int k10_gatt_method_acquire_write(sd_bus_message *m, void *userdata,
+                                         sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    if (!object->acquire || !object->writable) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_NOT_SUPPORTED,
+                                "AcquireWrite not supported");
+    }
+
+    return k10_gatt_acquire(m, &object->write_link, "WriteAcquired", k10_gatt_on_write_link);
+}
+
+static int k10_gatt_method_acquire_notify(sd_bus_message *m, void *userdata,
+                                          sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+
+    if (!object->acquire || !object->notifiable) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_NOT_SUPPORTED,
+                                "AcquireNotify not supported");
+    }
+
+    return k10_gatt_acquire(m, &object->notify_link, "NotifyAcquired", k10_gatt_on_notify_link);
+}
+
+static void k10_gatt_capture_read(struct k10_gatt_object *object,
+                                  const struct k10_gatt_request *request) {
+    struct k10_capture *capture = object->gatt->capture;
+    uint8_t offset[2] = {(uint8_t)request->offset, (uint8_t)(request->offset >> 8)};
+
+    if (request->offset == 0) {
+        k10_capture_att(capture, request->device, K10_CAPTURE_RECEIVED, K10_ATT_OP_READ_REQ,
+                        object->handle, NULL, 0);
+        k10_capture_att(capture, request->device, K10_CAPTURE_SENT, K10_ATT_OP_READ_RSP,
+                        object->handle, object->value, object->value_length);
+        return;
+    }
+
+    k10_capture_att(capture, request->device, K10_CAPTURE_RECEIVED, K10_ATT_OP_READ_BLOB_REQ,
+                    object->handle, offset, sizeof(offset));
+    k10_capture_att(capture, request->device, K10_CAPTURE_SENT, K10_ATT_OP_READ_BLOB_RSP,
+                    object->handle, object->value + request->offset,
+                    object->value_length - request->offset);
+}
+
+static int k10_gatt_method_read_value(sd_bus_message *m, void *userdata,
+                                      sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+    struct k10_gatt_request request;
+    sd_bus_message *reply = NULL;
+    int r = 0;
+
+    r = k10_gatt_read_request(m, &request);
+    if (r < 0) {
+        return r;
+    }
+
+    if (!object->readable) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_NOT_PERMITTED, "Read not permitted");
+    }
+
+    if (request.offset > object->value_length) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_INVALID_OFFSET, "Invalid offset");
+    }
+
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append_array(reply, 'y', object->value + request.offset,
+                                    object->value_length - request.offset);
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    if (r >= 0) {
+        k10_gatt_capture_read(object, &request);
+        k10_gatt_trace(object, "read", request.device, object->value + request.offset,
+                       object->value_length - request.offset);
+    }
+
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int k10_gatt_method_write_value(sd_bus_message *m, void *userdata,
+                                       sd_bus_error *ret_error) {
+    struct k10_gatt_object *object = userdata;
+    struct k10_gatt_request request;
+    const void *data = NULL;
+    size_t length = 0;
+    int r = 0;
+
+    r = sd_bus_message_read_array(m, 'y', &data, &length);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_gatt_read_request(m, &request);
+    if (r < 0) {
+        return r;
+    }
+
+    if (!object->writable) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_NOT_PERMITTED, "Write not permitted");
+    }
+
+    if ((size_t)request.offset + length > sizeof(object->value)) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_INVALID_LENGTH,
+                                "Invalid value length");
+    }
+
+    k10_gatt_dispatch_write(object, request.device,
+                            request.command ? K10_ATT_OP_WRITE_CMD : K10_ATT_OP_WRITE_REQ,
+                            request.offset, data, length);
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_gatt_set_notifying(sd_bus_message *m, struct k10_gatt_object *object, bool on,
+                                  sd_bus_error *ret_error) {
+    struct k10_log_fields fields = {K10_LOG_ID_GATT_SUBSCRIBE, object->uuid, NULL};
+
+    if (!object->notifiable) {
+        return sd_bus_error_set(ret_error, K10_BLUEZ_ERROR_NOT_SUPPORTED,
+                                "Notify not supported");
+    }
+
+    if (object->notifying != on) {
+        object->notifying = on;
+        k10_gatt_capture_subscription(object, NULL, on);
+        k10_log_info_at(object->log_subsystem, &fields, "gatt notify %s %s", object->uuid,
+                        on ? "on" : "off");
+        (void)sd_bus_emit_properties_changed(object->gatt->bus, object->path,
+                                             K10_BLUEZ_IFACE_GATT_CHRC, "Notifying", NULL);
+        if (on) {
+            k10_gatt_ready(object);
+        }
+    }
+
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_gatt_method_start_notify(sd_bus_message *m, void *userdata,
+                                        sd_bus_error *ret_error) {
+    return k10_gatt_set_notifying(m, userdata, true, ret_error);
+}
+
+static int k10_gatt_method_stop_notify(sd_bus_message *m, void *userdata,
+                                       sd_bus_error *ret_error) {
+    return k10_gatt_set_notifying(m, userdata, false, ret_error);
+}
+
+static const sd_bus_vtable k10_gatt_service_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_PROPERTY("UUID", "s", k10_gatt_property_uuid, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Primary", "b", k10_gatt_property_primary, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_VTABLE_END};
+
+/*
+ * Shared by every characteristic; which of them BlueZ may acquire is decided
+ * by the WriteAcquired/NotifyAcquired keys sent in GetManagedObjects.
+ */
+static const sd_bus_vtable k10_gatt_chrc_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("ReadValue", "a{sv}", "ay", k10_gatt_method_read_value,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("WriteValue", "aya{sv}", "", k10_gatt_method_write_value,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("StartNotify", "", "", k10_gatt_method_start_notify,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("StopNotify", "", "", k10_gatt_method_stop_notify, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("AcquireWrite", "a{sv}", "hq", k10_gatt_method_acquire_write,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("AcquireNotify", "a{sv}", "hq", k10_gatt_method_acquire_notify,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_PROPERTY("UUID", "s", k10_gatt_property_uuid, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Service", "o", k10_gatt_property_service, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Flags", "as", k10_gatt_property_flags, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Notifying", "b", k10_gatt_property_notifying, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("Value", "ay", k10_gatt_property_value, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("WriteAcquired", "b", k10_gatt_property_write_acquired, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("NotifyAcquired", "b", k10_gatt_property_notify_acquired, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_VTABLE_END};
+
+/* Lowercase 128-bit UUID, as BlueZ reports it for a remote characteristic. */
+const char *k10_gatt_chrc_uuid(enum k10_gatt_chrc chrc) {
+    for (size_t s = 0; s < K10_GATT_SERVICE_COUNT; s++) {
+        for (size_t c = 0; c < k10_gatt_services[s].chrc_count; c++) {
+            if (k10_gatt_services[s].chrcs[c].id == chrc) {
+                return k10_gatt_services[s].chrcs[c].uuid;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static struct k10_gatt_object *k10_gatt_add_object(struct k10_gatt *gatt) {
+    struct k10_gatt_object *object = &gatt->objects[gatt->object_count++];
+
+    object->gatt = gatt;
+    object->write_link.object = object;
+    object->write_link.fd = -1;
+    object->notify_link.object = object;
+    object->notify_link.fd = -1;
+    return object;
+}
+
+/* The application is exported below the owning instance's object. */
+int k10_gatt_new(sd_bus *bus, const char *instance_path, struct k10_gatt **out) {
+    struct k10_gatt *gatt = NULL;
+    uint16_t handle = 1;
+    int r = 0;
+
+    /* The acquired sockets are watched on the loop the bus is attached to. */
+    if (bus == NULL || sd_bus_get_event(bus) == NULL || instance_path == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    gatt = calloc(1, sizeof(*gatt));
+    if (gatt == NULL) {
+        return -ENOMEM;
+    }
+
+    gatt->bus = sd_bus_ref(bus);
+    gatt->event = sd_event_ref(sd_bus_get_event(bus));
+    snprintf(gatt->path, sizeof(gatt->path), "%s" K10_DBUS_GATT_CHILD, instance_path);
+
+    /* Handles follow the on-air layout: declaration, value, then a CCC when notifiable. */
+
+    for (size_t s = 0; s < K10_GATT_SERVICE_COUNT; s++) {
+        const struct k10_gatt_service_def *def = &k10_gatt_services[s];
+        size_t service = gatt->object_count;
+        struct k10_gatt_object *object = k10_gatt_add_object(gatt);
+
+        snprintf(object->path, sizeof(object->path), "%s/service%zu", gatt->path, s);
+        object->handle = handle++;
+        object->uuid = def->uuid;
+        object->def = def;
+        object->service = service;
+        object->log_subsystem = def->log_subsystem;
+
+        for (size_t c = 0; c < def->chrc_count; c++) {
+            object = k10_gatt_add_object(gatt);
+            snprintf(object->path, sizeof(object->path), "%s/service%zu/char%zu", gatt->path, s,
+                     c);
+            object->id = def->chrcs[c].id;
+            object->acquire = def->chrcs[c].acquire;
+            gatt->chrcs[object->id] = object;
+            object->uuid = def->chrcs[c].uuid;
+            object->flags = def->chrcs[c].flags;
+            object->source = def->chrcs[c].source;
+            object->service = service;
+            object->log_subsystem = def->log_subsystem;
+            object->readable = k10_gatt_has_flag(object->flags, "read");
+            object->writable = k10_gatt_has_flag(object->flags, "write") ||
+                               k10_gatt_has_flag(object->flags, "write-without-response");
+            object->notifiable = k10_gatt_has_flag(object->flags, "notify");
+            object->handle = (uint16_t)(handle + 1);
+            handle = (uint16_t)(handle + (object->notifiable ? 3 : 2));
+        }
+    }
+
+    r = sd_bus_add_object(bus, &gatt->app_slot, gatt->path, k10_gatt_on_app_message, gatt);
+    if (r < 0) {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < gatt->object_count; i++) {
+        struct k10_gatt_object *object = &gatt->objects[i];
+        bool service = object->flags == NULL;
+
+        r = sd_bus_add_object_vtable(
+            bus, &object->slot, object->path,
+            service ? K10_BLUEZ_IFACE_GATT_SERVICE : K10_BLUEZ_IFACE_GATT_CHRC,
+            service ? k10_gatt_service_vtable : k10_gatt_chrc_vtable, object);
+        if (r < 0) {
+            goto fail;
+        }
+    }
+
+    *out = gatt;
+    return 0;
+
+fail:
+    k10_gatt_free(gatt);
+    return r;
+}
+
+void k10_gatt_free(struct k10_gatt *gatt) {
+    if (gatt == NULL) {
+        return;
+    }
+
+    k10_gatt_unregister(gatt);
+    for (size_t i = 0; i < gatt->object_count; i++) {
+        k10_gatt_link_close(&gatt->objects[i].write_link);
+        k10_gatt_link_close(&gatt->objects[i].notify_link);
+        sd_bus_slot_unref(gatt->objects[i].slot);
+    }
+    sd_bus_slot_unref(gatt->app_slot);
+    sd_event_unref(gatt->event);
+    sd_bus_unref(gatt->bus);
+    free(gatt);
+}
+
+/* Returns 1 when the exported tree was refreshed, 0 when the generation was already current. */
+int k10_gatt_update(struct k10_gatt *gatt, const struct k10_config *config, uint64_t generation) {
+    bool enabled = false;
+
+    if (gatt->built && gatt->generation == generation) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < gatt->object_count; i++) {
+        struct k10_gatt_object *object = &gatt->objects[i];
+
+        /* Characteristics follow the service listed before them. */
+        if (object->def != NULL) {
+            enabled = object->def->always || k10_gatt_listed(config, object->def->uuid);
+        }
+
+        object->enabled = enabled;
+
+        if (object->source == K10_GATT_SOURCE_FIRMWARE) {
+            int length = snprintf((char *)object->value, sizeof(object->value), "%u.%u",
+                                  config->fw_major, config->fw_minor);
+
+            object->value_length = length > 0 ? (size_t)length : 0;
+        }
+    }
+
+    gatt->generation = generation;
+    gatt->built = true;
+    return 1;
+}
+
+static int k10_gatt_on_registered(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_gatt *gatt = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+
+    (void)ret_error;
+
+    gatt->call_slot = sd_bus_slot_unref(gatt->call_slot);
+
+    if (error != NULL) {
+        k10_log_error("gatt application register on %s failed: %s", gatt->adapter_path,
+                      error->message != NULL ? error->message : error->name);
+        return 0;
+    }
+
+    gatt->registered = true;
+    k10_log_info("gatt application registered on %s", gatt->adapter_path);
+    return 0;
+}
+
+/* BlueZ reads the whole tree once per registration, so a changed tree means re-registering. */
+int k10_gatt_register(struct k10_gatt *gatt, const char *adapter) {
+    int r = 0;
+
+    if (!gatt->built) {
+        return -ENODATA;
+    }
+
+    k10_gatt_unregister(gatt);
+    snprintf(gatt->adapter_path, sizeof(gatt->adapter_path), K10_BLUEZ_PATH_PREFIX "%s", adapter);
+
+    r = sd_bus_call_method_async(gatt->bus, &gatt->call_slot, K10_BLUEZ_SERVICE,
+                                 gatt->adapter_path, K10_BLUEZ_IFACE_GATT_MANAGER,
+                                 "RegisterApplication", k10_gatt_on_registered, gatt, "oa{sv}",
+                                 gatt->path, 0);
+    if (r < 0) {
+        k10_log_error("gatt application register call failed: %s", strerror(-r));
+    }
+
+    return r;
+}
+
+/* Like the advertisement: a RegisterApplication still in flight is withdrawn too. */
+int k10_gatt_unregister(struct k10_gatt *gatt) {
+    bool pending = gatt->call_slot != NULL;
+    int r = 0;
+
+    gatt->call_slot = sd_bus_slot_unref(gatt->call_slot);
+
+    if (!gatt->registered && !pending) {
+        return 0;
+    }
+
+    gatt->registered = false;
+    r = sd_bus_call_method_async(gatt->bus, NULL, K10_BLUEZ_SERVICE, gatt->adapter_path,
+                                 K10_BLUEZ_IFACE_GATT_MANAGER, "UnregisterApplication", NULL, NULL,
+                                 "o", gatt->path);
+    if (r < 0) {
+        k10_log_error("gatt application unregister failed: %s", strerror(-r));
+    }
+
+    return r;
+}
+
+void k10_gatt_set_write_handler(struct k10_gatt *gatt, k10_gatt_write_fn handler, void *userdata) {
+    gatt->write_handler = handler;
+    gatt->write_userdata = userdata;
+}
+
+/* Borrowed; the capture must outlive the application or be detached first. */
+void k10_gatt_set_capture(struct k10_gatt *gatt, struct k10_capture *capture) {
+    gatt->capture = capture;
+}
+
+void k10_gatt_set_ready_handler(struct k10_gatt *gatt, k10_gatt_ready_fn handler, void *userdata) {
+    gatt->ready_handler = handler;
+    gatt->ready_userdata = userdata;
+}
+
+static int k10_gatt_send_batch(struct k10_gatt_link *link, const struct iovec *frames,
+                               size_t count) {
+    struct mmsghdr messages[K10_GATT_SEND_BATCH];
+    int sent = 0;
+    int r = 0;
+
+    if (count > K10_GATT_SEND_BATCH) {
+        count = K10_GATT_SEND_BATCH;
+    }
+
+    memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < count; i++) {
+        messages[i].msg_hdr.msg_iov = (struct iovec *)&frames[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sent = sendmmsg(link->fd, messages, (unsigned int)count, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+        r = -errno;
+        if (r == -EPIPE || r == -ECONNRESET) {
+            k10_gatt_link_release(link, "NotifyAcquired");
+            return -ENOTCONN;
+        }
+        if (r != -EAGAIN) {
+            return r;
+        }
+        sent = 0;
+    }
+
+    for (int i = 0; i < sent; i++) {
+        k10_capture_att(link->object->gatt->capture, link->device, K10_CAPTURE_SENT,
+                        K10_ATT_OP_HANDLE_NOTIFY, link->object->handle, frames[i].iov_base,
+                        frames[i].iov_len);
+        k10_gatt_trace(link->object, "notify", link->device, frames[i].iov_base,
+                       frames[i].iov_len);
+    }
+
+    /* Socket full: wake the ready handler once BlueZ has drained it. */
+    if ((size_t)sent < count) {
+        (void)sd_event_source_set_io_events(link->source, EPOLLIN | EPOLLOUT);
+    }
+
+    return sent > 0 ? sent : -EAGAIN;
+}
+
+/*
+ * Sends up to K10_GATT_SEND_BATCH frames in one sendmmsg() when BlueZ
+ * acquired the socket, otherwise as Value PropertiesChanged signals once
+ * StartNotify was called. Returns how many frames went out, -EAGAIN when the
+ * socket is full (the ready handler runs when it drains) or -ENOTCONN when
+ * nobody is subscribed.
+ */
+int k10_gatt_notify_batch(struct k10_gatt *gatt, enum k10_gatt_chrc chrc,
+                          const struct iovec *frames, size_t count) {
+    struct k10_gatt_object *object = gatt->chrcs[chrc];
+    size_t sent = 0;
+    int r = 0;
+
+    if (!object->notifiable) {
+        return -EOPNOTSUPP;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (frames[i].iov_len > sizeof(object->value)) {
+            return -EMSGSIZE;
+        }
+    }
+
+    if (object->notify_link.fd >= 0) {
+        return k10_gatt_send_batch(&object->notify_link, frames, count);
+    }
+
+    if (!object->notifying) {
+        return -ENOTCONN;
+    }
+
+    for (; sent < count && sent < K10_GATT_SEND_BATCH; sent++) {
+        memcpy(object->value, frames[sent].iov_base, frames[sent].iov_len);
+        object->value_length = frames[sent].iov_len;
+
+        r = sd_bus_emit_properties_changed(gatt->bus, object->path, K10_BLUEZ_IFACE_GATT_CHRC,
+                                           "Value", NULL);
+        if (r < 0) {
+            break;
+        }
+
+        k10_capture_att(gatt->capture, NULL, K10_CAPTURE_SENT, K10_ATT_OP_HANDLE_NOTIFY,
+                        object->handle, object->value, object->value_length);
+        k10_gatt_trace(object, "notify", NULL, object->value, object->value_length);
+    }
+
+    return sent > 0 ? (int)sent : r;
+}
+
+int k10_gatt_notify(struct k10_gatt *gatt, enum k10_gatt_chrc chrc, const uint8_t *data,
+                    size_t length) {
+    struct iovec frame = {.iov_base = (void *)data, .iov_len = length};
+    int r = 0;
+
+    r = k10_gatt_notify_batch(gatt, chrc, &frame, 1);
+    return r < 0 ? r : 0;
+}
+
+/*
+ * Feeds a captured ATT PDU back in by handle: writes take the same dispatch
+ * path as live ones, notifications go out to whoever is subscribed now.
+ * Returns -ENOENT for handles that are not a characteristic value.
+ */
+int k10_gatt_replay(struct k10_gatt *gatt, const char *device, uint8_t opcode, uint16_t handle,
+                    const uint8_t *data, size_t length) {
+    struct k10_gatt_object *object = NULL;
+
+    for (size_t i = 0; i < K10_GATT_CHRC_COUNT; i++) {
+        if (gatt->chrcs[i] != NULL && gatt->chrcs[i]->handle == handle) {
+            object = gatt->chrcs[i];
+            break;
+        }
+    }
+
+    if (object == NULL) {
+        return -ENOENT;
+    }
+
+    if (length > sizeof(object->value)) {
+        return -EMSGSIZE;
+    }
+
+    if (opcode == K10_ATT_OP_HANDLE_NOTIFY) {
+        return k10_gatt_notify(gatt, object->id, data, length);
+    }
+
+    if ((opcode != K10_ATT_OP_WRITE_REQ && opcode != K10_ATT_OP_WRITE_CMD) || !object->writable) {
+        return -EOPNOTSUPP;
+    }
+
+    k10_gatt_dispatch_write(object, device, opcode, 0, data, length);
+    return 0;
+}
+
+/* Largest notification payload the current path carries in one ATT packet. */
+size_t k10_gatt_notify_limit(const struct k10_gatt *gatt, enum k10_gatt_chrc chrc) {
+    const struct k10_gatt_object *object = gatt->chrcs[chrc];
+    size_t mtu = object->notify_link.fd >= 0 ? object->notify_link.mtu : 0;
+
+    if (mtu > K10_GATT_NOTIFY_HEADER) {
+        return mtu - K10_GATT_NOTIFY_HEADER;
+    }
+
+    return sizeof(object->value);
+}
+
+/* Stops draining an acquired write socket so BlueZ, and with it the central, backs off. */
+void k10_gatt_pause_writes(struct k10_gatt *gatt, enum k10_gatt_chrc chrc, bool paused) {
+    struct k10_gatt_object *object = gatt->chrcs[chrc];
+
+    if (object->writes_paused == paused) {
+        return;
+    }
+
+    object->writes_paused = paused;
+    if (object->write_link.source != NULL) {
+        (void)sd_event_source_set_enabled(object->write_link.source,
+                                          paused ? SD_EVENT_OFF : SD_EVENT_ON);
+    }
+}
@@ -0,0 +1,1041 @@
+/* recvmmsg() */
+#define _GNU_SOURCE
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_RELAY
+
+#include "k10_barrel/relay.h"
+
+#include "k10_barrel/event.h"
+#include "k10_barrel/latency.h"
+#include "k10_barrel/log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "k10_barrel/dbus_defs.h"
+
+#define K10_RELAY_RECV_BATCH 16
+#define K10_RELAY_RETRY_USEC (5ULL * 1000000ULL)
+#define K10_BLUEZ_ERROR_ALREADY_CONNECTED "org.bluez.Error.AlreadyConnected"
+
+/* What crosses the relay; device information stays local. */
+static const enum k10_gatt_chrc k10_relay_chrcs[] = {
+    K10_GATT_CHRC_DOCK_WRITE,   K10_GATT_CHRC_DOCK_NOTIFY,  K10_GATT_CHRC_SWEEPER_B001,
+    K10_GATT_CHRC_SWEEPER_B002, K10_GATT_CHRC_SWEEPER_B003, K10_GATT_CHRC_SWEEPER_B004,
+};
+
+#define K10_RELAY_CHRC_COUNT (sizeof(k10_relay_chrcs) / sizeof(k10_relay_chrcs[0]))
+
+/* The real dock's copy of one of our characteristics. */
+struct k10_relay_remote {
+    struct k10_relay *relay;
+    enum k10_gatt_chrc chrc;
+    /* Empty until the dock's GATT database has been read. */
+    char path[160];
+    bool write;
+    bool write_command;
+    bool notify;
+    bool notifying;
+    sd_bus_slot *write_call;
+    sd_bus_slot *notify_call;
+    sd_bus_slot *value_match;
+    int write_fd;
+    sd_event_source *write_source;
+    int notify_fd;
+    sd_event_source *notify_source;
+};
+
+/*
+ * Plays the sweeper's dock on the peripheral side (the GATT application) and
+ * a central towards the real dock. Writes leave from the buffer the GATT
+ * application received them into; notifications are received into our own
+ * batch buffers and handed to k10_gatt_notify_batch() in place. Frames are
+ * only copied when a rewrite hook changes them, or when the CBA20003 queue
+ * has to hold them.
+ */
+struct k10_relay {
+    sd_bus *bus;
+    sd_event *event;
+    struct k10_gatt *gatt;
+    struct k10_chrc_dock *dock;
+    k10_relay_rewrite_fn rewrite;
+    void *rewrite_userdata;
+    bool enabled;
+    bool connected;
+    char device_path[96];
+    sd_bus_slot *device_match;
+    sd_bus_slot *connect_call;
+    sd_bus_slot *objects_call;
+    sd_event_source *retry;
+    struct k10_relay_remote remotes[K10_GATT_CHRC_COUNT];
+    uint8_t recv_buffers[K10_RELAY_RECV_BATCH][K10_GATT_VALUE_MAX];
+    uint8_t scratch[K10_RELAY_RECV_BATCH][K10_GATT_VALUE_MAX];
+    struct k10_latency latency[K10_RELAY_HOP_COUNT];
+    struct k10_relay_stats stats;
+};
+
+static void k10_relay_connect(struct k10_relay *relay);
+static void k10_relay_resolve(struct k10_relay *relay);
+
+static bool k10_relay_carried(enum k10_gatt_chrc chrc) {
+    for (size_t i = 0; i < K10_RELAY_CHRC_COUNT; i++) {
+        if (k10_relay_chrcs[i] == chrc) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void k10_relay_close_fd(int *fd, sd_event_source **source) {
+    *source = sd_event_source_unref(*source);
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void k10_relay_remote_reset(struct k10_relay_remote *remote) {
+    struct k10_relay *relay = remote->relay;
+
+    if (remote->notifying && remote->notify_fd < 0 && relay->connected) {
+        (void)sd_bus_call_method_async(relay->bus, NULL, K10_BLUEZ_SERVICE, remote->path,
+                                       K10_BLUEZ_IFACE_GATT_CHRC, "StopNotify", NULL, NULL, "");
+    }
+
+    remote->write_call = sd_bus_slot_unref(remote->write_call);
+    remote->notify_call = sd_bus_slot_unref(remote->notify_call);
+    remote->value_match = sd_bus_slot_unref(remote->value_match);
+    k10_relay_close_fd(&remote->write_fd, &remote->write_source);
+    k10_relay_close_fd(&remote->notify_fd, &remote->notify_source);
+    remote->path[0] = '\0';
+    remote->write = false;
+    remote->write_command = false;
+    remote->notify = false;
+    remote->notifying = false;
+}
+
+/* Drops everything learned about the dock; the device match stays so a reconnect is seen. */
+static void k10_relay_disconnect(struct k10_relay *relay) {
+    for (size_t i = 0; i < K10_GATT_CHRC_COUNT; i++) {
+        k10_relay_remote_reset(&relay->remotes[i]);
+    }
+
+    relay->connect_call = sd_bus_slot_unref(relay->connect_call);
+    relay->objects_call = sd_bus_slot_unref(relay->objects_call);
+    if (relay->connected) {
+        k10_log_info("relay: dock %s lost", relay->device_path);
+    }
+    relay->connected = false;
+}
+
+static int k10_relay_on_retry(sd_event_source *source, uint64_t usec, void *userdata) {
+    struct k10_relay *relay = userdata;
+
+    (void)usec;
+
+    relay->retry = sd_event_source_unref(source);
+    k10_relay_connect(relay);
+    return 0;
+}
+
+static void k10_relay_schedule_retry(struct k10_relay *relay) {
+    int r = 0;
+
+    if (!relay->enabled || relay->retry != NULL) {
+        return;
+    }
+
+    r = k10_event_add_timer(relay->event, &relay->retry, K10_RELAY_RETRY_USEC,
+                            K10_EVENT_ACCURACY_DEFAULT_USEC, K10_EVENT_PRIORITY_IDLE,
+                            k10_relay_on_retry, relay, "relay-retry");
+    if (r < 0) {
+        k10_log_error("relay: retry timer failed: %s", strerror(-r));
+    }
+}
+
+static void k10_relay_finish_hop(struct k10_relay *relay, enum k10_relay_hop hop,
+                                 uint64_t start, size_t frames, size_t bytes) {
+    struct k10_relay_hop_stats *stats = &relay->stats.hops[hop];
+    uint64_t elapsed = k10_latency_now_ns() - start;
+
+    stats->frames += frames;
+    stats->bytes += bytes;
+    for (size_t i = 0; i < frames; i++) {
+        k10_latency_record(&relay->latency[hop], elapsed);
+    }
+}
+
+/* Runs the hook; false means the frame is not forwarded. */
+static bool k10_relay_rewrite(struct k10_relay *relay, struct k10_relay_frame *frame) {
+    const uint8_t *original = frame->data;
+    size_t length = frame->length;
+
+    if (relay->rewrite == NULL) {
+        return true;
+    }
+
+    if (!relay->rewrite(frame, relay->rewrite_userdata)) {
+        relay->stats.hops[frame->hop].dropped++;
+        return false;
+    }
+
+    if (frame->data != original || frame->length != length) {
+        relay->stats.hops[frame->hop].rewritten++;
+    }
+
+    return true;
+}
+
+/*
+ * Sweeper -> dock. Called from the GATT write handler while data still
+ * points into the application's receive buffer, which is sent from directly.
+ */
+void k10_relay_forward(struct k10_relay *relay, enum k10_gatt_chrc chrc, const uint8_t *data,
+                       size_t length) {
+    struct k10_relay_remote *remote = &relay->remotes[chrc];
+    struct k10_relay_frame frame = {K10_RELAY_TO_DOCK, chrc, data, length, relay->scratch[0],
+                                    sizeof(relay->scratch[0])};
+    uint64_t start = k10_latency_now_ns();
+    ssize_t sent = 0;
+    int r = 0;
+
+    if (!k10_relay_carried(chrc)) {
+        return;
+    }
+
+    if (!relay->connected || !remote->write) {
+        relay->stats.hops[K10_RELAY_TO_DOCK].dropped++;
+        return;
+    }
+
+    if (!k10_relay_rewrite(relay, &frame)) {
+        return;
+    }
+
+    if (remote->write_fd >= 0) {
+        sent = send(remote->write_fd, frame.data, frame.length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            r = -errno;
+            relay->stats.hops[K10_RELAY_TO_DOCK].dropped++;
+            k10_log_debug("relay: write to %s dropped: %s", remote->path, strerror(-r));
+            if (r != -EAGAIN) {
+                /* BlueZ dropped the socket; WriteValue carries on until it is acquired again. */
+                k10_relay_close_fd(&remote->write_fd, &remote->write_source);
+            }
+            return;
+        }
+    } else {
+        sd_bus_message *m = NULL;
+
+        r = sd_bus_message_new_method_call(relay->bus, &m, K10_BLUEZ_SERVICE, remote->path,
+                                           K10_BLUEZ_IFACE_GATT_CHRC, "WriteValue");
+        if (r >= 0) {
+            r = sd_bus_message_append_array(m, 'y', frame.data, frame.length);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_append(m, "a{sv}", 1, "type", "s",
+                                      remote->write_command ? "command" : "request");
+        }
+        if (r >= 0) {
+            r = sd_bus_call_async(relay->bus, NULL, m, NULL, NULL, 0);
+        }
+        sd_bus_message_unref(m);
+        if (r < 0) {
+            relay->stats.hops[K10_RELAY_TO_DOCK].dropped++;
+            k10_log_debug("relay: WriteValue on %s failed: %s", remote->path, strerror(-r));
+            return;
+        }
+    }
+
+    k10_relay_finish_hop(relay, K10_RELAY_TO_DOCK, start, 1, frame.length);
+}
+
+/*
+ * Dock -> sweeper. CBA20003 keeps its order with whatever the notify queue
+ * already holds: frames go straight out only while the queue is empty, and
+ * what the socket does not take is queued behind them. The sweeper
+ * characteristics have no queue, so a full socket drops the rest.
+ */
+static void k10_relay_deliver(struct k10_relay *relay, enum k10_gatt_chrc chrc,
+                              const struct iovec *frames, size_t count, uint64_t start) {
+    struct k10_relay_hop_stats *stats = &relay->stats.hops[K10_RELAY_TO_SWEEPER];
+    struct k10_chrc_dock_stats queue;
+    size_t delivered = 0;
+    size_t bytes = 0;
+    int sent = 0;
+
+    if (count == 0) {
+        return;
+    }
+
+    if (chrc == K10_GATT_CHRC_DOCK_NOTIFY) {
+        k10_chrc_dock_get_stats(relay->dock, &queue);
+        sent = queue.length > 0 ? 0 : k10_gatt_notify_batch(relay->gatt, chrc, frames, count);
+    } else {
+        sent = k10_gatt_notify_batch(relay->gatt, chrc, frames, count);
+    }
+
+    /* Nobody is subscribed on our side. */
+    if (sent == -ENOTCONN) {
+        stats->dropped += count;
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if ((int)i >= sent &&
+            (chrc != K10_GATT_CHRC_DOCK_NOTIFY ||
+             k10_chrc_dock_notify(relay->dock, frames[i].iov_base, frames[i].iov_len) < 0)) {
+            stats->dropped++;
+            continue;
+        }
+
+        delivered++;
+        bytes += frames[i].iov_len;
+    }
+
+    k10_relay_finish_hop(relay, K10_RELAY_TO_SWEEPER, start, delivered, bytes);
+}
+
+static size_t k10_relay_take(struct k10_relay *relay, enum k10_gatt_chrc chrc, size_t slot,
+                             const uint8_t *data, size_t length, struct iovec *out) {
+    struct k10_relay_frame frame = {K10_RELAY_TO_SWEEPER, chrc, data, length,
+                                    relay->scratch[slot], sizeof(relay->scratch[slot])};
+
+    if (!k10_relay_rewrite(relay, &frame)) {
+        return 0;
+    }
+
+    out->iov_base = (void *)frame.data;
+    out->iov_len = frame.length;
+    return 1;
+}
+
+/* Notifications from an acquired socket, K10_RELAY_RECV_BATCH per syscall. */
+static int k10_relay_on_notify_socket(sd_event_source *source, int fd, uint32_t revents,
+                                      void *userdata) {
+    struct k10_relay_remote *remote = userdata;
+    struct k10_relay *relay = remote->relay;
+    struct mmsghdr messages[K10_RELAY_RECV_BATCH];
+    struct iovec iov[K10_RELAY_RECV_BATCH];
+    struct iovec frames[K10_RELAY_RECV_BATCH];
+    uint64_t start = 0;
+    size_t count = 0;
+    int received = 0;
+
+    (void)source;
+
+    for (;;) {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < K10_RELAY_RECV_BATCH; i++) {
+            iov[i].iov_base = relay->recv_buffers[i];
+            iov[i].iov_len = sizeof(relay->recv_buffers[i]);
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        received = recvmmsg(fd, messages, K10_RELAY_RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+
+            k10_log_error("relay: notify socket of %s failed: %s", remote->path,
+                          strerror(errno));
+            k10_relay_close_fd(&remote->notify_fd, &remote->notify_source);
+            return 0;
+        }
+
+        start = k10_latency_now_ns();
+        count = 0;
+        for (int i = 0; i < received; i++) {
+            if (messages[i].msg_len == 0) {
+                k10_relay_deliver(relay, remote->chrc, frames, count, start);
+                k10_log_info("relay: %s notify socket closed", remote->path);
+                k10_relay_close_fd(&remote->notify_fd, &remote->notify_source);
+                return 0;
+            }
+
+            count += k10_relay_take(relay, remote->chrc, (size_t)i, relay->recv_buffers[i],
+                                    messages[i].msg_len, &frames[count]);
+        }
+
+        k10_relay_deliver(relay, remote->chrc, frames, count, start);
+        if (received < K10_RELAY_RECV_BATCH) {
+            break;
+        }
+    }
+
+    if (revents & (EPOLLHUP | EPOLLERR)) {
+        k10_relay_close_fd(&remote->notify_fd, &remote->notify_source);
+    }
+
+    return 0;
+}
+
+/* BlueZ never writes to a write socket; readable means it went away. */
+static int k10_relay_on_write_socket(sd_event_source *source, int fd, uint32_t revents,
+                                     void *userdata) {
+    struct k10_relay_remote *remote = userdata;
+    uint8_t discard[16];
+
+    (void)source;
+
+    if ((revents & EPOLLIN) && recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+        return 0;
+    }
+
+    k10_log_info("relay: %s write socket closed", remote->path);
+    k10_relay_close_fd(&remote->write_fd, &remote->write_source);
+    return 0;
+}
+
+/* Value PropertiesChanged, when the dock's notifications could not be acquired as a socket. */
+static int k10_relay_on_value(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_relay_remote *remote = userdata;
+    struct k10_relay *relay = remote->relay;
+    const char *interface = NULL;
+    const char *name = NULL;
+    const void *value = NULL;
+    struct iovec frame;
+    uint64_t start = k10_latency_now_ns();
+    size_t length = 0;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_read(m, "s", &interface);
+    if (r < 0 || strcmp(interface, K10_BLUEZ_IFACE_GATT_CHRC) != 0) {
+        return 0;
+    }
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    while (r > 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "Value") == 0) {
+            r = sd_bus_message_enter_container(m, 'v', "ay");
+            if (r >= 0) {
+                r = sd_bus_message_read_array(m, 'y', &value, &length);
+            }
+            if (r >= 0) {
+                r = sd_bus_message_exit_container(m);
+            }
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = 1;
+        }
+    }
+
+    if (r < 0 || value == NULL || length > K10_GATT_VALUE_MAX) {
+        return 0;
+    }
+
+    if (k10_relay_take(relay, remote->chrc, 0, value, length, &frame) > 0) {
+        k10_relay_deliver(relay, remote->chrc, &frame, 1, start);
+    }
+
+    return 0;
+}
+
+static int k10_relay_read_fd(sd_bus_message *m, int *out) {
+    int fd = -1;
+    int r = 0;
+
+    r = sd_bus_message_read(m, "h", &fd);
+    if (r < 0) {
+        return r;
+    }
+
+    /* The message owns its descriptor. */
+    fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        r = -errno;
+        close(fd);
+        return r;
+    }
+
+    *out = fd;
+    return 0;
+}
+
+static int k10_relay_on_write_acquired(sd_bus_message *m, void *userdata,
+                                       sd_bus_error *ret_error) {
+    struct k10_relay_remote *remote = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+    int fd = -1;
+    int r = 0;
+
+    (void)ret_error;
+
+    remote->write_call = sd_bus_slot_unref(remote->write_call);
+
+    if (error != NULL) {
+        k10_log_debug("relay: AcquireWrite on %s refused (%s), using WriteValue", remote->path,
+                      error->name);
+        return 0;
+    }
+
+    r = k10_relay_read_fd(m, &fd);
+    if (r >= 0) {
+        r = k10_event_add_io(remote->relay->event, &remote->write_source, fd, EPOLLIN,
+                             K10_EVENT_PRIORITY_BLE, k10_relay_on_write_socket, remote,
+                             "relay-write");
+    }
+    if (r < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        k10_log_error("relay: write socket for %s unusable: %s", remote->path, strerror(-r));
+        return 0;
+    }
+
+    remote->write_fd = fd;
+    k10_log_debug("relay: %s write socket acquired", remote->path);
+    return 0;
+}
+
+static int k10_relay_on_notify_started(sd_bus_message *m, void *userdata,
+                                       sd_bus_error *ret_error) {
+    struct k10_relay_remote *remote = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+
+    (void)ret_error;
+
+    remote->notify_call = sd_bus_slot_unref(remote->notify_call);
+
+    if (error != NULL) {
+        remote->value_match = sd_bus_slot_unref(remote->value_match);
+        k10_log_error("relay: StartNotify on %s failed: %s", remote->path,
+                      error->message != NULL ? error->message : error->name);
+        return 0;
+    }
+
+    remote->notifying = true;
+    return 0;
+}
+
+/* Without a socket, notifications arrive as Value PropertiesChanged after StartNotify. */
+static void k10_relay_start_notify(struct k10_relay_remote *remote) {
+    struct k10_relay *relay = remote->relay;
+    int r = 0;
+
+    r = sd_bus_match_signal_async(relay->bus, &remote->value_match, K10_BLUEZ_SERVICE,
+                                  remote->path, K10_DBUS_IFACE_PROPERTIES, "PropertiesChanged",
+                                  k10_relay_on_value, NULL, remote);
+    if (r >= 0) {
+        r = sd_bus_call_method_async(relay->bus, &remote->notify_call, K10_BLUEZ_SERVICE,
+                                     remote->path, K10_BLUEZ_IFACE_GATT_CHRC, "StartNotify",
+                                     k10_relay_on_notify_started, remote, "");
+    }
+    if (r < 0) {
+        remote->value_match = sd_bus_slot_unref(remote->value_match);
+        k10_log_error("relay: StartNotify on %s failed: %s", remote->path, strerror(-r));
+    }
+}
+
+static int k10_relay_on_notify_acquired(sd_bus_message *m, void *userdata,
+                                        sd_bus_error *ret_error) {
+    struct k10_relay_remote *remote = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+    int fd = -1;
+    int r = 0;
+
+    (void)ret_error;
+
+    remote->notify_call = sd_bus_slot_unref(remote->notify_call);
+
+    if (error != NULL) {
+        k10_log_debug("relay: AcquireNotify on %s refused (%s), using StartNotify",
+                      remote->path, error->name);
+        k10_relay_start_notify(remote);
+        return 0;
+    }
+
+    r = k10_relay_read_fd(m, &fd);
+    if (r >= 0) {
+        r = k10_event_add_io(remote->relay->event, &remote->notify_source, fd, EPOLLIN,
+                             K10_EVENT_PRIORITY_BLE, k10_relay_on_notify_socket, remote,
+                             "relay-notify");
+    }
+    if (r < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        k10_log_error("relay: notify socket for %s unusable: %s", remote->path, strerror(-r));
+        k10_relay_start_notify(remote);
+        return 0;
+    }
+
+    remote->notify_fd = fd;
+    remote->notifying = true;
+    k10_log_debug("relay: %s notify socket acquired", remote->path);
+    return 0;
+}
+
+static void k10_relay_acquire(struct k10_relay_remote *remote) {
+    struct k10_relay *relay = remote->relay;
+    int r = 0;
+
+    if (remote->write_command) {
+        r = sd_bus_call_method_async(relay->bus, &remote->write_call, K10_BLUEZ_SERVICE,
+                                     remote->path, K10_BLUEZ_IFACE_GATT_CHRC, "AcquireWrite",
+                                     k10_relay_on_write_acquired, remote, "a{sv}", 0);
+        if (r < 0) {
+            k10_log_error("relay: AcquireWrite on %s failed: %s", remote->path, strerror(-r));
+        }
+    }
+
+    if (remote->notify) {
+        r = sd_bus_call_method_async(relay->bus, &remote->notify_call, K10_BLUEZ_SERVICE,
+                                     remote->path, K10_BLUEZ_IFACE_GATT_CHRC, "AcquireNotify",
+                                     k10_relay_on_notify_acquired, remote, "a{sv}", 0);
+        if (r < 0) {
+            k10_log_error("relay: AcquireNotify on %s failed: %s", remote->path, strerror(-r));
+        }
+    }
+}
+
+static struct k10_relay_remote *k10_relay_remote_by_uuid(struct k10_relay *relay,
+                                                         const char *uuid) {
+    for (size_t i = 0; i < K10_RELAY_CHRC_COUNT; i++) {
+        enum k10_gatt_chrc chrc = k10_relay_chrcs[i];
+
+        if (strcasecmp(k10_gatt_chrc_uuid(chrc), uuid) == 0) {
+            return &relay->remotes[chrc];
+        }
+    }
+
+    return NULL;
+}
+
+/* Reads a remote GattCharacteristic1 and fills in its slot if it is one we carry. */
+static int k10_relay_read_chrc(struct k10_relay *relay, const char *path, sd_bus_message *m) {
+    struct k10_relay_remote *remote = NULL;
+    const char *name = NULL;
+    const char *value = NULL;
+    const char *uuid = NULL;
+    bool write = false;
+    bool write_command = false;
+    bool notify = false;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    while (r > 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "UUID") == 0) {
+            r = sd_bus_message_read(m, "v", "s", &uuid);
+        } else if (r >= 0 && strcmp(name, "Flags") == 0) {
+            r = sd_bus_message_enter_container(m, 'v', "as");
+            if (r >= 0) {
+                r = sd_bus_message_enter_container(m, 'a', "s");
+            }
+            while (r > 0 && (r = sd_bus_message_read(m, "s", &value)) > 0) {
+                write = write || strcmp(value, "write") == 0;
+                write_command = write_command || strcmp(value, "write-without-response") == 0;
+                notify = notify || strcmp(value, "notify") == 0;
+            }
+            if (r >= 0) {
+                r = sd_bus_message_exit_container(m);
+            }
+            if (r >= 0) {
+                r = sd_bus_message_exit_container(m);
+            }
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = 1;
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_exit_container(m);
+    if (r < 0 || uuid == NULL) {
+        return r;
+    }
+
+    remote = k10_relay_remote_by_uuid(relay, uuid);
+    if (remote == NULL) {
+        return 0;
+    }
+
+    snprintf(remote->path, sizeof(remote->path), "%s", path);
+    remote->write = write || write_command;
+    remote->write_command = write_command;
+    remote->notify = notify;
+    return 0;
+}
+
+static int k10_relay_read_device(sd_bus_message *m, bool *resolved) {
+    const char *name = NULL;
+    int value = 0;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    while (r > 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "ServicesResolved") == 0) {
+            r = sd_bus_message_read(m, "v", "b", &value);
+            *resolved = value != 0;
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = 1;
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_exit_container(m);
+}
+
+/* One object of GetManagedObjects: only the dock and its characteristics are looked at. */
+static int k10_relay_read_object(struct k10_relay *relay, sd_bus_message *m, bool *resolved) {
+    size_t prefix = strlen(relay->device_path);
+    const char *path = NULL;
+    const char *interface = NULL;
+    bool device = false;
+    bool child = false;
+    int r = 0;
+
+    r = sd_bus_message_read(m, "o", &path);
+    if (r < 0) {
+        return r;
+    }
+
+    device = strcmp(path, relay->device_path) == 0;
+    child = strncmp(path, relay->device_path, prefix) == 0 && path[prefix] == '/';
+    if (!device && !child) {
+        return sd_bus_message_skip(m, "a{sa{sv}}");
+    }
+
+    r = sd_bus_message_enter_container(m, 'a', "{sa{sv}}");
+    while (r > 0 && (r = sd_bus_message_enter_container(m, 'e', "sa{sv}")) > 0) {
+        r = sd_bus_message_read(m, "s", &interface);
+        if (r >= 0 && device && strcmp(interface, K10_BLUEZ_IFACE_DEVICE) == 0) {
+            r = k10_relay_read_device(m, resolved);
+        } else if (r >= 0 && child && strcmp(interface, K10_BLUEZ_IFACE_GATT_CHRC) == 0) {
+            r = k10_relay_read_chrc(relay, path, m);
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "a{sv}");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = 1;
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_exit_container(m);
+}
+
+static int k10_relay_on_objects(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_relay *relay = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+    bool resolved = false;
+    size_t found = 0;
+    int r = 0;
+
+    (void)ret_error;
+
+    relay->objects_call = sd_bus_slot_unref(relay->objects_call);
+
+    if (error != NULL) {
+        k10_log_error("relay: reading the BlueZ object tree failed: %s",
+                      error->message != NULL ? error->message : error->name);
+        k10_relay_schedule_retry(relay);
+        return 0;
+    }
+
+    r = sd_bus_message_enter_container(m, 'a', "{oa{sa{sv}}}");
+    while (r > 0 && (r = sd_bus_message_enter_container(m, 'e', "oa{sa{sv}}")) > 0) {
+        r = k10_relay_read_object(relay, m, &resolved);
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = 1;
+        }
+    }
+    if (r < 0) {
+        k10_log_error("relay: BlueZ object tree unreadable: %s", strerror(-r));
+        k10_relay_disconnect(relay);
+        k10_relay_schedule_retry(relay);
+        return 0;
+    }
+
+    /* Connected but still discovering; ServicesResolved brings us back here. */
+    if (!resolved) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < K10_RELAY_CHRC_COUNT; i++) {
+        struct k10_relay_remote *remote = &relay->remotes[k10_relay_chrcs[i]];
+
+        if (remote->path[0] != '\0') {
+            found++;
+            k10_relay_acquire(remote);
+        }
+    }
+
+    if (found == 0) {
+        k10_log_error("relay: %s exposes none of the dock or sweeper characteristics",
+                      relay->device_path);
+        return 0;
+    }
+
+    relay->connected = true;
+    relay->stats.connects++;
+    k10_log_info("relay: forwarding to %s (%zu characteristics)", relay->device_path, found);
+    return 0;
+}
+
+static void k10_relay_resolve(struct k10_relay *relay) {
+    int r = 0;
+
+    if (relay->connected || relay->objects_call != NULL) {
+        return;
+    }
+
+    r = sd_bus_call_method_async(relay->bus, &relay->objects_call, K10_BLUEZ_SERVICE, "/",
+                                 K10_DBUS_IFACE_OBJECT_MANAGER, "GetManagedObjects",
+                                 k10_relay_on_objects, relay, "");
+    if (r < 0) {
+        k10_log_error("relay: GetManagedObjects failed: %s", strerror(-r));
+        k10_relay_schedule_retry(relay);
+    }
+}
+
+static int k10_relay_on_connected(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_relay *relay = userdata;
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+
+    (void)ret_error;
+
+    relay->connect_call = sd_bus_slot_unref(relay->connect_call);
+
+    if (error != NULL && !sd_bus_error_has_name(error, K10_BLUEZ_ERROR_ALREADY_CONNECTED)) {
+        k10_log_error("relay: connecting to %s failed: %s", relay->device_path,
+                      error->message != NULL ? error->message : error->name);
+        k10_relay_schedule_retry(relay);
+        return 0;
+    }
+
+    k10_relay_resolve(relay);
+    return 0;
+}
+
+static void k10_relay_connect(struct k10_relay *relay) {
+    int r = 0;
+
+    if (!relay->enabled || relay->connected || relay->connect_call != NULL) {
+        return;
+    }
+
+    r = sd_bus_call_method_async(relay->bus, &relay->connect_call, K10_BLUEZ_SERVICE,
+                                 relay->device_path, K10_BLUEZ_IFACE_DEVICE, "Connect",
+                                 k10_relay_on_connected, relay, "");
+    if (r < 0) {
+        k10_log_error("relay: Connect on %s failed: %s", relay->device_path, strerror(-r));
+        k10_relay_schedule_retry(relay);
+    }
+}
+
+/* Device1 PropertiesChanged: a lost link is retried, finished service discovery is picked up. */
+static int k10_relay_on_device_changed(sd_bus_message *m, void *userdata,
+                                       sd_bus_error *ret_error) {
+    struct k10_relay *relay = userdata;
+    const char *interface = NULL;
+    const char *name = NULL;
+    int connected = -1;
+    int resolved = -1;
+    int value = 0;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_read(m, "s", &interface);
+    if (r < 0 || strcmp(interface, K10_BLUEZ_IFACE_DEVICE) != 0) {
+        return 0;
+    }
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    while (r > 0 && (r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0 && strcmp(name, "Connected") == 0) {
+            r = sd_bus_message_read(m, "v", "b", &value);
+            connected = value;
+        } else if (r >= 0 && strcmp(name, "ServicesResolved") == 0) {
+            r = sd_bus_message_read(m, "v", "b", &value);
+            resolved = value;
+        } else if (r >= 0) {
+            r = sd_bus_message_skip(m, "v");
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+        if (r >= 0) {
+            r = 1;
+        }
+    }
+    if (r < 0) {
+        return 0;
+    }
+
+    if (connected == 0) {
+        k10_relay_disconnect(relay);
+        k10_relay_schedule_retry(relay);
+    } else if (resolved == 1) {
+        k10_relay_resolve(relay);
+    }
+
+    return 0;
+}
+
+int k10_relay_new(sd_bus *bus, struct k10_gatt *gatt, struct k10_chrc_dock *dock,
+                  struct k10_relay **out) {
+    struct k10_relay *relay = NULL;
+
+    if (bus == NULL || sd_bus_get_event(bus) == NULL || gatt == NULL || dock == NULL ||
+        out == NULL) {
+        return -EINVAL;
+    }
+
+    relay = calloc(1, sizeof(*relay));
+    if (relay == NULL) {
+        return -ENOMEM;
+    }
+
+    relay->bus = sd_bus_ref(bus);
+    relay->event = sd_event_ref(sd_bus_get_event(bus));
+    relay->gatt = gatt;
+    relay->dock = dock;
+    for (size_t i = 0; i < K10_GATT_CHRC_COUNT; i++) {
+        relay->remotes[i].relay = relay;
+        relay->remotes[i].chrc = (enum k10_gatt_chrc)i;
+        relay->remotes[i].write_fd = -1;
+        relay->remotes[i].notify_fd = -1;
+    }
+
+    *out = relay;
+    return 0;
+}
+
+void k10_relay_free(struct k10_relay *relay) {
+    if (relay == NULL) {
+        return;
+    }
+
+    k10_relay_stop(relay);
+    sd_event_unref(relay->event);
+    sd_bus_unref(relay->bus);
+    free(relay);
+}
+
+/*
+ * Connects to the dock at address through the adapter and forwards between
+ * it and whoever is connected to us. Starting again with the same dock is a
+ * no-op; a different one drops the current link first.
+ */
+int k10_relay_start(struct k10_relay *relay, const char *adapter, const char *address) {
+    char path[sizeof(relay->device_path)];
+    int length = 0;
+    int r = 0;
+
+    length = snprintf(path, sizeof(path), K10_BLUEZ_PATH_PREFIX "%s/dev_%s", adapter, address);
+    if (length < 0 || (size_t)length >= sizeof(path)) {
+        return -EINVAL;
+    }
+
+    for (char *c = path + length - strlen(address); *c != '\0'; c++) {
+        *c = *c == ':' ? '_' : (char)toupper((unsigned char)*c);
+    }
+
+    if (relay->enabled && strcmp(path, relay->device_path) == 0) {
+        return 0;
+    }
+
+    k10_relay_stop(relay);
+    snprintf(relay->device_path, sizeof(relay->device_path), "%s", path);
+
+    r = sd_bus_match_signal_async(relay->bus, &relay->device_match, K10_BLUEZ_SERVICE,
+                                  relay->device_path, K10_DBUS_IFACE_PROPERTIES,
+                                  "PropertiesChanged", k10_relay_on_device_changed, NULL, relay);
+    if (r < 0) {
+        k10_log_error("relay: watching %s failed: %s", relay->device_path, strerror(-r));
+        return r;
+    }
+
+    relay->enabled = true;
+    k10_log_info("relay: enabled towards %s", relay->device_path);
+    k10_relay_connect(relay);
+    return 0;
+}
+
+/* Releases the dock's sockets and subscriptions; the BlueZ connection is left to BlueZ. */
+void k10_relay_stop(struct k10_relay *relay) {
+    if (!relay->enabled) {
+        return;
+    }
+
+    k10_relay_disconnect(relay);
+    relay->device_match = sd_bus_slot_unref(relay->device_match);
+    relay->retry = sd_event_source_unref(relay->retry);
+    relay->enabled = false;
+    k10_log_info("relay: disabled");
+}
+
+bool k10_relay_enabled(const struct k10_relay *relay) {
+    return relay->enabled;
+}
+
+/* One hook for both directions; frame->hop tells them apart. NULL removes it. */
+void k10_relay_set_rewrite(struct k10_relay *relay, k10_relay_rewrite_fn rewrite,
+                           void *userdata) {
+    relay->rewrite = rewrite;
+    relay->rewrite_userdata = userdata;
+}
+
+void k10_relay_get_stats(const struct k10_relay *relay, struct k10_relay_stats *out) {
+    *out = relay->stats;
+    out->enabled = relay->enabled;
+    out->connected = relay->connected;
+    for (size_t i = 0; i < K10_RELAY_HOP_COUNT; i++) {
+        const struct k10_latency *latency = &relay->latency[i];
+
+        out->hops[i].latency_avg_ns = k10_latency_average(latency);
+        out->hops[i].latency_p50_ns = k10_latency_percentile(latency, 50);
+        out->hops[i].latency_p99_ns = k10_latency_percentile(latency, 99);
+        out->hops[i].latency_max_ns = latency->max_ns;
+    }
+}
@@ -0,0 +1,202 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_GATT
+
+#include "k10_barrel/responder.h"
+
+#include "k10_barrel/event.h"
+#include "k10_barrel/log.h"
+#include "k10_barrel/relay.h"
+#include "k10_barrel/rules.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define K10_RESPONDER_PENDING_MAX 64
+
+/* A delayed reply; the payload is copied so a rule reload never pulls it out from under us. */
+struct k10_responder_pending {
+    struct k10_responder *responder;
+    sd_event_source *timer;
+    enum k10_gatt_chrc chrc;
+    uint16_t length;
+    uint8_t data[K10_RULE_REPLY_MAX];
+};
+
+/*
+ * Owns the GATT write handler. While a relay is enabled every write goes to
+ * the real dock untouched by rules or codec. Otherwise writes are matched
+ * against the scripted rule set first; whatever no rule claims on CBA20002
+ * goes to the dock codec.
+ */
+struct k10_responder {
+    sd_event *event;
+    struct k10_gatt *gatt;
+    struct k10_chrc_dock *dock;
+    struct k10_rules *rules;
+    struct k10_relay *relay;
+    struct k10_responder_pending pending[K10_RESPONDER_PENDING_MAX];
+    struct k10_responder_stats stats;
+};
+
+/* Dock replies share the CBA20003 queue; sweeper replies notify on the written characteristic. */
+static void k10_responder_send(struct k10_responder *responder, enum k10_gatt_chrc chrc,
+                               const uint8_t *data, size_t length) {
+    int r = 0;
+
+    if (length == 0) {
+        return;
+    }
+
+    if (chrc == K10_GATT_CHRC_DOCK_WRITE) {
+        r = k10_chrc_dock_notify(responder->dock, data, length);
+    } else {
+        r = k10_gatt_notify(responder->gatt, chrc, data, length);
+    }
+
+    if (r < 0) {
+        k10_log_debug("rule reply not sent: %s", strerror(-r));
+        return;
+    }
+
+    responder->stats.replied++;
+}
+
+static int k10_responder_on_timer(sd_event_source *source, uint64_t usec, void *userdata) {
+    struct k10_responder_pending *pending = userdata;
+
+    (void)usec;
+
+    pending->timer = sd_event_source_unref(source);
+    k10_responder_send(pending->responder, pending->chrc, pending->data, pending->length);
+    return 0;
+}
+
+static void k10_responder_schedule(struct k10_responder *responder, const struct k10_rule *rule) {
+    struct k10_responder_pending *pending = NULL;
+    int r = 0;
+
+    for (size_t i = 0; i < K10_RESPONDER_PENDING_MAX; i++) {
+        if (responder->pending[i].timer == NULL) {
+            pending = &responder->pending[i];
+            break;
+        }
+    }
+
+    if (pending == NULL) {
+        responder->stats.dropped++;
+        k10_log_debug("rule %s reply dropped, %d replies pending", rule->name,
+                      K10_RESPONDER_PENDING_MAX);
+        return;
+    }
+
+    r = k10_event_add_timer(responder->event, &pending->timer, (uint64_t)rule->delay_ms * 1000ULL,
+                            K10_EVENT_ACCURACY_FINE_USEC, K10_EVENT_PRIORITY_BLE,
+                            k10_responder_on_timer, pending, "rule-reply");
+    if (r < 0) {
+        responder->stats.dropped++;
+        k10_log_error("rule %s reply timer failed: %s", rule->name, strerror(-r));
+        return;
+    }
+
+    pending->chrc = rule->chrc;
+    pending->length = rule->reply_length;
+    memcpy(pending->data, rule->reply, rule->reply_length);
+}
+
+static void k10_responder_on_write(enum k10_gatt_chrc chrc, const uint8_t *data, size_t length,
+                                   void *userdata) {
+    struct k10_responder *responder = userdata;
+    const struct k10_rule *rule = NULL;
+
+    if (responder->relay != NULL && k10_relay_enabled(responder->relay)) {
+        k10_relay_forward(responder->relay, chrc, data, length);
+        return;
+    }
+
+    rule = k10_rules_match(responder->rules, chrc, data, length);
+    if (rule == NULL) {
+        if (chrc == K10_GATT_CHRC_DOCK_WRITE) {
+            k10_chrc_dock_write(responder->dock, data, length);
+        }
+        return;
+    }
+
+    responder->stats.matched++;
+    k10_log_debug("rule %s matched %zu bytes, reply %u bytes after %u ms", rule->name, length,
+                  rule->reply_length, rule->delay_ms);
+
+    if (rule->delay_ms == 0) {
+        k10_responder_send(responder, rule->chrc, rule->reply, rule->reply_length);
+        return;
+    }
+
+    k10_responder_schedule(responder, rule);
+}
+
+int k10_responder_new(sd_event *event, struct k10_gatt *gatt, struct k10_chrc_dock *dock,
+                      struct k10_responder **out) {
+    struct k10_responder *responder = NULL;
+    int r = 0;
+
+    if (event == NULL || gatt == NULL || dock == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    responder = calloc(1, sizeof(*responder));
+    if (responder == NULL) {
+        return -ENOMEM;
+    }
+
+    r = k10_rules_compile(NULL, 0, &responder->rules);
+    if (r < 0) {
+        free(responder);
+        return r;
+    }
+
+    responder->event = sd_event_ref(event);
+    responder->gatt = gatt;
+    responder->dock = dock;
+    for (size_t i = 0; i < K10_RESPONDER_PENDING_MAX; i++) {
+        responder->pending[i].responder = responder;
+    }
+
+    k10_gatt_set_write_handler(gatt, k10_responder_on_write, responder);
+    *out = responder;
+    return 0;
+}
+
+void k10_responder_free(struct k10_responder *responder) {
+    if (responder == NULL) {
+        return;
+    }
+
+    k10_gatt_set_write_handler(responder->gatt, NULL, NULL);
+    for (size_t i = 0; i < K10_RESPONDER_PENDING_MAX; i++) {
+        sd_event_source_unref(responder->pending[i].timer);
+    }
+
+    k10_rules_free(responder->rules);
+    sd_event_unref(responder->event);
+    free(responder);
+}
+
+/*
+ * Swaps in a compiled rule set, taking a reference. Connections and queued
+ * replies are not touched.
+ */
+void k10_responder_set_rules(struct k10_responder *responder, struct k10_rules *rules) {
+    k10_rules_free(responder->rules);
+    responder->rules = k10_rules_ref(rules);
+}
+
+/* Borrowed; NULL detaches it. */
+void k10_responder_set_relay(struct k10_responder *responder, struct k10_relay *relay) {
+    responder->relay = relay;
+}
+
+void k10_responder_get_stats(const struct k10_responder *responder,
+                             struct k10_responder_stats *out) {
+    *out = responder->stats;
+    out->rules = k10_rules_count(responder->rules);
+}
@@ -0,0 +1,711 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_GATT
+
+#include "k10_barrel/rules.h"
+
+#include "k10_barrel/file.h"
+#include "k10_barrel/log.h"
+#include "k10_barrel/toml.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/* Hex with a separator after every byte. */
+#define K10_RULES_STRING_MAX (3 * K10_RULE_REPLY_MAX)
+/* Heavily masked rules multiply nodes; a rule file past this is refused rather than compiled. */
+#define K10_RULES_NODE_MAX (1U << 20)
+
+/*
+ * Rules are compiled into one deterministic trie per characteristic. A node
+ * stands for "these rules still match after depth bytes"; its edges are
+ * sorted by byte and bytes without an edge go to the node's fallback, so a
+ * masked byte costs the same as an exact one and matching is one binary
+ * search per input byte whatever the rule count.
+ */
+struct k10_rule_node {
+    /* Rule that has fully matched at this depth, or -1. */
+    int32_t rule;
+    int32_t fallback;
+    uint32_t edge_start;
+    uint32_t edge_count;
+};
+
+struct k10_rule_edge {
+    uint8_t byte;
+    int32_t node;
+};
+
+struct k10_rules {
+    /* Compiled once and shared read-only by every instance's responder. */
+    unsigned int refs;
+    struct k10_rule *rules;
+    size_t rule_count;
+    struct k10_rule_node *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    struct k10_rule_edge *edges;
+    size_t edge_count;
+    size_t edge_capacity;
+    int32_t roots[K10_GATT_CHRC_COUNT];
+};
+
+static const struct {
+    const char *name;
+    enum k10_gatt_chrc chrc;
+} k10_rules_chrcs[] = {
+    {"cba20002", K10_GATT_CHRC_DOCK_WRITE},  {"b001", K10_GATT_CHRC_SWEEPER_B001},
+    {"b002", K10_GATT_CHRC_SWEEPER_B002},    {"b003", K10_GATT_CHRC_SWEEPER_B003},
+    {"b004", K10_GATT_CHRC_SWEEPER_B004},
+};
+
+static int k10_rules_add_node(struct k10_rules *rules, int32_t *out) {
+    struct k10_rule_node *nodes = NULL;
+
+    if (rules->node_count == K10_RULES_NODE_MAX) {
+        return -E2BIG;
+    }
+
+    if (rules->node_count == rules->node_capacity) {
+        size_t capacity = rules->node_capacity > 0 ? rules->node_capacity * 2 : 64;
+
+        nodes = realloc(rules->nodes, capacity * sizeof(*nodes));
+        if (nodes == NULL) {
+            return -ENOMEM;
+        }
+        rules->nodes = nodes;
+        rules->node_capacity = capacity;
+    }
+
+    rules->nodes[rules->node_count] = (struct k10_rule_node){-1, -1, 0, 0};
+    *out = (int32_t)rules->node_count++;
+    return 0;
+}
+
+static int k10_rules_add_edges(struct k10_rules *rules, size_t count, uint32_t *out_start) {
+    struct k10_rule_edge *edges = NULL;
+
+    if (rules->edge_count + count > rules->edge_capacity) {
+        size_t capacity = rules->edge_capacity > 0 ? rules->edge_capacity : 256;
+
+        while (capacity < rules->edge_count + count) {
+            capacity *= 2;
+        }
+
+        edges = realloc(rules->edges, capacity * sizeof(*edges));
+        if (edges == NULL) {
+            return -ENOMEM;
+        }
+        rules->edges = edges;
+        rules->edge_capacity = capacity;
+    }
+
+    *out_start = (uint32_t)rules->edge_count;
+    rules->edge_count += count;
+    return 0;
+}
+
+static bool k10_rule_accepts(const struct k10_rule *rule, unsigned int depth, unsigned int byte) {
+    return (byte & rule->mask[depth]) == rule->match[depth];
+}
+
+/* The most common outcome (possibly "no rule") becomes the fallback; the rest become edges. */
+static int k10_rules_pick_fallback(const int *group) {
+    unsigned int members[256];
+    unsigned int best = 0;
+    int fallback = -1;
+
+    memset(members, 0, sizeof(members));
+    for (unsigned int b = 0; b < 256; b++) {
+        if (group[b] >= 0) {
+            members[group[b]]++;
+        } else {
+            best++;
+        }
+    }
+
+    for (unsigned int b = 0; b < 256; b++) {
+        if (members[b] > best) {
+            best = members[b];
+            fallback = (int)b;
+        }
+    }
+
+    return fallback;
+}
+
+/*
+ * Builds the node for the rules in alive (ascending, so file order) that
+ * matched the first depth bytes. Bytes that leave the same set of rules
+ * alive share one child.
+ */
+static int k10_rules_build(struct k10_rules *rules, const uint32_t *alive, size_t count,
+                           unsigned int depth, int32_t *out_node) {
+    size_t offsets[257];
+    uint64_t hashes[256];
+    int group[256];
+    int32_t children[256];
+    size_t fill[256];
+    uint32_t *sets = NULL;
+    size_t total = 0;
+    size_t edges = 0;
+    uint32_t edge = 0;
+    int fallback = -1;
+    int32_t node = -1;
+    int r = 0;
+
+    r = k10_rules_add_node(rules, &node);
+    if (r < 0) {
+        return r;
+    }
+    *out_node = node;
+
+    for (size_t i = 0; i < count; i++) {
+        if (rules->rules[alive[i]].length == depth) {
+            rules->nodes[node].rule = (int32_t)alive[i];
+            break;
+        }
+    }
+
+    /* Two passes: size each byte's set of surviving rules, then fill them in rule order. */
+    memset(offsets, 0, sizeof(offsets));
+    for (size_t i = 0; i < count; i++) {
+        const struct k10_rule *rule = &rules->rules[alive[i]];
+
+        if (rule->length <= depth) {
+            continue;
+        }
+        for (unsigned int b = 0; b < 256; b++) {
+            if (k10_rule_accepts(rule, depth, b)) {
+                offsets[b + 1]++;
+            }
+        }
+    }
+
+    for (unsigned int b = 0; b < 256; b++) {
+        offsets[b + 1] += offsets[b];
+    }
+    total = offsets[256];
+    if (total == 0) {
+        return 0;
+    }
+
+    sets = malloc(total * sizeof(*sets));
+    if (sets == NULL) {
+        return -ENOMEM;
+    }
+
+    memcpy(fill, offsets, sizeof(fill));
+    for (size_t i = 0; i < count; i++) {
+        const struct k10_rule *rule = &rules->rules[alive[i]];
+
+        if (rule->length <= depth) {
+            continue;
+        }
+        for (unsigned int b = 0; b < 256; b++) {
+            if (k10_rule_accepts(rule, depth, b)) {
+                sets[fill[b]++] = alive[i];
+            }
+        }
+    }
+
+    /* Group bytes with identical sets; group is the first byte with that set, -1 when empty. */
+    for (unsigned int b = 0; b < 256; b++) {
+        size_t length = offsets[b + 1] - offsets[b];
+
+        hashes[b] = 14695981039346656037ULL;
+        for (size_t i = offsets[b]; i < offsets[b + 1]; i++) {
+            hashes[b] = (hashes[b] ^ sets[i]) * 1099511628211ULL;
+        }
+
+        group[b] = length == 0 ? -1 : (int)b;
+        for (unsigned int p = 0; length > 0 && p < b; p++) {
+            if (group[p] == (int)p && hashes[p] == hashes[b] &&
+                offsets[p + 1] - offsets[p] == length &&
+                memcmp(sets + offsets[p], sets + offsets[b], length * sizeof(*sets)) == 0) {
+                group[b] = (int)p;
+                break;
+            }
+        }
+    }
+
+    fallback = k10_rules_pick_fallback(group);
+    for (unsigned int b = 0; b < 256; b++) {
+        edges += group[b] != fallback ? 1 : 0;
+    }
+
+    r = k10_rules_add_edges(rules, edges, &edge);
+    if (r < 0) {
+        goto done;
+    }
+    rules->nodes[node].edge_start = edge;
+    rules->nodes[node].edge_count = (uint32_t)edges;
+
+    for (unsigned int b = 0; b < 256; b++) {
+        children[b] = -1;
+        if (group[b] != (int)b) {
+            continue;
+        }
+
+        r = k10_rules_build(rules, sets + offsets[b], offsets[b + 1] - offsets[b], depth + 1,
+                            &children[b]);
+        if (r < 0) {
+            goto done;
+        }
+    }
+
+    if (fallback >= 0) {
+        rules->nodes[node].fallback = children[fallback];
+    }
+
+    for (unsigned int b = 0; b < 256; b++) {
+        if (group[b] == fallback) {
+            continue;
+        }
+
+        rules->edges[edge].byte = (uint8_t)b;
+        rules->edges[edge].node = group[b] >= 0 ? children[group[b]] : -1;
+        edge++;
+    }
+
+done:
+    free(sets);
+    return r;
+}
+
+int k10_rules_compile(const struct k10_rule *source, size_t count, struct k10_rules **out) {
+    struct k10_rules *rules = NULL;
+    uint32_t *alive = NULL;
+    int r = 0;
+
+    if ((source == NULL && count > 0) || out == NULL) {
+        return -EINVAL;
+    }
+
+    rules = calloc(1, sizeof(*rules));
+    if (rules == NULL) {
+        return -ENOMEM;
+    }
+
+    rules->refs = 1;
+    for (size_t c = 0; c < K10_GATT_CHRC_COUNT; c++) {
+        rules->roots[c] = -1;
+    }
+
+    if (count == 0) {
+        *out = rules;
+        return 0;
+    }
+
+    rules->rules = malloc(count * sizeof(*rules->rules));
+    alive = malloc(count * sizeof(*alive));
+    if (rules->rules == NULL || alive == NULL) {
+        r = -ENOMEM;
+        goto fail;
+    }
+
+    memcpy(rules->rules, source, count * sizeof(*source));
+    rules->rule_count = count;
+    for (size_t i = 0; i < count; i++) {
+        for (unsigned int b = 0; b < rules->rules[i].length; b++) {
+            rules->rules[i].match[b] &= rules->rules[i].mask[b];
+        }
+    }
+
+    for (size_t c = 0; c < K10_GATT_CHRC_COUNT; c++) {
+        size_t alive_count = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            if (source[i].chrc == (enum k10_gatt_chrc)c) {
+                alive[alive_count++] = (uint32_t)i;
+            }
+        }
+
+        if (alive_count == 0) {
+            continue;
+        }
+
+        r = k10_rules_build(rules, alive, alive_count, 0, &rules->roots[c]);
+        if (r < 0) {
+            goto fail;
+        }
+    }
+
+    free(alive);
+    *out = rules;
+    return 0;
+
+fail:
+    free(alive);
+    k10_rules_free(rules);
+    return r;
+}
+
+struct k10_rules *k10_rules_ref(struct k10_rules *rules) {
+    if (rules != NULL) {
+        rules->refs++;
+    }
+
+    return rules;
+}
+
+/* Drops one reference; the trie goes away with the last. */
+void k10_rules_free(struct k10_rules *rules) {
+    if (rules == NULL || --rules->refs > 0) {
+        return;
+    }
+
+    free(rules->rules);
+    free(rules->nodes);
+    free(rules->edges);
+    free(rules);
+}
+
+size_t k10_rules_count(const struct k10_rules *rules) {
+    return rules != NULL ? rules->rule_count : 0;
+}
+
+size_t k10_rules_node_count(const struct k10_rules *rules) {
+    return rules != NULL ? rules->node_count : 0;
+}
+
+static int32_t k10_rules_step(const struct k10_rules *rules, int32_t node, uint8_t byte) {
+    const struct k10_rule_node *current = &rules->nodes[node];
+    const struct k10_rule_edge *edges = rules->edges + current->edge_start;
+    uint32_t low = 0;
+    uint32_t high = current->edge_count;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+
+        if (edges[middle].byte == byte) {
+            return edges[middle].node;
+        }
+        if (edges[middle].byte < byte) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return current->fallback;
+}
+
+/* The longest matching rule wins; among equally long ones, the first in the file. */
+const struct k10_rule *k10_rules_match(const struct k10_rules *rules, enum k10_gatt_chrc chrc,
+                                       const uint8_t *data, size_t length) {
+    int32_t node = -1;
+    int32_t best = -1;
+
+    if (rules == NULL || (unsigned int)chrc >= K10_GATT_CHRC_COUNT) {
+        return NULL;
+    }
+
+    node = rules->roots[chrc];
+    for (size_t i = 0; node >= 0; i++) {
+        if (rules->nodes[node].rule >= 0) {
+            best = rules->nodes[node].rule;
+        }
+        if (i == length) {
+            break;
+        }
+        node = k10_rules_step(rules, node, data[i]);
+    }
+
+    return best >= 0 ? &rules->rules[best] : NULL;
+}
+
+struct k10_rule_draft {
+    struct k10_rule rule;
+    size_t mask_length;
+    bool has_chrc;
+    bool has_mask;
+    bool invalid;
+    unsigned int line;
+};
+
+struct k10_rules_loader {
+    const char *origin;
+    struct k10_rule_draft *drafts;
+    size_t count;
+    size_t capacity;
+};
+
+static int k10_rules_hex_nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+/* Accepts "5702", "57 02" and "57:02". */
+static int k10_rules_decode_hex(const char *hex, size_t hex_length, uint8_t *out, size_t out_size,
+                                size_t *out_length) {
+    size_t used = 0;
+    size_t i = 0;
+
+    while (i < hex_length) {
+        int high = 0;
+        int low = 0;
+
+        if (hex[i] == ' ' || hex[i] == ':') {
+            i++;
+            continue;
+        }
+
+        high = k10_rules_hex_nibble(hex[i]);
+        low = high < 0 || i + 1 == hex_length ? -1 : k10_rules_hex_nibble(hex[i + 1]);
+        if (low < 0) {
+            return -EINVAL;
+        }
+
+        if (used == out_size) {
+            return -EMSGSIZE;
+        }
+
+        out[used++] = (uint8_t)((high << 4) | low);
+        i += 2;
+    }
+
+    *out_length = used;
+    return 0;
+}
+
+static struct k10_rule_draft *k10_rules_draft(struct k10_rules_loader *loader,
+                                              struct k10_toml_slice name, unsigned int line) {
+    struct k10_rule_draft *draft = NULL;
+
+    /* Keys of one table arrive together, so the last draft is almost always the one. */
+    for (size_t i = loader->count; i > 0; i--) {
+        draft = &loader->drafts[i - 1];
+        if (k10_toml_slice_equal(name, draft->rule.name)) {
+            return draft;
+        }
+    }
+
+    if (loader->count == loader->capacity) {
+        size_t capacity = loader->capacity > 0 ? loader->capacity * 2 : 16;
+
+        draft = realloc(loader->drafts, capacity * sizeof(*draft));
+        if (draft == NULL) {
+            return NULL;
+        }
+        loader->drafts = draft;
+        loader->capacity = capacity;
+    }
+
+    draft = &loader->drafts[loader->count++];
+    memset(draft, 0, sizeof(*draft));
+    snprintf(draft->rule.name, sizeof(draft->rule.name), "%.*s", (int)name.length, name.start);
+    draft->line = line;
+    return draft;
+}
+
+static int k10_rules_string(const struct k10_toml_value *value, char *buffer,
+                            const char **out_string, size_t *out_length) {
+    if (value->type != K10_TOML_STRING) {
+        return -EINVAL;
+    }
+
+    if (!value->escaped) {
+        *out_string = value->raw.start;
+        *out_length = value->raw.length;
+        return 0;
+    }
+
+    *out_string = buffer;
+    return k10_toml_string_decode(value, buffer, K10_RULES_STRING_MAX, out_length);
+}
+
+static int k10_rules_apply(struct k10_rule_draft *draft, struct k10_toml_slice key,
+                           const struct k10_toml_value *value) {
+    struct k10_rule *rule = &draft->rule;
+    char buffer[K10_RULES_STRING_MAX];
+    const char *string = NULL;
+    size_t length = 0;
+    size_t decoded = 0;
+    int r = 0;
+
+    if (k10_toml_slice_equal(key, "delay_ms")) {
+        if (value->type != K10_TOML_INTEGER || value->integer < 0 || value->integer > 60000) {
+            return -EINVAL;
+        }
+        rule->delay_ms = (unsigned int)value->integer;
+        return 0;
+    }
+
+    r = k10_rules_string(value, buffer, &string, &length);
+    if (r < 0) {
+        return r;
+    }
+
+    if (k10_toml_slice_equal(key, "characteristic")) {
+        for (size_t i = 0; i < sizeof(k10_rules_chrcs) / sizeof(k10_rules_chrcs[0]); i++) {
+            if (length == strlen(k10_rules_chrcs[i].name) &&
+                strncasecmp(string, k10_rules_chrcs[i].name, length) == 0) {
+                rule->chrc = k10_rules_chrcs[i].chrc;
+                draft->has_chrc = true;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    if (k10_toml_slice_equal(key, "match")) {
+        r = k10_rules_decode_hex(string, length, rule->match, sizeof(rule->match), &decoded);
+        rule->length = (uint8_t)decoded;
+        return r < 0 ? r : (decoded > 0 ? 0 : -EINVAL);
+    }
+
+    if (k10_toml_slice_equal(key, "mask")) {
+        draft->has_mask = true;
+        return k10_rules_decode_hex(string, length, rule->mask, sizeof(rule->mask),
+                                    &draft->mask_length);
+    }
+
+    if (k10_toml_slice_equal(key, "reply")) {
+        r = k10_rules_decode_hex(string, length, rule->reply, sizeof(rule->reply), &decoded);
+        rule->reply_length = (uint16_t)decoded;
+        return r;
+    }
+
+    return -ENOENT;
+}
+
+static int k10_rules_on_value(void *userdata, const struct k10_toml_path *path,
+                              const struct k10_toml_value *value) {
+    struct k10_rules_loader *loader = userdata;
+    struct k10_rule_draft *draft = NULL;
+    int r = 0;
+
+    if (path->depth != 3 || !k10_toml_slice_equal(path->parts[0], "rule")) {
+        k10_log_error("rules: %s:%u:%u: ignoring unknown key", loader->origin, value->line,
+                      value->column);
+        return 0;
+    }
+
+    draft = k10_rules_draft(loader, path->parts[1], value->line);
+    if (draft == NULL) {
+        return -ENOMEM;
+    }
+
+    r = k10_rules_apply(draft, path->parts[2], value);
+    if (r == -ENOENT) {
+        k10_log_error("rules: %s:%u:%u: ignoring unknown key %.*s", loader->origin, value->line,
+                      value->column, (int)path->parts[2].length, path->parts[2].start);
+    } else if (r < 0) {
+        k10_log_error("rules: %s:%u:%u: invalid %.*s in rule %s", loader->origin, value->line,
+                      value->column, (int)path->parts[2].length, path->parts[2].start,
+                      draft->rule.name);
+        draft->invalid = true;
+    }
+
+    return 0;
+}
+
+/* A rule without a characteristic or match, or with a mask of the wrong length, is skipped. */
+static bool k10_rules_finish(const struct k10_rules_loader *loader, struct k10_rule_draft *draft) {
+    struct k10_rule *rule = &draft->rule;
+
+    if (!draft->invalid && (!draft->has_chrc || rule->length == 0)) {
+        k10_log_error("rules: %s:%u: rule %s needs characteristic and match", loader->origin,
+                      draft->line, rule->name);
+        return false;
+    }
+
+    if (!draft->invalid && draft->has_mask && draft->mask_length != rule->length) {
+        k10_log_error("rules: %s:%u: rule %s mask and match differ in length", loader->origin,
+                      draft->line, rule->name);
+        return false;
+    }
+
+    if (draft->invalid) {
+        return false;
+    }
+
+    if (!draft->has_mask) {
+        memset(rule->mask, 0xff, rule->length);
+    }
+
+    return true;
+}
+
+static const struct k10_toml_handler k10_rules_toml_handler = {
+    .value = k10_rules_on_value,
+};
+
+int k10_rules_parse(const char *data, size_t size, const char *origin, struct k10_rules **out) {
+    struct k10_rules_loader loader;
+    struct k10_toml_error error;
+    struct k10_rule *rules = NULL;
+    size_t count = 0;
+    int r = 0;
+
+    memset(&loader, 0, sizeof(loader));
+    loader.origin = origin;
+
+    r = k10_toml_parse(data, size, &k10_rules_toml_handler, &loader, &error);
+    if (r < 0) {
+        k10_log_error("rules: %s:%u:%u: %s", origin, error.line, error.column, error.message);
+        goto done;
+    }
+
+    rules = calloc(loader.count > 0 ? loader.count : 1, sizeof(*rules));
+    if (rules == NULL) {
+        r = -ENOMEM;
+        goto done;
+    }
+
+    for (size_t i = 0; i < loader.count; i++) {
+        if (k10_rules_finish(&loader, &loader.drafts[i])) {
+            rules[count++] = loader.drafts[i].rule;
+        }
+    }
+
+    r = k10_rules_compile(rules, count, out);
+
+done:
+    free(rules);
+    free(loader.drafts);
+    return r;
+}
+
+/* A missing file is an empty rule set. */
+int k10_rules_load(const char *path, struct k10_rules **out) {
+    char *data = NULL;
+    size_t size = 0;
+    int fd = -1;
+    int r = 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return k10_rules_compile(NULL, 0, out);
+        }
+        return -errno;
+    }
+
+    r = k10_file_read(fd, SIZE_MAX, &data, &size);
+    close(fd);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_rules_parse(data, size, path, out);
+    free(data);
+    return r;
+}
@@ -0,0 +1,643 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_CAPTURE
+
+#include "k10_barrel/capture.h"
+
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Microseconds from 0000-01-01, the btsnoop epoch, to the Unix epoch. */
+#define K10_BTSNOOP_EPOCH_DELTA 0x00dcddb30f2f8000ULL
+#define K10_BTSNOOP_DATALINK_H4 1002
+#define K10_BTSNOOP_FLAG_RECEIVED 0x01
+#define K10_BTSNOOP_RECORD_HEADER 24
+
+#define K10_PCAPNG_BLOCK_SHB 0x0a0d0d0aU
+#define K10_PCAPNG_BLOCK_IDB 0x00000001U
+#define K10_PCAPNG_BLOCK_EPB 0x00000006U
+#define K10_PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4dU
+/* LINKTYPE_BLUETOOTH_HCI_H4_WITH_PHDR: a 4-byte direction in front of the H4 packet. */
+#define K10_PCAPNG_LINKTYPE_H4_PHDR 201
+#define K10_PCAPNG_EPB_OVERHEAD 32
+
+#define K10_H4_ACL 0x02
+/* Packet boundary flag for the first, automatically flushable fragment. */
+#define K10_ACL_PB_FIRST 0x2000
+#define K10_ACL_HANDLE_MASK 0x0eff
+#define K10_L2CAP_CID_ATT 0x0004
+/* H4 type, ACL header, L2CAP header, ATT opcode and handle. */
+#define K10_CAPTURE_HEADER_MAX 12
+
+/* The writer drains at least this often while the ring stays below half full. */
+#define K10_CAPTURE_DRAIN_MS 100
+#define K10_CAPTURE_BUFFER_SIZE 65536
+
+struct k10_capture_record {
+    uint64_t timestamp_usec;
+    uint16_t connection;
+    uint16_t handle;
+    uint16_t length;
+    uint8_t opcode;
+    uint8_t direction;
+    uint8_t payload[K10_CAPTURE_PAYLOAD_MAX];
+};
+
+/*
+ * GATT handlers push fixed-size records into a single-producer,
+ * single-consumer ring on the loop thread, and a writer thread turns them
+ * into btsnoop or pcapng files. The producer never blocks, allocates or
+ * makes a syscall on the common path: a full ring counts an overrun and
+ * drops the record, and the writer is only woken once the ring is half
+ * full. Otherwise it drains on its own every K10_CAPTURE_DRAIN_MS.
+ */
+struct k10_capture {
+    /* Settings the running writer was started with. */
+    bool enabled;
+    bool pcapng;
+    char path[128];
+    unsigned int ring_size;
+    uint64_t file_limit;
+    unsigned int file_count;
+
+    struct k10_capture_record *ring;
+    uint32_t mask;
+    /* Next record the writer takes; written by the writer only. */
+    _Atomic uint32_t head;
+    /* Next free slot; written by the producer only. */
+    _Atomic uint32_t tail;
+    int wake_fd;
+    pthread_t thread;
+    bool thread_started;
+    atomic_bool stopping;
+
+    /* Loop thread only. */
+    uint64_t records;
+
+    /* Bumped by the producer, read by the writer for the btsnoop drop count. */
+    _Atomic uint64_t overruns;
+
+    /* Writer thread only, except for the published counters. */
+    FILE *file;
+    char file_name[sizeof(((struct k10_config *)0)->capture_path) + 8];
+    uint64_t file_bytes;
+    /* Set while the file cannot be opened; each drain retries once. */
+    bool open_failed;
+    _Atomic uint64_t written;
+    _Atomic uint64_t files;
+    /* Records drained while no file was open. */
+    _Atomic uint64_t lost;
+};
+
+static void k10_put_le16(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void k10_put_be32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static void k10_put_be64(uint8_t *out, uint64_t value) {
+    k10_put_be32(out, (uint32_t)(value >> 32));
+    k10_put_be32(out + 4, (uint32_t)value);
+}
+
+/* Stable stand-in for the ACL handle BlueZ keeps to itself, derived from the device path. */
+static uint16_t k10_capture_connection(const char *device) {
+    uint32_t hash = 2166136261u;
+
+    if (device == NULL || device[0] == '\0') {
+        return 0;
+    }
+
+    for (; *device != '\0'; device++) {
+        hash ^= (unsigned char)*device;
+        hash *= 16777619u;
+    }
+
+    return (uint16_t)(hash % K10_ACL_HANDLE_MASK + 1);
+}
+
+static bool k10_capture_has_handle(uint8_t opcode) {
+    return opcode != K10_ATT_OP_READ_RSP && opcode != K10_ATT_OP_READ_BLOB_RSP;
+}
+
+/* Wraps the ATT PDU in L2CAP and an H4 ACL packet so Wireshark dissects it as usual. */
+static size_t k10_capture_build_packet(const struct k10_capture_record *record, uint8_t *out) {
+    size_t att_length = 1 + record->length;
+    size_t offset = 10;
+
+    if (k10_capture_has_handle(record->opcode)) {
+        att_length += 2;
+    }
+
+    out[0] = K10_H4_ACL;
+    k10_put_le16(out + 1, (uint16_t)(record->connection | K10_ACL_PB_FIRST));
+    k10_put_le16(out + 3, (uint16_t)(att_length + 4));
+    k10_put_le16(out + 5, (uint16_t)att_length);
+    k10_put_le16(out + 7, K10_L2CAP_CID_ATT);
+    out[9] = record->opcode;
+    if (k10_capture_has_handle(record->opcode)) {
+        k10_put_le16(out + 10, record->handle);
+        offset += 2;
+    }
+
+    memcpy(out + offset, record->payload, record->length);
+    return offset + record->length;
+}
+
+static int k10_capture_put(struct k10_capture *capture, const void *data, size_t length) {
+    if (fwrite(data, 1, length, capture->file) != length) {
+        return -EIO;
+    }
+
+    capture->file_bytes += length;
+    return 0;
+}
+
+static int k10_capture_put_u16(struct k10_capture *capture, uint16_t value) {
+    return k10_capture_put(capture, &value, sizeof(value));
+}
+
+static int k10_capture_put_u32(struct k10_capture *capture, uint32_t value) {
+    return k10_capture_put(capture, &value, sizeof(value));
+}
+
+static int k10_capture_write_header(struct k10_capture *capture) {
+    uint8_t btsnoop[16] = {'b', 't', 's', 'n', 'o', 'o', 'p', '\0'};
+    uint64_t section_length = UINT64_MAX;
+    int r = 0;
+
+    if (!capture->pcapng) {
+        k10_put_be32(btsnoop + 8, 1);
+        k10_put_be32(btsnoop + 12, K10_BTSNOOP_DATALINK_H4);
+        return k10_capture_put(capture, btsnoop, sizeof(btsnoop));
+    }
+
+    /* pcapng blocks are written in host byte order; the magic tells readers which. */
+    r = k10_capture_put_u32(capture, K10_PCAPNG_BLOCK_SHB);
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, 28);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, K10_PCAPNG_BYTE_ORDER_MAGIC);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u16(capture, 1);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u16(capture, 0);
+    }
+    if (r >= 0) {
+        r = k10_capture_put(capture, &section_length, sizeof(section_length));
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, 28);
+    }
+    /* Microsecond timestamps are the pcapng default, so the IDB carries no options. */
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, K10_PCAPNG_BLOCK_IDB);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, 20);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u16(capture, K10_PCAPNG_LINKTYPE_H4_PHDR);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u16(capture, 0);
+    }
+    if (r >= 0) {
+        /* No snap length. */
+        r = k10_capture_put_u32(capture, 0);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, 20);
+    }
+
+    return r;
+}
+
+static int k10_capture_write_record(struct k10_capture *capture,
+                                    const struct k10_capture_record *record) {
+    uint8_t packet[K10_CAPTURE_HEADER_MAX + K10_CAPTURE_PAYLOAD_MAX];
+    uint8_t header[K10_BTSNOOP_RECORD_HEADER];
+    static const uint8_t padding[4] = {0};
+    size_t length = k10_capture_build_packet(record, packet);
+    size_t padded = (4 + length + 3) & ~(size_t)3;
+    uint32_t block_length = (uint32_t)(K10_PCAPNG_EPB_OVERHEAD + padded);
+    uint32_t drops = 0;
+    int r = 0;
+
+    if (!capture->pcapng) {
+        drops = (uint32_t)atomic_load_explicit(&capture->overruns, memory_order_relaxed);
+        k10_put_be32(header, (uint32_t)length);
+        k10_put_be32(header + 4, (uint32_t)length);
+        k10_put_be32(header + 8,
+                     record->direction == K10_CAPTURE_RECEIVED ? K10_BTSNOOP_FLAG_RECEIVED : 0);
+        k10_put_be32(header + 12, drops);
+        k10_put_be64(header + 16, record->timestamp_usec + K10_BTSNOOP_EPOCH_DELTA);
+
+        r = k10_capture_put(capture, header, sizeof(header));
+        if (r >= 0) {
+            r = k10_capture_put(capture, packet, length);
+        }
+        return r;
+    }
+
+    r = k10_capture_put_u32(capture, K10_PCAPNG_BLOCK_EPB);
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, block_length);
+    }
+    if (r >= 0) {
+        /* Interface 0. */
+        r = k10_capture_put_u32(capture, 0);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, (uint32_t)(record->timestamp_usec >> 32));
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, (uint32_t)record->timestamp_usec);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, (uint32_t)(4 + length));
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, (uint32_t)(4 + length));
+    }
+    if (r >= 0) {
+        k10_put_be32(header, record->direction == K10_CAPTURE_RECEIVED ? 1 : 0);
+        r = k10_capture_put(capture, header, 4);
+    }
+    if (r >= 0) {
+        r = k10_capture_put(capture, packet, length);
+    }
+    if (r >= 0) {
+        r = k10_capture_put(capture, padding, padded - 4 - length);
+    }
+    if (r >= 0) {
+        r = k10_capture_put_u32(capture, block_length);
+    }
+
+    return r;
+}
+
+static void k10_capture_close_file(struct k10_capture *capture) {
+    if (capture->file == NULL) {
+        return;
+    }
+
+    if (fclose(capture->file) != 0) {
+        k10_log_error("gatt capture close failed: %s: %s", capture->file_name, strerror(errno));
+    }
+    capture->file = NULL;
+}
+
+/* Shifts name -> name.1 -> ... so at most file_count files are kept. */
+static void k10_capture_rotate_files(struct k10_capture *capture) {
+    char from[sizeof(capture->file_name) + 12];
+    char to[sizeof(capture->file_name) + 12];
+
+    for (unsigned int i = capture->file_count - 1; i >= 1; i--) {
+        if (i == 1) {
+            snprintf(from, sizeof(from), "%s", capture->file_name);
+        } else {
+            snprintf(from, sizeof(from), "%s.%u", capture->file_name, i - 1);
+        }
+        snprintf(to, sizeof(to), "%s.%u", capture->file_name, i);
+
+        if (rename(from, to) < 0 && errno != ENOENT) {
+            k10_log_error("gatt capture rotate failed: %s: %s", from, strerror(errno));
+        }
+    }
+}
+
+static int k10_capture_create_file(struct k10_capture *capture) {
+    int r = 0;
+
+    capture->file = fopen(capture->file_name, "we");
+    if (capture->file == NULL) {
+        return -errno;
+    }
+
+    (void)setvbuf(capture->file, NULL, _IOFBF, K10_CAPTURE_BUFFER_SIZE);
+    capture->file_bytes = 0;
+    atomic_fetch_add_explicit(&capture->files, 1, memory_order_relaxed);
+
+    r = k10_capture_write_header(capture);
+    if (r < 0) {
+        k10_capture_close_file(capture);
+    }
+
+    return r;
+}
+
+/*
+ * Starts a new file, rotating the old ones first when asked. A failure is
+ * logged once and the writer retries on every drain until it succeeds, so a
+ * full disk or a missing directory only costs the records in between.
+ */
+static void k10_capture_open_file(struct k10_capture *capture, bool rotate) {
+    int r = 0;
+
+    if (rotate) {
+        k10_capture_rotate_files(capture);
+    }
+
+    r = k10_capture_create_file(capture);
+    if (r < 0) {
+        if (!capture->open_failed) {
+            k10_log_error("gatt capture open failed: %s: %s, retrying", capture->file_name,
+                          strerror(-r));
+        }
+        capture->open_failed = true;
+        return;
+    }
+
+    if (capture->open_failed) {
+        k10_log_info("gatt capture resumed: %s, %llu records lost", capture->file_name,
+                     (unsigned long long)atomic_load_explicit(&capture->lost,
+                                                              memory_order_relaxed));
+    }
+    capture->open_failed = false;
+}
+
+static void k10_capture_drain(struct k10_capture *capture) {
+    uint32_t head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&capture->tail, memory_order_acquire);
+    int r = 0;
+
+    if (head == tail) {
+        return;
+    }
+
+    if (capture->file == NULL) {
+        k10_capture_open_file(capture, false);
+    }
+
+    for (; head != tail; head++) {
+        const struct k10_capture_record *record = &capture->ring[head & capture->mask];
+
+        if (capture->file != NULL &&
+            capture->file_bytes + K10_PCAPNG_EPB_OVERHEAD + K10_CAPTURE_HEADER_MAX +
+                    record->length >
+                capture->file_limit) {
+            k10_capture_close_file(capture);
+            k10_capture_open_file(capture, true);
+        }
+
+        if (capture->file == NULL) {
+            atomic_fetch_add_explicit(&capture->lost, 1, memory_order_relaxed);
+        } else {
+            r = k10_capture_write_record(capture, record);
+            if (r < 0) {
+                k10_log_error("gatt capture write failed: %s", capture->file_name);
+                k10_capture_close_file(capture);
+                atomic_fetch_add_explicit(&capture->lost, 1, memory_order_relaxed);
+            } else {
+                atomic_fetch_add_explicit(&capture->written, 1, memory_order_relaxed);
+            }
+        }
+
+        atomic_store_explicit(&capture->head, head + 1, memory_order_release);
+    }
+
+    if (capture->file != NULL && fflush(capture->file) != 0) {
+        k10_log_error("gatt capture flush failed: %s: %s", capture->file_name, strerror(errno));
+        k10_capture_close_file(capture);
+    }
+}
+
+static void *k10_capture_worker(void *userdata) {
+    struct k10_capture *capture = userdata;
+    struct pollfd pfd = {.fd = capture->wake_fd, .events = POLLIN};
+    uint64_t count = 0;
+    bool stopping = false;
+
+    k10_capture_open_file(capture, true);
+
+    /* Records pushed before a stop request are still written out. */
+    while (!stopping) {
+        stopping = atomic_load_explicit(&capture->stopping, memory_order_acquire);
+        k10_capture_drain(capture);
+
+        if (!stopping && poll(&pfd, 1, K10_CAPTURE_DRAIN_MS) > 0 &&
+            read(capture->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            k10_log_error("gatt capture wake read failed: %s", strerror(errno));
+        }
+    }
+
+    k10_capture_close_file(capture);
+    return NULL;
+}
+
+static void k10_capture_wake(struct k10_capture *capture) {
+    uint64_t one = 1;
+
+    if (write(capture->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        k10_log_error("gatt capture wake failed: %s", strerror(errno));
+    }
+}
+
+static void k10_capture_stop(struct k10_capture *capture) {
+    if (!capture->thread_started) {
+        return;
+    }
+
+    atomic_store_explicit(&capture->stopping, true, memory_order_release);
+    k10_capture_wake(capture);
+    pthread_join(capture->thread, NULL);
+    capture->thread_started = false;
+
+    k10_log_info("gatt capture stopped: %llu records, %llu overruns",
+                 (unsigned long long)capture->records,
+                 (unsigned long long)atomic_load(&capture->overruns));
+
+    free(capture->ring);
+    capture->ring = NULL;
+}
+
+static void k10_capture_make_parent(const char *path) {
+    char parent[sizeof(((struct k10_capture *)0)->path)];
+    char *slash = NULL;
+
+    snprintf(parent, sizeof(parent), "%s", path);
+    slash = strrchr(parent, '/');
+    if (slash == NULL || slash == parent) {
+        return;
+    }
+
+    *slash = '\0';
+    if (mkdir(parent, 0750) < 0 && errno != EEXIST) {
+        k10_log_error("gatt capture directory failed: %s: %s", parent, strerror(errno));
+    }
+}
+
+static int k10_capture_start(struct k10_capture *capture) {
+    int r = 0;
+
+    capture->ring = calloc(capture->ring_size, sizeof(*capture->ring));
+    if (capture->ring == NULL) {
+        return -ENOMEM;
+    }
+
+    capture->mask = capture->ring_size - 1;
+    atomic_store(&capture->head, 0);
+    atomic_store(&capture->tail, 0);
+    atomic_store(&capture->stopping, false);
+    capture->open_failed = false;
+    snprintf(capture->file_name, sizeof(capture->file_name), "%s.%s", capture->path,
+             capture->pcapng ? K10_CAPTURE_FORMAT_PCAPNG : K10_CAPTURE_FORMAT_BTSNOOP);
+    k10_capture_make_parent(capture->path);
+
+    /* Started from the loop thread, so the writer inherits its blocked signal mask. */
+    r = -pthread_create(&capture->thread, NULL, k10_capture_worker, capture);
+    if (r < 0) {
+        free(capture->ring);
+        capture->ring = NULL;
+        return r;
+    }
+
+    capture->thread_started = true;
+    k10_log_info("gatt capture started: %s ring=%u", capture->file_name, capture->ring_size);
+    return 0;
+}
+
+/* Restarts the writer (and so starts a new file) only when a capture setting changed. */
+int k10_capture_configure(struct k10_capture *capture, const struct k10_config *config) {
+    bool pcapng = strcmp(config->capture_format, K10_CAPTURE_FORMAT_PCAPNG) == 0;
+    uint64_t file_limit = (uint64_t)config->capture_file_size_kb * 1024;
+
+    if (capture->enabled == config->capture_enabled && capture->pcapng == pcapng &&
+        strcmp(capture->path, config->capture_path) == 0 &&
+        capture->ring_size == config->capture_ring_size && capture->file_limit == file_limit &&
+        capture->file_count == config->capture_file_count) {
+        return 0;
+    }
+
+    k10_capture_stop(capture);
+
+    capture->enabled = config->capture_enabled;
+    capture->pcapng = pcapng;
+    snprintf(capture->path, sizeof(capture->path), "%s", config->capture_path);
+    capture->ring_size = config->capture_ring_size;
+    capture->file_limit = file_limit;
+    capture->file_count = config->capture_file_count > 0 ? config->capture_file_count : 1;
+
+    if (!capture->enabled) {
+        return 0;
+    }
+
+    return k10_capture_start(capture);
+}
+
+/* Starts idle; k10_capture_configure() starts the writer when capture_enabled is set. */
+int k10_capture_new(struct k10_capture **out) {
+    struct k10_capture *capture = NULL;
+    int r = 0;
+
+    if (out == NULL) {
+        return -EINVAL;
+    }
+
+    capture = calloc(1, sizeof(*capture));
+    if (capture == NULL) {
+        return -ENOMEM;
+    }
+
+    capture->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (capture->wake_fd < 0) {
+        r = -errno;
+        free(capture);
+        return r;
+    }
+
+    *out = capture;
+    return 0;
+}
+
+void k10_capture_free(struct k10_capture *capture) {
+    if (capture == NULL) {
+        return;
+    }
+
+    k10_capture_stop(capture);
+    close(capture->wake_fd);
+    free(capture);
+}
+
+bool k10_capture_active(const struct k10_capture *capture) {
+    return capture != NULL && capture->thread_started;
+}
+
+/* Loop thread only. Never blocks; a full ring drops the record and counts an overrun. */
+void k10_capture_att(struct k10_capture *capture, const char *device,
+                     enum k10_capture_direction direction, uint8_t opcode, uint16_t handle,
+                     const uint8_t *payload, size_t length) {
+    struct k10_capture_record *record = NULL;
+    struct timespec ts;
+    uint32_t tail = 0;
+    uint32_t used = 0;
+
+    if (!k10_capture_active(capture)) {
+        return;
+    }
+
+    tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+    used = tail - atomic_load_explicit(&capture->head, memory_order_acquire);
+    if (used > capture->mask) {
+        atomic_fetch_add_explicit(&capture->overruns, 1, memory_order_relaxed);
+        return;
+    }
+
+    if (length > K10_CAPTURE_PAYLOAD_MAX) {
+        length = K10_CAPTURE_PAYLOAD_MAX;
+    }
+
+    record = &capture->ring[tail & capture->mask];
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record->timestamp_usec = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+    record->connection = k10_capture_connection(device);
+    record->handle = handle;
+    record->length = (uint16_t)length;
+    record->opcode = opcode;
+    record->direction = (uint8_t)direction;
+    if (length > 0) {
+        memcpy(record->payload, payload, length);
+    }
+
+    atomic_store_explicit(&capture->tail, tail + 1, memory_order_release);
+    capture->records++;
+
+    if (used + 1 == (capture->mask + 1) / 2) {
+        k10_capture_wake(capture);
+    }
+}
+
+void k10_capture_get_stats(const struct k10_capture *capture, struct k10_capture_stats *out) {
+    memset(out, 0, sizeof(*out));
+    if (capture == NULL) {
+        return;
+    }
+
+    out->records = capture->records;
+    out->overruns = atomic_load_explicit(&capture->overruns, memory_order_relaxed);
+    out->written = atomic_load_explicit(&capture->written, memory_order_relaxed);
+    out->files = atomic_load_explicit(&capture->files, memory_order_relaxed);
+    out->lost = atomic_load_explicit(&capture->lost, memory_order_relaxed);
+    out->ring_size = capture->ring_size;
+    out->running = capture->thread_started;
+}
@@ -0,0 +1,483 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_CAPTURE
+
+#include "k10_barrel/replay.h"
+
+#include "k10_barrel/event.h"
+#include "k10_barrel/file.h"
+#include "k10_barrel/latency.h"
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Microseconds from 0000-01-01, the btsnoop epoch, to the Unix epoch. */
+#define K10_BTSNOOP_EPOCH_DELTA 0x00dcddb30f2f8000ULL
+#define K10_BTSNOOP_DATALINK_H4 1002
+#define K10_BTSNOOP_FLAG_RECEIVED 0x01
+#define K10_BTSNOOP_HEADER 16
+#define K10_BTSNOOP_RECORD_HEADER 24
+
+/* The largest file the capture writer rotates at (capture_file_size_kb). */
+#define K10_REPLAY_FILE_MAX (1048576ULL * 1024)
+
+#define K10_PCAPNG_BLOCK_SHB 0x0a0d0d0aU
+#define K10_PCAPNG_BLOCK_EPB 0x00000006U
+#define K10_PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4dU
+#define K10_PCAPNG_BYTE_ORDER_SWAPPED 0x4d3c2b1aU
+#define K10_PCAPNG_EPB_DATA 28
+
+#define K10_H4_ACL 0x02
+#define K10_L2CAP_CID_ATT 0x0004
+/* H4 type, ACL header and L2CAP header in front of the ATT opcode. */
+#define K10_REPLAY_ATT_OFFSET 9
+
+/* Records dispatched per wakeup before the loop gets to run other sources. */
+#define K10_REPLAY_BATCH 256
+/* Below the bus, so a flat-out replay never starves method calls or live GATT traffic. */
+#define K10_REPLAY_PRIORITY (K10_EVENT_PRIORITY_DBUS + 10)
+
+/*
+ * Streams a mapped capture through k10_gatt_replay() from a timer on the
+ * loop. Record n is due at start + (t(n) - t(0)) / speed; every wakeup
+ * dispatches what is due, up to K10_REPLAY_BATCH, and re-arms for the next.
+ */
+struct k10_replay {
+    sd_event *event;
+    struct k10_gatt *gatt;
+    struct k10_replay_file file;
+    struct k10_replay_options options;
+    sd_event_source *timer;
+    k10_replay_done_fn done;
+    void *userdata;
+    struct k10_replay_record next;
+    bool has_next;
+    bool finished;
+    uint64_t start_usec;
+    uint64_t first_timestamp;
+    struct k10_latency handler;
+    struct k10_replay_stats stats;
+};
+
+static uint16_t k10_get_le16(const uint8_t *data) {
+    return (uint16_t)(data[0] | data[1] << 8);
+}
+
+static uint32_t k10_get_be32(const uint8_t *data) {
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 |
+           (uint32_t)data[3];
+}
+
+static uint64_t k10_get_be64(const uint8_t *data) {
+    return (uint64_t)k10_get_be32(data) << 32 | k10_get_be32(data + 4);
+}
+
+static uint32_t k10_replay_u32(const struct k10_replay_file *file, const uint8_t *data) {
+    uint32_t value = 0;
+
+    memcpy(&value, data, sizeof(value));
+    if (file->swapped) {
+        value = value >> 24 | (value >> 8 & 0xff00) | (value << 8 & 0xff0000) | value << 24;
+    }
+    return value;
+}
+
+static bool k10_replay_has_handle(uint8_t opcode) {
+    return opcode != K10_ATT_OP_READ_RSP && opcode != K10_ATT_OP_READ_BLOB_RSP;
+}
+
+/* Unwraps H4/ACL/L2CAP; anything that is not a first-fragment ATT PDU is skipped. */
+static bool k10_replay_parse_packet(const uint8_t *packet, size_t length,
+                                    struct k10_replay_record *out) {
+    size_t value = K10_REPLAY_ATT_OFFSET + 1;
+
+    if (length <= K10_REPLAY_ATT_OFFSET || packet[0] != K10_H4_ACL ||
+        k10_get_le16(packet + 7) != K10_L2CAP_CID_ATT) {
+        return false;
+    }
+
+    out->opcode = packet[K10_REPLAY_ATT_OFFSET];
+    out->handle = 0;
+    if (k10_replay_has_handle(out->opcode)) {
+        if (length < value + 2) {
+            return false;
+        }
+        out->handle = k10_get_le16(packet + value);
+        value += 2;
+    }
+
+    out->payload = packet + value;
+    out->length = length - value;
+    return true;
+}
+
+static int k10_replay_next_btsnoop(struct k10_replay_file *file, struct k10_replay_record *out) {
+    while (file->size - file->offset >= K10_BTSNOOP_RECORD_HEADER) {
+        const uint8_t *header = file->data + file->offset;
+        uint32_t length = k10_get_be32(header + 4);
+
+        if (length > file->size - file->offset - K10_BTSNOOP_RECORD_HEADER) {
+            /* A capture cut short by a crash or a rotation in progress. */
+            file->offset = file->size;
+            return 0;
+        }
+
+        file->offset += K10_BTSNOOP_RECORD_HEADER + length;
+        if (!k10_replay_parse_packet(header + K10_BTSNOOP_RECORD_HEADER, length, out)) {
+            continue;
+        }
+
+        out->direction = (k10_get_be32(header + 8) & K10_BTSNOOP_FLAG_RECEIVED) != 0
+                             ? K10_CAPTURE_RECEIVED
+                             : K10_CAPTURE_SENT;
+        out->timestamp_usec = k10_get_be64(header + 16) - K10_BTSNOOP_EPOCH_DELTA;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Expects what k10_capture writes: microsecond timestamps and H4 with a direction header. */
+static bool k10_replay_parse_epb(const struct k10_replay_file *file, const uint8_t *block,
+                                 uint32_t length, struct k10_replay_record *out) {
+    const uint8_t *data = block + K10_PCAPNG_EPB_DATA;
+    uint32_t captured = 0;
+
+    if (length < K10_PCAPNG_EPB_DATA + 4 + 4) {
+        return false;
+    }
+
+    captured = k10_replay_u32(file, block + 20);
+    if (captured < 4 || captured > length - K10_PCAPNG_EPB_DATA - 4 ||
+        !k10_replay_parse_packet(data + 4, captured - 4, out)) {
+        return false;
+    }
+
+    out->direction = k10_get_be32(data) != 0 ? K10_CAPTURE_RECEIVED : K10_CAPTURE_SENT;
+    out->timestamp_usec =
+        (uint64_t)k10_replay_u32(file, block + 12) << 32 | k10_replay_u32(file, block + 16);
+    return true;
+}
+
+static int k10_replay_next_pcapng(struct k10_replay_file *file, struct k10_replay_record *out) {
+    while (file->size - file->offset >= 12) {
+        const uint8_t *block = file->data + file->offset;
+        uint32_t type = k10_replay_u32(file, block);
+        uint32_t length = 0;
+
+        if (type == K10_PCAPNG_BLOCK_SHB) {
+            uint32_t magic = 0;
+
+            memcpy(&magic, block + 8, sizeof(magic));
+            if (magic != K10_PCAPNG_BYTE_ORDER_MAGIC && magic != K10_PCAPNG_BYTE_ORDER_SWAPPED) {
+                return -EBADMSG;
+            }
+            file->swapped = magic == K10_PCAPNG_BYTE_ORDER_SWAPPED;
+        }
+
+        length = k10_replay_u32(file, block + 4);
+        if (length < 12 || length % 4 != 0 || length > file->size - file->offset) {
+            file->offset = file->size;
+            return 0;
+        }
+
+        file->offset += length;
+        if (type == K10_PCAPNG_BLOCK_EPB && k10_replay_parse_epb(file, block, length, out)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Copies the whole file; the fd can be closed afterwards. The fd comes from
+ * an unprivileged caller who can truncate the file at any time, and a
+ * mapping of it would fault the daemon, so it is read rather than mapped.
+ */
+int k10_replay_file_open(struct k10_replay_file *file, int fd) {
+    struct stat st;
+    char *data = NULL;
+    size_t size = 0;
+    int r = 0;
+
+    memset(file, 0, sizeof(*file));
+
+    if (fstat(fd, &st) < 0) {
+        return -errno;
+    }
+
+    if (!S_ISREG(st.st_mode) || st.st_size < K10_BTSNOOP_HEADER) {
+        return -EBADMSG;
+    }
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        return -errno;
+    }
+
+    r = k10_file_read(fd, K10_REPLAY_FILE_MAX, &data, &size);
+    if (r < 0) {
+        return r;
+    }
+
+    file->data = (const uint8_t *)data;
+    file->size = size;
+    if (size < K10_BTSNOOP_HEADER) {
+        k10_replay_file_close(file);
+        return -EBADMSG;
+    }
+
+    if (memcmp(file->data, "btsnoop", 8) == 0) {
+        if (k10_get_be32(file->data + 8) != 1 ||
+            k10_get_be32(file->data + 12) != K10_BTSNOOP_DATALINK_H4) {
+            k10_replay_file_close(file);
+            return -EPROTONOSUPPORT;
+        }
+        file->offset = K10_BTSNOOP_HEADER;
+        return 0;
+    }
+
+    if (k10_get_be32(file->data) == K10_PCAPNG_BLOCK_SHB) {
+        file->pcapng = true;
+        return 0;
+    }
+
+    k10_replay_file_close(file);
+    return -EBADMSG;
+}
+
+void k10_replay_file_close(struct k10_replay_file *file) {
+    free((void *)file->data);
+    memset(file, 0, sizeof(*file));
+}
+
+/* 1 with the next ATT record, 0 at the end of the file. */
+int k10_replay_file_next(struct k10_replay_file *file, struct k10_replay_record *out) {
+    if (file->data == NULL) {
+        return 0;
+    }
+
+    return file->pcapng ? k10_replay_next_pcapng(file, out) : k10_replay_next_btsnoop(file, out);
+}
+
+int k10_replay_direction_from_string(const char *value, unsigned int *out) {
+    if (strcasecmp(value, "writes") == 0) {
+        *out = K10_REPLAY_WRITES;
+    } else if (strcasecmp(value, "notify") == 0) {
+        *out = K10_REPLAY_NOTIFY;
+    } else if (strcasecmp(value, "all") == 0) {
+        *out = K10_REPLAY_ALL;
+    } else {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static bool k10_replay_wanted(const struct k10_replay *replay,
+                              const struct k10_replay_record *record) {
+    if (record->direction == K10_CAPTURE_RECEIVED) {
+        return (replay->options.directions & K10_REPLAY_WRITES) != 0 &&
+               (record->opcode == K10_ATT_OP_WRITE_REQ || record->opcode == K10_ATT_OP_WRITE_CMD);
+    }
+
+    return (replay->options.directions & K10_REPLAY_NOTIFY) != 0 &&
+           record->opcode == K10_ATT_OP_HANDLE_NOTIFY;
+}
+
+static void k10_replay_dispatch(struct k10_replay *replay, const struct k10_replay_record *record) {
+    uint64_t start = 0;
+    uint64_t elapsed = 0;
+    int r = 0;
+
+    replay->stats.records++;
+    if (!k10_replay_wanted(replay, record)) {
+        replay->stats.skipped++;
+        return;
+    }
+
+    start = k10_latency_now_ns();
+    r = k10_gatt_replay(replay->gatt, "replay", record->opcode, record->handle, record->payload,
+                        record->length);
+    elapsed = k10_latency_now_ns() - start;
+
+    if (r == -ENOENT) {
+        replay->stats.skipped++;
+        return;
+    }
+
+    /* Nobody subscribed, or a full socket, still counts: the handler ran. */
+    if (r < 0 && r != -ENOTCONN && r != -EAGAIN) {
+        replay->stats.failed++;
+        k10_log_debug("replay of handle 0x%04x failed: %s", record->handle, strerror(-r));
+        return;
+    }
+
+    replay->stats.dispatched++;
+    k10_latency_record(&replay->handler, elapsed);
+}
+
+static void k10_replay_finish(struct k10_replay *replay, int result) {
+    if (replay->finished) {
+        return;
+    }
+
+    replay->finished = true;
+    replay->has_next = false;
+    (void)sd_event_source_set_enabled(replay->timer, SD_EVENT_OFF);
+    replay->stats.elapsed_usec = k10_latency_now_ns() / 1000 - replay->start_usec;
+    replay->stats.cancelled = result == -ECANCELED;
+    replay->stats.handler_avg_ns = k10_latency_average(&replay->handler);
+    replay->stats.handler_p50_ns = k10_latency_percentile(&replay->handler, 50);
+    replay->stats.handler_p99_ns = k10_latency_percentile(&replay->handler, 99);
+    replay->stats.handler_max_ns = replay->handler.max_ns;
+
+    k10_log_info("replay %s: %llu records, %llu dispatched in %llu us",
+                 result < 0 ? strerror(-result) : "done",
+                 (unsigned long long)replay->stats.records,
+                 (unsigned long long)replay->stats.dispatched,
+                 (unsigned long long)replay->stats.elapsed_usec);
+
+    /* May free the replay; nothing touches it past this point. */
+    replay->done(replay, result, replay->userdata);
+}
+
+/* Absolute CLOCK_MONOTONIC time the pending record is due; 0 when pacing is off. */
+static uint64_t k10_replay_due(const struct k10_replay *replay) {
+    uint64_t offset = 0;
+
+    if (replay->options.speed <= 0) {
+        return 0;
+    }
+
+    if (replay->next.timestamp_usec > replay->first_timestamp) {
+        offset = replay->next.timestamp_usec - replay->first_timestamp;
+    }
+
+    return replay->start_usec + (uint64_t)((double)offset / replay->options.speed);
+}
+
+static int k10_replay_on_timer(sd_event_source *source, uint64_t usec, void *userdata) {
+    struct k10_replay *replay = userdata;
+    uint64_t now = k10_latency_now_ns() / 1000;
+    uint64_t due = 0;
+    int r = 0;
+
+    (void)source;
+    (void)usec;
+
+    for (unsigned int batch = 0; batch < K10_REPLAY_BATCH; batch++) {
+        if (!replay->has_next) {
+            k10_replay_finish(replay, 0);
+            return 0;
+        }
+
+        due = k10_replay_due(replay);
+        if (due > now) {
+            break;
+        }
+
+        if (due > 0 && now - due > replay->stats.lag_max_usec) {
+            replay->stats.lag_max_usec = now - due;
+        }
+
+        k10_replay_dispatch(replay, &replay->next);
+
+        r = k10_replay_file_next(&replay->file, &replay->next);
+        if (r < 0) {
+            k10_replay_finish(replay, r);
+            return 0;
+        }
+        replay->has_next = r > 0;
+    }
+
+    /* After a full batch the due time has passed, so other sources run and then the next batch. */
+    r = sd_event_source_set_time(replay->timer, replay->has_next ? due : 0);
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(replay->timer, SD_EVENT_ONESHOT);
+    }
+    if (r < 0) {
+        k10_replay_finish(replay, r);
+    }
+
+    return 0;
+}
+
+int k10_replay_start(sd_event *event, struct k10_gatt *gatt, int fd,
+                     const struct k10_replay_options *options, k10_replay_done_fn done,
+                     void *userdata, struct k10_replay **out) {
+    struct k10_replay *replay = NULL;
+    int r = 0;
+
+    if (event == NULL || gatt == NULL || options == NULL || done == NULL || out == NULL ||
+        options->speed < 0 || options->directions == 0) {
+        return -EINVAL;
+    }
+
+    replay = calloc(1, sizeof(*replay));
+    if (replay == NULL) {
+        return -ENOMEM;
+    }
+
+    r = k10_replay_file_open(&replay->file, fd);
+    if (r < 0) {
+        free(replay);
+        return r;
+    }
+
+    r = k10_replay_file_next(&replay->file, &replay->next);
+    if (r < 0) {
+        goto fail;
+    }
+
+    replay->has_next = r > 0;
+    replay->first_timestamp = replay->next.timestamp_usec;
+    replay->event = sd_event_ref(event);
+    replay->gatt = gatt;
+    replay->options = *options;
+    replay->done = done;
+    replay->userdata = userdata;
+    replay->start_usec = k10_latency_now_ns() / 1000;
+
+    r = k10_event_add_timer(event, &replay->timer, 0, K10_EVENT_ACCURACY_FINE_USEC,
+                            K10_REPLAY_PRIORITY, k10_replay_on_timer, replay, "replay");
+    if (r < 0) {
+        goto fail;
+    }
+
+    k10_log_info("replay started: %zu bytes of %s, speed %g", replay->file.size,
+                 replay->file.pcapng ? "pcapng" : "btsnoop", options->speed);
+    *out = replay;
+    return 0;
+
+fail:
+    k10_replay_file_close(&replay->file);
+    sd_event_unref(replay->event);
+    free(replay);
+    return r;
+}
+
+/* Stops at the current record and runs the done callback with -ECANCELED. */
+void k10_replay_cancel(struct k10_replay *replay) {
+    if (replay != NULL) {
+        k10_replay_finish(replay, -ECANCELED);
+    }
+}
+
+void k10_replay_free(struct k10_replay *replay) {
+    if (replay == NULL) {
+        return;
+    }
+
+    sd_event_source_unref(replay->timer);
+    k10_replay_file_close(&replay->file);
+    sd_event_unref(replay->event);
+    free(replay);
+}
+
+void k10_replay_get_stats(const struct k10_replay *replay, struct k10_replay_stats *out) {
+    *out = replay->stats;
+}
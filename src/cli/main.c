@@ -1,18 +1,25 @@
 #include "k10_barrel/dbus_defs.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <systemd/sd-bus.h>
 
 #define K10_DEFAULT_MODE "barrel"
 
+/* The primary instance unless --instance picks a named one. */
+static char k10_object_path[K10_DBUS_OBJECT_MAX] = K10_DBUS_OBJECT;
+
 static void k10_print_usage(const char *name) {
     fprintf(stderr,
-            "Usage: %s <command> [options]\n\n"
+            "Usage: %s [--instance <name>] <command> [options]\n\n"
             "Commands:\n"
             "  status [--mode sweeper|barrel]\n"
             "  start [--mode sweeper|barrel]\n"
@@ -20,7 +27,14 @@ static void k10_print_usage(const char *name) {
             "  reload [--mode sweeper|barrel]\n"
             "  config get\n"
             "  config set <key> <value> [--type string|uint|bool|list]\n"
-            "  config reload\n",
+            "  config reload\n"
+            "  log-level [<subsystem|all> <error|info|debug|trace>]\n"
+            "  replay <capture> [--speed <factor>|max] [--direction writes|notify|all]\n"
+            "  replay --cancel\n"
+            "  relay\n"
+            "  instances\n"
+            "  batch [<file>|-]\n"
+            "  monitor [--json] [--interface config|status|<name>]... [--property <name>]...\n",
             name);
 }
 
@@ -81,7 +95,7 @@ static int k10_open_bus(sd_bus **bus) {
 static int k10_call_simple(sd_bus *bus, const char *interface, const char *method) {
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *reply = NULL;
-    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT, interface, method, &error,
+    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, k10_object_path, interface, method, &error,
                                &reply, "");
 
     if (r < 0) {
@@ -93,7 +107,22 @@ static int k10_call_simple(sd_bus *bus, const char *interface, const char *metho
     return r;
 }
 
-static int k10_print_variant(sd_bus_message *m) {
+static void k10_print_json_string(const char *value) {
+    putchar('"');
+    for (const unsigned char *c = (const unsigned char *)value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+/* With json set, strings are quoted and string lists become arrays. */
+static int k10_print_variant(sd_bus_message *m, bool json) {
     char type = 0;
     const char *contents = NULL;
     int r = sd_bus_message_peek_type(m, &type, &contents);
@@ -108,7 +137,11 @@ static int k10_print_variant(sd_bus_message *m) {
         if (r < 0) {
             return r;
         }
-        printf("%s", value ? value : "");
+        if (json) {
+            k10_print_json_string(value ? value : "");
+        } else {
+            printf("%s", value ? value : "");
+        }
     } else if (type == 'b') {
         int value = 0;
         r = sd_bus_message_read(m, "b", &value);
@@ -123,6 +156,13 @@ static int k10_print_variant(sd_bus_message *m) {
             return r;
         }
         printf("%u", value);
+    } else if (type == 't') {
+        uint64_t value = 0;
+        r = sd_bus_message_read(m, "t", &value);
+        if (r < 0) {
+            return r;
+        }
+        printf("%llu", (unsigned long long)value);
     } else if (type == 'a' && contents != NULL && strcmp(contents, "s") == 0) {
         const char *item = NULL;
         bool first = true;
@@ -132,13 +172,23 @@ static int k10_print_variant(sd_bus_message *m) {
             return r;
         }
 
+        if (json) {
+            putchar('[');
+        }
         while ((r = sd_bus_message_read(m, "s", &item)) > 0) {
             if (!first) {
-                printf(", ");
+                printf(json ? "," : ", ");
+            }
+            if (json) {
+                k10_print_json_string(item);
+            } else {
+                printf("%s", item);
             }
-            printf("%s", item);
             first = false;
         }
+        if (json) {
+            putchar(']');
+        }
 
         if (r < 0) {
             return r;
@@ -177,7 +227,7 @@ static int k10_print_dict(sd_bus_message *reply) {
         }
 
         printf("%s=", key);
-        r = k10_print_variant(reply);
+        r = k10_print_variant(reply, false);
         if (r < 0) {
             return r;
         }
@@ -204,7 +254,7 @@ static int k10_print_dict(sd_bus_message *reply) {
 static int k10_call_get_dict(sd_bus *bus, const char *interface, const char *method) {
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *reply = NULL;
-    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, K10_DBUS_OBJECT, interface, method, &error,
+    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, k10_object_path, interface, method, &error,
                                &reply, "");
 
     if (r < 0) {
@@ -272,13 +322,66 @@ static int k10_append_string_array(sd_bus_message *m, const char *value) {
     return r;
 }
 
+/* One {sv} entry of a SetConfig dict; the value is checked before anything is appended. */
+static int k10_append_config_entry(sd_bus_message *m, const char *key, const char *value,
+                                   const char *type) {
+    unsigned int number = 0;
+    bool flag = false;
+    int r = 0;
+
+    if (type == NULL) {
+        type = "string";
+    }
+
+    if (strcmp(type, "uint") == 0 && k10_parse_uint(value, &number) != 0) {
+        fprintf(stderr, "Invalid uint value: %s\n", value);
+        return -EINVAL;
+    }
+
+    if (strcmp(type, "bool") == 0 && k10_parse_bool(value, &flag) != 0) {
+        fprintf(stderr, "Invalid bool value: %s\n", value);
+        return -EINVAL;
+    }
+
+    if (strcmp(type, "string") != 0 && strcmp(type, "uint") != 0 && strcmp(type, "bool") != 0 &&
+        strcmp(type, "list") != 0) {
+        fprintf(stderr, "Unknown type: %s\n", type);
+        return -EINVAL;
+    }
+
+    r = sd_bus_message_open_container(m, 'e', "sv");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(m, "s", key);
+    if (r < 0) {
+        return r;
+    }
+
+    if (strcmp(type, "uint") == 0) {
+        r = sd_bus_message_append(m, "v", "u", number);
+    } else if (strcmp(type, "bool") == 0) {
+        r = sd_bus_message_append(m, "v", "b", flag ? 1 : 0);
+    } else if (strcmp(type, "list") == 0) {
+        r = k10_append_string_array(m, value);
+    } else {
+        r = sd_bus_message_append(m, "v", "s", value);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_close_container(m);
+}
+
 static int k10_call_set_config(sd_bus *bus, const char *key, const char *value, const char *type) {
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *m = NULL;
     sd_bus_message *reply = NULL;
     int r = 0;
 
-    r = sd_bus_message_new_method_call(bus, &m, K10_DBUS_SERVICE, K10_DBUS_OBJECT,
+    r = sd_bus_message_new_method_call(bus, &m, K10_DBUS_SERVICE, k10_object_path,
                                        K10_DBUS_IFACE_CONFIG, "SetConfig");
     if (r < 0) {
         return r;
@@ -289,73 +392,271 @@ static int k10_call_set_config(sd_bus *bus, const char *key, const char *value,
         goto finish;
     }
 
-    r = sd_bus_message_open_container(m, 'e', "sv");
+    r = k10_append_config_entry(m, key, value, type);
     if (r < 0) {
         goto finish;
     }
 
-    r = sd_bus_message_append(m, "s", key);
+    r = sd_bus_message_close_container(m);
     if (r < 0) {
         goto finish;
     }
 
-    if (type == NULL || strcmp(type, "string") == 0) {
-        r = sd_bus_message_append(m, "v", "s", value);
-    } else if (strcmp(type, "uint") == 0) {
-        unsigned int parsed = 0;
-        if (k10_parse_uint(value, &parsed) != 0) {
-            fprintf(stderr, "Invalid uint value: %s\n", value);
-            r = -EINVAL;
-        } else {
-            r = sd_bus_message_append(m, "v", "u", parsed);
+    r = sd_bus_call(bus, m, 0, &error, &reply);
+    if (r < 0) {
+        fprintf(stderr, "D-Bus call failed: %s\n", error.message ? error.message : strerror(-r));
+        goto finish;
+    }
+
+    r = sd_bus_message_read(reply, "b", &r);
+    if (r < 0) {
+        fprintf(stderr, "Invalid reply: %s\n", strerror(-r));
+    }
+
+finish:
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    sd_bus_message_unref(m);
+    return r;
+}
+
+static int k10_print_log_levels(sd_bus_message *reply) {
+    const char *subsystem = NULL;
+    const char *level = NULL;
+    int r = sd_bus_message_enter_container(reply, 'a', "{ss}");
+
+    while (r >= 0 && (r = sd_bus_message_read(reply, "{ss}", &subsystem, &level)) > 0) {
+        printf("%s=%s\n", subsystem, level);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_exit_container(reply);
+    }
+
+    return r;
+}
+
+static int k10_call_get_log_levels(sd_bus *bus) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, k10_object_path, K10_DBUS_IFACE_CONFIG,
+                               "GetLogLevels", &error, &reply, "");
+
+    if (r < 0) {
+        fprintf(stderr, "D-Bus call failed: %s\n", error.message ? error.message : strerror(-r));
+        goto finish;
+    }
+
+    r = k10_print_log_levels(reply);
+    if (r < 0) {
+        fprintf(stderr, "Failed to parse response: %s\n", strerror(-r));
+    }
+
+finish:
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int k10_call_set_log_level(sd_bus *bus, const char *subsystem, const char *level) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, k10_object_path, K10_DBUS_IFACE_CONFIG,
+                               "SetLogLevel", &error, NULL, "ss", subsystem, level);
+
+    if (r < 0) {
+        fprintf(stderr, "D-Bus call failed: %s\n", error.message ? error.message : strerror(-r));
+    }
+
+    sd_bus_error_free(&error);
+    return r;
+}
+
+/* One line per instance; the primary one has no name and prints as "-". */
+static int k10_call_list_instances(sd_bus *bus) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    const char *instance = NULL;
+    const char *path = NULL;
+    const char *adapter = NULL;
+    int r = sd_bus_call_method(bus, K10_DBUS_SERVICE, k10_object_path, K10_DBUS_IFACE_CONFIG,
+                               "ListInstances", &error, &reply, "");
+
+    if (r < 0) {
+        fprintf(stderr, "D-Bus call failed: %s\n", error.message ? error.message : strerror(-r));
+        goto finish;
+    }
+
+    r = sd_bus_message_enter_container(reply, 'a', "(sos)");
+    while (r >= 0 && (r = sd_bus_message_read(reply, "(sos)", &instance, &path, &adapter)) > 0) {
+        printf("%s %s %s\n", instance[0] != '\0' ? instance : "-", adapter, path);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_exit_container(reply);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to parse response: %s\n", strerror(-r));
+    }
+
+finish:
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+/* Named instances live below the primary object, see [instance.<name>] in the config. */
+static int k10_select_instance(const char *instance) {
+    size_t length = strlen(instance);
+
+    if (length >= K10_DBUS_OBJECT_MAX - sizeof(K10_DBUS_OBJECT)) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        char c = instance[i];
+
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '_')) {
+            return -EINVAL;
         }
-    } else if (strcmp(type, "bool") == 0) {
-        bool parsed = false;
-        if (k10_parse_bool(value, &parsed) != 0) {
-            fprintf(stderr, "Invalid bool value: %s\n", value);
-            r = -EINVAL;
+    }
+
+    if (length > 0) {
+        snprintf(k10_object_path, sizeof(k10_object_path), "%s/%s", K10_DBUS_OBJECT, instance);
+    }
+    return 0;
+}
+
+/* Prints the stats as key=value like status, then the throughput they imply. */
+static int k10_print_replay_stats(sd_bus_message *reply) {
+    uint64_t dispatched = 0;
+    uint64_t elapsed_usec = 0;
+    int r = sd_bus_message_enter_container(reply, 'a', "{sv}");
+
+    while (r >= 0 && (r = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
+        const char *key = NULL;
+        const char *contents = NULL;
+        uint64_t value = 0;
+        int flag = 0;
+
+        r = sd_bus_message_read(reply, "s", &key);
+        if (r >= 0) {
+            r = sd_bus_message_peek_type(reply, NULL, &contents);
+        }
+        if (r < 0) {
+            return r;
+        }
+
+        if (strcmp(contents, "t") == 0) {
+            r = sd_bus_message_read(reply, "v", "t", &value);
+            printf("%s=%llu\n", key, (unsigned long long)value);
         } else {
-            r = sd_bus_message_append(m, "v", "b", parsed ? 1 : 0);
+            r = sd_bus_message_read(reply, "v", "b", &flag);
+            printf("%s=%s\n", key, flag ? "true" : "false");
         }
-    } else if (strcmp(type, "list") == 0) {
-        r = k10_append_string_array(m, value);
-    } else {
-        fprintf(stderr, "Unknown type: %s\n", type);
-        r = -EINVAL;
+        if (r < 0) {
+            return r;
+        }
+
+        if (strcmp(key, "dispatched") == 0) {
+            dispatched = value;
+        } else if (strcmp(key, "elapsed_usec") == 0) {
+            elapsed_usec = value;
+        }
+
+        r = sd_bus_message_exit_container(reply);
     }
 
     if (r < 0) {
-        goto finish;
+        return r;
     }
 
-    r = sd_bus_message_close_container(m);
+    if (elapsed_usec > 0) {
+        printf("frames_per_sec=%.0f\n", (double)dispatched * 1e6 / (double)elapsed_usec);
+    }
+
+    return sd_bus_message_exit_container(reply);
+}
+
+/* The daemon maps the file through the passed descriptor and answers once the replay ends. */
+static int k10_call_replay(sd_bus *bus, const char *path, double speed, const char *direction) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *m = NULL;
+    sd_bus_message *reply = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int r = 0;
+
+    if (fd < 0) {
+        r = -errno;
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return r;
+    }
+
+    r = sd_bus_message_new_method_call(bus, &m, K10_DBUS_SERVICE, k10_object_path,
+                                       K10_DBUS_IFACE_BARREL, "Replay");
     if (r < 0) {
         goto finish;
     }
 
-    r = sd_bus_message_close_container(m);
+    r = sd_bus_message_append(m, "hds", fd, speed, direction);
     if (r < 0) {
         goto finish;
     }
 
-    r = sd_bus_call(bus, m, 0, &error, &reply);
+    /* A replay at the captured pace runs as long as the capture did. */
+    r = sd_bus_call(bus, m, UINT64_MAX, &error, &reply);
     if (r < 0) {
         fprintf(stderr, "D-Bus call failed: %s\n", error.message ? error.message : strerror(-r));
         goto finish;
     }
 
-    r = sd_bus_message_read(reply, "b", &r);
+    r = k10_print_replay_stats(reply);
     if (r < 0) {
-        fprintf(stderr, "Invalid reply: %s\n", strerror(-r));
+        fprintf(stderr, "Failed to parse response: %s\n", strerror(-r));
     }
 
 finish:
     sd_bus_error_free(&error);
     sd_bus_message_unref(reply);
     sd_bus_message_unref(m);
+    close(fd);
     return r;
 }
 
+static int k10_replay_command(sd_bus *bus, const char *name, int argc, char **argv) {
+    const char *direction = "writes";
+    double speed = 1.0;
+    char *end = NULL;
+
+    if (argc == 1 && strcmp(argv[0], "--cancel") == 0) {
+        return k10_call_simple(bus, K10_DBUS_IFACE_BARREL, "CancelReplay");
+    }
+
+    if (argc < 1 || argv[0][0] == '-') {
+        k10_print_usage(name);
+        return -EINVAL;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "max") == 0) {
+                speed = 0;
+                continue;
+            }
+            speed = strtod(argv[i], &end);
+            if (end == argv[i] || *end != '\0' || !(speed > 0)) {
+                fprintf(stderr, "Invalid speed: %s\n", argv[i]);
+                return -EINVAL;
+            }
+        } else if (strcmp(argv[i], "--direction") == 0 && i + 1 < argc) {
+            direction = argv[++i];
+        } else {
+            k10_print_usage(name);
+            return -EINVAL;
+        }
+    }
+
+    return k10_call_replay(bus, argv[0], speed, direction);
+}
+
 static const char *k10_get_mode(int argc, char **argv, const char *fallback) {
     for (int i = 0; i < argc; i++) {
         if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
@@ -366,11 +667,707 @@ static const char *k10_get_mode(int argc, char **argv, const char *fallback) {
     return fallback;
 }
 
+#define K10_BATCH_MAX_ARGS 16
+
+enum k10_batch_output {
+    K10_BATCH_OUTPUT_NONE = 0,
+    K10_BATCH_OUTPUT_DICT,
+    K10_BATCH_OUTPUT_LOG_LEVELS,
+    /* SetConfig answers b: false when the daemon could not schedule the save. */
+    K10_BATCH_OUTPUT_SAVED,
+};
+
+/* One pipelined method call; consecutive `config set` lines share a single SetConfig. */
+struct k10_batch_call {
+    sd_bus_message *m;
+    sd_bus_message *reply;
+    enum k10_batch_output output;
+    /* A SetConfig whose dict is still open for more entries. */
+    bool open;
+    size_t *pending;
+};
+
+struct k10_batch_line {
+    unsigned int number;
+    char *text;
+    /* Index into calls; SIZE_MAX when the line failed before anything was sent. */
+    size_t call;
+};
+
+struct k10_batch {
+    struct k10_batch_line *lines;
+    size_t line_count;
+    struct k10_batch_call *calls;
+    size_t call_count;
+    size_t pending;
+};
+
+/* Splits on blanks; double quotes keep blanks and \ escapes the next character. */
+static int k10_batch_split(char *line, char **argv, int max) {
+    int argc = 0;
+    char *in = line;
+
+    while (*in != '\0') {
+        char *out = NULL;
+        bool quoted = false;
+
+        while (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n') {
+            in++;
+        }
+        if (*in == '\0' || *in == '#') {
+            break;
+        }
+        if (argc == max) {
+            return -E2BIG;
+        }
+
+        argv[argc++] = out = in;
+        while (*in != '\0' && (quoted || (*in != ' ' && *in != '\t' && *in != '\r' &&
+                                          *in != '\n'))) {
+            if (*in == '"') {
+                quoted = !quoted;
+                in++;
+            } else if (*in == '\\' && in[1] != '\0') {
+                *out++ = in[1];
+                in += 2;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        if (quoted) {
+            return -EINVAL;
+        }
+        if (*in != '\0') {
+            in++;
+        }
+        *out = '\0';
+    }
+
+    return argc;
+}
+
+static int k10_batch_add_call(struct k10_batch *batch, sd_bus_message *m,
+                              enum k10_batch_output output, size_t *out) {
+    struct k10_batch_call *calls = NULL;
+
+    calls = realloc(batch->calls, (batch->call_count + 1) * sizeof(*calls));
+    if (calls == NULL) {
+        sd_bus_message_unref(m);
+        return -ENOMEM;
+    }
+
+    batch->calls = calls;
+    memset(&calls[batch->call_count], 0, sizeof(*calls));
+    calls[batch->call_count].m = m;
+    calls[batch->call_count].output = output;
+    calls[batch->call_count].pending = &batch->pending;
+    *out = batch->call_count++;
+    return 0;
+}
+
+static int k10_batch_close_config(struct k10_batch *batch) {
+    struct k10_batch_call *last = NULL;
+
+    if (batch->call_count == 0) {
+        return 0;
+    }
+
+    last = &batch->calls[batch->call_count - 1];
+    if (!last->open) {
+        return 0;
+    }
+
+    last->open = false;
+    return sd_bus_message_close_container(last->m);
+}
+
+static int k10_batch_config_set(struct k10_batch *batch, sd_bus *bus, int argc, char **argv,
+                                size_t *out) {
+    struct k10_batch_call *last = NULL;
+    sd_bus_message *m = NULL;
+    const char *type = "string";
+    int r = 0;
+
+    for (int i = 4; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--type") == 0) {
+            type = argv[i + 1];
+            break;
+        }
+    }
+
+    last = batch->call_count > 0 ? &batch->calls[batch->call_count - 1] : NULL;
+    if (last == NULL || !last->open) {
+        r = sd_bus_message_new_method_call(bus, &m, K10_DBUS_SERVICE, k10_object_path,
+                                           K10_DBUS_IFACE_CONFIG, "SetConfig");
+        if (r >= 0) {
+            r = sd_bus_message_open_container(m, 'a', "{sv}");
+        }
+        if (r >= 0) {
+            r = k10_batch_add_call(batch, m, K10_BATCH_OUTPUT_SAVED, out);
+            m = NULL;
+        }
+        if (r < 0) {
+            sd_bus_message_unref(m);
+            return r;
+        }
+        last = &batch->calls[*out];
+        last->open = true;
+    }
+
+    /* A rejected value is not appended, so the rest of the dict still goes out. */
+    *out = (size_t)(last - batch->calls);
+    return k10_append_config_entry(last->m, argv[2], argv[3], type);
+}
+
+/* Builds the call for one line in the CLI's own syntax, minus the program name. */
+static int k10_batch_prepare(struct k10_batch *batch, sd_bus *bus, int argc, char **argv,
+                             size_t *out) {
+    const char *interface = NULL;
+    const char *method = NULL;
+    enum k10_batch_output output = K10_BATCH_OUTPUT_NONE;
+    sd_bus_message *m = NULL;
+    int r = 0;
+
+    if (argc >= 4 && strcmp(argv[0], "config") == 0 && strcmp(argv[1], "set") == 0) {
+        return k10_batch_config_set(batch, bus, argc, argv, out);
+    }
+
+    r = k10_batch_close_config(batch);
+    if (r < 0) {
+        return r;
+    }
+
+    if (strcmp(argv[0], "status") == 0) {
+        interface = k10_mode_iface(k10_get_mode(argc - 1, argv + 1, K10_DEFAULT_MODE));
+        method = "GetStatus";
+        output = K10_BATCH_OUTPUT_DICT;
+    } else if (strcmp(argv[0], "start") == 0 || strcmp(argv[0], "stop") == 0 ||
+               strcmp(argv[0], "reload") == 0) {
+        interface = k10_mode_iface(k10_get_mode(argc - 1, argv + 1, K10_DEFAULT_MODE));
+        method = strcmp(argv[0], "start") == 0  ? "Start"
+                 : strcmp(argv[0], "stop") == 0 ? "Stop"
+                                                : "Reload";
+    } else if (argc == 2 && strcmp(argv[0], "config") == 0 && strcmp(argv[1], "get") == 0) {
+        interface = K10_DBUS_IFACE_CONFIG;
+        method = "GetConfig";
+        output = K10_BATCH_OUTPUT_DICT;
+    } else if (argc == 2 && strcmp(argv[0], "config") == 0 && strcmp(argv[1], "reload") == 0) {
+        interface = K10_DBUS_IFACE_CONFIG;
+        method = "Reload";
+    } else if ((argc == 1 || argc == 3) && strcmp(argv[0], "log-level") == 0) {
+        interface = K10_DBUS_IFACE_CONFIG;
+        method = argc == 1 ? "GetLogLevels" : "SetLogLevel";
+        output = argc == 1 ? K10_BATCH_OUTPUT_LOG_LEVELS : K10_BATCH_OUTPUT_NONE;
+    } else if (argc == 1 && strcmp(argv[0], "relay") == 0) {
+        interface = K10_DBUS_IFACE_BARREL;
+        method = "GetRelayStats";
+        output = K10_BATCH_OUTPUT_DICT;
+    } else {
+        /* replay and monitor block for as long as they run and are left to their own invocation. */
+        return -EOPNOTSUPP;
+    }
+
+    r = sd_bus_message_new_method_call(bus, &m, K10_DBUS_SERVICE, k10_object_path, interface,
+                                       method);
+    if (r >= 0 && strcmp(method, "SetLogLevel") == 0) {
+        r = sd_bus_message_append(m, "ss", argv[1], argv[2]);
+    }
+    if (r < 0) {
+        sd_bus_message_unref(m);
+        return r;
+    }
+
+    return k10_batch_add_call(batch, m, output, out);
+}
+
+static int k10_batch_read(struct k10_batch *batch, sd_bus *bus, FILE *input) {
+    char *line = NULL;
+    size_t size = 0;
+    unsigned int number = 0;
+    int r = 0;
+
+    while (getline(&line, &size, input) >= 0) {
+        struct k10_batch_line *lines = NULL;
+        struct k10_batch_line *entry = NULL;
+        char *argv[K10_BATCH_MAX_ARGS];
+        char *text = NULL;
+        int argc = 0;
+
+        number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        text = strdup(line);
+        if (text == NULL) {
+            r = -ENOMEM;
+            break;
+        }
+
+        argc = k10_batch_split(line, argv, K10_BATCH_MAX_ARGS);
+        if (argc == 0) {
+            free(text);
+            continue;
+        }
+
+        lines = realloc(batch->lines, (batch->line_count + 1) * sizeof(*lines));
+        if (lines == NULL) {
+            free(text);
+            r = -ENOMEM;
+            break;
+        }
+
+        batch->lines = lines;
+        entry = &lines[batch->line_count++];
+        entry->number = number;
+        entry->text = text;
+        entry->call = SIZE_MAX;
+
+        if (argc < 0) {
+            fprintf(stderr, "%u: %s\n", number,
+                    argc == -E2BIG ? "too many arguments" : "unterminated quote");
+            continue;
+        }
+
+        r = k10_batch_prepare(batch, bus, argc, argv, &entry->call);
+        if (r == -ENOMEM) {
+            break;
+        }
+        if (r < 0) {
+            if (r == -EOPNOTSUPP) {
+                fprintf(stderr, "%u: not a batch command: %s\n", number, text);
+            }
+            entry->call = SIZE_MAX;
+            r = 0;
+        }
+    }
+
+    free(line);
+    if (r < 0) {
+        return r;
+    }
+
+    return k10_batch_close_config(batch);
+}
+
+static int k10_batch_on_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_batch_call *call = userdata;
+
+    (void)ret_error;
+
+    call->reply = sd_bus_message_ref(m);
+    (*call->pending)--;
+    return 0;
+}
+
+/* All calls go out back to back on the one connection; the daemon runs them in order. */
+static int k10_batch_send(struct k10_batch *batch, sd_bus *bus) {
+    int r = 0;
+
+    for (size_t i = 0; i < batch->call_count; i++) {
+        struct k10_batch_call *call = &batch->calls[i];
+
+        r = sd_bus_call_async(bus, NULL, call->m, k10_batch_on_reply, call, 0);
+        if (r < 0) {
+            fprintf(stderr, "Failed to send call: %s\n", strerror(-r));
+            return r;
+        }
+        batch->pending++;
+    }
+
+    while (batch->pending > 0) {
+        r = sd_bus_process(bus, NULL);
+        if (r == 0) {
+            r = sd_bus_wait(bus, UINT64_MAX);
+        }
+        if (r < 0) {
+            fprintf(stderr, "D-Bus connection failed: %s\n", strerror(-r));
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+/* One result line per command, followed by what a get printed outside a batch. */
+static bool k10_batch_report(const struct k10_batch *batch) {
+    bool ok = true;
+
+    for (size_t i = 0; i < batch->line_count; i++) {
+        const struct k10_batch_line *line = &batch->lines[i];
+        struct k10_batch_call *call = NULL;
+        const sd_bus_error *error = NULL;
+        int saved = 1;
+        int r = 0;
+
+        if (line->call == SIZE_MAX) {
+            printf("%u %s: failed: not sent\n", line->number, line->text);
+            ok = false;
+            continue;
+        }
+
+        call = &batch->calls[line->call];
+        error = sd_bus_message_get_error(call->reply);
+        if (error != NULL) {
+            printf("%u %s: failed: %s\n", line->number, line->text,
+                   error->message != NULL ? error->message : error->name);
+            ok = false;
+            continue;
+        }
+
+        /* Folded lines share the reply, which can only be read once. */
+        if (call->output == K10_BATCH_OUTPUT_SAVED) {
+            r = sd_bus_message_rewind(call->reply, true);
+            if (r >= 0) {
+                r = sd_bus_message_read(call->reply, "b", &saved);
+            }
+        }
+        if (r >= 0 && !saved) {
+            printf("%u %s: failed: not saved\n", line->number, line->text);
+            ok = false;
+            continue;
+        }
+
+        printf("%u %s: ok\n", line->number, line->text);
+        if (call->output == K10_BATCH_OUTPUT_DICT) {
+            r = k10_print_dict(call->reply);
+        } else if (call->output == K10_BATCH_OUTPUT_LOG_LEVELS) {
+            r = k10_print_log_levels(call->reply);
+        }
+        if (r < 0) {
+            fprintf(stderr, "Failed to parse response: %s\n", strerror(-r));
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static int k10_batch_command(sd_bus *bus, const char *name, int argc, char **argv) {
+    struct k10_batch batch;
+    FILE *input = stdin;
+    bool ok = false;
+    int r = 0;
+
+    if (argc > 1) {
+        k10_print_usage(name);
+        return -EINVAL;
+    }
+
+    if (argc == 1 && strcmp(argv[0], "-") != 0) {
+        input = fopen(argv[0], "re");
+        if (input == NULL) {
+            r = -errno;
+            fprintf(stderr, "Failed to open %s: %s\n", argv[0], strerror(errno));
+            return r;
+        }
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    r = k10_batch_read(&batch, bus, input);
+    if (r >= 0) {
+        r = k10_batch_send(&batch, bus);
+    }
+    if (r >= 0) {
+        ok = k10_batch_report(&batch);
+    }
+
+    for (size_t i = 0; i < batch.call_count; i++) {
+        sd_bus_message_unref(batch.calls[i].m);
+        sd_bus_message_unref(batch.calls[i].reply);
+    }
+    for (size_t i = 0; i < batch.line_count; i++) {
+        free(batch.lines[i].text);
+    }
+    free(batch.calls);
+    free(batch.lines);
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    if (r < 0) {
+        return r;
+    }
+    return ok ? 0 : -EIO;
+}
+
+#define K10_MONITOR_MAX_FILTERS 32
+
+struct k10_monitor {
+    bool json;
+    /* Property names to keep; every property when empty. */
+    const char *properties[K10_MONITOR_MAX_FILTERS];
+    size_t property_count;
+};
+
+static void k10_monitor_print_time(bool json) {
+    struct timespec now;
+    struct tm local;
+    char text[32];
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    localtime_r(&now.tv_sec, &local);
+    strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &local);
+
+    if (json) {
+        printf("{\"time\":\"%s.%03ld\"", text, now.tv_nsec / 1000000L);
+    } else {
+        printf("%s.%03ld", text, now.tv_nsec / 1000000L);
+    }
+}
+
+static bool k10_monitor_wants(const struct k10_monitor *monitor, const char *property) {
+    if (monitor->property_count == 0) {
+        return true;
+    }
+
+    for (size_t i = 0; i < monitor->property_count; i++) {
+        if (strcmp(monitor->properties[i], property) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Prints the line prefix on the first property that passes the filters. */
+static void k10_monitor_begin(const struct k10_monitor *monitor, const char *interface,
+                              size_t *printed) {
+    const char *name = strrchr(interface, '.');
+
+    if ((*printed)++ > 0) {
+        printf(monitor->json ? "," : " ");
+        return;
+    }
+
+    k10_monitor_print_time(monitor->json);
+    if (monitor->json) {
+        printf(",\"event\":\"properties\",\"interface\":");
+        k10_print_json_string(interface);
+        printf(",\"changed\":{");
+    } else {
+        printf(" %s ", name != NULL ? name + 1 : interface);
+    }
+}
+
+static int k10_monitor_on_properties(sd_bus_message *m, void *userdata,
+                                     sd_bus_error *ret_error) {
+    const struct k10_monitor *monitor = userdata;
+    const char *interface = NULL;
+    const char *property = NULL;
+    size_t printed = 0;
+    size_t invalidated = 0;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_read(m, "s", &interface);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_enter_container(m, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        r = sd_bus_message_read(m, "s", &property);
+        if (r < 0) {
+            return r;
+        }
+
+        if (!k10_monitor_wants(monitor, property)) {
+            r = sd_bus_message_skip(m, "v");
+        } else {
+            k10_monitor_begin(monitor, interface, &printed);
+            if (monitor->json) {
+                k10_print_json_string(property);
+                putchar(':');
+            } else {
+                printf("%s=", property);
+            }
+
+            r = sd_bus_message_enter_container(m, 'v', NULL);
+            if (r >= 0) {
+                r = k10_print_variant(m, monitor->json);
+            }
+            if (r >= 0) {
+                r = sd_bus_message_exit_container(m);
+            }
+        }
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_exit_container(m);
+        if (r < 0) {
+            return r;
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_exit_container(m);
+    if (r < 0) {
+        return r;
+    }
+
+    /* Invalidated properties changed but carry no value; fetch them if needed. */
+    r = sd_bus_message_enter_container(m, 'a', "s");
+    if (r < 0) {
+        return r;
+    }
+
+    while ((r = sd_bus_message_read(m, "s", &property)) > 0) {
+        if (!k10_monitor_wants(monitor, property)) {
+            continue;
+        }
+
+        if (monitor->json) {
+            if (printed == 0) {
+                k10_monitor_begin(monitor, interface, &printed);
+            }
+            printf(invalidated++ == 0 ? "},\"invalidated\":[" : ",");
+            k10_print_json_string(property);
+        } else {
+            k10_monitor_begin(monitor, interface, &printed);
+            printf("%s (invalidated)", property);
+        }
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    if (monitor->json && (printed > 0 || invalidated > 0)) {
+        printf(invalidated > 0 ? "]}\n" : "},\"invalidated\":[]}\n");
+    } else if (printed > 0) {
+        printf("\n");
+    }
+
+    fflush(stdout);
+    return 0;
+}
+
+static int k10_monitor_on_owner(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const struct k10_monitor *monitor = userdata;
+    const char *name = NULL;
+    const char *old_owner = NULL;
+    const char *new_owner = NULL;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
+    if (r < 0) {
+        return r;
+    }
+
+    k10_monitor_print_time(monitor->json);
+    if (monitor->json) {
+        printf(",\"event\":\"daemon\",\"owner\":");
+        k10_print_json_string(new_owner);
+        printf("}\n");
+    } else if (new_owner[0] != '\0') {
+        printf(" daemon %s (%s)\n", old_owner[0] != '\0' ? "restarted" : "started", new_owner);
+    } else {
+        printf(" daemon stopped\n");
+    }
+
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * Follows PropertiesChanged on the daemon's object, which carries every
+ * status and config change with its new value, until the connection drops.
+ * The process sleeps in sd_bus_wait between signals.
+ */
+static int k10_monitor_command(sd_bus *bus, const char *name, int argc, char **argv) {
+    struct k10_monitor monitor;
+    const char *interfaces[K10_MONITOR_MAX_FILTERS];
+    size_t interface_count = 0;
+    char match[512];
+    int r = 0;
+
+    memset(&monitor, 0, sizeof(monitor));
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            monitor.json = true;
+        } else if (strcmp(argv[i], "--interface") == 0 && i + 1 < argc &&
+                   interface_count < K10_MONITOR_MAX_FILTERS) {
+            const char *value = argv[++i];
+
+            if (strcmp(value, "config") == 0) {
+                value = K10_DBUS_IFACE_CONFIG;
+            } else if (strcmp(value, "status") == 0) {
+                value = K10_DBUS_IFACE_BARREL;
+            } else if (strchr(value, '.') == NULL || strchr(value, '\'') != NULL) {
+                fprintf(stderr, "Invalid interface: %s\n", value);
+                return -EINVAL;
+            }
+            interfaces[interface_count++] = value;
+        } else if (strcmp(argv[i], "--property") == 0 && i + 1 < argc &&
+                   monitor.property_count < K10_MONITOR_MAX_FILTERS) {
+            monitor.properties[monitor.property_count++] = argv[++i];
+        } else {
+            k10_print_usage(name);
+            return -EINVAL;
+        }
+    }
+
+    /* Interfaces are filtered by the bus, so unrelated changes never wake us. */
+    for (size_t i = 0; i == 0 || i < interface_count; i++) {
+        int length = snprintf(match, sizeof(match),
+                              "type='signal',path='%s',interface='%s',member='PropertiesChanged'",
+                              k10_object_path, K10_DBUS_IFACE_PROPERTIES);
+
+        if (interface_count > 0) {
+            snprintf(match + length, sizeof(match) - (size_t)length, ",arg0='%s'", interfaces[i]);
+        }
+
+        r = sd_bus_add_match(bus, NULL, match, k10_monitor_on_properties, &monitor);
+        if (r < 0) {
+            fprintf(stderr, "Failed to add match: %s\n", strerror(-r));
+            return r;
+        }
+    }
+
+    snprintf(match, sizeof(match),
+             "type='signal',sender='org.freedesktop.DBus',member='NameOwnerChanged',arg0='%s'",
+             K10_DBUS_SERVICE);
+    r = sd_bus_add_match(bus, NULL, match, k10_monitor_on_owner, &monitor);
+    if (r < 0) {
+        fprintf(stderr, "Failed to add match: %s\n", strerror(-r));
+        return r;
+    }
+
+    for (;;) {
+        r = sd_bus_process(bus, NULL);
+        if (r == 0) {
+            r = sd_bus_wait(bus, UINT64_MAX);
+        }
+        if (r < 0) {
+            fprintf(stderr, "D-Bus connection failed: %s\n", strerror(-r));
+            return r;
+        }
+    }
+}
+
 int main(int argc, char **argv) {
     sd_bus *bus = NULL;
     const char *command = NULL;
     int r = 0;
 
+    if (argc >= 3 && strcmp(argv[1], "--instance") == 0) {
+        if (k10_select_instance(argv[2]) < 0) {
+            fprintf(stderr, "Invalid instance name: %s\n", argv[2]);
+            return 1;
+        }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
     if (argc < 2) {
         k10_print_usage(argv[0]);
         return 1;
@@ -422,6 +1419,25 @@ int main(int argc, char **argv) {
             k10_print_usage(argv[0]);
             r = -EINVAL;
         }
+    } else if (strcmp(command, "log-level") == 0) {
+        if (argc == 2) {
+            r = k10_call_get_log_levels(bus);
+        } else if (argc == 4) {
+            r = k10_call_set_log_level(bus, argv[2], argv[3]);
+        } else {
+            k10_print_usage(argv[0]);
+            r = -EINVAL;
+        }
+    } else if (strcmp(command, "replay") == 0) {
+        r = k10_replay_command(bus, argv[0], argc - 2, argv + 2);
+    } else if (strcmp(command, "relay") == 0) {
+        r = k10_call_get_dict(bus, K10_DBUS_IFACE_BARREL, "GetRelayStats");
+    } else if (strcmp(command, "instances") == 0) {
+        r = k10_call_list_instances(bus);
+    } else if (strcmp(command, "batch") == 0) {
+        r = k10_batch_command(bus, argv[0], argc - 2, argv + 2);
+    } else if (strcmp(command, "monitor") == 0) {
+        r = k10_monitor_command(bus, argv[0], argc - 2, argv + 2);
     } else {
         k10_print_usage(argv[0]);
         r = -EINVAL;
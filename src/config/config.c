@@ -1,14 +1,21 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_CONFIG
+
 #include "k10_barrel/config.h"
 
-#include <ctype.h>
+#include "k10_barrel/config_schema.h"
+#include "k10_barrel/file.h"
+#include "k10_barrel/log.h"
+#include "k10_barrel/toml.h"
+
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
-
-#define K10_MAX_LINE 256
-#define K10_MAX_VALUE 1024
+#include <sys/stat.h>
+#include <unistd.h>
 
 static void k10_config_set_defaults(struct k10_config *config) {
     memset(config, 0, sizeof(*config));
@@ -18,336 +25,653 @@ static void k10_config_set_defaults(struct k10_config *config) {
     config->include_tx_power = true;
     config->fw_major = 1;
     config->fw_minor = 0;
+    config->save_delay_ms = 250;
+    config->notify_queue_depth = 32;
+    strncpy(config->notify_queue_policy, K10_NOTIFY_POLICY_DROP_OLDEST,
+            sizeof(config->notify_queue_policy) - 1);
+    strncpy(config->capture_format, K10_CAPTURE_FORMAT_BTSNOOP,
+            sizeof(config->capture_format) - 1);
+    strncpy(config->capture_path, "/var/log/k10-barrel-emulator/gatt",
+            sizeof(config->capture_path) - 1);
+    config->capture_ring_size = 1024;
+    config->capture_file_size_kb = 4096;
+    config->capture_file_count = 4;
 }
 
-static char *k10_trim(char *value) {
-    char *end = NULL;
+/* Decoded copy of an escaped string; unescaped strings are used in place. */
+#define K10_CONFIG_STRING_MAX 256
+
+struct k10_config_loader {
+    const char *path;
+    struct k10_config_set *set;
+    /* Instances whose table names its own capture_path. */
+    bool capture_path_set[K10_INSTANCE_MAX];
+    struct k10_config *list_config;
+    struct k10_config candidate;
+    const struct k10_config_field *list_field;
+    unsigned int list_nesting;
+    bool list_invalid;
+    /* Inside an array or inline table that was rejected; its elements are ignored. */
+    unsigned int skip_nesting;
+};
+
+static void k10_config_reject(const struct k10_config_loader *loader,
+                              const struct k10_config_field *field,
+                              const struct k10_toml_value *value) {
+    k10_log_error("config: %s:%u:%u: ignoring invalid value for %s", loader->path, value->line,
+                  value->column, field->name);
+}
 
-    while (*value != '\0' && isspace((unsigned char)*value)) {
-        value++;
+/* Object path elements, minus the names the primary instance's children already use. */
+bool k10_config_instance_name_valid(const char *name, size_t length) {
+    if (length == 0 || length >= K10_INSTANCE_NAME_MAX) {
+        return false;
     }
 
-    if (*value == '\0') {
-        return value;
-    }
+    for (size_t i = 0; i < length; i++) {
+        char c = name[i];
 
-    end = value + strlen(value) - 1;
-    while (end > value && isspace((unsigned char)*end)) {
-        *end = '\0';
-        end--;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '_')) {
+            return false;
+        }
     }
 
-    return value;
+    return !(length == 4 && memcmp(name, "gatt", 4) == 0) &&
+           !(length >= 13 && memcmp(name, "advertisement", 13) == 0);
 }
 
-static void k10_copy_string(char *dest, size_t dest_size, const char *src) {
-    if (dest_size == 0) {
-        return;
-    }
-
-    if (src == NULL) {
-        dest[0] = '\0';
-        return;
+int k10_config_set_find(const struct k10_config_set *set, const char *name) {
+    for (unsigned int i = 0; i < set->count; i++) {
+        if (strcmp(set->names[i], name) == 0) {
+            return (int)i;
+        }
     }
 
-    strncpy(dest, src, dest_size - 1);
-    dest[dest_size - 1] = '\0';
+    return -ENOENT;
 }
 
-static int k10_parse_bool(const char *value, bool *out_value) {
-    if (strcasecmp(value, "true") == 0) {
-        *out_value = true;
-        return 0;
+/* A new [instance.<name>] starts from whatever the top-level keys set so far. */
+static struct k10_config *k10_config_loader_instance(struct k10_config_loader *loader,
+                                                     const struct k10_toml_value *value,
+                                                     struct k10_toml_slice name) {
+    struct k10_config_set *set = loader->set;
+
+    for (unsigned int i = 1; i < set->count; i++) {
+        if (k10_toml_slice_equal(name, set->names[i])) {
+            return &set->configs[i];
+        }
     }
 
-    if (strcasecmp(value, "false") == 0) {
-        *out_value = false;
-        return 0;
+    if (!k10_config_instance_name_valid(name.start, name.length)) {
+        k10_log_error("config: %s:%u:%u: ignoring instance with invalid name %.*s", loader->path,
+                      value->line, value->column, (int)name.length, name.start);
+        return NULL;
     }
 
-    return -1;
+    if (set->count == K10_INSTANCE_MAX) {
+        k10_log_error("config: %s:%u:%u: ignoring instance %.*s, at most %d are supported",
+                      loader->path, value->line, value->column, (int)name.length, name.start,
+                      K10_INSTANCE_MAX);
+        return NULL;
+    }
+
+    memcpy(set->names[set->count], name.start, name.length);
+    set->names[set->count][name.length] = '\0';
+    set->configs[set->count] = set->configs[0];
+    return &set->configs[set->count++];
 }
 
-static int k10_parse_uint(const char *value, unsigned int *out_value) {
-    char *end = NULL;
-    unsigned long parsed = 0;
+/* Top-level keys belong to the primary instance, instance.<name>.<key> to a named one. */
+static const struct k10_config_field *k10_config_path_field(struct k10_config_loader *loader,
+                                                            const struct k10_toml_path *path,
+                                                            const struct k10_toml_value *value,
+                                                            struct k10_config **out_config) {
+    const struct k10_config_field *field = NULL;
+    const struct k10_toml_slice *key = &path->parts[path->depth - 1];
 
-    errno = 0;
-    parsed = strtoul(value, &end, 0);
-    if (errno != 0 || end == value) {
-        return -1;
+    if (path->depth != 1 &&
+        (path->depth != 3 || !k10_toml_slice_equal(path->parts[0], "instance"))) {
+        return NULL;
     }
 
-    while (*end != '\0') {
-        if (!isspace((unsigned char)*end)) {
-            return -1;
-        }
-        end++;
+    field = k10_config_field_lookup(key->start, key->length);
+    if (field == NULL) {
+        return NULL;
     }
 
-    *out_value = (unsigned int)parsed;
-    return 0;
+    *out_config = path->depth == 1 ? &loader->set->configs[0]
+                                   : k10_config_loader_instance(loader, value, path->parts[1]);
+    return *out_config != NULL ? field : NULL;
 }
 
-static int k10_parse_string(char *value, char *out, size_t out_size) {
-    size_t len = 0;
+static void k10_config_loader_applied(struct k10_config_loader *loader,
+                                      const struct k10_config_field *field,
+                                      const struct k10_config *config) {
+    size_t index = (size_t)(config - loader->set->configs);
 
-    value = k10_trim(value);
-    len = strlen(value);
+    if (index > 0 && strcmp(field->name, "capture_path") == 0) {
+        loader->capture_path_set[index] = true;
+    }
+}
 
-    if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
-        value[len - 1] = '\0';
-        value++;
+static int k10_config_string_value(const struct k10_toml_value *value, char *buffer,
+                                   const char **out_string, size_t *out_length) {
+    int r = 0;
+
+    if (!value->escaped) {
+        *out_string = value->raw.start;
+        *out_length = value->raw.length;
+        return 0;
     }
 
-    k10_copy_string(out, out_size, value);
+    r = k10_toml_string_decode(value, buffer, K10_CONFIG_STRING_MAX, out_length);
+    if (r < 0) {
+        return r;
+    }
+
+    *out_string = buffer;
     return 0;
 }
 
-static void k10_reset_service_uuids(struct k10_config *config) {
-    config->service_uuid_count = 0;
-    memset(config->service_uuids, 0, sizeof(config->service_uuids));
-}
+static int k10_config_apply_value(struct k10_config *config, const struct k10_config_field *field,
+                                  const struct k10_toml_value *value) {
+    char buffer[K10_CONFIG_STRING_MAX];
+    const char *string = NULL;
+    size_t length = 0;
+    int r = 0;
+
+    switch (field->type) {
+    case K10_CONFIG_STRING:
+    case K10_CONFIG_STRING_LIST:
+        if (value->type != K10_TOML_STRING) {
+            return -EINVAL;
+        }
 
-static char *k10_strip_comment(char *line) {
-    char *comment = NULL;
+        r = k10_config_string_value(value, buffer, &string, &length);
+        if (r < 0) {
+            return r;
+        }
 
-    if (line == NULL) {
-        return line;
-    }
+        if (field->type == K10_CONFIG_STRING_LIST) {
+            return k10_config_append_list(config, field, string, length);
+        }
+
+        return k10_config_set_string(config, field, string, length);
+    case K10_CONFIG_UINT:
+        if (value->type != K10_TOML_INTEGER || value->integer < 0) {
+            return -EINVAL;
+        }
+
+        return k10_config_set_uint(config, field, (unsigned long)value->integer);
+    case K10_CONFIG_BOOL:
+        if (value->type != K10_TOML_BOOL) {
+            return -EINVAL;
+        }
 
-    comment = strpbrk(line, "#;");
-    if (comment != NULL) {
-        *comment = '\0';
+        return k10_config_set_bool(config, field, value->boolean);
     }
 
-    return k10_trim(line);
+    return -EINVAL;
 }
 
-static int k10_parse_service_uuids(char *value, struct k10_config *config) {
-    char *cursor = NULL;
+static int k10_config_on_begin(void *userdata, const struct k10_toml_path *path,
+                               const struct k10_toml_value *value) {
+    struct k10_config_loader *loader = userdata;
+    const struct k10_config_field *field = NULL;
+    struct k10_config *config = NULL;
 
-    value = k10_trim(value);
-    if (*value != '[') {
-        return -1;
+    if (loader->skip_nesting > 0) {
+        loader->skip_nesting++;
+        return 0;
     }
 
-    k10_reset_service_uuids(config);
-    value++;
-    cursor = value;
+    if (loader->list_field != NULL) {
+        loader->list_nesting++;
+        loader->list_invalid = true;
+        return 0;
+    }
 
-    while (*cursor != '\0') {
-        char *item_start = NULL;
-        char *item_end = NULL;
+    field = k10_config_path_field(loader, path, value, &config);
+    if (field == NULL) {
+        return 0;
+    }
 
-        while (*cursor != '\0' && isspace((unsigned char)*cursor)) {
-            cursor++;
-        }
+    if (field->type != K10_CONFIG_STRING_LIST || value->type != K10_TOML_ARRAY) {
+        k10_config_reject(loader, field, value);
+        loader->skip_nesting = 1;
+        return 0;
+    }
 
-        if (*cursor == ']') {
-            return 0;
-        }
+    loader->list_config = config;
+    loader->candidate = *config;
+    k10_config_clear_list(&loader->candidate, field);
+    loader->list_field = field;
+    loader->list_invalid = false;
+    return 0;
+}
 
-        if (*cursor == ',') {
-            cursor++;
-            continue;
-        }
+static int k10_config_on_end(void *userdata, const struct k10_toml_path *path,
+                             const struct k10_toml_value *value) {
+    struct k10_config_loader *loader = userdata;
+    const struct k10_config_field *field = loader->list_field;
 
-        if (*cursor != '"') {
-            return -1;
-        }
+    (void)path;
 
-        item_start = cursor + 1;
-        item_end = strchr(item_start, '"');
-        if (item_end == NULL) {
-            return -1;
-        }
+    if (loader->skip_nesting > 0) {
+        loader->skip_nesting--;
+        return 0;
+    }
 
-        if (config->service_uuid_count < K10_MAX_UUIDS) {
-            size_t length = (size_t)(item_end - item_start);
-            if (length >= sizeof(config->service_uuids[0])) {
-                length = sizeof(config->service_uuids[0]) - 1;
-            }
-            memcpy(config->service_uuids[config->service_uuid_count], item_start, length);
-            config->service_uuids[config->service_uuid_count][length] = '\0';
-            config->service_uuid_count++;
-        }
+    if (field == NULL) {
+        return 0;
+    }
+
+    if (loader->list_nesting > 0) {
+        loader->list_nesting--;
+        return 0;
+    }
 
-        cursor = item_end + 1;
+    loader->list_field = NULL;
+    if (loader->list_invalid || k10_config_field_validate(&loader->candidate, field) != 0) {
+        k10_config_reject(loader, field, value);
+        return 0;
     }
 
+    *loader->list_config = loader->candidate;
     return 0;
 }
 
-static int k10_apply_config_line(char *line, struct k10_config *config) {
-    char *equals = NULL;
-    char *key = NULL;
-    char *value = NULL;
+static int k10_config_on_value(void *userdata, const struct k10_toml_path *path,
+                               const struct k10_toml_value *value) {
+    struct k10_config_loader *loader = userdata;
+    const struct k10_config_field *field = NULL;
+    struct k10_config *config = NULL;
+    struct k10_config candidate;
 
-    if (line == NULL) {
-        return -1;
+    if (loader->skip_nesting > 0) {
+        return 0;
     }
 
-    equals = strchr(line, '=');
-    if (equals == NULL) {
+    if (loader->list_field != NULL) {
+        if (!loader->list_invalid &&
+            k10_config_apply_value(&loader->candidate, loader->list_field, value) != 0) {
+            loader->list_invalid = true;
+        }
         return 0;
     }
 
-    *equals = '\0';
-    key = k10_trim(line);
-    value = k10_trim(equals + 1);
+    field = k10_config_path_field(loader, path, value, &config);
+    if (field == NULL) {
+        return 0;
+    }
 
-    if (*key == '\0' || *value == '\0') {
+    candidate = *config;
+    if (field->type == K10_CONFIG_STRING_LIST ||
+        k10_config_apply_value(&candidate, field, value) != 0 ||
+        k10_config_field_validate(&candidate, field) != 0) {
+        k10_config_reject(loader, field, value);
         return 0;
     }
 
-    if (strcmp(key, "adapter") == 0) {
-        return k10_parse_string(value, config->adapter, sizeof(config->adapter));
+    *config = candidate;
+    k10_config_loader_applied(loader, field, config);
+    return 0;
+}
+
+static const struct k10_toml_handler k10_config_toml_handler = {
+    .value = k10_config_on_value,
+    .begin = k10_config_on_begin,
+    .end = k10_config_on_end,
+};
+
+uint64_t k10_config_content_hash(const char *data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
     }
 
-    if (strcmp(key, "local_name") == 0) {
-        return k10_parse_string(value, config->local_name, sizeof(config->local_name));
+    return hash;
+}
+
+/* Named instances capture next to the primary one unless they say otherwise. */
+static void k10_config_loader_finish(struct k10_config_loader *loader) {
+    struct k10_config_set *set = loader->set;
+
+    for (unsigned int i = 1; i < set->count; i++) {
+        struct k10_config *config = &set->configs[i];
+        char capture_path[sizeof(config->capture_path)];
+
+        if (loader->capture_path_set[i]) {
+            continue;
+        }
+
+        snprintf(capture_path, sizeof(capture_path), "%.*s-%s",
+                 (int)(sizeof(capture_path) - K10_INSTANCE_NAME_MAX - 1),
+                 set->configs[0].capture_path, set->names[i]);
+        memcpy(config->capture_path, capture_path, sizeof(capture_path));
     }
+}
 
-    if (strcmp(key, "company_id") == 0) {
-        return k10_parse_uint(value, &config->company_id);
+int k10_config_parse(const char *data, size_t size, const char *origin,
+                     struct k10_config_set *out_set) {
+    struct k10_config_loader loader;
+    struct k10_config_set *loaded = NULL;
+    struct k10_toml_error error;
+    int r = 0;
+
+    loaded = calloc(1, sizeof(*loaded));
+    if (loaded == NULL) {
+        return -ENOMEM;
     }
 
-    if (strcmp(key, "manufacturer_mac_label") == 0) {
-        return k10_parse_string(value, config->manufacturer_mac_label,
-                                sizeof(config->manufacturer_mac_label));
+    loaded->count = 1;
+    k10_config_set_defaults(&loaded->configs[0]);
+
+    memset(&loader, 0, sizeof(loader));
+    loader.path = origin;
+    loader.set = loaded;
+
+    r = k10_toml_parse(data, size, &k10_config_toml_handler, &loader, &error);
+    if (r < 0) {
+        k10_log_error("config: %s:%u:%u: %s", origin, error.line, error.column, error.message);
+        free(loaded);
+        return r;
     }
 
-    if (strcmp(key, "service_uuids") == 0) {
-        return k10_parse_service_uuids(value, config);
+    k10_config_loader_finish(&loader);
+    *out_set = *loaded;
+    free(loaded);
+    return 0;
+}
+
+/*
+ * The file is read and tokenized in one pass; a syntax error leaves
+ * out_config untouched. Returns -errno when the file cannot be opened.
+ */
+int k10_config_load_hashed(const char *path, struct k10_config_set *out_set, uint64_t *out_hash) {
+    char *data = NULL;
+    size_t size = 0;
+    int fd = -1;
+    int r = 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
     }
 
-    if (strcmp(key, "fd3d_service_data_hex") == 0) {
-        return k10_parse_string(value, config->fd3d_service_data_hex,
-                                sizeof(config->fd3d_service_data_hex));
+    r = k10_file_read(fd, SIZE_MAX, &data, &size);
+    close(fd);
+    if (r < 0) {
+        k10_log_error("config: read %s failed: %s", path, strerror(-r));
+        return r;
     }
 
-    if (strcmp(key, "include_tx_power") == 0) {
-        return k10_parse_bool(value, &config->include_tx_power);
+    r = k10_config_parse(data, size, path, out_set);
+    if (r >= 0 && out_hash != NULL) {
+        *out_hash = k10_config_content_hash(data, size);
     }
 
-    if (strcmp(key, "fw_major") == 0) {
-        return k10_parse_uint(value, &config->fw_major);
+    free(data);
+    return r;
+}
+
+int k10_config_load_set(const char *path, struct k10_config_set *out_set) {
+    int r = 0;
+
+    if (out_set == NULL) {
+        return -1;
     }
 
-    if (strcmp(key, "fw_minor") == 0) {
-        return k10_parse_uint(value, &config->fw_minor);
+    if (path != NULL) {
+        r = k10_config_load_hashed(path, out_set, NULL);
+        if (r >= 0) {
+            return 0;
+        }
+
+        if (r != -ENOENT && r != -EACCES) {
+            return -1;
+        }
     }
 
+    /* No file yet: run on defaults until the first SetConfig writes one. */
+    memset(out_set, 0, sizeof(*out_set));
+    out_set->count = 1;
+    k10_config_set_defaults(&out_set->configs[0]);
     return 0;
 }
 
+/* The primary instance only, for tools that emulate a single dock. */
 int k10_config_load(const char *path, struct k10_config *out_config) {
-    FILE *file = NULL;
-    char line[K10_MAX_LINE];
+    struct k10_config_set *set = NULL;
+    int r = 0;
 
     if (out_config == NULL) {
         return -1;
     }
 
-    k10_config_set_defaults(out_config);
-
-    if (path == NULL) {
-        return 0;
+    set = malloc(sizeof(*set));
+    if (set == NULL) {
+        return -1;
     }
 
-    file = fopen(path, "r");
-    if (file == NULL) {
-        return 0;
+    r = k10_config_load_set(path, set);
+    if (r == 0) {
+        *out_config = set->configs[0];
     }
 
-    while (fgets(line, sizeof(line), file) != NULL) {
-        char *cursor = k10_strip_comment(line);
+    free(set);
+    return r;
+}
 
-        if (*cursor == '\0') {
-            continue;
+static void k10_write_string(FILE *file, const char *value) {
+    fputc('"', file);
+
+    for (const unsigned char *c = (const unsigned char *)value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20 || *c == 0x7F) {
+            fprintf(file, "\\u%04X", *c);
+        } else {
+            fputc(*c, file);
         }
+    }
 
-        if (strncmp(cursor, "service_uuids", strlen("service_uuids")) == 0) {
-            char *equals = strchr(cursor, '=');
-
-            if (equals != NULL) {
-                char value[K10_MAX_VALUE];
-                size_t used = 0;
-                char *value_start = k10_trim(equals + 1);
-
-                if (strchr(value_start, '[') != NULL && strchr(value_start, ']') == NULL) {
-                    used = snprintf(value, sizeof(value), "%s", value_start);
-                    while (fgets(line, sizeof(line), file) != NULL) {
-                        char *next = k10_strip_comment(line);
-
-                        if (*next == '\0') {
-                            continue;
-                        }
-
-                        if (used + 2 < sizeof(value)) {
-                            value[used++] = ' ';
-                            value[used] = '\0';
-                        }
-
-                        if (used + strlen(next) < sizeof(value)) {
-                            strncat(value, next, sizeof(value) - used - 1);
-                            used = strlen(value);
-                        }
-
-                        if (strchr(next, ']') != NULL) {
-                            break;
-                        }
-                    }
-
-                    if (used > 0) {
-                        char combined[K10_MAX_VALUE + 32];
-                        snprintf(combined, sizeof(combined), "service_uuids = %s", value);
-                        k10_apply_config_line(combined, out_config);
-                        continue;
-                    }
-                }
+    fputc('"', file);
+}
+
+static void k10_write_field(FILE *file, const struct k10_config *config,
+                            const struct k10_config_field *field) {
+    unsigned int count = 0;
+
+    fprintf(file, "%s = ", field->name);
+
+    switch (field->type) {
+    case K10_CONFIG_STRING:
+        k10_write_string(file, k10_config_get_string(config, field));
+        break;
+    case K10_CONFIG_UINT:
+        if (field->flags & K10_CONFIG_FLAG_HEX) {
+            fprintf(file, "0x%04X", k10_config_get_uint(config, field));
+        } else {
+            fprintf(file, "%u", k10_config_get_uint(config, field));
+        }
+        break;
+    case K10_CONFIG_BOOL:
+        fputs(k10_config_get_bool(config, field) ? "true" : "false", file);
+        break;
+    case K10_CONFIG_STRING_LIST:
+        count = k10_config_get_list_count(config, field);
+        fputc('[', file);
+        for (unsigned int i = 0; i < count; i++) {
+            k10_write_string(file, k10_config_get_list_item(config, field, i));
+            if (i + 1 < count) {
+                fputs(", ", file);
             }
         }
-
-        k10_apply_config_line(cursor, out_config);
+        fputc(']', file);
+        break;
     }
 
-    fclose(file);
-    return 0;
+    fputc('\n', file);
 }
 
-int k10_config_save(const char *path, const struct k10_config *config) {
+/* Instance tables are written out in full, so loading the result needs no inheritance. */
+int k10_config_render(const struct k10_config_set *set, char **out_data, size_t *out_length) {
     FILE *file = NULL;
 
-    if (path == NULL || config == NULL) {
-        return -1;
+    if (set == NULL || out_data == NULL || out_length == NULL) {
+        return -EINVAL;
     }
 
-    file = fopen(path, "w");
+    file = open_memstream(out_data, out_length);
     if (file == NULL) {
-        return -1;
+        return -errno;
     }
 
-    fprintf(file, "adapter = \"%s\"\n", config->adapter);
-    fprintf(file, "local_name = \"%s\"\n", config->local_name);
-    fprintf(file, "company_id = 0x%04X\n", config->company_id);
-    fprintf(file, "manufacturer_mac_label = \"%s\"\n", config->manufacturer_mac_label);
+    for (unsigned int i = 0; i < set->count; i++) {
+        if (i > 0) {
+            fprintf(file, "\n[instance.%s]\n", set->names[i]);
+        }
 
-    fprintf(file, "service_uuids = [");
-    for (unsigned int i = 0; i < config->service_uuid_count; i++) {
-        fprintf(file, "\"%s\"", config->service_uuids[i]);
-        if (i + 1 < config->service_uuid_count) {
-            fprintf(file, ", ");
+        for (size_t j = 0; j < k10_config_field_count; j++) {
+            k10_write_field(file, &set->configs[i], &k10_config_fields[j]);
         }
     }
-    fprintf(file, "]\n");
 
-    fprintf(file, "fd3d_service_data_hex = \"%s\"\n", config->fd3d_service_data_hex);
-    fprintf(file, "include_tx_power = %s\n", config->include_tx_power ? "true" : "false");
-    fprintf(file, "fw_major = %u\n", config->fw_major);
-    fprintf(file, "fw_minor = %u\n", config->fw_minor);
+    if (fclose(file) != 0) {
+        free(*out_data);
+        *out_data = NULL;
+        return -ENOMEM;
+    }
 
-    fclose(file);
     return 0;
 }
+
+static int k10_write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return 0;
+}
+
+static int k10_sync_parent_dir(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int fd = -1;
+    int r = 0;
+
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == path) {
+        snprintf(dir, sizeof(dir), "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (fsync(fd) < 0) {
+        r = -errno;
+    }
+
+    close(fd);
+    return r;
+}
+
+/*
+ * Write to a sibling temp file, fdatasync, then rename over the target so a
+ * crash leaves either the old or the new file, never a truncated one. The
+ * directory is synced last so the rename itself survives a power cut.
+ */
+int k10_config_write(const char *path, const char *data, size_t length) {
+    char tmp_path[PATH_MAX];
+    struct stat st;
+    mode_t mode = 0644;
+    int fd = -1;
+    int r = 0;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path)) {
+        return -ENAMETOOLONG;
+    }
+
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777;
+    }
+
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (fchmod(fd, mode) < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    r = k10_write_all(fd, data, length);
+    if (r < 0) {
+        goto fail;
+    }
+
+    if (fdatasync(fd) < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    if (close(fd) < 0) {
+        fd = -1;
+        r = -errno;
+        goto fail;
+    }
+    fd = -1;
+
+    if (rename(tmp_path, path) < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    return k10_sync_parent_dir(path);
+
+fail:
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(tmp_path);
+    return r;
+}
+
+int k10_config_save(const char *path, const struct k10_config_set *set) {
+    char *data = NULL;
+    size_t length = 0;
+    int r = 0;
+
+    if (path == NULL || set == NULL) {
+        return -EINVAL;
+    }
+
+    r = k10_config_render(set, &data, &length);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_config_write(path, data, length);
+    free(data);
+    return r;
+}
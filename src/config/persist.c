@@ -0,0 +1,380 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_CONFIG
+
+#include "k10_barrel/config_persist.h"
+
+#include "k10_barrel/event.h"
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct k10_config_waiter {
+    uint64_t seq;
+    k10_config_persist_done_fn done;
+    void *userdata;
+    struct k10_config_waiter *next;
+};
+
+/*
+ * Config writes happen on a worker thread so SD-card latency never stalls
+ * the bus. The loop thread keeps the newest unsaved config in `pending` and
+ * hands it over after save_delay_ms; the worker always writes the latest
+ * hand-off, so a burst of changes costs one write. Completion comes back
+ * through an eventfd.
+ */
+struct k10_config_persist {
+    char path[256];
+    sd_event_source *timer_source;
+    sd_event_source *wake_source;
+    int wake_fd;
+    pthread_t thread;
+    bool thread_started;
+
+    /* Loop thread only. */
+    struct k10_config_set pending;
+    uint64_t pending_seq;
+    uint64_t submitted_seq;
+    uint64_t completed_seq;
+    uint64_t written_hash;
+    bool written;
+    int last_result;
+    bool timer_armed;
+    struct k10_config_waiter *waiters;
+    uint64_t writes;
+    uint64_t coalesced;
+
+    /* Shared with the worker, guarded by lock. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct k10_config_set job;
+    uint64_t job_seq;
+    uint64_t done_seq;
+    uint64_t done_writes;
+    uint64_t done_hash;
+    int done_result;
+    bool stopping;
+};
+
+static int k10_config_persist_write(const char *path, const struct k10_config_set *set,
+                                    uint64_t *out_hash) {
+    char *data = NULL;
+    size_t length = 0;
+    int r = 0;
+
+    r = k10_config_render(set, &data, &length);
+    if (r < 0) {
+        return r;
+    }
+
+    *out_hash = k10_config_content_hash(data, length);
+    r = k10_config_write(path, data, length);
+    free(data);
+    return r;
+}
+
+static void *k10_config_persist_worker(void *userdata) {
+    struct k10_config_persist *persist = userdata;
+    struct k10_config_set set;
+    uint64_t hash = 0;
+    uint64_t one = 1;
+    uint64_t seq = 0;
+    int r = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&persist->lock);
+        while (persist->job_seq == 0 && !persist->stopping) {
+            pthread_cond_wait(&persist->cond, &persist->lock);
+        }
+
+        if (persist->job_seq == 0) {
+            pthread_mutex_unlock(&persist->lock);
+            break;
+        }
+
+        set = persist->job;
+        seq = persist->job_seq;
+        persist->job_seq = 0;
+        pthread_mutex_unlock(&persist->lock);
+
+        r = k10_config_persist_write(persist->path, &set, &hash);
+
+        pthread_mutex_lock(&persist->lock);
+        persist->done_seq = seq;
+        persist->done_hash = hash;
+        persist->done_writes++;
+        persist->done_result = r;
+        pthread_mutex_unlock(&persist->lock);
+
+        if (write(persist->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            k10_log_error("config persist wake failed: %s", strerror(errno));
+        }
+    }
+
+    return NULL;
+}
+
+static void k10_config_persist_submit(struct k10_config_persist *persist) {
+    if (persist->timer_armed) {
+        (void)sd_event_source_set_enabled(persist->timer_source, SD_EVENT_OFF);
+        persist->timer_armed = false;
+    }
+
+    if (persist->pending_seq == persist->submitted_seq) {
+        return;
+    }
+
+    pthread_mutex_lock(&persist->lock);
+    if (persist->job_seq != 0) {
+        persist->coalesced++;
+    }
+    persist->job = persist->pending;
+    persist->job_seq = persist->pending_seq;
+    pthread_cond_signal(&persist->cond);
+    pthread_mutex_unlock(&persist->lock);
+
+    persist->submitted_seq = persist->pending_seq;
+}
+
+static void k10_config_persist_complete(struct k10_config_persist *persist) {
+    struct k10_config_waiter **link = &persist->waiters;
+
+    while (*link != NULL) {
+        struct k10_config_waiter *waiter = *link;
+
+        if (waiter->seq > persist->completed_seq) {
+            link = &waiter->next;
+            continue;
+        }
+
+        *link = waiter->next;
+        waiter->done(persist->last_result, waiter->userdata);
+        free(waiter);
+    }
+}
+
+static int k10_config_persist_on_timer(sd_event_source *source, uint64_t usec, void *userdata) {
+    struct k10_config_persist *persist = userdata;
+
+    (void)source;
+    (void)usec;
+
+    persist->timer_armed = false;
+    k10_config_persist_submit(persist);
+    return 0;
+}
+
+static int k10_config_persist_on_wake(sd_event_source *source, int fd, uint32_t revents,
+                                      void *userdata) {
+    struct k10_config_persist *persist = userdata;
+    uint64_t count = 0;
+    uint64_t hash = 0;
+    uint64_t seq = 0;
+    int result = 0;
+
+    (void)source;
+    (void)revents;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        k10_log_error("config persist wake read failed: %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&persist->lock);
+    seq = persist->done_seq;
+    result = persist->done_result;
+    hash = persist->done_hash;
+    persist->writes = persist->done_writes;
+    pthread_mutex_unlock(&persist->lock);
+
+    if (seq <= persist->completed_seq) {
+        return 0;
+    }
+
+    persist->completed_seq = seq;
+    persist->last_result = result;
+
+    if (result < 0) {
+        k10_log_error("config save failed: %s: %s", persist->path, strerror(-result));
+    } else {
+        persist->written_hash = hash;
+        persist->written = true;
+    }
+
+    k10_config_persist_complete(persist);
+    return 0;
+}
+
+int k10_config_persist_open(sd_event *event, const char *path, struct k10_config_persist **out) {
+    struct k10_config_persist *persist = NULL;
+    int r = 0;
+
+    if (event == NULL || path == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    persist = calloc(1, sizeof(*persist));
+    if (persist == NULL) {
+        return -ENOMEM;
+    }
+
+    strncpy(persist->path, path, sizeof(persist->path) - 1);
+    persist->wake_fd = -1;
+    pthread_mutex_init(&persist->lock, NULL);
+    pthread_cond_init(&persist->cond, NULL);
+
+    persist->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (persist->wake_fd < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    r = k10_event_add_io(event, &persist->wake_source, persist->wake_fd, EPOLLIN,
+                         K10_EVENT_PRIORITY_DBUS, k10_config_persist_on_wake, persist,
+                         "config-persist-wake");
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = k10_event_add_timer(event, &persist->timer_source, 0, K10_EVENT_ACCURACY_DEFAULT_USEC,
+                            K10_EVENT_PRIORITY_IDLE, k10_config_persist_on_timer, persist,
+                            "config-persist-delay");
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(persist->timer_source, SD_EVENT_OFF);
+    }
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = -pthread_create(&persist->thread, NULL, k10_config_persist_worker, persist);
+    if (r < 0) {
+        goto fail;
+    }
+
+    persist->thread_started = true;
+    *out = persist;
+    return 0;
+
+fail:
+    k10_config_persist_close(persist);
+    return r;
+}
+
+/* Writes whatever is still pending before returning; called once the loop has stopped. */
+void k10_config_persist_close(struct k10_config_persist *persist) {
+    if (persist == NULL) {
+        return;
+    }
+
+    if (persist->thread_started) {
+        k10_config_persist_submit(persist);
+
+        pthread_mutex_lock(&persist->lock);
+        persist->stopping = true;
+        pthread_cond_signal(&persist->cond);
+        pthread_mutex_unlock(&persist->lock);
+
+        pthread_join(persist->thread, NULL);
+
+        if (persist->done_seq > persist->completed_seq) {
+            persist->completed_seq = persist->done_seq;
+            persist->last_result = persist->done_result;
+            if (persist->last_result < 0) {
+                k10_log_error("config save failed: %s: %s", persist->path,
+                              strerror(-persist->last_result));
+            }
+        }
+
+        k10_config_persist_complete(persist);
+    }
+
+    sd_event_source_unref(persist->timer_source);
+    sd_event_source_unref(persist->wake_source);
+    if (persist->wake_fd >= 0) {
+        close(persist->wake_fd);
+    }
+
+    pthread_cond_destroy(&persist->cond);
+    pthread_mutex_destroy(&persist->lock);
+    free(persist);
+}
+
+/* The file holds every instance; the primary instance's save_delay_ms applies to it. */
+int k10_config_persist_schedule(struct k10_config_persist *persist,
+                                const struct k10_config_set *set) {
+    uint64_t delay_usec = (uint64_t)set->configs[0].save_delay_ms * 1000ULL;
+    int r = 0;
+
+    persist->pending = *set;
+    persist->pending_seq++;
+
+    if (persist->timer_armed) {
+        persist->coalesced++;
+        return 0;
+    }
+
+    if (delay_usec == 0) {
+        k10_config_persist_submit(persist);
+        return 0;
+    }
+
+    r = sd_event_source_set_time_relative(persist->timer_source, delay_usec);
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(persist->timer_source, SD_EVENT_ONESHOT);
+    }
+
+    if (r < 0) {
+        k10_log_error("config persist schedule failed: %s", strerror(-r));
+        k10_config_persist_submit(persist);
+        return 0;
+    }
+
+    persist->timer_armed = true;
+    return 0;
+}
+
+int k10_config_persist_flush(struct k10_config_persist *persist, k10_config_persist_done_fn done,
+                             void *userdata) {
+    struct k10_config_waiter *waiter = NULL;
+
+    if (persist->completed_seq == persist->pending_seq) {
+        done(persist->last_result, userdata);
+        return 0;
+    }
+
+    waiter = calloc(1, sizeof(*waiter));
+    if (waiter == NULL) {
+        return -ENOMEM;
+    }
+
+    waiter->seq = persist->pending_seq;
+    waiter->done = done;
+    waiter->userdata = userdata;
+    waiter->next = persist->waiters;
+    persist->waiters = waiter;
+
+    k10_config_persist_submit(persist);
+    return 0;
+}
+
+/* True while a change is waiting for, or in the middle of, a write. */
+bool k10_config_persist_busy(const struct k10_config_persist *persist) {
+    return persist->completed_seq != persist->pending_seq;
+}
+
+/* True when the file content hashing to `hash` is the last one this process wrote. */
+bool k10_config_persist_wrote(const struct k10_config_persist *persist, uint64_t hash) {
+    return persist->written && persist->written_hash == hash;
+}
+
+uint64_t k10_config_persist_writes(const struct k10_config_persist *persist) {
+    return persist->writes;
+}
+
+uint64_t k10_config_persist_coalesced(const struct k10_config_persist *persist) {
+    return persist->coalesced;
+}
@@ -0,0 +1,531 @@
+#include "k10_barrel/config_schema.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+
+#define K10_ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define K10_MEMBER_SIZE(member) sizeof(((struct k10_config *)0)->member)
+
+#define K10_FIELD_STRING(member, field_scope, validator)                                           \
+    {.name = #member,                                                                              \
+     .type = K10_CONFIG_STRING,                                                                    \
+     .scope = field_scope,                                                                         \
+     .offset = offsetof(struct k10_config, member),                                                \
+     .size = K10_MEMBER_SIZE(member),                                                              \
+     .validate = validator}
+
+#define K10_FIELD_STRING_FLAGS(member, field_scope, field_flags, validator)                        \
+    {.name = #member,                                                                              \
+     .type = K10_CONFIG_STRING,                                                                    \
+     .scope = field_scope,                                                                         \
+     .flags = field_flags,                                                                         \
+     .offset = offsetof(struct k10_config, member),                                                \
+     .size = K10_MEMBER_SIZE(member),                                                              \
+     .validate = validator}
+
+#define K10_FIELD_UINT(member, field_scope, field_flags, validator)                                \
+    {.name = #member,                                                                              \
+     .type = K10_CONFIG_UINT,                                                                      \
+     .scope = field_scope,                                                                         \
+     .flags = field_flags,                                                                         \
+     .offset = offsetof(struct k10_config, member),                                                \
+     .size = K10_MEMBER_SIZE(member),                                                              \
+     .validate = validator}
+
+#define K10_FIELD_BOOL(member, field_scope)                                                        \
+    {.name = #member,                                                                              \
+     .type = K10_CONFIG_BOOL,                                                                      \
+     .scope = field_scope,                                                                         \
+     .offset = offsetof(struct k10_config, member),                                                \
+     .size = K10_MEMBER_SIZE(member)}
+
+#define K10_FIELD_STRING_LIST(member, count_member, field_scope, validator)                        \
+    {.name = #member,                                                                              \
+     .type = K10_CONFIG_STRING_LIST,                                                               \
+     .scope = field_scope,                                                                         \
+     .offset = offsetof(struct k10_config, member),                                                \
+     .size = K10_MEMBER_SIZE(member[0]),                                                           \
+     .count_offset = offsetof(struct k10_config, count_member),                                    \
+     .max_count = K10_ARRAY_SIZE(((struct k10_config *)0)->member),                                \
+     .validate = validator}
+
+/* Open-addressed index over k10_config_fields; slots hold index + 1, 0 is empty. */
+#define K10_CONFIG_INDEX_SLOTS 128
+
+static int k10_validate_adapter(const struct k10_config *config,
+                                const struct k10_config_field *field);
+static int k10_validate_hex_bytes(const struct k10_config *config,
+                                  const struct k10_config_field *field);
+static int k10_validate_uuid_list(const struct k10_config *config,
+                                  const struct k10_config_field *field);
+static int k10_validate_u8(const struct k10_config *config, const struct k10_config_field *field);
+static int k10_validate_u16(const struct k10_config *config, const struct k10_config_field *field);
+static int k10_validate_delay_ms(const struct k10_config *config,
+                                 const struct k10_config_field *field);
+static int k10_validate_queue_depth(const struct k10_config *config,
+                                    const struct k10_config_field *field);
+static int k10_validate_queue_policy(const struct k10_config *config,
+                                     const struct k10_config_field *field);
+static int k10_validate_capture_format(const struct k10_config *config,
+                                       const struct k10_config_field *field);
+static int k10_validate_absolute_path(const struct k10_config *config,
+                                      const struct k10_config_field *field);
+static int k10_validate_ring_size(const struct k10_config *config,
+                                  const struct k10_config_field *field);
+static int k10_validate_file_size_kb(const struct k10_config *config,
+                                     const struct k10_config_field *field);
+static int k10_validate_file_count(const struct k10_config *config,
+                                   const struct k10_config_field *field);
+static int k10_validate_address(const struct k10_config *config,
+                                const struct k10_config_field *field);
+
+#define K10_ADV K10_CONFIG_SCOPE_ADVERTISING
+#define K10_GATT K10_CONFIG_SCOPE_GATT
+#define K10_ADAPTER K10_CONFIG_SCOPE_ADAPTER
+#define K10_RUNTIME K10_CONFIG_SCOPE_NONE
+
+const struct k10_config_field k10_config_fields[] = {
+    K10_FIELD_STRING(adapter, K10_ADAPTER, k10_validate_adapter),
+    K10_FIELD_STRING(local_name, K10_ADV, NULL),
+    K10_FIELD_UINT(company_id, K10_ADV, K10_CONFIG_FLAG_HEX, k10_validate_u16),
+    K10_FIELD_STRING(manufacturer_mac_label, K10_ADV, k10_validate_hex_bytes),
+    K10_FIELD_STRING_LIST(service_uuids, service_uuid_count, K10_GATT, k10_validate_uuid_list),
+    K10_FIELD_STRING(fd3d_service_data_hex, K10_ADV, k10_validate_hex_bytes),
+    K10_FIELD_BOOL(include_tx_power, K10_ADV),
+    K10_FIELD_UINT(fw_major, K10_GATT, 0, k10_validate_u8),
+    K10_FIELD_UINT(fw_minor, K10_GATT, 0, k10_validate_u8),
+    K10_FIELD_UINT(notify_coalesce_ms, K10_RUNTIME, 0, k10_validate_delay_ms),
+    K10_FIELD_UINT(save_delay_ms, K10_RUNTIME, 0, k10_validate_delay_ms),
+    K10_FIELD_UINT(notify_queue_depth, K10_RUNTIME, 0, k10_validate_queue_depth),
+    K10_FIELD_STRING(notify_queue_policy, K10_RUNTIME, k10_validate_queue_policy),
+    K10_FIELD_BOOL(capture_enabled, K10_RUNTIME),
+    K10_FIELD_STRING(capture_format, K10_RUNTIME, k10_validate_capture_format),
+    /* Capture files are created, truncated and rotated as root wherever this points. */
+    K10_FIELD_STRING_FLAGS(capture_path, K10_RUNTIME, K10_CONFIG_FLAG_FILE_ONLY,
+                           k10_validate_absolute_path),
+    K10_FIELD_UINT(capture_ring_size, K10_RUNTIME, 0, k10_validate_ring_size),
+    K10_FIELD_UINT(capture_file_size_kb, K10_RUNTIME, 0, k10_validate_file_size_kb),
+    K10_FIELD_UINT(capture_file_count, K10_RUNTIME, 0, k10_validate_file_count),
+    K10_FIELD_STRING(relay_dock_address, K10_RUNTIME, k10_validate_address),
+};
+
+#undef K10_ADV
+#undef K10_GATT
+#undef K10_ADAPTER
+#undef K10_RUNTIME
+
+const size_t k10_config_field_count = K10_ARRAY_SIZE(k10_config_fields);
+
+_Static_assert(K10_ARRAY_SIZE(k10_config_fields) <= K10_CONFIG_FIELD_MAX,
+               "k10_config_mask cannot describe every config field");
+_Static_assert(K10_ARRAY_SIZE(k10_config_fields) * 2 <= K10_CONFIG_INDEX_SLOTS,
+               "config index too small for the schema");
+
+static unsigned char k10_config_index[K10_CONFIG_INDEX_SLOTS];
+static pthread_once_t k10_config_index_once = PTHREAD_ONCE_INIT;
+
+static uint32_t k10_config_hash(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void k10_config_index_build(void) {
+    for (size_t i = 0; i < k10_config_field_count; i++) {
+        const char *name = k10_config_fields[i].name;
+        uint32_t slot = k10_config_hash(name, strlen(name)) % K10_CONFIG_INDEX_SLOTS;
+
+        while (k10_config_index[slot] != 0) {
+            slot = (slot + 1) % K10_CONFIG_INDEX_SLOTS;
+        }
+
+        k10_config_index[slot] = (unsigned char)(i + 1);
+    }
+}
+
+const struct k10_config_field *k10_config_field_lookup(const char *name, size_t length) {
+    uint32_t slot = 0;
+
+    if (name == NULL) {
+        return NULL;
+    }
+
+    pthread_once(&k10_config_index_once, k10_config_index_build);
+
+    slot = k10_config_hash(name, length) % K10_CONFIG_INDEX_SLOTS;
+    while (k10_config_index[slot] != 0) {
+        const struct k10_config_field *field = &k10_config_fields[k10_config_index[slot] - 1];
+
+        if (strncmp(field->name, name, length) == 0 && field->name[length] == '\0') {
+            return field;
+        }
+
+        slot = (slot + 1) % K10_CONFIG_INDEX_SLOTS;
+    }
+
+    return NULL;
+}
+
+size_t k10_config_field_index(const struct k10_config_field *field) {
+    return (size_t)(field - k10_config_fields);
+}
+
+const char *k10_config_type_signature(enum k10_config_type type) {
+    switch (type) {
+    case K10_CONFIG_UINT:
+        return "u";
+    case K10_CONFIG_BOOL:
+        return "b";
+    case K10_CONFIG_STRING_LIST:
+        return "as";
+    default:
+        return "s";
+    }
+}
+
+static const unsigned char *k10_config_member(const struct k10_config *config, size_t offset) {
+    return (const unsigned char *)config + offset;
+}
+
+static unsigned char *k10_config_member_mut(struct k10_config *config, size_t offset) {
+    return (unsigned char *)config + offset;
+}
+
+const char *k10_config_get_string(const struct k10_config *config,
+                                  const struct k10_config_field *field) {
+    return (const char *)k10_config_member(config, field->offset);
+}
+
+unsigned int k10_config_get_uint(const struct k10_config *config,
+                                 const struct k10_config_field *field) {
+    unsigned int value = 0;
+
+    memcpy(&value, k10_config_member(config, field->offset), sizeof(value));
+    return value;
+}
+
+bool k10_config_get_bool(const struct k10_config *config, const struct k10_config_field *field) {
+    bool value = false;
+
+    memcpy(&value, k10_config_member(config, field->offset), sizeof(value));
+    return value;
+}
+
+unsigned int k10_config_get_list_count(const struct k10_config *config,
+                                       const struct k10_config_field *field) {
+    unsigned int count = 0;
+
+    memcpy(&count, k10_config_member(config, field->count_offset), sizeof(count));
+    return count;
+}
+
+const char *k10_config_get_list_item(const struct k10_config *config,
+                                     const struct k10_config_field *field, unsigned int index) {
+    return (const char *)k10_config_member(config, field->offset + index * field->size);
+}
+
+static int k10_config_copy_string(unsigned char *dest, size_t dest_size, const char *value,
+                                  size_t length) {
+    if (length >= dest_size || memchr(value, '\0', length) != NULL) {
+        return -EINVAL;
+    }
+
+    memcpy(dest, value, length);
+    memset(dest + length, 0, dest_size - length);
+    return 0;
+}
+
+int k10_config_set_string(struct k10_config *config, const struct k10_config_field *field,
+                          const char *value, size_t length) {
+    return k10_config_copy_string(k10_config_member_mut(config, field->offset), field->size, value,
+                                  length);
+}
+
+int k10_config_set_uint(struct k10_config *config, const struct k10_config_field *field,
+                        unsigned long value) {
+    unsigned int narrowed = 0;
+
+    if (value > UINT_MAX) {
+        return -ERANGE;
+    }
+
+    narrowed = (unsigned int)value;
+    memcpy(k10_config_member_mut(config, field->offset), &narrowed, sizeof(narrowed));
+    return 0;
+}
+
+int k10_config_set_bool(struct k10_config *config, const struct k10_config_field *field,
+                        bool value) {
+    memcpy(k10_config_member_mut(config, field->offset), &value, sizeof(value));
+    return 0;
+}
+
+void k10_config_clear_list(struct k10_config *config, const struct k10_config_field *field) {
+    unsigned int count = 0;
+
+    memset(k10_config_member_mut(config, field->offset), 0, field->size * field->max_count);
+    memcpy(k10_config_member_mut(config, field->count_offset), &count, sizeof(count));
+}
+
+int k10_config_append_list(struct k10_config *config, const struct k10_config_field *field,
+                           const char *value, size_t length) {
+    unsigned int count = k10_config_get_list_count(config, field);
+    int r = 0;
+
+    if (count >= field->max_count) {
+        return -E2BIG;
+    }
+
+    r = k10_config_copy_string(k10_config_member_mut(config, field->offset + count * field->size),
+                               field->size, value, length);
+    if (r < 0) {
+        return r;
+    }
+
+    count++;
+    memcpy(k10_config_member_mut(config, field->count_offset), &count, sizeof(count));
+    return 0;
+}
+
+int k10_config_field_validate(const struct k10_config *config,
+                              const struct k10_config_field *field) {
+    if (field->validate == NULL) {
+        return 0;
+    }
+
+    return field->validate(config, field);
+}
+
+bool k10_config_field_equal(const struct k10_config_field *field, const struct k10_config *a,
+                            const struct k10_config *b) {
+    unsigned int count = 0;
+
+    switch (field->type) {
+    case K10_CONFIG_STRING:
+        return strcmp(k10_config_get_string(a, field), k10_config_get_string(b, field)) == 0;
+    case K10_CONFIG_STRING_LIST:
+        count = k10_config_get_list_count(a, field);
+        if (count != k10_config_get_list_count(b, field)) {
+            return false;
+        }
+
+        for (unsigned int i = 0; i < count; i++) {
+            if (strcmp(k10_config_get_list_item(a, field, i),
+                       k10_config_get_list_item(b, field, i)) != 0) {
+                return false;
+            }
+        }
+
+        return true;
+    default:
+        return memcmp(k10_config_member(a, field->offset), k10_config_member(b, field->offset),
+                      field->size) == 0;
+    }
+}
+
+k10_config_mask k10_config_diff(const struct k10_config *a, const struct k10_config *b) {
+    k10_config_mask mask = 0;
+
+    for (size_t i = 0; i < k10_config_field_count; i++) {
+        if (!k10_config_field_equal(&k10_config_fields[i], a, b)) {
+            mask |= (k10_config_mask)1 << i;
+        }
+    }
+
+    return mask;
+}
+
+unsigned int k10_config_scope(k10_config_mask mask) {
+    unsigned int scope = K10_CONFIG_SCOPE_NONE;
+
+    for (size_t i = 0; i < k10_config_field_count; i++) {
+        if (mask & ((k10_config_mask)1 << i)) {
+            scope |= k10_config_fields[i].scope;
+        }
+    }
+
+    return scope;
+}
+
+static int k10_validate_adapter(const struct k10_config *config,
+                                const struct k10_config_field *field) {
+    const char *value = k10_config_get_string(config, field);
+
+    if (strncmp(value, "hci", 3) != 0 || value[3] == '\0') {
+        return -EINVAL;
+    }
+
+    for (value += 3; *value != '\0'; value++) {
+        if (!isdigit((unsigned char)*value)) {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/* Accepts "" or hex byte pairs, optionally separated by ':' (e.g. a MAC label). */
+static int k10_validate_hex_bytes(const struct k10_config *config,
+                                  const struct k10_config_field *field) {
+    const char *value = k10_config_get_string(config, field);
+
+    while (*value != '\0') {
+        if (!isxdigit((unsigned char)value[0]) || !isxdigit((unsigned char)value[1])) {
+            return -EINVAL;
+        }
+
+        value += 2;
+        if (*value == ':' && value[1] != '\0') {
+            value++;
+        }
+    }
+
+    return 0;
+}
+
+static bool k10_uuid_is_valid(const char *value) {
+    size_t length = strlen(value);
+
+    if (length == 4 || length == 8) {
+        for (size_t i = 0; i < length; i++) {
+            if (!isxdigit((unsigned char)value[i])) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    if (length != 36) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        bool dash = (i == 8 || i == 13 || i == 18 || i == 23);
+
+        if (dash ? value[i] != '-' : !isxdigit((unsigned char)value[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int k10_validate_uuid_list(const struct k10_config *config,
+                                  const struct k10_config_field *field) {
+    unsigned int count = k10_config_get_list_count(config, field);
+
+    for (unsigned int i = 0; i < count; i++) {
+        if (!k10_uuid_is_valid(k10_config_get_list_item(config, field, i))) {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static int k10_validate_u8(const struct k10_config *config, const struct k10_config_field *field) {
+    return k10_config_get_uint(config, field) <= 0xFF ? 0 : -ERANGE;
+}
+
+static int k10_validate_u16(const struct k10_config *config, const struct k10_config_field *field) {
+    return k10_config_get_uint(config, field) <= 0xFFFF ? 0 : -ERANGE;
+}
+
+static int k10_validate_delay_ms(const struct k10_config *config,
+                                 const struct k10_config_field *field) {
+    return k10_config_get_uint(config, field) <= 10000 ? 0 : -ERANGE;
+}
+
+static int k10_validate_queue_depth(const struct k10_config *config,
+                                    const struct k10_config_field *field) {
+    unsigned int depth = k10_config_get_uint(config, field);
+
+    return depth >= 1 && depth <= 1024 ? 0 : -ERANGE;
+}
+
+static int k10_validate_queue_policy(const struct k10_config *config,
+                                     const struct k10_config_field *field) {
+    const char *value = k10_config_get_string(config, field);
+
+    if (strcmp(value, K10_NOTIFY_POLICY_DROP_NEWEST) == 0 ||
+        strcmp(value, K10_NOTIFY_POLICY_DROP_OLDEST) == 0 ||
+        strcmp(value, K10_NOTIFY_POLICY_BLOCK) == 0) {
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+static int k10_validate_capture_format(const struct k10_config *config,
+                                       const struct k10_config_field *field) {
+    const char *value = k10_config_get_string(config, field);
+
+    if (strcmp(value, K10_CAPTURE_FORMAT_BTSNOOP) == 0 ||
+        strcmp(value, K10_CAPTURE_FORMAT_PCAPNG) == 0) {
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+static int k10_validate_absolute_path(const struct k10_config *config,
+                                      const struct k10_config_field *field) {
+    return k10_config_get_string(config, field)[0] == '/' ? 0 : -EINVAL;
+}
+
+static int k10_validate_ring_size(const struct k10_config *config,
+                                  const struct k10_config_field *field) {
+    unsigned int size = k10_config_get_uint(config, field);
+
+    /* A power of two, so ring indices wrap with a mask. */
+    if (size < 16 || size > 65536 || (size & (size - 1)) != 0) {
+        return -ERANGE;
+    }
+
+    return 0;
+}
+
+static int k10_validate_file_size_kb(const struct k10_config *config,
+                                     const struct k10_config_field *field) {
+    unsigned int size = k10_config_get_uint(config, field);
+
+    return size >= 64 && size <= 1048576 ? 0 : -ERANGE;
+}
+
+static int k10_validate_file_count(const struct k10_config *config,
+                                   const struct k10_config_field *field) {
+    unsigned int count = k10_config_get_uint(config, field);
+
+    return count >= 1 && count <= 32 ? 0 : -ERANGE;
+}
+
+/* Accepts "" or a Bluetooth address in the AA:BB:CC:DD:EE:FF form BlueZ uses. */
+static int k10_validate_address(const struct k10_config *config,
+                                const struct k10_config_field *field) {
+    const char *value = k10_config_get_string(config, field);
+
+    if (value[0] == '\0') {
+        return 0;
+    }
+
+    if (strlen(value) != 17) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < 17; i++) {
+        if (i % 3 == 2 ? value[i] != ':' : !isxdigit((unsigned char)value[i])) {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,951 @@
+#include "k10_barrel/toml.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Arrays and inline tables may nest this deep inside a single value. */
+#define K10_TOML_MAX_NESTING 16
+
+/* A key or [table] header already defined in the document. */
+struct k10_toml_defined {
+    struct k10_toml_path path;
+    uint64_t hash;
+    bool table;
+};
+
+struct k10_toml_parser {
+    const char *data;
+    size_t size;
+    size_t pos;
+    unsigned int line;
+    size_t line_start;
+    unsigned int nesting;
+    const struct k10_toml_handler *handler;
+    void *userdata;
+    struct k10_toml_error *error;
+    struct k10_toml_path path;
+    /* Arrays the cursor is inside; keys of inline tables in them are not unique. */
+    unsigned int arrays;
+    struct k10_toml_defined *defined;
+    size_t defined_count;
+    size_t defined_capacity;
+    /* Open-addressed on hash; each slot is an index into defined plus one, 0 when empty. */
+    uint32_t *slots;
+    size_t slot_count;
+};
+
+static int k10_toml_fail_at(struct k10_toml_parser *p, size_t pos, const char *format, ...) {
+    va_list args;
+
+    if (p->error == NULL || p->error->message[0] != '\0') {
+        return -EINVAL;
+    }
+
+    p->error->line = p->line;
+    p->error->column = (unsigned int)(pos - p->line_start) + 1;
+
+    va_start(args, format);
+    vsnprintf(p->error->message, sizeof(p->error->message), format, args);
+    va_end(args);
+
+    return -EINVAL;
+}
+
+#define k10_toml_fail(p, ...) k10_toml_fail_at((p), (p)->pos, __VA_ARGS__)
+
+static int k10_toml_peek(const struct k10_toml_parser *p, size_t offset) {
+    if (p->pos + offset >= p->size) {
+        return -1;
+    }
+
+    return (unsigned char)p->data[p->pos + offset];
+}
+
+static bool k10_toml_is_bare(int c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == '-';
+}
+
+static int k10_toml_hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+static void k10_toml_skip_ws(struct k10_toml_parser *p) {
+    while (p->pos < p->size && (p->data[p->pos] == ' ' || p->data[p->pos] == '\t')) {
+        p->pos++;
+    }
+}
+
+static void k10_toml_skip_comment(struct k10_toml_parser *p) {
+    if (k10_toml_peek(p, 0) != '#') {
+        return;
+    }
+
+    while (p->pos < p->size && p->data[p->pos] != '\n') {
+        p->pos++;
+    }
+}
+
+static void k10_toml_mark_newline(struct k10_toml_parser *p) {
+    p->line++;
+    p->line_start = p->pos;
+}
+
+static bool k10_toml_consume_newline(struct k10_toml_parser *p) {
+    if (k10_toml_peek(p, 0) == '\n') {
+        p->pos++;
+    } else if (k10_toml_peek(p, 0) == '\r' && k10_toml_peek(p, 1) == '\n') {
+        p->pos += 2;
+    } else {
+        return false;
+    }
+
+    k10_toml_mark_newline(p);
+    return true;
+}
+
+/* Whitespace, comments and newlines, as allowed between array elements. */
+static void k10_toml_skip_blank(struct k10_toml_parser *p) {
+    for (;;) {
+        k10_toml_skip_ws(p);
+        k10_toml_skip_comment(p);
+        if (!k10_toml_consume_newline(p)) {
+            return;
+        }
+    }
+}
+
+static uint64_t k10_toml_path_hash(const struct k10_toml_path *path) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned int i = 0; i < path->depth; i++) {
+        for (size_t j = 0; j < path->parts[i].length; j++) {
+            hash ^= (unsigned char)path->parts[i].start[j];
+            hash *= 1099511628211ULL;
+        }
+
+        hash ^= 0xFF;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static bool k10_toml_path_equal(const struct k10_toml_path *a, const struct k10_toml_path *b) {
+    if (a->depth != b->depth) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < a->depth; i++) {
+        if (a->parts[i].length != b->parts[i].length ||
+            memcmp(a->parts[i].start, b->parts[i].start, a->parts[i].length) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int k10_toml_defined_grow(struct k10_toml_parser *p) {
+    size_t capacity = p->defined_capacity == 0 ? 32 : p->defined_capacity * 2;
+    struct k10_toml_defined *defined = NULL;
+    uint32_t *slots = NULL;
+
+    if (capacity > UINT32_MAX / 2) {
+        return -ENOMEM;
+    }
+
+    defined = realloc(p->defined, capacity * sizeof(*defined));
+    if (defined == NULL) {
+        return -ENOMEM;
+    }
+    p->defined = defined;
+    p->defined_capacity = capacity;
+
+    slots = calloc(capacity * 2, sizeof(*slots));
+    if (slots == NULL) {
+        return -ENOMEM;
+    }
+
+    free(p->slots);
+    p->slots = slots;
+    p->slot_count = capacity * 2;
+    for (size_t i = 0; i < p->defined_count; i++) {
+        size_t slot = (size_t)p->defined[i].hash & (p->slot_count - 1);
+
+        while (p->slots[slot] != 0) {
+            slot = (slot + 1) & (p->slot_count - 1);
+        }
+        p->slots[slot] = (uint32_t)i + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Records p->path as a key or table header. TOML allows each to be defined
+ * once; pos is where the definition starts, for the error location.
+ */
+static int k10_toml_define(struct k10_toml_parser *p, bool table, size_t pos) {
+    uint64_t hash = k10_toml_path_hash(&p->path);
+    struct k10_toml_defined *entry = NULL;
+    size_t slot = 0;
+    int r = 0;
+
+    if (p->arrays > 0) {
+        return 0;
+    }
+
+    if (p->defined_count == p->defined_capacity) {
+        r = k10_toml_defined_grow(p);
+        if (r < 0) {
+            k10_toml_fail_at(p, pos, "out of memory");
+            return r;
+        }
+    }
+
+    for (slot = (size_t)hash & (p->slot_count - 1); p->slots[slot] != 0;
+         slot = (slot + 1) & (p->slot_count - 1)) {
+        entry = &p->defined[p->slots[slot] - 1];
+        if (entry->hash != hash || !k10_toml_path_equal(&entry->path, &p->path)) {
+            continue;
+        }
+
+        if (table && entry->table) {
+            return k10_toml_fail_at(p, pos, "table defined twice");
+        }
+
+        return k10_toml_fail_at(p, pos, "key defined twice");
+    }
+
+    entry = &p->defined[p->defined_count++];
+    entry->path = p->path;
+    entry->hash = hash;
+    entry->table = table;
+    p->slots[slot] = (uint32_t)p->defined_count;
+    return 0;
+}
+
+static int k10_toml_emit(struct k10_toml_parser *p,
+                         int (*callback)(void *userdata, const struct k10_toml_path *path,
+                                         const struct k10_toml_value *value),
+                         const struct k10_toml_value *value) {
+    int r = 0;
+
+    if (callback == NULL) {
+        return 0;
+    }
+
+    r = callback(p->userdata, &p->path, value);
+    if (r < 0) {
+        k10_toml_fail(p, "rejected: %s", strerror(-r));
+        return r;
+    }
+
+    return 0;
+}
+
+/* On success *out_length is the number of bytes after the backslash that belong to the escape. */
+static bool k10_toml_escape_length(const struct k10_toml_parser *p, bool multiline,
+                                   size_t *out_length) {
+    size_t digits = 0;
+    size_t i = 0;
+    int c = k10_toml_peek(p, 1);
+
+    switch (c) {
+    case 'b':
+    case 't':
+    case 'n':
+    case 'f':
+    case 'r':
+    case '"':
+    case '\\':
+        *out_length = 1;
+        return true;
+    case 'u':
+        digits = 4;
+        break;
+    case 'U':
+        digits = 8;
+        break;
+    default:
+        if (!multiline) {
+            return false;
+        }
+
+        /* Line-ending backslash: only whitespace may sit between it and the newline. */
+        for (i = 1; k10_toml_peek(p, i) == ' ' || k10_toml_peek(p, i) == '\t'; i++) {
+        }
+        c = k10_toml_peek(p, i);
+        *out_length = i - 1;
+        return c == '\n' || c == '\r';
+    }
+
+    for (i = 0; i < digits; i++) {
+        if (k10_toml_hex_digit(k10_toml_peek(p, 2 + i)) < 0) {
+            return false;
+        }
+    }
+
+    *out_length = 1 + digits;
+    return true;
+}
+
+static int k10_toml_parse_string(struct k10_toml_parser *p, struct k10_toml_value *value) {
+    int quote = k10_toml_peek(p, 0);
+    bool basic = (quote == '"');
+    size_t start = 0;
+
+    value->type = K10_TOML_STRING;
+    value->multiline = (k10_toml_peek(p, 1) == quote && k10_toml_peek(p, 2) == quote);
+
+    if (!value->multiline) {
+        p->pos++;
+        start = p->pos;
+
+        for (;;) {
+            int c = k10_toml_peek(p, 0);
+
+            if (c < 0 || c == '\n' || c == '\r') {
+                return k10_toml_fail_at(p, start - 1, "unterminated string");
+            }
+
+            if (c == quote) {
+                break;
+            }
+
+            if (basic && c == '\\') {
+                size_t length = 0;
+
+                if (!k10_toml_escape_length(p, false, &length)) {
+                    return k10_toml_fail(p, "invalid escape sequence");
+                }
+
+                value->escaped = true;
+                p->pos += length;
+            }
+
+            p->pos++;
+        }
+
+        value->raw.start = p->data + start;
+        value->raw.length = p->pos - start;
+        p->pos++;
+        return 0;
+    }
+
+    p->pos += 3;
+    /* A newline right after the opening delimiter is not part of the string. */
+    k10_toml_consume_newline(p);
+    start = p->pos;
+
+    for (;;) {
+        int c = k10_toml_peek(p, 0);
+        size_t run = 0;
+
+        if (c < 0) {
+            return k10_toml_fail(p, "unterminated multi-line string");
+        }
+
+        if (c == quote) {
+            while (k10_toml_peek(p, run) == quote) {
+                run++;
+            }
+
+            if (run >= 3) {
+                if (run > 5) {
+                    return k10_toml_fail(p, "too many quotes closing string");
+                }
+
+                value->raw.start = p->data + start;
+                value->raw.length = p->pos + run - 3 - start;
+                p->pos += run;
+                return 0;
+            }
+
+            p->pos += run;
+            continue;
+        }
+
+        if (basic && c == '\\') {
+            size_t length = 0;
+
+            if (!k10_toml_escape_length(p, true, &length)) {
+                return k10_toml_fail(p, "invalid escape sequence");
+            }
+
+            value->escaped = true;
+            p->pos += length + 1;
+            continue;
+        }
+
+        if (c == '\n') {
+            p->pos++;
+            k10_toml_mark_newline(p);
+            continue;
+        }
+
+        p->pos++;
+    }
+}
+
+static int k10_toml_parse_integer(struct k10_toml_parser *p, struct k10_toml_value *value) {
+    unsigned int base = 10;
+    uint64_t magnitude = 0;
+    uint64_t limit = INT64_MAX;
+    size_t digits = 0;
+    bool negative = false;
+    bool underscore_ok = false;
+    int c = k10_toml_peek(p, 0);
+
+    value->type = K10_TOML_INTEGER;
+
+    if (c == '+' || c == '-') {
+        negative = (c == '-');
+        limit = (uint64_t)INT64_MAX + (negative ? 1 : 0);
+        p->pos++;
+    } else if (c == '0') {
+        int prefix = k10_toml_peek(p, 1);
+
+        base = prefix == 'x' ? 16 : prefix == 'o' ? 8 : prefix == 'b' ? 2 : 10;
+        if (base != 10) {
+            p->pos += 2;
+        }
+    }
+
+    if (base == 10 && k10_toml_peek(p, 0) == '0' && k10_toml_peek(p, 1) >= '0' &&
+        k10_toml_peek(p, 1) <= '9') {
+        return k10_toml_fail(p, "leading zeros are not allowed");
+    }
+
+    for (;;) {
+        int digit = 0;
+
+        c = k10_toml_peek(p, 0);
+        if (c == '_') {
+            if (!underscore_ok) {
+                return k10_toml_fail(p, "misplaced '_' in integer");
+            }
+            underscore_ok = false;
+            p->pos++;
+            continue;
+        }
+
+        digit = k10_toml_hex_digit(c);
+        if (digit < 0 || (unsigned int)digit >= base) {
+            break;
+        }
+
+        if (magnitude > (limit - (uint64_t)digit) / base) {
+            return k10_toml_fail_at(p, (size_t)(value->raw.start - p->data),
+                                    "integer out of range");
+        }
+
+        magnitude = magnitude * base + (uint64_t)digit;
+        underscore_ok = true;
+        digits++;
+        p->pos++;
+    }
+
+    if (digits == 0) {
+        return k10_toml_fail(p, "expected a value");
+    }
+
+    if (!underscore_ok) {
+        return k10_toml_fail(p, "misplaced '_' in integer");
+    }
+
+    if (c == '.' || c == 'e' || c == 'E' || c == ':' || c == '-' || c == 'T') {
+        return k10_toml_fail(p, "floats and dates are not supported");
+    }
+
+    if (k10_toml_is_bare(c)) {
+        return k10_toml_fail(p, "invalid character in integer");
+    }
+
+    if (negative) {
+        value->integer = magnitude == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)magnitude;
+    } else {
+        value->integer = (int64_t)magnitude;
+    }
+
+    value->raw.length = p->pos - (size_t)(value->raw.start - p->data);
+    return 0;
+}
+
+static int k10_toml_parse_keyword(struct k10_toml_parser *p, struct k10_toml_value *value) {
+    static const char *const words[] = {"false", "true"};
+
+    for (size_t i = 0; i < 2; i++) {
+        size_t length = strlen(words[i]);
+
+        if (p->size - p->pos >= length && memcmp(p->data + p->pos, words[i], length) == 0 &&
+            !k10_toml_is_bare(k10_toml_peek(p, length))) {
+            value->type = K10_TOML_BOOL;
+            value->boolean = (i == 1);
+            value->raw.length = length;
+            p->pos += length;
+            return 0;
+        }
+    }
+
+    return k10_toml_fail(p, "expected a value");
+}
+
+static int k10_toml_parse_simple_key(struct k10_toml_parser *p, struct k10_toml_slice *out) {
+    int c = k10_toml_peek(p, 0);
+    size_t start = p->pos;
+
+    if (c == '"' || c == '\'') {
+        struct k10_toml_value key;
+        int r = 0;
+
+        memset(&key, 0, sizeof(key));
+        if (k10_toml_peek(p, 1) == c && k10_toml_peek(p, 2) == c) {
+            return k10_toml_fail(p, "multi-line strings cannot be keys");
+        }
+
+        r = k10_toml_parse_string(p, &key);
+        if (r < 0) {
+            return r;
+        }
+
+        /* Quoted keys are matched verbatim; escapes are not decoded. */
+        *out = key.raw;
+        return 0;
+    }
+
+    while (k10_toml_is_bare(k10_toml_peek(p, 0))) {
+        p->pos++;
+    }
+
+    if (p->pos == start) {
+        return k10_toml_fail(p, "expected a key");
+    }
+
+    out->start = p->data + start;
+    out->length = p->pos - start;
+    return 0;
+}
+
+/* Appends the (possibly dotted) key at the cursor to p->path. */
+static int k10_toml_parse_key(struct k10_toml_parser *p) {
+    int r = 0;
+
+    for (;;) {
+        k10_toml_skip_ws(p);
+
+        if (p->path.depth >= K10_TOML_MAX_DEPTH) {
+            return k10_toml_fail(p, "key nested too deeply");
+        }
+
+        r = k10_toml_parse_simple_key(p, &p->path.parts[p->path.depth]);
+        if (r < 0) {
+            return r;
+        }
+
+        p->path.depth++;
+        k10_toml_skip_ws(p);
+
+        if (k10_toml_peek(p, 0) != '.') {
+            return 0;
+        }
+
+        p->pos++;
+    }
+}
+
+static int k10_toml_parse_value(struct k10_toml_parser *p, int index);
+
+static int k10_toml_parse_array(struct k10_toml_parser *p, struct k10_toml_value *value) {
+    int count = 0;
+    int r = 0;
+
+    value->type = K10_TOML_ARRAY;
+    r = k10_toml_emit(p, p->handler->begin, value);
+    if (r < 0) {
+        return r;
+    }
+
+    p->pos++;
+    p->arrays++;
+    for (;;) {
+        k10_toml_skip_blank(p);
+        if (k10_toml_peek(p, 0) == ']') {
+            break;
+        }
+
+        r = k10_toml_parse_value(p, count++);
+        if (r < 0) {
+            return r;
+        }
+
+        k10_toml_skip_blank(p);
+        if (k10_toml_peek(p, 0) == ',') {
+            p->pos++;
+            continue;
+        }
+
+        if (k10_toml_peek(p, 0) != ']') {
+            return k10_toml_fail(p, "expected ',' or ']' in array");
+        }
+
+        break;
+    }
+
+    p->arrays--;
+    p->pos++;
+    return k10_toml_emit(p, p->handler->end, value);
+}
+
+static int k10_toml_parse_inline_table(struct k10_toml_parser *p, struct k10_toml_value *value) {
+    unsigned int depth = p->path.depth;
+    int r = 0;
+
+    value->type = K10_TOML_TABLE;
+    r = k10_toml_emit(p, p->handler->begin, value);
+    if (r < 0) {
+        return r;
+    }
+
+    p->pos++;
+    k10_toml_skip_ws(p);
+
+    if (k10_toml_peek(p, 0) != '}') {
+        for (;;) {
+            size_t start = p->pos;
+
+            r = k10_toml_parse_key(p);
+            if (r >= 0) {
+                r = k10_toml_define(p, false, start);
+            }
+            if (r < 0) {
+                return r;
+            }
+
+            if (k10_toml_peek(p, 0) != '=') {
+                return k10_toml_fail(p, "expected '=' after key");
+            }
+
+            p->pos++;
+            k10_toml_skip_ws(p);
+
+            r = k10_toml_parse_value(p, -1);
+            if (r < 0) {
+                return r;
+            }
+
+            p->path.depth = depth;
+            k10_toml_skip_ws(p);
+
+            if (k10_toml_peek(p, 0) == ',') {
+                p->pos++;
+                continue;
+            }
+
+            if (k10_toml_peek(p, 0) != '}') {
+                return k10_toml_fail(p, "expected ',' or '}' in inline table");
+            }
+
+            break;
+        }
+    }
+
+    p->pos++;
+    return k10_toml_emit(p, p->handler->end, value);
+}
+
+static int k10_toml_parse_value(struct k10_toml_parser *p, int index) {
+    struct k10_toml_value value;
+    int c = k10_toml_peek(p, 0);
+    int r = 0;
+
+    memset(&value, 0, sizeof(value));
+    value.index = index;
+    value.line = p->line;
+    value.column = (unsigned int)(p->pos - p->line_start) + 1;
+    value.raw.start = p->data + p->pos;
+
+    switch (c) {
+    case '"':
+    case '\'':
+        r = k10_toml_parse_string(p, &value);
+        break;
+    case '[':
+    case '{':
+        if (p->nesting >= K10_TOML_MAX_NESTING) {
+            return k10_toml_fail(p, "value nested too deeply");
+        }
+
+        p->nesting++;
+        r = c == '[' ? k10_toml_parse_array(p, &value) : k10_toml_parse_inline_table(p, &value);
+        p->nesting--;
+        return r;
+    case 't':
+    case 'f':
+        r = k10_toml_parse_keyword(p, &value);
+        break;
+    default:
+        if (c == '+' || c == '-' || (c >= '0' && c <= '9')) {
+            r = k10_toml_parse_integer(p, &value);
+        } else {
+            r = k10_toml_fail(p, "expected a value");
+        }
+        break;
+    }
+
+    if (r < 0) {
+        return r;
+    }
+
+    return k10_toml_emit(p, p->handler->value, &value);
+}
+
+static int k10_toml_parse_table_header(struct k10_toml_parser *p) {
+    size_t start = p->pos;
+    int r = 0;
+
+    if (k10_toml_peek(p, 1) == '[') {
+        return k10_toml_fail(p, "arrays of tables are not supported");
+    }
+
+    p->pos++;
+    p->path.depth = 0;
+
+    r = k10_toml_parse_key(p);
+    if (r < 0) {
+        return r;
+    }
+
+    if (k10_toml_peek(p, 0) != ']') {
+        return k10_toml_fail(p, "expected ']' after table name");
+    }
+
+    r = k10_toml_define(p, true, start);
+    if (r < 0) {
+        return r;
+    }
+
+    p->pos++;
+
+    if (p->handler->table != NULL) {
+        r = p->handler->table(p->userdata, &p->path);
+        if (r < 0) {
+            k10_toml_fail(p, "rejected: %s", strerror(-r));
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+static int k10_toml_parse_document(struct k10_toml_parser *p) {
+    unsigned int table_depth = 0;
+    int r = 0;
+
+    for (;;) {
+        k10_toml_skip_ws(p);
+        k10_toml_skip_comment(p);
+
+        if (p->pos >= p->size) {
+            return 0;
+        }
+
+        if (k10_toml_consume_newline(p)) {
+            continue;
+        }
+
+        if (k10_toml_peek(p, 0) == '[') {
+            r = k10_toml_parse_table_header(p);
+            if (r < 0) {
+                return r;
+            }
+
+            table_depth = p->path.depth;
+        } else {
+            size_t start = p->pos;
+
+            p->path.depth = table_depth;
+
+            r = k10_toml_parse_key(p);
+            if (r >= 0) {
+                r = k10_toml_define(p, false, start);
+            }
+            if (r < 0) {
+                return r;
+            }
+
+            if (k10_toml_peek(p, 0) != '=') {
+                return k10_toml_fail(p, "expected '=' after key");
+            }
+
+            p->pos++;
+            k10_toml_skip_ws(p);
+
+            r = k10_toml_parse_value(p, -1);
+            if (r < 0) {
+                return r;
+            }
+        }
+
+        k10_toml_skip_ws(p);
+        k10_toml_skip_comment(p);
+
+        if (p->pos < p->size && !k10_toml_consume_newline(p)) {
+            return k10_toml_fail(p, "expected end of line");
+        }
+    }
+}
+
+int k10_toml_parse(const char *data, size_t size, const struct k10_toml_handler *handler,
+                   void *userdata, struct k10_toml_error *out_error) {
+    struct k10_toml_parser p;
+    int r = 0;
+
+    if ((data == NULL && size > 0) || handler == NULL) {
+        return -EINVAL;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.data = data;
+    p.size = size;
+    p.line = 1;
+    p.handler = handler;
+    p.userdata = userdata;
+    p.error = out_error;
+
+    if (out_error != NULL) {
+        memset(out_error, 0, sizeof(*out_error));
+    }
+
+    r = k10_toml_parse_document(&p);
+    free(p.defined);
+    free(p.slots);
+    return r;
+}
+
+static size_t k10_toml_utf8_encode(uint32_t codepoint, char *out) {
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+
+    if (codepoint < 0x10000) {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+int k10_toml_string_decode(const struct k10_toml_value *value, char *out, size_t out_size,
+                           size_t *out_length) {
+    const char *raw = value->raw.start;
+    size_t length = value->raw.length;
+    size_t used = 0;
+
+    if (value->type != K10_TOML_STRING || out_size == 0) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        char encoded[4];
+        size_t encoded_length = 1;
+        uint32_t codepoint = 0;
+        size_t digits = 0;
+
+        encoded[0] = raw[i];
+
+        if (value->escaped && raw[i] == '\\') {
+            i++;
+            switch (raw[i]) {
+            case 'b':
+                encoded[0] = '\b';
+                break;
+            case 't':
+                encoded[0] = '\t';
+                break;
+            case 'n':
+                encoded[0] = '\n';
+                break;
+            case 'f':
+                encoded[0] = '\f';
+                break;
+            case 'r':
+                encoded[0] = '\r';
+                break;
+            case '"':
+            case '\\':
+                encoded[0] = raw[i];
+                break;
+            case 'u':
+            case 'U':
+                digits = raw[i] == 'u' ? 4 : 8;
+                for (size_t d = 1; d <= digits; d++) {
+                    codepoint = (codepoint << 4) | (uint32_t)k10_toml_hex_digit(raw[i + d]);
+                }
+                i += digits;
+
+                if (codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+                    return -EINVAL;
+                }
+
+                encoded_length = k10_toml_utf8_encode(codepoint, encoded);
+                break;
+            default:
+                /* Line-ending backslash trims all following whitespace and newlines. */
+                while (i < length &&
+                       (raw[i] == ' ' || raw[i] == '\t' || raw[i] == '\r' || raw[i] == '\n')) {
+                    i++;
+                }
+                i--;
+                continue;
+            }
+        }
+
+        if (used + encoded_length >= out_size) {
+            return -ENOBUFS;
+        }
+
+        memcpy(out + used, encoded, encoded_length);
+        used += encoded_length;
+    }
+
+    out[used] = '\0';
+    if (out_length != NULL) {
+        *out_length = used;
+    }
+
+    return 0;
+}
+
+bool k10_toml_slice_equal(struct k10_toml_slice slice, const char *text) {
+    return strlen(text) == slice.length && memcmp(slice.start, text, slice.length) == 0;
+}
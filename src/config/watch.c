@@ -0,0 +1,283 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_CONFIG
+
+#include "k10_barrel/config_watch.h"
+
+#include "k10_barrel/event.h"
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/* Deploy tools tend to touch the file several times in a row; reload once it settles. */
+#define K10_CONFIG_WATCH_DEBOUNCE_USEC 200000ULL
+
+#define K10_CONFIG_WATCH_EVENTS                                                                    \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB)
+
+struct k10_config_watch {
+    char path[256];
+    const char *name;
+    int inotify_fd;
+    sd_event_source *io_source;
+    sd_event_source *debounce_source;
+    struct k10_config_persist *persist;
+    k10_config_watch_fn changed;
+    void *userdata;
+    uint64_t loaded_hash;
+    bool loaded;
+    /* Another file in the same directory, such as rules.toml. */
+    char sibling_name[NAME_MAX + 1];
+    sd_event_source *sibling_source;
+    k10_config_watch_sibling_fn sibling_changed;
+    void *sibling_userdata;
+};
+
+static void k10_config_watch_arm_source(sd_event_source *source) {
+    int r = 0;
+
+    r = sd_event_source_set_time_relative(source, K10_CONFIG_WATCH_DEBOUNCE_USEC);
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(source, SD_EVENT_ONESHOT);
+    }
+
+    if (r < 0) {
+        k10_log_error("config watch debounce failed: %s", strerror(-r));
+    }
+}
+
+static void k10_config_watch_arm(struct k10_config_watch *watch) {
+    k10_config_watch_arm_source(watch->debounce_source);
+}
+
+static int k10_config_watch_on_debounce(sd_event_source *source, uint64_t usec, void *userdata) {
+    struct k10_config_watch *watch = userdata;
+    struct k10_config_set set;
+    uint64_t hash = 0;
+    int r = 0;
+
+    (void)source;
+    (void)usec;
+
+    /* Our own write is about to replace whatever is there; look again afterwards. */
+    if (watch->persist != NULL && k10_config_persist_busy(watch->persist)) {
+        k10_config_watch_arm(watch);
+        return 0;
+    }
+
+    r = k10_config_load_hashed(watch->path, &set, &hash);
+    if (r == -ENOENT) {
+        k10_log_info("config watch: %s removed, keeping current config", watch->path);
+        watch->loaded = false;
+        return 0;
+    }
+
+    if (r < 0) {
+        k10_log_error("config watch: keeping current config, %s is not loadable", watch->path);
+        return 0;
+    }
+
+    if (watch->loaded && watch->loaded_hash == hash) {
+        return 0;
+    }
+
+    watch->loaded_hash = hash;
+    watch->loaded = true;
+
+    if (watch->persist != NULL && k10_config_persist_wrote(watch->persist, hash)) {
+        return 0;
+    }
+
+    k10_log_info("config watch: %s changed on disk, reloading", watch->path);
+    watch->changed(&set, watch->userdata);
+    return 0;
+}
+
+static int k10_config_watch_on_sibling(sd_event_source *source, uint64_t usec, void *userdata) {
+    struct k10_config_watch *watch = userdata;
+
+    (void)source;
+    (void)usec;
+
+    k10_log_info("config watch: %s changed on disk, reloading", watch->sibling_name);
+    watch->sibling_changed(watch->sibling_userdata);
+    return 0;
+}
+
+static int k10_config_watch_on_inotify(sd_event_source *source, int fd, uint32_t revents,
+                                       void *userdata) {
+    struct k10_config_watch *watch = userdata;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool relevant = false;
+    bool sibling = false;
+    ssize_t length = 0;
+
+    (void)source;
+    (void)revents;
+
+    for (;;) {
+        length = read(fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                k10_log_error("config watch read failed: %s", strerror(errno));
+            }
+            break;
+        }
+
+        for (char *cursor = buffer; cursor < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)cursor;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                relevant = true;
+                sibling = true;
+            } else if (event->mask & IN_IGNORED) {
+                k10_log_error("config watch: directory of %s went away", watch->path);
+            } else if (event->len > 0 && strcmp(event->name, watch->name) == 0) {
+                relevant = true;
+            } else if (event->len > 0 && strcmp(event->name, watch->sibling_name) == 0) {
+                sibling = true;
+            }
+
+            cursor += sizeof(*event) + event->len;
+        }
+    }
+
+    if (relevant) {
+        k10_config_watch_arm(watch);
+    }
+    if (sibling && watch->sibling_source != NULL) {
+        k10_config_watch_arm_source(watch->sibling_source);
+    }
+
+    return 0;
+}
+
+/*
+ * The directory is watched instead of the file itself: tools that write a
+ * temp file and rename it over config.toml replace the inode, which would
+ * silently detach a watch on the file. Events are filtered by name.
+ */
+int k10_config_watch_open(sd_event *event, const char *path, struct k10_config_persist *persist,
+                          k10_config_watch_fn changed, void *userdata,
+                          struct k10_config_watch **out) {
+    struct k10_config_watch *watch = NULL;
+    struct k10_config_set set;
+    char dir[PATH_MAX];
+    const char *slash = NULL;
+    int r = 0;
+
+    if (event == NULL || path == NULL || changed == NULL || out == NULL) {
+        return -EINVAL;
+    }
+
+    watch = calloc(1, sizeof(*watch));
+    if (watch == NULL) {
+        return -ENOMEM;
+    }
+
+    strncpy(watch->path, path, sizeof(watch->path) - 1);
+    watch->inotify_fd = -1;
+    watch->persist = persist;
+    watch->changed = changed;
+    watch->userdata = userdata;
+
+    slash = strrchr(watch->path, '/');
+    watch->name = slash != NULL ? slash + 1 : watch->path;
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == watch->path) {
+        snprintf(dir, sizeof(dir), "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - watch->path), watch->path);
+    }
+
+    watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->inotify_fd < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    if (inotify_add_watch(watch->inotify_fd, dir, K10_CONFIG_WATCH_EVENTS) < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    r = k10_event_add_io(event, &watch->io_source, watch->inotify_fd, EPOLLIN,
+                         K10_EVENT_PRIORITY_IDLE, k10_config_watch_on_inotify, watch,
+                         "config-watch");
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = k10_event_add_timer(event, &watch->debounce_source, 0, K10_EVENT_ACCURACY_DEFAULT_USEC,
+                            K10_EVENT_PRIORITY_IDLE, k10_config_watch_on_debounce, watch,
+                            "config-watch-debounce");
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(watch->debounce_source, SD_EVENT_OFF);
+    }
+    if (r < 0) {
+        goto fail;
+    }
+
+    /* Remember what is on disk now so the first event only reloads on a real change. */
+    watch->loaded = (k10_config_load_hashed(watch->path, &set, &watch->loaded_hash) >= 0);
+
+    *out = watch;
+    return 0;
+
+fail:
+    k10_config_watch_close(watch);
+    return r;
+}
+
+/* The sibling shares the directory watch and the debounce, but not the reload. */
+int k10_config_watch_add_sibling(struct k10_config_watch *watch, const char *name,
+                                 k10_config_watch_sibling_fn changed, void *userdata) {
+    int r = 0;
+
+    if (watch == NULL || name == NULL || name[0] == '\0' || strchr(name, '/') != NULL ||
+        strlen(name) >= sizeof(watch->sibling_name) || changed == NULL) {
+        return -EINVAL;
+    }
+
+    if (watch->sibling_source != NULL) {
+        return -EBUSY;
+    }
+
+    r = k10_event_add_timer(sd_event_source_get_event(watch->io_source), &watch->sibling_source,
+                            0, K10_EVENT_ACCURACY_DEFAULT_USEC, K10_EVENT_PRIORITY_IDLE,
+                            k10_config_watch_on_sibling, watch, "config-watch-sibling");
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(watch->sibling_source, SD_EVENT_OFF);
+    }
+    if (r < 0) {
+        watch->sibling_source = sd_event_source_unref(watch->sibling_source);
+        return r;
+    }
+
+    snprintf(watch->sibling_name, sizeof(watch->sibling_name), "%s", name);
+    watch->sibling_changed = changed;
+    watch->sibling_userdata = userdata;
+    return 0;
+}
+
+void k10_config_watch_close(struct k10_config_watch *watch) {
+    if (watch == NULL) {
+        return;
+    }
+
+    sd_event_source_unref(watch->sibling_source);
+    sd_event_source_unref(watch->debounce_source);
+    sd_event_source_unref(watch->io_source);
+    if (watch->inotify_fd >= 0) {
+        close(watch->inotify_fd);
+    }
+
+    free(watch);
+}
@@ -1,24 +1,603 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_DAEMON
+
 #include "k10_barrel/daemon.h"
+#include "k10_barrel/advertising.h"
+#include "k10_barrel/capture.h"
+#include "k10_barrel/chrc_dock.h"
 #include "k10_barrel/config.h"
+#include "k10_barrel/config_persist.h"
+#include "k10_barrel/config_schema.h"
+#include "k10_barrel/config_watch.h"
 #include "k10_barrel/dbus.h"
+#include "k10_barrel/event.h"
+#include "k10_barrel/gatt_app.h"
 #include "k10_barrel/log.h"
+#include "k10_barrel/relay.h"
+#include "k10_barrel/responder.h"
+#include "k10_barrel/rules.h"
 
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define K10_DEFAULT_CONFIG_PATH "/etc/k10-barrel-emulator/config.toml"
+#define K10_RULES_FILE_NAME "rules.toml"
+
+static const char *k10_daemon_label(const struct k10_daemon_state *state) {
+    return state->name[0] != '\0' ? state->name : "primary";
+}
+
+static const char *k10_daemon_scope_name(unsigned int scope) {
+    if (scope & K10_CONFIG_SCOPE_ADAPTER) {
+        return "adapter";
+    }
+
+    if (scope & K10_CONFIG_SCOPE_GATT) {
+        return "gatt";
+    }
+
+    if (scope & K10_CONFIG_SCOPE_ADVERTISING) {
+        return "advertising";
+    }
+
+    return "runtime";
+}
+
+/*
+ * Only the widest affected scope is redone: re-registering the advertisement
+ * keeps centrals connected, re-registering the GATT application drops their
+ * attribute caches, and only an adapter change tears the whole stack down.
+ */
+static int k10_daemon_restart_ble(struct k10_daemon_state *state, unsigned int scope) {
+    bool gatt = (scope & (K10_CONFIG_SCOPE_GATT | K10_CONFIG_SCOPE_ADAPTER)) != 0;
+    int r = 0;
+
+    if (scope == K10_CONFIG_SCOPE_NONE || state->adv == NULL) {
+        return 0;
+    }
+
+    /* Keep advertising the previous payload if the new one does not fit. */
+    r = k10_adv_update(state->adv, &state->config, state->config_generation);
+    if (r < 0) {
+        return r;
+    }
+
+    if (gatt) {
+        r = k10_gatt_update(state->gatt, &state->config, state->config_generation);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    if (!state->running) {
+        return 0;
+    }
+
+    k10_log_info("config apply: restarting %s scope of %s", k10_daemon_scope_name(scope),
+                 k10_daemon_label(state));
+
+    if (gatt) {
+        r = k10_gatt_register(state->gatt, state->config.adapter);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return k10_adv_register(state->adv, state->config.adapter);
+}
+
+/* The relay follows relay_dock_address while the emulation runs. */
+static void k10_daemon_apply_relay(struct k10_daemon_state *state) {
+    int r = 0;
+
+    if (state->relay == NULL) {
+        return;
+    }
+
+    if (!state->running || state->config.relay_dock_address[0] == '\0') {
+        k10_relay_stop(state->relay);
+        return;
+    }
+
+    r = k10_relay_start(state->relay, state->config.adapter, state->config.relay_dock_address);
+    if (r < 0) {
+        k10_log_error("relay start for %s failed: %s", k10_daemon_label(state), strerror(-r));
+    }
+}
+
+int k10_daemon_start(struct k10_daemon_state *state, enum k10_emulator_mode mode) {
+    int r = 0;
+
+    /* Registering again would drop every connected central; only the mode is taken. */
+    if (state->running) {
+        if (state->mode != mode) {
+            state->mode = mode;
+            k10_dbus_state_changed(state->dbus);
+        }
+        return 0;
+    }
+
+    if (state->adv != NULL) {
+        r = k10_adv_update(state->adv, &state->config, state->config_generation);
+        if (r < 0) {
+            return r;
+        }
+
+        r = k10_gatt_update(state->gatt, &state->config, state->config_generation);
+        if (r < 0) {
+            return r;
+        }
+
+        /* The application goes first so centrals never see an advertisement without services. */
+        r = k10_gatt_register(state->gatt, state->config.adapter);
+        if (r < 0) {
+            return r;
+        }
+
+        r = k10_adv_register(state->adv, state->config.adapter);
+        if (r < 0) {
+            k10_gatt_unregister(state->gatt);
+            return r;
+        }
+    }
+
+    state->running = true;
+    state->mode = mode;
+    k10_daemon_apply_relay(state);
+    k10_dbus_state_changed(state->dbus);
+    return 0;
+}
+
+void k10_daemon_stop(struct k10_daemon_state *state) {
+    if (state->adv != NULL) {
+        k10_adv_unregister(state->adv);
+        k10_gatt_unregister(state->gatt);
+    }
+
+    state->running = false;
+    state->mode = K10_MODE_NONE;
+    k10_daemon_apply_relay(state);
+    k10_dbus_state_changed(state->dbus);
+}
+
+int k10_daemon_apply_config(struct k10_daemon_state *state, const struct k10_config *config) {
+    k10_config_mask mask = k10_config_diff(&state->config, config);
+    unsigned int scope = k10_config_scope(mask);
+    int r = 0;
+
+    if (mask == 0) {
+        return 0;
+    }
+
+    state->config = *config;
+    state->config_generation++;
+
+    if (state->dock != NULL) {
+        r = k10_chrc_dock_configure(state->dock, &state->config);
+        if (r < 0) {
+            k10_log_error("notify queue resize failed: %s", strerror(-r));
+        }
+    }
+
+    if (state->capture != NULL) {
+        r = k10_capture_configure(state->capture, &state->config);
+        if (r < 0) {
+            k10_log_error("gatt capture restart failed: %s", strerror(-r));
+        }
+    }
+
+    r = k10_daemon_restart_ble(state, scope);
+    if (r < 0) {
+        k10_log_error("config apply (%s) of %s failed: %s", k10_daemon_scope_name(scope),
+                      k10_daemon_label(state), strerror(-r));
+    }
+
+    k10_daemon_apply_relay(state);
+
+    k10_dbus_state_changed(state->dbus);
+    return r;
+}
+
+bool k10_daemon_adapter_taken(const struct k10_daemon_state *state, const char *adapter) {
+    const struct k10_daemon *daemon = state->daemon;
+
+    for (unsigned int i = 0; i < daemon->instance_count; i++) {
+        if (daemon->instances[i] != state &&
+            strcmp(daemon->instances[i]->config.adapter, adapter) == 0) {
+            return true;
+        }
+    }
 
-int k10_daemon_run(void) {
-    struct k10_daemon_state state;
+    return false;
+}
+
+/*
+ * The file holds every section, so any change writes all of them: the live
+ * configs over the sections as loaded, which keeps those that did not start.
+ */
+int k10_daemon_save_config(struct k10_daemon *daemon) {
+    struct k10_config_set *set = NULL;
+    int r = 0;
+
+    set = malloc(sizeof(*set));
+    if (set == NULL) {
+        return -ENOMEM;
+    }
+
+    *set = *daemon->loaded;
+    for (unsigned int i = 0; i < daemon->instance_count; i++) {
+        int index = k10_config_set_find(set, daemon->instances[i]->name);
 
-    memset(&state, 0, sizeof(state));
-    strncpy(state.config_path, K10_DEFAULT_CONFIG_PATH, sizeof(state.config_path) - 1);
+        if (index >= 0) {
+            set->configs[index] = daemon->instances[i]->config;
+        }
+    }
+
+    r = k10_config_persist_schedule(daemon->persist, set);
+    free(set);
+    return r;
+}
+
+/* The rules live next to the config file, so --config setups bring their own. */
+static void k10_daemon_set_rules_path(struct k10_daemon *daemon) {
+    const char *slash = strrchr(daemon->config_path, '/');
+    int directory_length = slash != NULL ? (int)(slash - daemon->config_path) + 1 : 0;
+
+    snprintf(daemon->rules_path, sizeof(daemon->rules_path), "%.*s" K10_RULES_FILE_NAME,
+             directory_length, daemon->config_path);
+}
+
+/* Compiled once; every responder holds a reference to the same trie. */
+static int k10_daemon_load_rules(struct k10_daemon *daemon) {
+    struct k10_rules *rules = NULL;
+    int r = 0;
+
+    r = k10_rules_load(daemon->rules_path, &rules);
+    if (r < 0) {
+        k10_log_error("rules: loading %s failed: %s", daemon->rules_path, strerror(-r));
+        return r;
+    }
+
+    k10_rules_free(daemon->rules);
+    daemon->rules = rules;
+    k10_log_info("rules: %zu loaded from %s (%zu trie nodes)", k10_rules_count(rules),
+                 daemon->rules_path, k10_rules_node_count(rules));
+
+    for (unsigned int i = 0; i < daemon->instance_count; i++) {
+        k10_responder_set_rules(daemon->instances[i]->responder, rules);
+    }
+
+    return 0;
+}
+
+static void k10_daemon_instance_free(struct k10_daemon_state *state) {
+    if (state == NULL) {
+        return;
+    }
 
-    if (k10_config_load(state.config_path, &state.config) != 0) {
-        k10_log_error("failed to load config: %s", K10_DEFAULT_CONFIG_PATH);
+    k10_dbus_close(state->dbus);
+    k10_adv_free(state->adv);
+    k10_responder_free(state->responder);
+    k10_relay_free(state->relay);
+    k10_chrc_dock_free(state->dock);
+    k10_gatt_free(state->gatt);
+    k10_capture_free(state->capture);
+    free(state);
+}
+
+/* The D-Bus object goes up last, so clients never see a half-built instance. */
+static int k10_daemon_instance_new(struct k10_daemon *daemon, const char *name,
+                                   const struct k10_config *config,
+                                   struct k10_daemon_state **out) {
+    struct k10_daemon_state *state = NULL;
+    int r = 0;
+
+    state = calloc(1, sizeof(*state));
+    if (state == NULL) {
+        return -ENOMEM;
+    }
+
+    state->daemon = daemon;
+    state->config = *config;
+    snprintf(state->name, sizeof(state->name), "%s", name);
+    if (name[0] == '\0') {
+        snprintf(state->path, sizeof(state->path), "%s", K10_DBUS_OBJECT);
+    } else {
+        snprintf(state->path, sizeof(state->path), K10_DBUS_OBJECT "/%s", name);
+    }
+
+    r = k10_gatt_new(daemon->bus, state->path, &state->gatt);
+    if (r < 0) {
+        k10_log_error("gatt application export failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    r = k10_capture_new(&state->capture);
+    if (r < 0) {
+        k10_log_error("gatt capture init failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    /* Capture is diagnostics only; a failed start leaves it off until the next config change. */
+    r = k10_capture_configure(state->capture, &state->config);
+    if (r < 0) {
+        k10_log_error("gatt capture start failed: %s", strerror(-r));
+    }
+    k10_gatt_set_capture(state->gatt, state->capture);
+
+    r = k10_chrc_dock_new(state->gatt, &state->config, &state->dock);
+    if (r < 0) {
+        k10_log_error("dock notify queue init failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    r = k10_responder_new(daemon->event, state->gatt, state->dock, &state->responder);
+    if (r < 0) {
+        k10_log_error("rule responder init failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    /* Without a usable rule file every frame goes to the codec. */
+    if (daemon->rules != NULL) {
+        k10_responder_set_rules(state->responder, daemon->rules);
+    }
+
+    r = k10_relay_new(daemon->bus, state->gatt, state->dock, &state->relay);
+    if (r < 0) {
+        k10_log_error("relay init failed: %s", strerror(-r));
+        goto fail;
+    }
+    k10_responder_set_relay(state->responder, state->relay);
+
+    r = k10_adv_new(daemon->bus, state->path, &state->adv);
+    if (r < 0) {
+        k10_log_error("advertisement export failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    /* An oversized payload is logged here and refused again on Start. */
+    (void)k10_adv_update(state->adv, &state->config, state->config_generation);
+    (void)k10_gatt_update(state->gatt, &state->config, state->config_generation);
+
+    if (k10_dbus_open(daemon->bus, state, &state->dbus) != 0) {
+        r = -EIO;
+        goto fail;
+    }
+
+    k10_log_info("instance %s: adapter=%s name=%s path=%s", k10_daemon_label(state),
+                 state->config.adapter, state->config.local_name, state->path);
+    *out = state;
+    return 0;
+
+fail:
+    k10_daemon_instance_free(state);
+    return r;
+}
+
+/*
+ * Brings the running instances in line with the file: sections that went away
+ * are torn down, new ones come up stopped, and the rest get their config
+ * applied in place. The primary instance always stays. A section that repeats
+ * an earlier one's adapter gets no instance but stays in the file.
+ */
+static int k10_daemon_apply_set(struct k10_daemon *daemon, const struct k10_config_set *set) {
+    bool skipped[K10_INSTANCE_MAX] = {false};
+    unsigned int kept = 0;
+    int result = 0;
+    int r = 0;
+
+    *daemon->loaded = *set;
+
+    for (unsigned int i = 1; i < set->count; i++) {
+        for (unsigned int j = 0; j < i; j++) {
+            if (!skipped[j] && strcmp(set->configs[j].adapter, set->configs[i].adapter) == 0) {
+                k10_log_error("instance %s: not started, adapter %s is already in use",
+                              set->names[i], set->configs[i].adapter);
+                skipped[i] = true;
+                break;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < daemon->instance_count; i++) {
+        struct k10_daemon_state *state = daemon->instances[i];
+        int index = k10_config_set_find(set, state->name);
+
+        if (i > 0 && (index < 0 || skipped[index])) {
+            k10_log_info("instance %s: removed from the config", state->name);
+            k10_daemon_instance_free(state);
+            continue;
+        }
+
+        daemon->instances[kept++] = state;
+    }
+    daemon->instance_count = kept;
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        struct k10_daemon_state *state = NULL;
+        unsigned int j = 0;
+
+        if (skipped[i]) {
+            continue;
+        }
+
+        for (j = 0; j < daemon->instance_count; j++) {
+            if (strcmp(daemon->instances[j]->name, set->names[i]) == 0) {
+                break;
+            }
+        }
+
+        if (j < daemon->instance_count) {
+            r = k10_daemon_apply_config(daemon->instances[j], &set->configs[i]);
+        } else {
+            r = k10_daemon_instance_new(daemon, set->names[i], &set->configs[i], &state);
+            if (r >= 0) {
+                daemon->instances[daemon->instance_count++] = state;
+            } else {
+                k10_log_error("instance %s: not started: %s", set->names[i], strerror(-r));
+            }
+        }
+
+        if (r < 0) {
+            result = r;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Rereads the config file, every section of it, and the rules. Returns the
+ * first failure; the rules are reread even when an instance did not take its
+ * section.
+ */
+int k10_daemon_reload(struct k10_daemon *daemon) {
+    struct k10_config_set *set = NULL;
+    int result = 0;
+    int r = 0;
+
+    set = malloc(sizeof(*set));
+    if (set == NULL) {
+        return -ENOMEM;
+    }
+
+    if (k10_config_load_set(daemon->config_path, set) != 0) {
+        k10_log_error("reload failed: %s", daemon->config_path);
+        free(set);
+        return -EINVAL;
+    }
+
+    k10_log_info("reload: %s", daemon->config_path);
+    result = k10_daemon_apply_set(daemon, set);
+    free(set);
+    if (result < 0) {
+        k10_log_error("reload: config not fully applied: %s", strerror(-result));
+    }
+
+    /* A broken rule file keeps the current rules. */
+    r = k10_daemon_load_rules(daemon);
+    return result < 0 ? result : r;
+}
+
+static void k10_daemon_on_config_file(const struct k10_config_set *set, void *userdata) {
+    int r = k10_daemon_apply_set(userdata, set);
+
+    if (r < 0) {
+        k10_log_error("config watch: config not fully applied: %s", strerror(-r));
+    }
+}
+
+/* A broken edit keeps the current rules, as on Reload. */
+static void k10_daemon_on_rules_file(void *userdata) {
+    (void)k10_daemon_load_rules(userdata);
+}
+
+int k10_daemon_run(const char *config_path) {
+    struct k10_daemon daemon;
+    struct k10_config_set *set = NULL;
+    int exit_code = 0;
+    int r = 0;
+
+    memset(&daemon, 0, sizeof(daemon));
+    snprintf(daemon.config_path, sizeof(daemon.config_path), "%s",
+             config_path != NULL ? config_path : K10_DEFAULT_CONFIG_PATH);
+    k10_daemon_set_rules_path(&daemon);
+
+    set = malloc(sizeof(*set));
+    daemon.loaded = malloc(sizeof(*daemon.loaded));
+    if (set == NULL || daemon.loaded == NULL ||
+        k10_config_load_set(daemon.config_path, set) != 0) {
+        k10_log_error("failed to load config: %s", daemon.config_path);
+        free(daemon.loaded);
+        free(set);
         return 1;
     }
 
-    k10_log_info("daemon start: adapter=%s name=%s", state.config.adapter, state.config.local_name);
+    k10_log_info("daemon start: %u instance(s), primary adapter=%s name=%s", set->count,
+                 set->configs[0].adapter, set->configs[0].local_name);
 
-    return k10_dbus_run(&state);
+    r = sd_event_default(&daemon.event);
+    if (r < 0) {
+        k10_log_error("event loop init failed: %s", strerror(-r));
+        free(daemon.loaded);
+        free(set);
+        return 1;
+    }
+
+    r = k10_event_add_signals(daemon.event);
+    if (r < 0) {
+        k10_log_error("signal setup failed: %s", strerror(-r));
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    /* Like the persist worker, the log drain thread must start with signals blocked. */
+    r = k10_log_open();
+    if (r < 0) {
+        k10_log_error("async logging disabled: %s", strerror(-r));
+    }
+
+    /* After signal setup so the worker thread inherits the blocked mask. */
+    r = k10_config_persist_open(daemon.event, daemon.config_path, &daemon.persist);
+    if (r < 0) {
+        k10_log_error("config persistence init failed: %s", strerror(-r));
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    if (k10_dbus_connect(daemon.event, &daemon.bus) != 0) {
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    /* Scripted replies are optional. */
+    (void)k10_daemon_load_rules(&daemon);
+
+    r = k10_daemon_apply_set(&daemon, set);
+    if (r < 0) {
+        k10_log_error("config not fully applied: %s", strerror(-r));
+    }
+
+    if (daemon.instance_count == 0 || daemon.instances[0]->name[0] != '\0') {
+        k10_log_error("primary instance init failed");
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    /* Hot reload is a convenience; the daemon still works without it. */
+    r = k10_config_watch_open(daemon.event, daemon.config_path, daemon.persist,
+                              k10_daemon_on_config_file, &daemon, &daemon.watch);
+    if (r < 0) {
+        k10_log_error("config watch disabled: %s", strerror(-r));
+    } else {
+        r = k10_config_watch_add_sibling(daemon.watch, K10_RULES_FILE_NAME,
+                                         k10_daemon_on_rules_file, &daemon);
+        if (r < 0) {
+            k10_log_error("rules watch disabled: %s", strerror(-r));
+        }
+    }
+
+    r = sd_event_loop(daemon.event);
+    if (r < 0) {
+        k10_log_error("event loop failed: %s", strerror(-r));
+        exit_code = 1;
+    } else if (r != 0) {
+        exit_code = 1;
+    }
+
+cleanup:
+    while (daemon.instance_count > 0) {
+        k10_daemon_instance_free(daemon.instances[--daemon.instance_count]);
+    }
+    k10_rules_free(daemon.rules);
+    k10_config_watch_close(daemon.watch);
+    k10_config_persist_close(daemon.persist);
+    k10_dbus_disconnect(daemon.bus);
+    sd_event_unref(daemon.event);
+    k10_log_close();
+    free(daemon.loaded);
+    free(set);
+    return exit_code;
 }
@@ -0,0 +1,112 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_DAEMON
+
+#include "k10_barrel/event.h"
+
+#include "k10_barrel/log.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+static int k10_event_finish_source(sd_event_source *source, int64_t priority,
+                                   const char *description) {
+    int r = 0;
+
+    r = sd_event_source_set_priority(source, priority);
+    if (r < 0) {
+        return r;
+    }
+
+    if (description != NULL) {
+        (void)sd_event_source_set_description(source, description);
+    }
+
+    return 0;
+}
+
+int k10_event_add_timer(sd_event *event, sd_event_source **out_source, uint64_t delay_usec,
+                        uint64_t accuracy_usec, int64_t priority, sd_event_time_handler_t handler,
+                        void *userdata, const char *description) {
+    sd_event_source *source = NULL;
+    int r = 0;
+
+    r = sd_event_add_time_relative(event, &source, CLOCK_MONOTONIC, delay_usec, accuracy_usec,
+                                   handler, userdata);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_event_finish_source(source, priority, description);
+    if (r < 0) {
+        sd_event_source_unref(source);
+        return r;
+    }
+
+    *out_source = source;
+    return 0;
+}
+
+int k10_event_add_io(sd_event *event, sd_event_source **out_source, int fd, uint32_t events,
+                     int64_t priority, sd_event_io_handler_t handler, void *userdata,
+                     const char *description) {
+    sd_event_source *source = NULL;
+    int r = 0;
+
+    r = sd_event_add_io(event, &source, fd, events, handler, userdata);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_event_finish_source(source, priority, description);
+    if (r < 0) {
+        sd_event_source_unref(source);
+        return r;
+    }
+
+    *out_source = source;
+    return 0;
+}
+
+static int k10_event_on_signal(sd_event_source *source, const struct signalfd_siginfo *info,
+                               void *userdata) {
+    (void)userdata;
+
+    k10_log_info("received %s, shutting down", strsignal((int)info->ssi_signo));
+    return sd_event_exit(sd_event_source_get_event(source), 0);
+}
+
+int k10_event_add_signals(sd_event *event) {
+    static const int signals[] = {SIGTERM, SIGINT};
+    sigset_t mask;
+    int r = 0;
+
+    sigemptyset(&mask);
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        sigaddset(&mask, signals[i]);
+    }
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        return -errno;
+    }
+
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        sd_event_source *source = NULL;
+
+        r = sd_event_add_signal(event, &source, signals[i], k10_event_on_signal, NULL);
+        if (r < 0) {
+            return r;
+        }
+
+        r = k10_event_finish_source(source, K10_EVENT_PRIORITY_SIGNAL, "signal");
+        if (r >= 0) {
+            r = sd_event_source_set_floating(source, 1);
+        }
+        sd_event_source_unref(source);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "k10_barrel/file.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Reads everything left in fd into a heap buffer. Files the daemon parses can
+ * be rewritten or truncated underneath it, and a mapping of one would fault,
+ * so they are copied rather than mapped; st_size is only the first guess.
+ * More than max_size bytes is -EFBIG.
+ */
+int k10_file_read(int fd, size_t max_size, char **out_data, size_t *out_size) {
+    struct stat st;
+    char *data = NULL;
+    size_t capacity = 4096;
+    size_t size = 0;
+
+    if (fstat(fd, &st) < 0) {
+        return -errno;
+    }
+    if ((unsigned long long)st.st_size > max_size) {
+        return -EFBIG;
+    }
+    if (st.st_size > 0) {
+        capacity = (size_t)st.st_size + 1;
+    }
+
+    data = malloc(capacity);
+    if (data == NULL) {
+        return -ENOMEM;
+    }
+
+    for (;;) {
+        ssize_t n = 0;
+
+        if (size == capacity) {
+            char *grown = realloc(data, capacity * 2);
+
+            if (grown == NULL) {
+                free(data);
+                return -ENOMEM;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+
+        n = read(fd, data + size, capacity - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int r = -errno;
+
+            free(data);
+            return r;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += (size_t)n;
+        if (size > max_size) {
+            free(data);
+            return -EFBIG;
+        }
+    }
+
+    *out_data = data;
+    *out_size = size;
+    return 0;
+}
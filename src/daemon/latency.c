@@ -0,0 +1,78 @@
+#include "k10_barrel/latency.h"
+
+#include <time.h>
+
+uint64_t k10_latency_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int k10_latency_bucket(uint64_t ns) {
+    unsigned int exponent = 4;
+
+    if (ns < 16) {
+        return (unsigned int)ns;
+    }
+
+    if (ns >> 36 != 0) {
+        return K10_LATENCY_BUCKETS - 1;
+    }
+
+    while (exponent < 35 && ns >> (exponent + 1) != 0) {
+        exponent++;
+    }
+
+    return 16 + (exponent - 4) * 8 + (unsigned int)((ns >> (exponent - 3)) & 7);
+}
+
+/* Upper edge of a bucket, so reported percentiles never flatter what was measured. */
+static uint64_t k10_latency_bucket_ns(unsigned int bucket) {
+    unsigned int exponent = 0;
+
+    if (bucket < 16) {
+        return bucket;
+    }
+
+    /* The overflow bucket has no upper edge; the caller falls back to max_ns. */
+    if (bucket == K10_LATENCY_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+
+    exponent = (bucket - 16) / 8 + 4;
+    return ((uint64_t)(8 + (bucket - 16) % 8 + 1) << (exponent - 3)) - 1;
+}
+
+void k10_latency_record(struct k10_latency *latency, uint64_t ns) {
+    latency->count++;
+    latency->total_ns += ns;
+    latency->buckets[k10_latency_bucket(ns)]++;
+    if (ns > latency->max_ns) {
+        latency->max_ns = ns;
+    }
+}
+
+uint64_t k10_latency_average(const struct k10_latency *latency) {
+    return latency->count > 0 ? latency->total_ns / latency->count : 0;
+}
+
+uint64_t k10_latency_percentile(const struct k10_latency *latency, unsigned int percent) {
+    uint64_t rank = (latency->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    if (latency->count == 0) {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < K10_LATENCY_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if (seen >= rank) {
+            uint64_t edge = k10_latency_bucket_ns(i);
+
+            return edge < latency->max_ns ? edge : latency->max_ns;
+        }
+    }
+
+    return latency->max_ns;
+}
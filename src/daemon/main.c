@@ -1,10 +1,21 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_DAEMON
+
 #include "k10_barrel/daemon.h"
 #include "k10_barrel/log.h"
 
+#include <stdio.h>
+#include <string.h>
+
 int main(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
+    const char *config_path = NULL;
+
+    if (argc == 3 && strcmp(argv[1], "--config") == 0) {
+        config_path = argv[2];
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [--config <path>]\n", argv[0]);
+        return 1;
+    }
 
     k10_log_info("k10-barrel-emulatord starting");
-    return k10_daemon_run();
+    return k10_daemon_run(config_path);
 }
@@ -1,20 +1,41 @@
+#define K10_LOG_SUBSYSTEM K10_LOG_SUBSYSTEM_DBUS
+
 #include "k10_barrel/dbus.h"
 
+#include "k10_barrel/advertising.h"
+#include "k10_barrel/capture.h"
+#include "k10_barrel/chrc_dock.h"
 #include "k10_barrel/config.h"
+#include "k10_barrel/config_persist.h"
+#include "k10_barrel/config_schema.h"
+#include "k10_barrel/dbus_marshal.h"
+#include "k10_barrel/event.h"
 #include "k10_barrel/log.h"
+#include "k10_barrel/relay.h"
+#include "k10_barrel/replay.h"
+#include "k10_barrel/responder.h"
 
-#include <signal.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <systemd/sd-bus.h>
 
 #include "k10_barrel/dbus_defs.h"
 
-struct k10_dbus_context {
-    sd_bus *bus;
-    struct k10_daemon_state *state;
+#define K10_ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+/* VTABLE_START plus the config methods; checked against the head array below. */
+#define K10_CONFIG_VTABLE_HEAD 8
+
+struct k10_dbus_context;
+
+struct k10_status_snapshot {
+    bool running;
+    enum k10_emulator_mode mode;
+    char adapter[sizeof(((struct k10_config *)0)->adapter)];
 };
 
 struct k10_control_binding {
@@ -22,305 +43,164 @@ struct k10_control_binding {
     enum k10_emulator_mode mode;
 };
 
-static volatile sig_atomic_t k10_should_exit = 0;
-
-static const char *k10_mode_to_string(enum k10_emulator_mode mode) {
-    switch (mode) {
-    case K10_MODE_SWEEPER:
-        return "sweeper";
-    case K10_MODE_BARREL:
-        return "barrel";
-    default:
-        return "idle";
-    }
-}
-
-static int k10_dbus_append_kv_string(sd_bus_message *msg, const char *key, const char *value) {
-    int r = 0;
-
-    r = sd_bus_message_open_container(msg, 'e', "sv");
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_append(msg, "s", key);
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_open_container(msg, 'v', "s");
-    if (r < 0) {
-        return r;
-    }
+struct k10_dbus_context {
+    sd_bus *bus;
+    struct k10_daemon_state *state;
+    struct k10_control_binding sweeper_binding;
+    struct k10_control_binding barrel_binding;
+    sd_bus_slot *sweeper_slot;
+    sd_bus_slot *barrel_slot;
+    sd_bus_slot *config_slot;
+    sd_event_source *notify_idle_source;
+    sd_event_source *notify_timer_source;
+    bool notify_pending;
+    struct k10_config published_config;
+    struct k10_status_snapshot published_status;
+    uint64_t notifications_sent;
+    uint64_t notifications_coalesced;
+    uint64_t generation;
+    /* One replay at a time; its Replay() call is answered when it ends. */
+    struct k10_replay *replay;
+    sd_bus_message *replay_call;
+    sd_bus_vtable config_vtable[K10_CONFIG_VTABLE_HEAD + K10_CONFIG_FIELD_MAX + 1];
+};
 
-    r = sd_bus_message_append(msg, "s", value);
-    if (r < 0) {
-        return r;
-    }
+enum {
+    K10_STATUS_RUNNING = 1u << 0,
+    K10_STATUS_MODE = 1u << 1,
+    K10_STATUS_ADAPTER = 1u << 2,
+};
 
-    r = sd_bus_message_close_container(msg);
-    if (r < 0) {
-        return r;
-    }
+static const char *const k10_status_property_names[] = {"running", "mode", "adapter"};
 
-    return sd_bus_message_close_container(msg);
+static void k10_dbus_snapshot_status(const struct k10_daemon_state *state,
+                                     struct k10_status_snapshot *out) {
+    out->running = state->running;
+    out->mode = state->mode;
+    memcpy(out->adapter, state->config.adapter, sizeof(out->adapter));
 }
 
-static int k10_dbus_append_kv_bool(sd_bus_message *msg, const char *key, bool value) {
-    int r = 0;
-
-    r = sd_bus_message_open_container(msg, 'e', "sv");
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_append(msg, "s", key);
-    if (r < 0) {
-        return r;
-    }
+static unsigned int k10_dbus_status_changed_mask(const struct k10_status_snapshot *before,
+                                                 const struct k10_daemon_state *state) {
+    unsigned int mask = 0;
 
-    r = sd_bus_message_open_container(msg, 'v', "b");
-    if (r < 0) {
-        return r;
+    if (before->running != state->running) {
+        mask |= K10_STATUS_RUNNING;
     }
 
-    r = sd_bus_message_append(msg, "b", value);
-    if (r < 0) {
-        return r;
+    if (before->mode != state->mode) {
+        mask |= K10_STATUS_MODE;
     }
 
-    r = sd_bus_message_close_container(msg);
-    if (r < 0) {
-        return r;
+    if (strcmp(before->adapter, state->config.adapter) != 0) {
+        mask |= K10_STATUS_ADAPTER;
     }
 
-    return sd_bus_message_close_container(msg);
+    return mask;
 }
 
-static int k10_dbus_append_kv_uint(sd_bus_message *msg, const char *key, unsigned int value) {
-    int r = 0;
-
-    r = sd_bus_message_open_container(msg, 'e', "sv");
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_append(msg, "s", key);
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_open_container(msg, 'v', "u");
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_append(msg, "u", value);
-    if (r < 0) {
-        return r;
+static int k10_dbus_emit_properties(struct k10_dbus_context *ctx, const char *interface,
+                                    char **changed) {
+    if (changed[0] == NULL) {
+        return 0;
     }
 
-    r = sd_bus_message_close_container(msg);
-    if (r < 0) {
-        return r;
-    }
-
-    return sd_bus_message_close_container(msg);
+    return sd_bus_emit_properties_changed_strv(ctx->bus, ctx->state->path, interface, changed);
 }
 
-static int k10_dbus_append_kv_string_array(sd_bus_message *msg, const char *key,
-                                           const char *values[], unsigned int count) {
+static void k10_dbus_flush_notifications(struct k10_dbus_context *ctx) {
+    char *config_changed[K10_CONFIG_FIELD_MAX + 1];
+    char *status_changed[K10_ARRAY_SIZE(k10_status_property_names) + 1];
+    k10_config_mask config_mask = 0;
+    unsigned int status_mask = 0;
+    size_t used = 0;
     int r = 0;
 
-    r = sd_bus_message_open_container(msg, 'e', "sv");
-    if (r < 0) {
-        return r;
-    }
+    ctx->notify_pending = false;
 
-    r = sd_bus_message_append(msg, "s", key);
-    if (r < 0) {
-        return r;
-    }
+    config_mask = k10_config_diff(&ctx->published_config, &ctx->state->config);
+    status_mask = k10_dbus_status_changed_mask(&ctx->published_status, ctx->state);
 
-    r = sd_bus_message_open_container(msg, 'v', "as");
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_open_container(msg, 'a', "s");
-    if (r < 0) {
-        return r;
-    }
-
-    for (unsigned int i = 0; i < count; i++) {
-        r = sd_bus_message_append(msg, "s", values[i]);
-        if (r < 0) {
-            return r;
+    for (size_t i = 0; i < k10_config_field_count; i++) {
+        if (config_mask & ((k10_config_mask)1 << i)) {
+            config_changed[used++] = (char *)k10_config_fields[i].name;
         }
     }
+    config_changed[used] = NULL;
 
-    r = sd_bus_message_close_container(msg);
-    if (r < 0) {
-        return r;
-    }
-
-    r = sd_bus_message_close_container(msg);
-    if (r < 0) {
-        return r;
+    used = 0;
+    for (size_t i = 0; i < K10_ARRAY_SIZE(k10_status_property_names); i++) {
+        if (status_mask & (1u << i)) {
+            status_changed[used++] = (char *)k10_status_property_names[i];
+        }
     }
+    status_changed[used] = NULL;
 
-    return sd_bus_message_close_container(msg);
-}
-
-static int k10_dbus_append_status(sd_bus_message *msg, const struct k10_daemon_state *state) {
-    int r = 0;
-
-    r = sd_bus_message_open_container(msg, 'a', "{sv}");
+    r = k10_dbus_emit_properties(ctx, K10_DBUS_IFACE_CONFIG, config_changed);
     if (r < 0) {
-        return r;
+        k10_log_error("dbus config signal failed: %s", strerror(-r));
     }
 
-    r = k10_dbus_append_kv_bool(msg, "running", state->running);
+    r = k10_dbus_emit_properties(ctx, K10_DBUS_IFACE_BARREL, status_changed);
     if (r < 0) {
-        return r;
+        k10_log_error("dbus status signal failed: %s", strerror(-r));
     }
 
-    r = k10_dbus_append_kv_string(msg, "mode", k10_mode_to_string(state->mode));
-    if (r < 0) {
-        return r;
+    if (config_mask != 0 || status_mask != 0) {
+        ctx->generation++;
+        ctx->notifications_sent++;
     }
 
-    r = k10_dbus_append_kv_string(msg, "adapter", state->config.adapter);
-    if (r < 0) {
-        return r;
-    }
+    ctx->published_config = ctx->state->config;
+    k10_dbus_snapshot_status(ctx->state, &ctx->published_status);
+}
 
-    r = sd_bus_message_close_container(msg);
-    if (r < 0) {
-        return r;
-    }
+static int k10_dbus_on_notify_idle(sd_event_source *source, void *userdata) {
+    (void)source;
 
+    k10_dbus_flush_notifications(userdata);
     return 0;
 }
 
-static int k10_dbus_append_config(sd_bus_message *msg, const struct k10_config *config) {
-    const char *service_uuids[K10_MAX_UUIDS];
-    int r = 0;
-
-    for (unsigned int i = 0; i < config->service_uuid_count; i++) {
-        service_uuids[i] = config->service_uuids[i];
-    }
-
-    r = sd_bus_message_open_container(msg, 'a', "{sv}");
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_string(msg, "adapter", config->adapter);
-    if (r < 0) {
-        return r;
-    }
+static int k10_dbus_on_notify_timer(sd_event_source *source, uint64_t usec, void *userdata) {
+    (void)source;
+    (void)usec;
 
-    r = k10_dbus_append_kv_string(msg, "local_name", config->local_name);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_uint(msg, "company_id", config->company_id);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_string(msg, "manufacturer_mac_label", config->manufacturer_mac_label);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_string_array(msg, "service_uuids", service_uuids,
-                                        config->service_uuid_count);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_string(msg, "fd3d_service_data_hex", config->fd3d_service_data_hex);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_bool(msg, "include_tx_power", config->include_tx_power);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_uint(msg, "fw_major", config->fw_major);
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_kv_uint(msg, "fw_minor", config->fw_minor);
-    if (r < 0) {
-        return r;
-    }
-
-    return sd_bus_message_close_container(msg);
+    k10_dbus_flush_notifications(userdata);
+    return 0;
 }
 
-static int k10_dbus_emit_status_changed(struct k10_dbus_context *ctx, const char *interface) {
-    sd_bus_message *signal = NULL;
+/*
+ * Handlers only mark state dirty; change signals go out once per idle loop
+ * iteration (or per notify_coalesce_ms window) with the net delta since the
+ * last flush. The generation bumps with that flush, and only when the delta
+ * is not empty, so a no-op Start/Stop/SetConfig never sends pollers refetching.
+ */
+static void k10_dbus_mark_dirty(struct k10_dbus_context *ctx) {
+    unsigned int window_ms = ctx->state->config.notify_coalesce_ms;
     int r = 0;
 
-    r = sd_bus_message_new_signal(ctx->bus, &signal, K10_DBUS_OBJECT, interface, "StatusChanged");
-    if (r < 0) {
-        return r;
-    }
-
-    r = k10_dbus_append_status(signal, ctx->state);
-    if (r < 0) {
-        sd_bus_message_unref(signal);
-        return r;
+    if (ctx->notify_pending) {
+        ctx->notifications_coalesced++;
+        return;
     }
 
-    r = sd_bus_send(ctx->bus, signal, NULL);
-    sd_bus_message_unref(signal);
-    return r;
-}
-
-static int k10_dbus_emit_config_changed(struct k10_dbus_context *ctx) {
-    sd_bus_message *signal = NULL;
-    int r = 0;
+    ctx->notify_pending = true;
 
-    r = sd_bus_message_new_signal(ctx->bus, &signal, K10_DBUS_OBJECT, K10_DBUS_IFACE_CONFIG,
-                                  "ConfigChanged");
-    if (r < 0) {
-        return r;
+    if (window_ms == 0) {
+        r = sd_event_source_set_enabled(ctx->notify_idle_source, SD_EVENT_ONESHOT);
+    } else {
+        r = sd_event_source_set_time_relative(ctx->notify_timer_source,
+                                              (uint64_t)window_ms * 1000ULL);
+        if (r >= 0) {
+            r = sd_event_source_set_enabled(ctx->notify_timer_source, SD_EVENT_ONESHOT);
+        }
     }
 
-    r = k10_dbus_append_config(signal, &ctx->state->config);
     if (r < 0) {
-        sd_bus_message_unref(signal);
-        return r;
+        k10_log_error("dbus notify schedule failed: %s", strerror(-r));
+        k10_dbus_flush_notifications(ctx);
     }
-
-    r = sd_bus_send(ctx->bus, signal, NULL);
-    sd_bus_message_unref(signal);
-    return r;
-}
-
-static void k10_dbus_emit_status_all(struct k10_dbus_context *ctx) {
-    k10_dbus_emit_status_changed(ctx, K10_DBUS_IFACE_SWEEPER);
-    k10_dbus_emit_status_changed(ctx, K10_DBUS_IFACE_BARREL);
-}
-
-static int k10_dbus_reload_config(struct k10_dbus_context *ctx) {
-    if (k10_config_load(ctx->state->config_path, &ctx->state->config) != 0) {
-        k10_log_error("dbus reload failed: %s", ctx->state->config_path);
-        return -1;
-    }
-
-    k10_log_info("dbus reload: %s", ctx->state->config_path);
-    k10_dbus_emit_config_changed(ctx);
-    k10_dbus_emit_status_all(ctx);
-    return 0;
 }
 
 static int k10_method_get_status(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
@@ -348,16 +228,18 @@ static int k10_method_get_status(sd_bus_message *m, void *userdata, sd_bus_error
 
 static int k10_method_start(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     struct k10_control_binding *binding = userdata;
+    int r = 0;
 
     (void)ret_error;
 
-    binding->ctx->state->running = true;
-    binding->ctx->state->mode = binding->mode;
-
     k10_log_info("dbus start requested: mode=%s", k10_mode_to_string(binding->mode));
-    k10_dbus_emit_status_all(binding->ctx);
 
-    return sd_bus_reply_method_return(m, "b", 1);
+    r = k10_daemon_start(binding->ctx->state, binding->mode);
+    if (r < 0) {
+        k10_log_error("dbus start failed: %s", strerror(-r));
+    }
+
+    return sd_bus_reply_method_return(m, "b", r >= 0);
 }
 
 static int k10_method_stop(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
@@ -365,11 +247,8 @@ static int k10_method_stop(sd_bus_message *m, void *userdata, sd_bus_error *ret_
 
     (void)ret_error;
 
-    binding->ctx->state->running = false;
-    binding->ctx->state->mode = K10_MODE_NONE;
-
     k10_log_info("dbus stop requested");
-    k10_dbus_emit_status_all(binding->ctx);
+    k10_daemon_stop(binding->ctx->state);
 
     return sd_bus_reply_method_return(m, "b", 1);
 }
@@ -380,144 +259,160 @@ static int k10_method_reload(sd_bus_message *m, void *userdata, sd_bus_error *re
 
     (void)ret_error;
 
-    ok = (k10_dbus_reload_config(binding->ctx) == 0);
+    /* May tear down this very instance; only m is used afterwards. */
+    ok = (k10_daemon_reload(binding->ctx->state->daemon) >= 0);
     return sd_bus_reply_method_return(m, "b", ok);
 }
 
-static int k10_method_get_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+static void k10_dbus_on_replay_done(struct k10_replay *replay, int result, void *userdata) {
     struct k10_dbus_context *ctx = userdata;
+    struct k10_replay_stats stats;
     sd_bus_message *reply = NULL;
     int r = 0;
 
-    (void)ret_error;
+    k10_replay_get_stats(replay, &stats);
 
-    r = sd_bus_message_new_method_return(m, &reply);
-    if (r < 0) {
-        return r;
+    if (result < 0 && result != -ECANCELED) {
+        r = sd_bus_reply_method_errnof(ctx->replay_call, -result, "Replay failed: %s",
+                                       strerror(-result));
+    } else {
+        r = sd_bus_message_new_method_return(ctx->replay_call, &reply);
+        if (r >= 0) {
+            r = k10_dbus_append_replay_stats(reply, &stats);
+        }
+        if (r >= 0) {
+            r = sd_bus_send(NULL, reply, NULL);
+        }
     }
 
-    r = k10_dbus_append_config(reply, &ctx->state->config);
     if (r < 0) {
-        sd_bus_message_unref(reply);
-        return r;
+        k10_log_error("dbus replay reply failed: %s", strerror(-r));
     }
 
-    r = sd_bus_send(ctx->bus, reply, NULL);
     sd_bus_message_unref(reply);
-    return r;
+    sd_bus_message_unref(ctx->replay_call);
+    ctx->replay_call = NULL;
+    ctx->replay = NULL;
+    k10_replay_free(replay);
 }
 
-static int k10_dbus_apply_string(sd_bus_message *m, char *out, size_t out_size) {
-    const char *value = NULL;
+/* The reply carries the replay's stats and goes out from k10_dbus_on_replay_done(). */
+static int k10_method_replay(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+    struct k10_dbus_context *ctx = binding->ctx;
+    struct k10_replay_options options;
+    const char *direction = NULL;
+    int fd = -1;
     int r = 0;
 
-    r = sd_bus_message_enter_container(m, 'v', "s");
+    memset(&options, 0, sizeof(options));
+    r = sd_bus_message_read(m, "hds", &fd, &options.speed, &direction);
     if (r < 0) {
         return r;
     }
 
-    r = sd_bus_message_read(m, "s", &value);
-    if (r < 0) {
-        return r;
+    if (!(options.speed >= 0 && options.speed <= 1e6)) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Invalid speed %g",
+                                 options.speed);
     }
 
-    if (value == NULL) {
-        value = "";
+    if (k10_replay_direction_from_string(direction, &options.directions) < 0) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Unknown direction %s",
+                                 direction);
     }
 
-    strncpy(out, value, out_size - 1);
-    out[out_size - 1] = '\0';
-
-    return sd_bus_message_exit_container(m);
-}
-
-static int k10_dbus_apply_uint(sd_bus_message *m, unsigned int *out_value) {
-    uint32_t value = 0;
-    int r = 0;
-
-    r = sd_bus_message_enter_container(m, 'v', "u");
-    if (r < 0) {
-        return r;
+    if (ctx->replay != NULL) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "A replay is already running");
     }
 
-    r = sd_bus_message_read(m, "u", &value);
+    r = k10_replay_start(ctx->state->daemon->event, ctx->state->gatt, fd, &options,
+                         k10_dbus_on_replay_done, ctx, &ctx->replay);
     if (r < 0) {
-        return r;
+        return sd_bus_error_set_errnof(ret_error, -r, "Cannot replay capture: %s", strerror(-r));
     }
 
-    *out_value = value;
-    return sd_bus_message_exit_container(m);
+    ctx->replay_call = sd_bus_message_ref(m);
+    return 1;
 }
 
-static int k10_dbus_apply_bool(sd_bus_message *m, bool *out_value) {
-    int r = 0;
-    int value = 0;
-
-    r = sd_bus_message_enter_container(m, 'v', "b");
-    if (r < 0) {
-        return r;
-    }
+static int k10_method_cancel_replay(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+    bool running = binding->ctx->replay != NULL;
 
-    r = sd_bus_message_read(m, "b", &value);
-    if (r < 0) {
-        return r;
-    }
+    (void)ret_error;
 
-    *out_value = value != 0;
-    return sd_bus_message_exit_container(m);
+    k10_replay_cancel(binding->ctx->replay);
+    return sd_bus_reply_method_return(m, "b", running);
 }
 
-static int k10_dbus_apply_uuid_array(sd_bus_message *m, struct k10_config *config) {
-    const char *value = NULL;
-    unsigned int count = 0;
+static int k10_method_get_relay_stats(sd_bus_message *m, void *userdata,
+                                      sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+    struct k10_relay_stats stats;
+    sd_bus_message *reply = NULL;
     int r = 0;
 
-    r = sd_bus_message_enter_container(m, 'v', "as");
+    (void)ret_error;
+
+    memset(&stats, 0, sizeof(stats));
+    if (binding->ctx->state->relay != NULL) {
+        k10_relay_get_stats(binding->ctx->state->relay, &stats);
+    }
+
+    r = sd_bus_message_new_method_return(m, &reply);
     if (r < 0) {
         return r;
     }
 
-    r = sd_bus_message_enter_container(m, 'a', "s");
+    r = k10_dbus_append_relay_stats(reply, &stats);
     if (r < 0) {
+        sd_bus_message_unref(reply);
         return r;
     }
 
-    while ((r = sd_bus_message_read(m, "s", &value)) > 0) {
-        if (count < K10_MAX_UUIDS) {
-            strncpy(config->service_uuids[count], value, sizeof(config->service_uuids[0]) - 1);
-            config->service_uuids[count][sizeof(config->service_uuids[0]) - 1] = '\0';
-            count++;
-        }
-    }
+    r = sd_bus_send(binding->ctx->bus, reply, NULL);
+    sd_bus_message_unref(reply);
+    return r;
+}
 
+static int k10_method_get_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_dbus_context *ctx = userdata;
+    sd_bus_message *reply = NULL;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_new_method_return(m, &reply);
     if (r < 0) {
         return r;
     }
 
-    config->service_uuid_count = count;
-
-    r = sd_bus_message_exit_container(m);
+    r = k10_dbus_append_config(reply, &ctx->state->config);
     if (r < 0) {
+        sd_bus_message_unref(reply);
         return r;
     }
 
-    return sd_bus_message_exit_container(m);
+    r = sd_bus_send(ctx->bus, reply, NULL);
+    sd_bus_message_unref(reply);
+    return r;
 }
 
 static int k10_method_set_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     struct k10_dbus_context *ctx = userdata;
+    struct k10_config previous_config = ctx->state->config;
     struct k10_config updated_config = ctx->state->config;
+    struct k10_adv_payload payload;
     int changed = 0;
     int r = 0;
 
-    (void)ret_error;
-
     r = sd_bus_message_enter_container(m, 'a', "{sv}");
     if (r < 0) {
         return r;
     }
 
     while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+        const struct k10_config_field *field = NULL;
         const char *key = NULL;
         bool entry_updated = false;
 
@@ -526,38 +421,26 @@ static int k10_method_set_config(sd_bus_message *m, void *userdata, sd_bus_error
             return r;
         }
 
-        if (strcmp(key, "adapter") == 0) {
-            r = k10_dbus_apply_string(m, updated_config.adapter, sizeof(updated_config.adapter));
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "local_name") == 0) {
-            r = k10_dbus_apply_string(m, updated_config.local_name,
-                                      sizeof(updated_config.local_name));
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "company_id") == 0) {
-            r = k10_dbus_apply_uint(m, &updated_config.company_id);
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "manufacturer_mac_label") == 0) {
-            r = k10_dbus_apply_string(m, updated_config.manufacturer_mac_label,
-                                      sizeof(updated_config.manufacturer_mac_label));
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "service_uuids") == 0) {
-            r = k10_dbus_apply_uuid_array(m, &updated_config);
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "fd3d_service_data_hex") == 0) {
-            r = k10_dbus_apply_string(m, updated_config.fd3d_service_data_hex,
-                                      sizeof(updated_config.fd3d_service_data_hex));
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "include_tx_power") == 0) {
-            r = k10_dbus_apply_bool(m, &updated_config.include_tx_power);
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "fw_major") == 0) {
-            r = k10_dbus_apply_uint(m, &updated_config.fw_major);
-            entry_updated = (r >= 0);
-        } else if (strcmp(key, "fw_minor") == 0) {
-            r = k10_dbus_apply_uint(m, &updated_config.fw_minor);
-            entry_updated = (r >= 0);
-        } else {
+        field = k10_config_field_lookup(key, strlen(key));
+        if (field == NULL) {
             r = sd_bus_message_skip(m, "v");
+        } else {
+            r = k10_dbus_read_config_value(m, &updated_config, field);
+            if (r == -EINVAL || r == -E2BIG || r == -ERANGE ||
+                (r >= 0 && k10_config_field_validate(&updated_config, field) < 0)) {
+                return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+                                         "Invalid value for %s", field->name);
+            }
+            entry_updated = (r >= 0);
+
+            /* Echoing the current value back, as whole-config writers do, is fine. */
+            if (entry_updated && (field->flags & K10_CONFIG_FLAG_FILE_ONLY) &&
+                k10_config_diff(&ctx->state->config, &updated_config) &
+                    ((k10_config_mask)1 << k10_config_field_index(field))) {
+                return sd_bus_error_setf(ret_error, SD_BUS_ERROR_ACCESS_DENIED,
+                                         "%s can only be changed in the config file",
+                                         field->name);
+            }
         }
 
         if (r < 0) {
@@ -584,137 +467,540 @@ static int k10_method_set_config(sd_bus_message *m, void *userdata, sd_bus_error
     }
 
     if (changed) {
-        ctx->state->config = updated_config;
-        if (k10_config_save(ctx->state->config_path, &ctx->state->config) != 0) {
-            k10_log_error("dbus config save failed: %s", ctx->state->config_path);
+        if (k10_daemon_adapter_taken(ctx->state, updated_config.adapter)) {
+            return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+                                     "Adapter %s is used by another instance",
+                                     updated_config.adapter);
+        }
+
+        r = k10_adv_payload_build(&updated_config, &payload);
+        if (r == -EMSGSIZE) {
+            return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+                                     "Advertising payload too large: data %zu/%d, scan response "
+                                     "%zu/%d bytes",
+                                     payload.adv_length, K10_ADV_LEGACY_MAX, payload.scan_length,
+                                     K10_ADV_LEGACY_MAX);
+        } else if (r < 0) {
+            return sd_bus_error_set_errno(ret_error, r);
+        }
+
+        r = k10_daemon_apply_config(ctx->state, &updated_config);
+        if (r < 0) {
+            /* Nothing is persisted that the adapter did not take; put the old values back. */
+            if (k10_daemon_apply_config(ctx->state, &previous_config) < 0) {
+                k10_log_error("dbus config rollback failed");
+            }
+            return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                                     "Failed to apply config: %s", strerror(-r));
+        }
+
+        /* Written behind by the persist thread; Flush() waits for it. */
+        r = k10_daemon_save_config(ctx->state->daemon);
+        if (r < 0) {
+            k10_log_error("dbus config save failed: %s", strerror(-r));
             return sd_bus_reply_method_return(m, "b", 0);
         }
 
         k10_log_info("dbus config updated");
-        k10_dbus_emit_config_changed(ctx);
-        k10_dbus_emit_status_all(ctx);
     }
 
     return sd_bus_reply_method_return(m, "b", 1);
 }
 
+static void k10_dbus_on_flushed(int result, void *userdata) {
+    sd_bus_message *m = userdata;
+    int r = 0;
+
+    r = sd_bus_reply_method_return(m, "b", result >= 0);
+    if (r < 0) {
+        k10_log_error("dbus flush reply failed: %s", strerror(-r));
+    }
+
+    sd_bus_message_unref(m);
+}
+
+static int k10_method_flush(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    struct k10_dbus_context *ctx = userdata;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = k10_config_persist_flush(ctx->state->daemon->persist, k10_dbus_on_flushed,
+                                 sd_bus_message_ref(m));
+    if (r < 0) {
+        sd_bus_message_unref(m);
+        return r;
+    }
+
+    /* The reply goes out from k10_dbus_on_flushed() once the write has landed. */
+    return 1;
+}
+
 static int k10_method_reload_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     struct k10_dbus_context *ctx = userdata;
     int ok = 0;
 
     (void)ret_error;
 
-    ok = (k10_dbus_reload_config(ctx) == 0);
+    ok = (k10_daemon_reload(ctx->state->daemon) >= 0);
     return sd_bus_reply_method_return(m, "b", ok);
 }
 
-static const sd_bus_vtable k10_control_vtable[] = {
+/* Runtime only: levels go back to info on restart. "all" sets every subsystem. */
+static int k10_method_set_log_level(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    enum k10_log_subsystem subsystem = K10_LOG_SUBSYSTEM_DAEMON;
+    enum k10_log_level level = K10_LOG_INFO;
+    const char *subsystem_name = NULL;
+    const char *level_name = NULL;
+    bool all = false;
+    int r = 0;
+
+    (void)userdata;
+
+    r = sd_bus_message_read(m, "ss", &subsystem_name, &level_name);
+    if (r < 0) {
+        return r;
+    }
+
+    all = strcmp(subsystem_name, "all") == 0;
+    if (!all && k10_log_subsystem_from_string(subsystem_name, &subsystem) < 0) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Unknown subsystem %s",
+                                 subsystem_name);
+    }
+
+    if (k10_log_level_from_string(level_name, &level) < 0) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Unknown log level %s",
+                                 level_name);
+    }
+
+    for (unsigned int i = 0; i < K10_LOG_SUBSYSTEM_COUNT; i++) {
+        if (!all && i != (unsigned int)subsystem) {
+            continue;
+        }
+
+        r = k10_log_set_level((enum k10_log_subsystem)i, level);
+        if (r == -EOPNOTSUPP) {
+            return sd_bus_error_setf(ret_error, SD_BUS_ERROR_NOT_SUPPORTED,
+                                     "Log level %s is not compiled in", level_name);
+        }
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    k10_log_info("log level of %s set to %s", subsystem_name, level_name);
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int k10_method_get_log_levels(sd_bus_message *m, void *userdata,
+                                     sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    int r = 0;
+
+    (void)userdata;
+    (void)ret_error;
+
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'a', "{ss}");
+    for (unsigned int i = 0; r >= 0 && i < K10_LOG_SUBSYSTEM_COUNT; i++) {
+        r = sd_bus_message_append(
+            reply, "{ss}", k10_log_subsystem_name((enum k10_log_subsystem)i),
+            k10_log_level_name((enum k10_log_level)atomic_load(&k10_log_levels[i])));
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+/* Daemon-wide, like the log levels: every instance's name, object path and adapter. */
+static int k10_method_list_instances(sd_bus_message *m, void *userdata,
+                                     sd_bus_error *ret_error) {
+    struct k10_dbus_context *ctx = userdata;
+    const struct k10_daemon *daemon = ctx->state->daemon;
+    sd_bus_message *reply = NULL;
+    int r = 0;
+
+    (void)ret_error;
+
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'a', "(sos)");
+    for (unsigned int i = 0; r >= 0 && i < daemon->instance_count; i++) {
+        const struct k10_daemon_state *state = daemon->instances[i];
+
+        r = sd_bus_message_append(reply, "(sos)", state->name, state->path,
+                                  state->config.adapter);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int k10_property_get_running(sd_bus *bus, const char *path, const char *interface,
+                                    const char *property, sd_bus_message *reply, void *userdata,
+                                    sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "b", binding->ctx->state->running);
+}
+
+static int k10_property_get_mode(sd_bus *bus, const char *path, const char *interface,
+                                 const char *property, sd_bus_message *reply, void *userdata,
+                                 sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "s", k10_mode_to_string(binding->ctx->state->mode));
+}
+
+static int k10_property_get_adapter(sd_bus *bus, const char *path, const char *interface,
+                                    const char *property, sd_bus_message *reply, void *userdata,
+                                    sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)property;
+    (void)ret_error;
+
+    return sd_bus_message_append(reply, "s", binding->ctx->state->config.adapter);
+}
+
+static int k10_property_get_counter(sd_bus *bus, const char *path, const char *interface,
+                                    const char *property, sd_bus_message *reply, void *userdata,
+                                    sd_bus_error *ret_error) {
+    struct k10_control_binding *binding = userdata;
+    struct k10_capture_stats capture;
+    struct k10_chrc_dock_stats stats;
+    struct k10_responder_stats rules;
+    uint64_t value = binding->ctx->notifications_coalesced;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+    (void)ret_error;
+
+    memset(&stats, 0, sizeof(stats));
+    if (binding->ctx->state->dock != NULL) {
+        k10_chrc_dock_get_stats(binding->ctx->state->dock, &stats);
+    }
+    k10_capture_get_stats(binding->ctx->state->capture, &capture);
+    memset(&rules, 0, sizeof(rules));
+    if (binding->ctx->state->responder != NULL) {
+        k10_responder_get_stats(binding->ctx->state->responder, &rules);
+    }
+
+    if (strcmp(property, "notifications_sent") == 0) {
+        value = binding->ctx->notifications_sent;
+    } else if (strcmp(property, "generation") == 0) {
+        /*
+         * A change still waiting for its flush must already show here. The
+         * flush will bump to the same number, so count it without emitting.
+         */
+        value = binding->ctx->generation;
+        if (binding->ctx->notify_pending &&
+            (k10_config_diff(&binding->ctx->published_config, &binding->ctx->state->config) != 0 ||
+             k10_dbus_status_changed_mask(&binding->ctx->published_status,
+                                          binding->ctx->state) != 0)) {
+            value++;
+        }
+    } else if (strcmp(property, "notify_queue_high_water") == 0) {
+        value = stats.high_water;
+    } else if (strcmp(property, "notify_queue_dropped") == 0) {
+        value = stats.dropped;
+    } else if (strcmp(property, "notify_queue_stalls") == 0) {
+        value = stats.stalls;
+    } else if (strcmp(property, "capture_records") == 0) {
+        value = capture.records;
+    } else if (strcmp(property, "capture_overruns") == 0) {
+        value = capture.overruns;
+    } else if (strcmp(property, "capture_lost") == 0) {
+        value = capture.lost;
+    } else if (strcmp(property, "rule_matches") == 0) {
+        value = rules.matched;
+    } else if (strcmp(property, "rule_replies") == 0) {
+        value = rules.replied;
+    }
+
+    return sd_bus_message_append(reply, "t", value);
+}
+
+static int k10_property_get_config(sd_bus *bus, const char *path, const char *interface,
+                                   const char *property, sd_bus_message *reply, void *userdata,
+                                   sd_bus_error *ret_error) {
+    struct k10_dbus_context *ctx = userdata;
+    const struct k10_config_field *field = NULL;
+
+    (void)bus;
+    (void)path;
+    (void)interface;
+
+    field = k10_config_field_lookup(property, strlen(property));
+    if (field == NULL) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_UNKNOWN_PROPERTY, "Unknown property %s",
+                                 property);
+    }
+
+    return k10_dbus_append_config_value(reply, &ctx->state->config, field);
+}
+
+static const sd_bus_vtable k10_sweeper_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_METHOD("Start", "", "b", k10_method_start, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Stop", "", "b", k10_method_stop, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Reload", "", "b", k10_method_reload, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("GetStatus", "", "a{sv}", k10_method_get_status, SD_BUS_VTABLE_UNPRIVILEGED),
-    SD_BUS_SIGNAL("StatusChanged", "a{sv}", 0),
     SD_BUS_VTABLE_END};
 
-static const sd_bus_vtable k10_config_vtable[] = {
+/* Status properties live on the barrel interface only so each change is announced once. */
+static const sd_bus_vtable k10_barrel_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_METHOD("GetConfig", "", "a{sv}", k10_method_get_config, SD_BUS_VTABLE_UNPRIVILEGED),
-    SD_BUS_METHOD("SetConfig", "a{sv}", "b", k10_method_set_config, SD_BUS_VTABLE_UNPRIVILEGED),
-    SD_BUS_METHOD("Reload", "", "b", k10_method_reload_config, SD_BUS_VTABLE_UNPRIVILEGED),
-    SD_BUS_SIGNAL("ConfigChanged", "a{sv}", 0),
+    SD_BUS_METHOD("Start", "", "b", k10_method_start, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Stop", "", "b", k10_method_stop, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Reload", "", "b", k10_method_reload, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetStatus", "", "a{sv}", k10_method_get_status, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Replay", "hds", "a{sv}", k10_method_replay, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("CancelReplay", "", "b", k10_method_cancel_replay, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetRelayStats", "", "a{sv}", k10_method_get_relay_stats,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_PROPERTY("running", "b", k10_property_get_running, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("mode", "s", k10_property_get_mode, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("adapter", "s", k10_property_get_adapter, 0,
+                    SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("generation", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("notifications_sent", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("notifications_coalesced", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("notify_queue_high_water", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("notify_queue_dropped", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("notify_queue_stalls", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("capture_records", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("capture_overruns", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("capture_lost", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("rule_matches", "t", k10_property_get_counter, 0, 0),
+    SD_BUS_PROPERTY("rule_replies", "t", k10_property_get_counter, 0, 0),
     SD_BUS_VTABLE_END};
 
-static void k10_handle_signal(int signal_value) {
-    (void)signal_value;
-    k10_should_exit = 1;
+/* The config interface exposes one property per schema field, so its vtable is built at open. */
+static void k10_dbus_build_config_vtable(sd_bus_vtable *vtable) {
+    static const sd_bus_vtable head[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_METHOD("GetConfig", "", "a{sv}", k10_method_get_config, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("SetConfig", "a{sv}", "b", k10_method_set_config,
+                      SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("Reload", "", "b", k10_method_reload_config, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("Flush", "", "b", k10_method_flush, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("SetLogLevel", "ss", "", k10_method_set_log_level,
+                      SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("GetLogLevels", "", "a{ss}", k10_method_get_log_levels,
+                      SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListInstances", "", "a(sos)", k10_method_list_instances,
+                      SD_BUS_VTABLE_UNPRIVILEGED),
+    };
+    static const sd_bus_vtable end = SD_BUS_VTABLE_END;
+    size_t used = 0;
+
+    _Static_assert(K10_ARRAY_SIZE(head) == K10_CONFIG_VTABLE_HEAD,
+                   "K10_CONFIG_VTABLE_HEAD must match the config interface methods");
+
+    for (size_t i = 0; i < K10_ARRAY_SIZE(head); i++) {
+        vtable[used++] = head[i];
+    }
+
+    for (size_t i = 0; i < k10_config_field_count; i++) {
+        const struct k10_config_field *field = &k10_config_fields[i];
+        const sd_bus_vtable property =
+            SD_BUS_PROPERTY(field->name, k10_config_type_signature(field->type),
+                            k10_property_get_config, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE);
+
+        vtable[used++] = property;
+    }
+
+    vtable[used] = end;
 }
 
-int k10_dbus_run(struct k10_daemon_state *state) {
-    struct k10_dbus_context ctx = {0};
-    struct k10_control_binding sweeper_binding = {0};
-    struct k10_control_binding barrel_binding = {0};
-    sd_bus_slot *sweeper_slot = NULL;
-    sd_bus_slot *barrel_slot = NULL;
-    sd_bus_slot *config_slot = NULL;
-    int exit_code = 0;
+/* One connection and one bus name for the whole daemon; instances only add objects to it. */
+int k10_dbus_connect(sd_event *event, sd_bus **out_bus) {
+    sd_bus *bus = NULL;
     int r = 0;
 
-    if (state == NULL) {
+    if (event == NULL || out_bus == NULL) {
         return 1;
     }
 
-    ctx.state = state;
-    r = sd_bus_default_system(&ctx.bus);
+    r = sd_bus_default_system(&bus);
     if (r < 0) {
         k10_log_error("dbus connect failed: %s", strerror(-r));
         return 1;
     }
 
-    r = sd_bus_request_name(ctx.bus, K10_DBUS_SERVICE, 0);
+    r = sd_bus_request_name(bus, K10_DBUS_SERVICE, 0);
     if (r < 0) {
         k10_log_error("dbus request name failed: %s", strerror(-r));
-        sd_bus_unref(ctx.bus);
+        goto fail;
+    }
+
+    r = sd_bus_attach_event(bus, event, K10_EVENT_PRIORITY_DBUS);
+    if (r < 0) {
+        k10_log_error("dbus attach event loop failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    /* Losing the system bus ends the event loop so systemd can restart us. */
+    r = sd_bus_set_exit_on_disconnect(bus, 1);
+    if (r < 0) {
+        k10_log_error("dbus exit-on-disconnect failed: %s", strerror(-r));
+        goto fail;
+    }
+
+    *out_bus = bus;
+    return 0;
+
+fail:
+    k10_dbus_disconnect(bus);
+    return 1;
+}
+
+void k10_dbus_disconnect(sd_bus *bus) {
+    if (bus == NULL) {
+        return;
+    }
+
+    sd_bus_detach_event(bus);
+    sd_bus_flush_close_unref(bus);
+}
+
+/* Exports the control interfaces of one instance at state->path. */
+int k10_dbus_open(sd_bus *bus, struct k10_daemon_state *state, struct k10_dbus_context **out_ctx) {
+    struct k10_dbus_context *ctx = NULL;
+    sd_event *event = NULL;
+    int r = 0;
+
+    if (bus == NULL || state == NULL || state->daemon == NULL || out_ctx == NULL) {
         return 1;
     }
 
-    sweeper_binding.ctx = &ctx;
-    sweeper_binding.mode = K10_MODE_SWEEPER;
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        k10_log_error("dbus context allocation failed");
+        return 1;
+    }
 
-    barrel_binding.ctx = &ctx;
-    barrel_binding.mode = K10_MODE_BARREL;
+    ctx->state = state;
+    ctx->bus = sd_bus_ref(bus);
+    event = state->daemon->event;
 
-    r = sd_bus_add_object_vtable(ctx.bus, &sweeper_slot, K10_DBUS_OBJECT, K10_DBUS_IFACE_SWEEPER,
-                                 k10_control_vtable, &sweeper_binding);
+    ctx->sweeper_binding.ctx = ctx;
+    ctx->sweeper_binding.mode = K10_MODE_SWEEPER;
+
+    ctx->barrel_binding.ctx = ctx;
+    ctx->barrel_binding.mode = K10_MODE_BARREL;
+
+    r = sd_bus_add_object_vtable(ctx->bus, &ctx->sweeper_slot, state->path,
+                                 K10_DBUS_IFACE_SWEEPER, k10_sweeper_vtable, &ctx->sweeper_binding);
     if (r < 0) {
         k10_log_error("dbus add sweeper iface failed: %s", strerror(-r));
-        exit_code = 1;
-        goto cleanup;
+        goto fail;
     }
 
-    r = sd_bus_add_object_vtable(ctx.bus, &barrel_slot, K10_DBUS_OBJECT, K10_DBUS_IFACE_BARREL,
-                                 k10_control_vtable, &barrel_binding);
+    r = sd_bus_add_object_vtable(ctx->bus, &ctx->barrel_slot, state->path,
+                                 K10_DBUS_IFACE_BARREL, k10_barrel_vtable, &ctx->barrel_binding);
     if (r < 0) {
         k10_log_error("dbus add barrel iface failed: %s", strerror(-r));
-        exit_code = 1;
-        goto cleanup;
+        goto fail;
     }
 
-    r = sd_bus_add_object_vtable(ctx.bus, &config_slot, K10_DBUS_OBJECT, K10_DBUS_IFACE_CONFIG,
-                                 k10_config_vtable, &ctx);
+    k10_dbus_build_config_vtable(ctx->config_vtable);
+    r = sd_bus_add_object_vtable(ctx->bus, &ctx->config_slot, state->path,
+                                 K10_DBUS_IFACE_CONFIG, ctx->config_vtable, ctx);
     if (r < 0) {
         k10_log_error("dbus add config iface failed: %s", strerror(-r));
-        exit_code = 1;
-        goto cleanup;
+        goto fail;
     }
 
-    signal(SIGINT, k10_handle_signal);
-    signal(SIGTERM, k10_handle_signal);
+    r = sd_event_add_defer(event, &ctx->notify_idle_source, k10_dbus_on_notify_idle, ctx);
+    if (r >= 0) {
+        r = sd_event_source_set_priority(ctx->notify_idle_source, K10_EVENT_PRIORITY_IDLE);
+    }
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(ctx->notify_idle_source, SD_EVENT_OFF);
+    }
+    if (r < 0) {
+        k10_log_error("dbus notify idle source failed: %s", strerror(-r));
+        goto fail;
+    }
 
-    while (!k10_should_exit) {
-        r = sd_bus_process(ctx.bus, NULL);
-        if (r < 0) {
-            k10_log_error("dbus process failed: %s", strerror(-r));
-            exit_code = 1;
-            break;
-        }
+    r = k10_event_add_timer(event, &ctx->notify_timer_source, 0, K10_EVENT_ACCURACY_FINE_USEC,
+                            K10_EVENT_PRIORITY_DBUS, k10_dbus_on_notify_timer, ctx,
+                            "dbus-notify");
+    if (r >= 0) {
+        r = sd_event_source_set_enabled(ctx->notify_timer_source, SD_EVENT_OFF);
+    }
+    if (r < 0) {
+        k10_log_error("dbus notify timer failed: %s", strerror(-r));
+        goto fail;
+    }
 
-        if (r > 0) {
-            continue;
-        }
+    ctx->published_config = state->config;
+    k10_dbus_snapshot_status(state, &ctx->published_status);
 
-        r = sd_bus_wait(ctx.bus, (uint64_t)-1);
-        if (r < 0) {
-            k10_log_error("dbus wait failed: %s", strerror(-r));
-            exit_code = 1;
-            break;
-        }
+    *out_ctx = ctx;
+    return 0;
+
+fail:
+    k10_dbus_close(ctx);
+    return 1;
+}
+
+/* For changes made outside a method handler, e.g. a config file edited on disk. */
+void k10_dbus_state_changed(struct k10_dbus_context *ctx) {
+    if (ctx != NULL) {
+        k10_dbus_mark_dirty(ctx);
+    }
+}
+
+void k10_dbus_close(struct k10_dbus_context *ctx) {
+    if (ctx == NULL) {
+        return;
     }
 
-cleanup:
-    sd_bus_slot_unref(config_slot);
-    sd_bus_slot_unref(barrel_slot);
-    sd_bus_slot_unref(sweeper_slot);
-    sd_bus_unref(ctx.bus);
-    return exit_code;
+    k10_replay_cancel(ctx->replay);
+    sd_event_source_unref(ctx->notify_timer_source);
+    sd_event_source_unref(ctx->notify_idle_source);
+    sd_bus_slot_unref(ctx->config_slot);
+    sd_bus_slot_unref(ctx->barrel_slot);
+    sd_bus_slot_unref(ctx->sweeper_slot);
+    sd_bus_unref(ctx->bus);
+    free(ctx);
 }
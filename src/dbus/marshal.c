@@ -0,0 +1,380 @@
+#include "k10_barrel/dbus_marshal.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+const char *k10_mode_to_string(enum k10_emulator_mode mode) {
+    switch (mode) {
+    case K10_MODE_SWEEPER:
+        return "sweeper";
+    case K10_MODE_BARREL:
+        return "barrel";
+    default:
+        return "idle";
+    }
+}
+
+static int k10_dbus_append_kv_string(sd_bus_message *msg, const char *key, const char *value) {
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'e', "sv");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(msg, "s", key);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(msg, 'v', "s");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(msg, "s", value);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_close_container(msg);
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_close_container(msg);
+}
+
+static int k10_dbus_append_kv_bool(sd_bus_message *msg, const char *key, bool value) {
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'e', "sv");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(msg, "s", key);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(msg, 'v', "b");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(msg, "b", value);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_close_container(msg);
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_close_container(msg);
+}
+
+static int k10_dbus_append_kv_uint64(sd_bus_message *msg, const char *key, uint64_t value) {
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'e', "sv");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(msg, "s", key);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(msg, 'v', "t");
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_append(msg, "t", value);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_close_container(msg);
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_close_container(msg);
+}
+
+int k10_dbus_append_status(sd_bus_message *msg, const struct k10_daemon_state *state) {
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_dbus_append_kv_bool(msg, "running", state->running);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_dbus_append_kv_string(msg, "mode", k10_mode_to_string(state->mode));
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_dbus_append_kv_string(msg, "adapter", state->config.adapter);
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_dbus_append_kv_string(msg, "instance", state->name);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_close_container(msg);
+    if (r < 0) {
+        return r;
+    }
+
+    return 0;
+}
+
+int k10_dbus_append_config_value(sd_bus_message *msg, const struct k10_config *config,
+                                 const struct k10_config_field *field) {
+    unsigned int count = 0;
+    int r = 0;
+
+    switch (field->type) {
+    case K10_CONFIG_STRING:
+        return sd_bus_message_append_basic(msg, 's', k10_config_get_string(config, field));
+    case K10_CONFIG_UINT:
+        return sd_bus_message_append(msg, "u", k10_config_get_uint(config, field));
+    case K10_CONFIG_BOOL:
+        return sd_bus_message_append(msg, "b", k10_config_get_bool(config, field));
+    case K10_CONFIG_STRING_LIST:
+        r = sd_bus_message_open_container(msg, 'a', "s");
+        if (r < 0) {
+            return r;
+        }
+
+        count = k10_config_get_list_count(config, field);
+        for (unsigned int i = 0; i < count; i++) {
+            r = sd_bus_message_append_basic(msg, 's', k10_config_get_list_item(config, field, i));
+            if (r < 0) {
+                return r;
+            }
+        }
+
+        return sd_bus_message_close_container(msg);
+    }
+
+    return -EINVAL;
+}
+
+int k10_dbus_append_config(sd_bus_message *msg, const struct k10_config *config) {
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    for (size_t i = 0; i < k10_config_field_count; i++) {
+        const struct k10_config_field *field = &k10_config_fields[i];
+
+        r = sd_bus_message_open_container(msg, 'e', "sv");
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_append(msg, "s", field->name);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_open_container(msg, 'v', k10_config_type_signature(field->type));
+        if (r < 0) {
+            return r;
+        }
+
+        r = k10_dbus_append_config_value(msg, config, field);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_close_container(msg);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_message_close_container(msg);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return sd_bus_message_close_container(msg);
+}
+
+static int k10_dbus_read_config_list(sd_bus_message *msg, struct k10_config *config,
+                                     const struct k10_config_field *field) {
+    const char *value = NULL;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(msg, 'a', "s");
+    if (r < 0) {
+        return r;
+    }
+
+    k10_config_clear_list(config, field);
+    while ((r = sd_bus_message_read_basic(msg, 's', &value)) > 0) {
+        r = k10_config_append_list(config, field, value, strlen(value));
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_exit_container(msg);
+}
+
+int k10_dbus_read_config_value(sd_bus_message *msg, struct k10_config *config,
+                               const struct k10_config_field *field) {
+    const char *string = NULL;
+    uint32_t number = 0;
+    int flag = 0;
+    int r = 0;
+
+    r = sd_bus_message_enter_container(msg, 'v', k10_config_type_signature(field->type));
+    if (r < 0) {
+        return r;
+    }
+
+    switch (field->type) {
+    case K10_CONFIG_STRING:
+        r = sd_bus_message_read_basic(msg, 's', &string);
+        if (r >= 0) {
+            r = k10_config_set_string(config, field, string, strlen(string));
+        }
+        break;
+    case K10_CONFIG_UINT:
+        r = sd_bus_message_read_basic(msg, 'u', &number);
+        if (r >= 0) {
+            r = k10_config_set_uint(config, field, number);
+        }
+        break;
+    case K10_CONFIG_BOOL:
+        r = sd_bus_message_read_basic(msg, 'b', &flag);
+        if (r >= 0) {
+            r = k10_config_set_bool(config, field, flag != 0);
+        }
+        break;
+    case K10_CONFIG_STRING_LIST:
+        r = k10_dbus_read_config_list(msg, config, field);
+        break;
+    }
+
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_exit_container(msg);
+}
+
+int k10_dbus_append_replay_stats(sd_bus_message *msg, const struct k10_replay_stats *stats) {
+    const struct {
+        const char *key;
+        uint64_t value;
+    } counters[] = {
+        {"records", stats->records},
+        {"dispatched", stats->dispatched},
+        {"skipped", stats->skipped},
+        {"failed", stats->failed},
+        {"elapsed_usec", stats->elapsed_usec},
+        {"handler_avg_ns", stats->handler_avg_ns},
+        {"handler_p50_ns", stats->handler_p50_ns},
+        {"handler_p99_ns", stats->handler_p99_ns},
+        {"handler_max_ns", stats->handler_max_ns},
+        {"lag_max_usec", stats->lag_max_usec},
+    };
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        r = k10_dbus_append_kv_uint64(msg, counters[i].key, counters[i].value);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    r = k10_dbus_append_kv_bool(msg, "cancelled", stats->cancelled);
+    if (r < 0) {
+        return r;
+    }
+
+    return sd_bus_message_close_container(msg);
+}
+
+/* Flat keys, one set per direction prefixed with its hop name (to_dock_frames, ...). */
+int k10_dbus_append_relay_stats(sd_bus_message *msg, const struct k10_relay_stats *stats) {
+    static const char *const hops[K10_RELAY_HOP_COUNT] = {"to_dock", "to_sweeper"};
+    char key[64];
+    int r = 0;
+
+    r = sd_bus_message_open_container(msg, 'a', "{sv}");
+    if (r < 0) {
+        return r;
+    }
+
+    r = k10_dbus_append_kv_bool(msg, "enabled", stats->enabled);
+    if (r >= 0) {
+        r = k10_dbus_append_kv_bool(msg, "connected", stats->connected);
+    }
+    if (r >= 0) {
+        r = k10_dbus_append_kv_uint64(msg, "connects", stats->connects);
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    for (size_t hop = 0; hop < K10_RELAY_HOP_COUNT; hop++) {
+        const struct k10_relay_hop_stats *h = &stats->hops[hop];
+        const struct {
+            const char *key;
+            uint64_t value;
+        } counters[] = {
+            {"frames", h->frames},
+            {"bytes", h->bytes},
+            {"rewritten", h->rewritten},
+            {"dropped", h->dropped},
+            {"latency_avg_ns", h->latency_avg_ns},
+            {"latency_p50_ns", h->latency_p50_ns},
+            {"latency_p99_ns", h->latency_p99_ns},
+            {"latency_max_ns", h->latency_max_ns},
+        };
+
+        for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+            snprintf(key, sizeof(key), "%s_%s", hops[hop], counters[i].key);
+            r = k10_dbus_append_kv_uint64(msg, key, counters[i].value);
+            if (r < 0) {
+                return r;
+            }
+        }
+    }
+
+    return sd_bus_message_close_container(msg);
+}
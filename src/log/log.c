@@ -1,43 +1,405 @@
 #include "k10_barrel/log.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #ifdef K10_USE_SYSTEMD
+#include <sys/uio.h>
 #include <systemd/sd-journal.h>
 #endif
 
-static void k10_log_vprint(FILE *stream, const char *level, const char *format, va_list args) {
+#define K10_LOG_RING_SIZE 256
+#define K10_LOG_DRAIN_BATCH 16
+#define K10_LOG_MESSAGE_MAX 512
+/* Each call site may log K10_LOG_RATE_BURST messages per interval; the rest are counted. */
+#define K10_LOG_RATE_INTERVAL_USEC 5000000ULL
+#define K10_LOG_RATE_BURST 20
+
+struct k10_log_entry {
+    enum k10_log_level level;
+    const char *file;
+    int line;
+    enum k10_log_subsystem subsystem;
+    char message_id[33];
+    char char_uuid[40];
+    char device[64];
+    char message[K10_LOG_MESSAGE_MAX];
+};
+
+/*
+ * Messages are formatted on the caller's thread and copied into a
+ * preallocated ring; a drain thread hands them to journald, so a slow or
+ * rate-limiting journald never stalls the event loop. A full ring drops the
+ * message and the drain thread reports how many were lost. Outside
+ * k10_log_open()/k10_log_close() messages are written synchronously.
+ */
+struct k10_log_backend {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    struct k10_log_entry ring[K10_LOG_RING_SIZE];
+    unsigned int head;
+    unsigned int length;
+    unsigned int dropped;
+};
+
+static struct k10_log_backend k10_log_backend = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static const char *const k10_log_level_names[] = {
+    [K10_LOG_ERROR] = "error",
+    [K10_LOG_INFO] = "info",
+    [K10_LOG_DEBUG] = "debug",
+    [K10_LOG_TRACE] = "trace",
+};
+
+static const char *const k10_log_subsystem_names[K10_LOG_SUBSYSTEM_COUNT] = {
+    [K10_LOG_SUBSYSTEM_DAEMON] = "daemon",
+    [K10_LOG_SUBSYSTEM_DBUS] = "dbus",
+    [K10_LOG_SUBSYSTEM_CONFIG] = "config",
+    [K10_LOG_SUBSYSTEM_ADV] = "adv",
+    [K10_LOG_SUBSYSTEM_GATT] = "gatt",
+    [K10_LOG_SUBSYSTEM_GATT_DOCK] = "gatt-dock",
+    [K10_LOG_SUBSYSTEM_GATT_SWEEPER] = "gatt-sweeper",
+    [K10_LOG_SUBSYSTEM_CAPTURE] = "capture",
+    [K10_LOG_SUBSYSTEM_RELAY] = "relay",
+};
+
+atomic_int k10_log_levels[K10_LOG_SUBSYSTEM_COUNT] = {
+    [K10_LOG_SUBSYSTEM_DAEMON] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_DBUS] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_CONFIG] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_ADV] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_GATT] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_GATT_DOCK] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_GATT_SWEEPER] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_CAPTURE] = K10_LOG_INFO,
+    [K10_LOG_SUBSYSTEM_RELAY] = K10_LOG_INFO,
+};
+
+const char *k10_log_level_name(enum k10_log_level level) {
+    if ((unsigned int)level > K10_LOG_TRACE) {
+        return NULL;
+    }
+    return k10_log_level_names[level];
+}
+
+int k10_log_level_from_string(const char *name, enum k10_log_level *out_level) {
+    if (name == NULL || out_level == NULL) {
+        return -EINVAL;
+    }
+
+    for (unsigned int i = 0; i <= K10_LOG_TRACE; i++) {
+        if (strcmp(name, k10_log_level_names[i]) == 0) {
+            *out_level = (enum k10_log_level)i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+const char *k10_log_subsystem_name(enum k10_log_subsystem subsystem) {
+    if ((unsigned int)subsystem >= K10_LOG_SUBSYSTEM_COUNT) {
+        return NULL;
+    }
+    return k10_log_subsystem_names[subsystem];
+}
+
+int k10_log_subsystem_from_string(const char *name, enum k10_log_subsystem *out_subsystem) {
+    if (name == NULL || out_subsystem == NULL) {
+        return -EINVAL;
+    }
+
+    for (unsigned int i = 0; i < K10_LOG_SUBSYSTEM_COUNT; i++) {
+        if (strcmp(name, k10_log_subsystem_names[i]) == 0) {
+            *out_subsystem = (enum k10_log_subsystem)i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+/* Levels above the compiled-in ceiling would silently log nothing, so they are refused. */
+int k10_log_set_level(enum k10_log_subsystem subsystem, enum k10_log_level level) {
+    if ((unsigned int)subsystem >= K10_LOG_SUBSYSTEM_COUNT || (unsigned int)level > K10_LOG_TRACE) {
+        return -EINVAL;
+    }
+    if (level > K10_LOG_MAX_LEVEL) {
+        return -EOPNOTSUPP;
+    }
+
+    atomic_store_explicit(&k10_log_levels[subsystem], (int)level, memory_order_relaxed);
+    return 0;
+}
+
 #ifdef K10_USE_SYSTEMD
-    int priority = LOG_INFO;
+static void k10_log_field(struct iovec *iov, size_t *count, char *buffer, size_t size,
+                          const char *name, const char *value) {
+    int length = 0;
+
+    if (value == NULL || value[0] == '\0') {
+        return;
+    }
 
-    if (strcmp(level, "ERROR") == 0) {
-        priority = LOG_ERR;
+    length = snprintf(buffer, size, "%s=%s", name, value);
+    if (length < 0) {
+        return;
     }
 
-    sd_journal_printv(priority, format, args);
-    (void)stream;
+    iov[*count].iov_base = buffer;
+    iov[*count].iov_len = (size_t)length < size ? (size_t)length : size - 1;
+    (*count)++;
+}
+#endif
+
+static void k10_log_emit(const struct k10_log_entry *entry) {
+#ifdef K10_USE_SYSTEMD
+    char message[K10_LOG_MESSAGE_MAX + 16];
+    char priority[16];
+    char file[256];
+    char line[24];
+    char subsystem[48];
+    char message_id[48];
+    char char_uuid[56];
+    char device[80];
+    char number[16];
+    struct iovec iov[8];
+    size_t count = 0;
+    int priority_value = entry->level == K10_LOG_ERROR  ? LOG_ERR
+                         : entry->level == K10_LOG_INFO ? LOG_INFO
+                                                        : LOG_DEBUG;
+
+    k10_log_field(iov, &count, message, sizeof(message), "MESSAGE", entry->message);
+    snprintf(number, sizeof(number), "%d", priority_value);
+    k10_log_field(iov, &count, priority, sizeof(priority), "PRIORITY", number);
+    k10_log_field(iov, &count, file, sizeof(file), "CODE_FILE", entry->file);
+    if (entry->file != NULL) {
+        snprintf(number, sizeof(number), "%d", entry->line);
+        k10_log_field(iov, &count, line, sizeof(line), "CODE_LINE", number);
+    }
+    k10_log_field(iov, &count, subsystem, sizeof(subsystem), "SUBSYSTEM",
+                  k10_log_subsystem_name(entry->subsystem));
+    k10_log_field(iov, &count, message_id, sizeof(message_id), "MESSAGE_ID",
+                  entry->message_id);
+    k10_log_field(iov, &count, char_uuid, sizeof(char_uuid), "CHAR_UUID", entry->char_uuid);
+    k10_log_field(iov, &count, device, sizeof(device), "DEVICE", entry->device);
+
+    (void)sd_journal_sendv(iov, (int)count);
 #else
-    fprintf(stream, "%s: ", level);
-    vfprintf(stream, format, args);
-    fputc('\n', stream);
+    FILE *stream = entry->level == K10_LOG_ERROR ? stderr : stdout;
+
+    static const char *const prefixes[] = {"ERROR", "INFO", "DEBUG", "TRACE"};
+
+    fprintf(stream, "%s: %s\n", prefixes[entry->level], entry->message);
 #endif
 }
 
-void k10_log_info(const char *format, ...) {
-    va_list args;
+static void k10_log_copy(char *out, size_t size, const char *value) {
+    snprintf(out, size, "%s", value != NULL ? value : "");
+}
 
-    va_start(args, format);
-    k10_log_vprint(stdout, "INFO", format, args);
-    va_end(args);
+static void k10_log_entry_init(struct k10_log_entry *entry, const struct k10_log_site *site,
+                               enum k10_log_subsystem subsystem, enum k10_log_level level,
+                               const struct k10_log_fields *fields) {
+    entry->level = level;
+    entry->file = site != NULL ? site->file : NULL;
+    entry->line = site != NULL ? site->line : 0;
+    entry->subsystem = subsystem;
+    k10_log_copy(entry->message_id, sizeof(entry->message_id),
+                 fields != NULL ? fields->message_id : NULL);
+    k10_log_copy(entry->char_uuid, sizeof(entry->char_uuid),
+                 fields != NULL ? fields->char_uuid : NULL);
+    k10_log_copy(entry->device, sizeof(entry->device), fields != NULL ? fields->device : NULL);
+}
+
+static void k10_log_emit_dropped(unsigned int dropped) {
+    struct k10_log_entry entry;
+
+    k10_log_entry_init(&entry, NULL, K10_LOG_SUBSYSTEM_DAEMON, K10_LOG_ERROR, NULL);
+    k10_log_copy(entry.message_id, sizeof(entry.message_id), K10_LOG_ID_SUPPRESSED);
+    snprintf(entry.message, sizeof(entry.message), "%u log messages dropped, log ring full",
+             dropped);
+    k10_log_emit(&entry);
+}
+
+static void *k10_log_drain(void *userdata) {
+    struct k10_log_backend *backend = userdata;
+    struct k10_log_entry batch[K10_LOG_DRAIN_BATCH];
+    unsigned int dropped = 0;
+    unsigned int count = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&backend->lock);
+        while (backend->length == 0 && backend->dropped == 0 && !backend->stopping) {
+            pthread_cond_wait(&backend->cond, &backend->lock);
+        }
+
+        /* k10_log_close() writes out whatever is still queued. */
+        if (backend->stopping) {
+            pthread_mutex_unlock(&backend->lock);
+            break;
+        }
+
+        count = backend->length < K10_LOG_DRAIN_BATCH ? backend->length : K10_LOG_DRAIN_BATCH;
+        for (unsigned int i = 0; i < count; i++) {
+            batch[i] = backend->ring[(backend->head + i) % K10_LOG_RING_SIZE];
+        }
+        backend->head = (backend->head + count) % K10_LOG_RING_SIZE;
+        backend->length -= count;
+        dropped = backend->dropped;
+        backend->dropped = 0;
+        pthread_mutex_unlock(&backend->lock);
+
+        if (dropped > 0) {
+            k10_log_emit_dropped(dropped);
+        }
+
+        for (unsigned int i = 0; i < count; i++) {
+            k10_log_emit(&batch[i]);
+        }
+    }
+
+    return NULL;
+}
+
+static void k10_log_submit(const struct k10_log_entry *entry) {
+    struct k10_log_backend *backend = &k10_log_backend;
+
+    pthread_mutex_lock(&backend->lock);
+    if (!backend->running) {
+        pthread_mutex_unlock(&backend->lock);
+        k10_log_emit(entry);
+        return;
+    }
+
+    if (backend->length == K10_LOG_RING_SIZE) {
+        backend->dropped++;
+    } else {
+        backend->ring[(backend->head + backend->length) % K10_LOG_RING_SIZE] = *entry;
+        backend->length++;
+    }
+
+    pthread_cond_signal(&backend->cond);
+    pthread_mutex_unlock(&backend->lock);
+}
+
+/* Returns false when the site is over its burst; *out_suppressed is set when a window closes. */
+static bool k10_log_ratelimit(struct k10_log_site *site, unsigned int *out_suppressed) {
+    struct timespec ts;
+    uint64_t start = atomic_load_explicit(&site->window_start, memory_order_relaxed);
+    uint64_t now = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+
+    *out_suppressed = 0;
+    if (now - start >= K10_LOG_RATE_INTERVAL_USEC &&
+        atomic_compare_exchange_strong(&site->window_start, &start, now)) {
+        atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+        *out_suppressed = atomic_exchange(&site->suppressed, 0);
+    }
+
+    if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) < K10_LOG_RATE_BURST) {
+        return true;
+    }
+
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    return false;
 }
 
-void k10_log_error(const char *format, ...) {
+void k10_log_write(struct k10_log_site *site, enum k10_log_subsystem subsystem,
+                   enum k10_log_level level, const struct k10_log_fields *fields,
+                   const char *format, ...) {
+    struct k10_log_entry entry;
+    unsigned int suppressed = 0;
     va_list args;
 
+    /* Debug and trace were asked for explicitly, so only the ring bounds them. */
+    if (level <= K10_LOG_INFO && !k10_log_ratelimit(site, &suppressed)) {
+        return;
+    }
+
+    if (suppressed > 0) {
+        k10_log_entry_init(&entry, site, subsystem, level, NULL);
+        k10_log_copy(entry.message_id, sizeof(entry.message_id), K10_LOG_ID_SUPPRESSED);
+        snprintf(entry.message, sizeof(entry.message), "%u messages suppressed", suppressed);
+        k10_log_submit(&entry);
+    }
+
+    k10_log_entry_init(&entry, site, subsystem, level, fields);
     va_start(args, format);
-    k10_log_vprint(stderr, "ERROR", format, args);
+    vsnprintf(entry.message, sizeof(entry.message), format, args);
     va_end(args);
+    k10_log_submit(&entry);
+}
+
+/* Starts the drain thread; call after signals are blocked so it inherits the mask. */
+int k10_log_open(void) {
+    struct k10_log_backend *backend = &k10_log_backend;
+    int r = 0;
+
+    pthread_mutex_lock(&backend->lock);
+    if (!backend->running) {
+        backend->stopping = false;
+        r = -pthread_create(&backend->thread, NULL, k10_log_drain, backend);
+        backend->running = r == 0;
+    }
+    pthread_mutex_unlock(&backend->lock);
+
+    return r;
+}
+
+/* Stops the drain thread and writes out everything still queued before returning. */
+void k10_log_close(void) {
+    struct k10_log_backend *backend = &k10_log_backend;
+    struct k10_log_entry entry;
+    unsigned int dropped = 0;
+
+    pthread_mutex_lock(&backend->lock);
+    if (!backend->running) {
+        pthread_mutex_unlock(&backend->lock);
+        return;
+    }
+    backend->stopping = true;
+    pthread_cond_signal(&backend->cond);
+    pthread_mutex_unlock(&backend->lock);
+
+    pthread_join(backend->thread, NULL);
+
+    pthread_mutex_lock(&backend->lock);
+    backend->running = false;
+    dropped = backend->dropped;
+    backend->dropped = 0;
+    pthread_mutex_unlock(&backend->lock);
+
+    if (dropped > 0) {
+        k10_log_emit_dropped(dropped);
+    }
+
+    /* New messages go out synchronously now, so the ring only shrinks. */
+    for (;;) {
+        pthread_mutex_lock(&backend->lock);
+        if (backend->length == 0) {
+            pthread_mutex_unlock(&backend->lock);
+            break;
+        }
+        entry = backend->ring[backend->head];
+        backend->head = (backend->head + 1) % K10_LOG_RING_SIZE;
+        backend->length--;
+        pthread_mutex_unlock(&backend->lock);
+
+        k10_log_emit(&entry);
+    }
 }
@@ -0,0 +1,123 @@
+# Sourced by the integration tests, which are run by ctest as
+#   <test>.sh <k10-barrel-emulatord> <k10-barrel-emulatorctl>
+#
+# Gives each test a scratch directory with its own system bus and daemon so
+# nothing on the host is touched. Without dbus-daemon the test is skipped
+# (exit 77, see SKIP_RETURN_CODE in CMakeLists.txt).
+
+K10_DAEMON=$1
+K10_CTL=$2
+
+if [ ! -x "$K10_DAEMON" ] || [ ! -x "$K10_CTL" ]; then
+    echo "usage: $0 <k10-barrel-emulatord> <k10-barrel-emulatorctl>" >&2
+    exit 2
+fi
+
+if ! command -v dbus-daemon >/dev/null 2>&1; then
+    echo "dbus-daemon not found, skipping"
+    exit 77
+fi
+
+K10_DIR=$(mktemp -d "${TMPDIR:-/tmp}/k10-test.XXXXXX") || exit 1
+K10_BUS_PID=
+K10_DAEMON_PID=
+# Other background processes the test started, killed on exit.
+K10_PIDS=
+K10_FAILURES=0
+
+k10_stop_daemon() {
+    if [ -n "$K10_DAEMON_PID" ]; then
+        kill "$K10_DAEMON_PID" 2>/dev/null
+        wait "$K10_DAEMON_PID" 2>/dev/null
+        K10_DAEMON_PID=
+    fi
+}
+
+k10_cleanup() {
+    k10_stop_daemon
+    for pid in $K10_PIDS $K10_BUS_PID; do
+        kill "$pid" 2>/dev/null
+        wait "$pid" 2>/dev/null
+    done
+    rm -rf "$K10_DIR"
+}
+
+k10_fail() {
+    echo "FAIL: $*" >&2
+    K10_FAILURES=$((K10_FAILURES + 1))
+}
+
+# Retries a command for up to about 5 s until it succeeds.
+k10_wait_for() {
+    tries=50
+    while ! "$@" >/dev/null 2>&1; do
+        tries=$((tries - 1))
+        if [ "$tries" -eq 0 ]; then
+            return 1
+        fi
+        sleep 0.1
+    done
+}
+
+# Starts the daemon on $K10_DIR/config.toml and waits until it answers.
+k10_start_daemon() {
+    "$K10_DAEMON" --config "$K10_DIR/config.toml" >"$K10_DIR/daemon.log" 2>&1 &
+    K10_DAEMON_PID=$!
+    k10_wait_for "$K10_CTL" status || {
+        echo "daemon did not come up" >&2
+        cat "$K10_DIR/daemon.log" >&2
+        exit 1
+    }
+}
+
+# Fails unless the file has a line that is exactly the given text.
+k10_expect_line() {
+    if ! grep -qxF -- "$2" "$1"; then
+        k10_fail "$1: missing line: $2"
+    fi
+}
+
+k10_finish() {
+    if [ "$K10_FAILURES" -ne 0 ]; then
+        echo "$K10_FAILURES check(s) failed; output was:" >&2
+        for file in "$K10_DIR"/*.out; do
+            [ -f "$file" ] && sed "s|^|$(basename "$file"): |" "$file" >&2
+        done
+        exit 1
+    fi
+    exit 0
+}
+
+trap k10_cleanup EXIT
+
+cat >"$K10_DIR/bus.conf" <<EOF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>system</type>
+  <listen>unix:path=$K10_DIR/bus</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_type="method_call"/>
+    <allow send_type="signal"/>
+    <allow send_type="method_return"/>
+    <allow send_type="error"/>
+    <allow receive_type="method_call"/>
+    <allow receive_type="signal"/>
+    <allow receive_type="method_return"/>
+    <allow receive_type="error"/>
+  </policy>
+</busconfig>
+EOF
+
+dbus-daemon --config-file="$K10_DIR/bus.conf" --nofork --nopidfile >/dev/null 2>&1 &
+K10_BUS_PID=$!
+DBUS_SYSTEM_BUS_ADDRESS=unix:path=$K10_DIR/bus
+export DBUS_SYSTEM_BUS_ADDRESS
+
+k10_wait_for test -S "$K10_DIR/bus" || {
+    echo "private bus did not come up" >&2
+    exit 1
+}
@@ -0,0 +1,53 @@
+#ifndef K10_TESTS_TEST_H
+#define K10_TESTS_TEST_H
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Just enough of a harness for the unit tests: checks report the failing
+ * expression with its location and keep going, and main() returns non-zero
+ * when any failed so ctest marks the test failed.
+ */
+
+/* Each test is a single translation unit, so the counter can live here. */
+static unsigned int k10_test_failures;
+
+#define K10_CHECK(expr)                                                                            \
+    do {                                                                                           \
+        if (!(expr)) {                                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);               \
+            k10_test_failures++;                                                                   \
+        }                                                                                          \
+    } while (0)
+
+#define K10_CHECK_INT(actual, expected)                                                            \
+    do {                                                                                           \
+        long long k10_actual = (long long)(actual);                                                \
+        long long k10_expected = (long long)(expected);                                            \
+        if (k10_actual != k10_expected) {                                                          \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual,     \
+                    k10_actual, k10_expected);                                                     \
+            k10_test_failures++;                                                                   \
+        }                                                                                          \
+    } while (0)
+
+#define K10_CHECK_STR(actual, expected)                                                            \
+    do {                                                                                           \
+        const char *k10_actual = (actual);                                                         \
+        const char *k10_expected = (expected);                                                     \
+        if (k10_actual == NULL || strcmp(k10_actual, k10_expected) != 0) {                         \
+            fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__,          \
+                    #actual, k10_actual != NULL ? k10_actual : "(null)", k10_expected);            \
+            k10_test_failures++;                                                                   \
+        }                                                                                          \
+    } while (0)
+
+#define K10_TEST_RUN(test)                                                                         \
+    do {                                                                                           \
+        unsigned int k10_before = k10_test_failures;                                               \
+        test();                                                                                    \
+        printf("%-4s %s\n", k10_test_failures == k10_before ? "ok" : "FAIL", #test);               \
+    } while (0)
+
+#endif
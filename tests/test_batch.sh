@@ -0,0 +1,68 @@
+#!/bin/sh
+# k10-barrel-emulatorctl batch against a daemon on a private bus.
+
+. "$(dirname "$0")/bus.sh"
+
+cat >"$K10_DIR/config.toml" <<EOF
+adapter = "hci0"
+local_name = "WoS1MB"
+fw_minor = 0
+EOF
+k10_start_daemon
+
+# Folded sets are one SetConfig, so one bad value fails the lot.
+cat >"$K10_DIR/rejected.in" <<EOF
+config set local_name "Two Words"
+config set notify_queue_policy bogus
+config get
+EOF
+"$K10_CTL" batch "$K10_DIR/rejected.in" >"$K10_DIR/rejected.out" 2>&1
+[ $? -eq 1 ] || k10_fail "batch with a rejected set did not exit 1"
+k10_expect_line "$K10_DIR/rejected.out" \
+    '1 config set local_name "Two Words": failed: Invalid value for notify_queue_policy'
+k10_expect_line "$K10_DIR/rejected.out" \
+    '2 config set notify_queue_policy bogus: failed: Invalid value for notify_queue_policy'
+k10_expect_line "$K10_DIR/rejected.out" '3 config get: ok'
+k10_expect_line "$K10_DIR/rejected.out" 'local_name=WoS1MB'
+
+# Quoting, comments and blank lines; replies come back in line order.
+cat >"$K10_DIR/applied.in" <<EOF
+# set two fields at once
+
+config set local_name "Two Words"
+config set fw_minor 7 --type uint
+log-level dbus debug
+log-level
+config get
+EOF
+"$K10_CTL" batch - <"$K10_DIR/applied.in" >"$K10_DIR/applied.out" 2>&1
+[ $? -eq 0 ] || k10_fail "batch with valid lines did not exit 0"
+k10_expect_line "$K10_DIR/applied.out" '3 config set local_name "Two Words": ok'
+k10_expect_line "$K10_DIR/applied.out" '4 config set fw_minor 7 --type uint: ok'
+k10_expect_line "$K10_DIR/applied.out" '5 log-level dbus debug: ok'
+k10_expect_line "$K10_DIR/applied.out" 'dbus=debug'
+k10_expect_line "$K10_DIR/applied.out" 'local_name=Two Words'
+k10_expect_line "$K10_DIR/applied.out" 'fw_minor=7'
+if [ "$(grep -c '^[0-9]' "$K10_DIR/applied.out")" -ne 5 ]; then
+    k10_fail "expected a result for each of the 5 commands"
+fi
+
+# The daemon saved the folded set as a single change.
+k10_wait_for grep -qxF 'fw_minor = 7' "$K10_DIR/config.toml" ||
+    k10_fail "fw_minor was not saved"
+k10_expect_line "$K10_DIR/config.toml" 'local_name = "Two Words"'
+
+# Lines that cannot be sent are reported without holding up the rest.
+printf 'replay capture.btsnoop\nconfig set local_name "open\nstatus\n' |
+    "$K10_CTL" batch >"$K10_DIR/unsent.out" 2>&1
+[ $? -eq 1 ] || k10_fail "batch with unsent lines did not exit 1"
+k10_expect_line "$K10_DIR/unsent.out" '1: not a batch command: replay capture.btsnoop'
+k10_expect_line "$K10_DIR/unsent.out" '2: unterminated quote'
+k10_expect_line "$K10_DIR/unsent.out" '1 replay capture.btsnoop: failed: not sent'
+k10_expect_line "$K10_DIR/unsent.out" '2 config set local_name "open: failed: not sent'
+k10_expect_line "$K10_DIR/unsent.out" '3 status: ok'
+
+"$K10_CTL" batch "$K10_DIR/missing.in" >"$K10_DIR/missing.out" 2>&1 &&
+    k10_fail "batch with a missing file succeeded"
+
+k10_finish
@@ -0,0 +1,264 @@
+#include "k10_barrel/config.h"
+#include "k10_barrel/config_schema.h"
+
+#include "test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char k10_test_instances_toml[] = "adapter = \"hci0\"\n"
+                                              "local_name = \"Main\"\n"
+                                              "fw_minor = 3\n"
+                                              "capture_path = \"/var/tmp/k10/gatt\"\n"
+                                              "\n"
+                                              "[instance.dock2]\n"
+                                              "adapter = \"hci1\"\n"
+                                              "\n"
+                                              "[instance.dock3]\n"
+                                              "adapter = \"hci2\"\n"
+                                              "local_name = \"Third\"\n"
+                                              "capture_path = \"/srv/dock3\"\n"
+                                              "\n"
+                                              "[instance.again]\n"
+                                              "adapter = \"hci1\"\n";
+
+/* Sets are large, so each test parses into the heap. */
+static struct k10_config_set *k10_test_parse(const char *toml) {
+    struct k10_config_set *set = calloc(1, sizeof(*set));
+
+    if (set != NULL && k10_config_parse(toml, strlen(toml), "test", set) < 0) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+static void test_primary_only(void) {
+    struct k10_config_set *set = k10_test_parse("adapter = \"hci3\"\nfw_major = 2\n");
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(set->count, 1);
+    K10_CHECK_STR(set->names[0], "");
+    K10_CHECK_STR(set->configs[0].adapter, "hci3");
+    K10_CHECK_INT(set->configs[0].fw_major, 2);
+    K10_CHECK_STR(set->configs[0].local_name, "WoS1MB");
+    free(set);
+}
+
+static void test_instances_inherit(void) {
+    struct k10_config_set *set = k10_test_parse(k10_test_instances_toml);
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(set->count, 4);
+    K10_CHECK_STR(set->names[1], "dock2");
+    K10_CHECK_STR(set->names[2], "dock3");
+
+    /* Only what a section sets differs from the top level. */
+    K10_CHECK_STR(set->configs[1].adapter, "hci1");
+    K10_CHECK_STR(set->configs[1].local_name, "Main");
+    K10_CHECK_INT(set->configs[1].fw_minor, 3);
+    K10_CHECK_STR(set->configs[2].local_name, "Third");
+    K10_CHECK_INT(set->configs[2].fw_minor, 3);
+    free(set);
+}
+
+static void test_capture_path_default(void) {
+    struct k10_config_set *set = k10_test_parse(k10_test_instances_toml);
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_STR(set->configs[0].capture_path, "/var/tmp/k10/gatt");
+    K10_CHECK_STR(set->configs[1].capture_path, "/var/tmp/k10/gatt-dock2");
+    K10_CHECK_STR(set->configs[2].capture_path, "/srv/dock3");
+    free(set);
+}
+
+/* Which section runs on a repeated adapter is the daemon's call; the set keeps them all. */
+static void test_repeated_adapter_kept(void) {
+    struct k10_config_set *set = k10_test_parse(k10_test_instances_toml);
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(k10_config_set_find(set, "again"), 3);
+    K10_CHECK_STR(set->configs[3].adapter, "hci1");
+    K10_CHECK_STR(set->configs[3].capture_path, "/var/tmp/k10/gatt-again");
+    K10_CHECK_INT(k10_config_set_find(set, ""), 0);
+    K10_CHECK_INT(k10_config_set_find(set, "dock4"), -ENOENT);
+    free(set);
+}
+
+static void test_invalid_names(void) {
+    static const char toml[] = "[instance.gatt]\nadapter = \"hci1\"\n"
+                               "[instance.advertisement0]\nadapter = \"hci2\"\n"
+                               "[instance.has-dash]\nadapter = \"hci3\"\n"
+                               "[instance.ok_1]\nadapter = \"hci4\"\n";
+    struct k10_config_set *set = k10_test_parse(toml);
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(set->count, 2);
+    K10_CHECK_STR(set->names[1], "ok_1");
+    K10_CHECK(!k10_config_instance_name_valid("", 0));
+    K10_CHECK(!k10_config_instance_name_valid("a234567890123456789012345678901", 32));
+    K10_CHECK(k10_config_instance_name_valid("a234567890123456789012345678901", 31));
+    free(set);
+}
+
+static void test_instance_limit(void) {
+    char toml[1024];
+    struct k10_config_set *set = NULL;
+    size_t used = 0;
+
+    for (unsigned int i = 1; i <= K10_INSTANCE_MAX; i++) {
+        used += (size_t)snprintf(toml + used, sizeof(toml) - used,
+                                 "[instance.dock%u]\nadapter = \"hci%u\"\n", i, i);
+    }
+
+    set = k10_test_parse(toml);
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(set->count, K10_INSTANCE_MAX);
+    K10_CHECK_INT(k10_config_set_find(set, "dock8"), -ENOENT);
+    free(set);
+}
+
+static void test_invalid_value_keeps_default(void) {
+    struct k10_config_set *set = k10_test_parse("fw_minor = \"three\"\n"
+                                                "[instance.dock2]\n"
+                                                "notify_queue_policy = \"sometimes\"\n");
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(set->configs[0].fw_minor, 0);
+    K10_CHECK_STR(set->configs[1].notify_queue_policy, K10_NOTIFY_POLICY_DROP_OLDEST);
+    free(set);
+}
+
+/* The elements of an array given to a scalar key must not be applied one by one. */
+static void test_array_for_scalar_ignored(void) {
+    struct k10_config_set *set = k10_test_parse("local_name = [\"One\", \"Two\"]\n"
+                                                "fw_minor = [[1], 2]\n"
+                                                "fw_major = 3\n");
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_STR(set->configs[0].local_name, "WoS1MB");
+    K10_CHECK_INT(set->configs[0].fw_minor, 0);
+    K10_CHECK_INT(set->configs[0].fw_major, 3);
+    free(set);
+}
+
+static void test_parse_rejects_redefinitions(void) {
+    static const char *const documents[] = {
+        "fw_minor = 1\nfw_minor = 2\n",
+        "fw_minor = 1\n\"fw_minor\" = 2\n",
+        "[instance.dock2]\nadapter = \"hci1\"\n[instance.dock2]\nlocal_name = \"Two\"\n",
+        "[instance.dock2]\nadapter = \"hci1\"\nadapter = \"hci2\"\n",
+        "instance.dock2 = { adapter = \"hci1\", adapter = \"hci2\" }\n",
+    };
+
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+        struct k10_config_set *set = k10_test_parse(documents[i]);
+
+        K10_CHECK(set == NULL);
+        free(set);
+    }
+}
+
+/* Same key names in different tables, or in separate inline tables of an array, are fine. */
+static void test_parse_allows_same_key_elsewhere(void) {
+    struct k10_config_set *set = k10_test_parse("adapter = \"hci0\"\n"
+                                                "other = [{ a = 1 }, { a = 2 }]\n"
+                                                "[instance.dock2]\nadapter = \"hci1\"\n"
+                                                "[instance.dock3]\nadapter = \"hci2\"\n");
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(set->count, 3);
+    free(set);
+}
+
+static void test_parse_rejects_bad_toml(void) {
+    struct k10_config_set *set = k10_test_parse("adapter = \"hci0\n");
+
+    K10_CHECK(set == NULL);
+    free(set);
+}
+
+/* What the daemon saves must load back as the same set. */
+static void test_render_round_trip(void) {
+    struct k10_config_set *set = k10_test_parse(k10_test_instances_toml);
+    struct k10_config_set *again = NULL;
+    char *data = NULL;
+    size_t length = 0;
+
+    K10_CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    K10_CHECK_INT(k10_config_render(set, &data, &length), 0);
+    again = calloc(1, sizeof(*again));
+    K10_CHECK(data != NULL && again != NULL);
+    if (data != NULL && again != NULL) {
+        K10_CHECK_INT(k10_config_parse(data, length, "rendered", again), 0);
+        K10_CHECK_INT(again->count, set->count);
+        for (unsigned int i = 0; i < set->count && i < again->count; i++) {
+            K10_CHECK_STR(again->names[i], set->names[i]);
+            K10_CHECK_INT(k10_config_diff(&set->configs[i], &again->configs[i]), 0);
+        }
+    }
+
+    free(again);
+    free(data);
+    free(set);
+}
+
+int main(void) {
+    K10_TEST_RUN(test_primary_only);
+    K10_TEST_RUN(test_instances_inherit);
+    K10_TEST_RUN(test_capture_path_default);
+    K10_TEST_RUN(test_repeated_adapter_kept);
+    K10_TEST_RUN(test_invalid_names);
+    K10_TEST_RUN(test_instance_limit);
+    K10_TEST_RUN(test_invalid_value_keeps_default);
+    K10_TEST_RUN(test_array_for_scalar_ignored);
+    K10_TEST_RUN(test_parse_rejects_redefinitions);
+    K10_TEST_RUN(test_parse_allows_same_key_elsewhere);
+    K10_TEST_RUN(test_parse_rejects_bad_toml);
+    K10_TEST_RUN(test_render_round_trip);
+
+    return k10_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+#include "k10_barrel/dock_frame.h"
+
+#include "test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Parses and answers a frame the way k10_chrc_dock_write() does. */
+static const struct k10_dock_response *k10_test_answer(const struct k10_dock_codec *codec,
+                                                       const uint8_t *data, size_t length) {
+    struct k10_dock_frame frame;
+
+    if (k10_dock_frame_parse(data, length, &frame) < 0) {
+        return NULL;
+    }
+    return k10_dock_codec_answer(codec, &frame);
+}
+
+static void k10_test_codec(struct k10_dock_codec *codec, unsigned int fw_major,
+                           unsigned int fw_minor) {
+    struct k10_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.fw_major = fw_major;
+    config.fw_minor = fw_minor;
+    k10_dock_codec_init(codec, &config);
+}
+
+static void test_parse_rejects_malformed(void) {
+    static const uint8_t empty[] = {0};
+    static const uint8_t magic_only[] = {K10_DOCK_FRAME_MAGIC};
+    static const uint8_t bad_magic[] = {0x56, K10_DOCK_CMD_GET_INFO};
+    struct k10_dock_frame frame;
+
+    K10_CHECK_INT(k10_dock_frame_parse(empty, 0, &frame), -EBADMSG);
+    K10_CHECK_INT(k10_dock_frame_parse(magic_only, sizeof(magic_only), &frame), -EBADMSG);
+    K10_CHECK_INT(k10_dock_frame_parse(bad_magic, sizeof(bad_magic), &frame), -EBADMSG);
+    K10_CHECK_INT(k10_dock_frame_parse(NULL, 2, &frame), -EINVAL);
+    K10_CHECK_INT(k10_dock_frame_parse(magic_only, sizeof(magic_only), NULL), -EINVAL);
+}
+
+static void test_parse_views_payload(void) {
+    static const uint8_t data[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_EXTENDED,
+                                   K10_DOCK_EXT_SET_MODE, 0x03};
+    struct k10_dock_frame frame;
+
+    K10_CHECK_INT(k10_dock_frame_parse(data, sizeof(data), &frame), 0);
+    K10_CHECK_INT(frame.command, K10_DOCK_CMD_EXTENDED);
+    K10_CHECK_INT(frame.subcommand, K10_DOCK_EXT_SET_MODE);
+    K10_CHECK(frame.payload == data + 2);
+    K10_CHECK_INT(frame.payload_length, 2);
+    K10_CHECK_STR(k10_dock_frame_name(&frame), "set-mode");
+}
+
+static void test_dispatch_commands(void) {
+    static const uint8_t action[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_ACTION};
+    static const uint8_t get_info[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_GET_INFO};
+    static const uint8_t set_time[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_SET_TIME, 1, 2, 3, 4};
+    struct k10_dock_codec codec;
+
+    k10_test_codec(&codec, 1, 0);
+    K10_CHECK(k10_test_answer(&codec, action, sizeof(action)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_ACK]);
+    K10_CHECK(k10_test_answer(&codec, get_info, sizeof(get_info)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_INFO]);
+    K10_CHECK(k10_test_answer(&codec, set_time, sizeof(set_time)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_ACK]);
+}
+
+static void test_dispatch_extended(void) {
+    static const uint8_t get_state[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_EXTENDED,
+                                        K10_DOCK_EXT_GET_STATE};
+    static const uint8_t set_mode[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_EXTENDED,
+                                       K10_DOCK_EXT_SET_MODE, 0x01};
+    static const uint8_t unknown[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_EXTENDED, 0x7f};
+    struct k10_dock_codec codec;
+    struct k10_dock_frame frame;
+
+    k10_test_codec(&codec, 1, 0);
+    K10_CHECK(k10_test_answer(&codec, get_state, sizeof(get_state)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_STATE]);
+    K10_CHECK(k10_test_answer(&codec, set_mode, sizeof(set_mode)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_ACK]);
+    K10_CHECK(k10_test_answer(&codec, unknown, sizeof(unknown)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_UNSUPPORTED]);
+
+    K10_CHECK_INT(k10_dock_frame_parse(get_state, sizeof(get_state), &frame), 0);
+    K10_CHECK_STR(k10_dock_frame_name(&frame), "get-state");
+    K10_CHECK_INT(k10_dock_frame_parse(unknown, sizeof(unknown), &frame), 0);
+    K10_CHECK_STR(k10_dock_frame_name(&frame), "extended");
+}
+
+static void test_short_payload_is_error(void) {
+    static const uint8_t set_time[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_SET_TIME, 1, 2, 3};
+    static const uint8_t extended[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_EXTENDED};
+    static const uint8_t set_mode[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_EXTENDED,
+                                       K10_DOCK_EXT_SET_MODE};
+    const struct k10_dock_response *response = NULL;
+    struct k10_dock_codec codec;
+
+    k10_test_codec(&codec, 1, 0);
+    response = k10_test_answer(&codec, set_time, sizeof(set_time));
+    K10_CHECK(response == &codec.templates[K10_DOCK_TEMPLATE_ERROR]);
+    K10_CHECK(response != NULL && response->length == 1 &&
+              response->data[0] == K10_DOCK_STATUS_ERROR);
+    K10_CHECK(k10_test_answer(&codec, extended, sizeof(extended)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_ERROR]);
+    K10_CHECK(k10_test_answer(&codec, set_mode, sizeof(set_mode)) ==
+              &codec.templates[K10_DOCK_TEMPLATE_ERROR]);
+}
+
+static void test_unknown_command_is_unsupported(void) {
+    static const uint8_t unknown[] = {K10_DOCK_FRAME_MAGIC, 0x55, 0x00};
+    const struct k10_dock_response *response = NULL;
+    struct k10_dock_codec codec;
+    struct k10_dock_frame frame;
+
+    k10_test_codec(&codec, 1, 0);
+    response = k10_test_answer(&codec, unknown, sizeof(unknown));
+    K10_CHECK(response == &codec.templates[K10_DOCK_TEMPLATE_UNSUPPORTED]);
+    K10_CHECK(response != NULL && response->length == 1 &&
+              response->data[0] == K10_DOCK_STATUS_UNSUPPORTED);
+
+    K10_CHECK_INT(k10_dock_frame_parse(unknown, sizeof(unknown), &frame), 0);
+    K10_CHECK_STR(k10_dock_frame_name(&frame), "unknown");
+}
+
+static void test_configure_patches_firmware(void) {
+    static const uint8_t get_info[] = {K10_DOCK_FRAME_MAGIC, K10_DOCK_CMD_GET_INFO};
+    const struct k10_dock_response *info = NULL;
+    struct k10_dock_codec codec;
+    struct k10_dock_response before;
+    struct k10_config config;
+
+    k10_test_codec(&codec, 3, 7);
+    info = k10_test_answer(&codec, get_info, sizeof(get_info));
+    K10_CHECK(info != NULL);
+    if (info == NULL) {
+        return;
+    }
+    K10_CHECK_INT(info->length, 5);
+    K10_CHECK_INT(info->data[0], K10_DOCK_STATUS_OK);
+    K10_CHECK_INT(info->data[2], 3);
+    K10_CHECK_INT(info->data[3], 7);
+
+    before = *info;
+    memset(&config, 0, sizeof(config));
+    config.fw_major = 4;
+    config.fw_minor = 12;
+    k10_dock_codec_configure(&codec, &config);
+
+    /* Same template, only the firmware bytes move. */
+    K10_CHECK(k10_test_answer(&codec, get_info, sizeof(get_info)) == info);
+    K10_CHECK_INT(info->length, before.length);
+    K10_CHECK_INT(info->data[2], 4);
+    K10_CHECK_INT(info->data[3], 12);
+    K10_CHECK_INT(info->data[1], before.data[1]);
+    K10_CHECK_INT(info->data[4], before.data[4]);
+}
+
+int main(void) {
+    K10_TEST_RUN(test_parse_rejects_malformed);
+    K10_TEST_RUN(test_parse_views_payload);
+    K10_TEST_RUN(test_dispatch_commands);
+    K10_TEST_RUN(test_dispatch_extended);
+    K10_TEST_RUN(test_short_payload_is_error);
+    K10_TEST_RUN(test_unknown_command_is_unsupported);
+    K10_TEST_RUN(test_configure_patches_firmware);
+
+    return k10_test_failures == 0 ? 0 : 1;
+}
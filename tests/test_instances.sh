@@ -0,0 +1,74 @@
+#!/bin/sh
+# Named instances on a private bus: which sections run, and what is saved.
+
+. "$(dirname "$0")/bus.sh"
+
+cat >"$K10_DIR/config.toml" <<EOF
+adapter = "hci0"
+local_name = "Main"
+capture_path = "$K10_DIR/gatt"
+
+[instance.dock2]
+adapter = "hci1"
+
+[instance.dup]
+adapter = "hci0"
+local_name = "Dup"
+EOF
+k10_start_daemon
+
+# dup repeats the primary's adapter, so it gets no instance.
+"$K10_CTL" instances >"$K10_DIR/instances.out" 2>&1 || k10_fail "instances failed"
+cat >"$K10_DIR/instances.expected" <<EOF
+- hci0 /ro/vilt/SwitchbotBleEmulator
+dock2 hci1 /ro/vilt/SwitchbotBleEmulator/dock2
+EOF
+cmp -s "$K10_DIR/instances.out" "$K10_DIR/instances.expected" ||
+    k10_fail "unexpected instance list"
+
+"$K10_CTL" --instance dock2 config get >"$K10_DIR/dock2.out" 2>&1 ||
+    k10_fail "config get on dock2 failed"
+k10_expect_line "$K10_DIR/dock2.out" "local_name=Main"
+k10_expect_line "$K10_DIR/dock2.out" "capture_path=$K10_DIR/gatt-dock2"
+
+"$K10_CTL" --instance dup status >"$K10_DIR/dup.out" 2>&1 &&
+    k10_fail "status on the skipped instance succeeded"
+
+# Saving writes the live configs over every loaded section, dup included.
+"$K10_CTL" --instance dock2 config set local_name Two >/dev/null ||
+    k10_fail "config set on dock2 failed"
+k10_wait_for grep -qxF 'local_name = "Two"' "$K10_DIR/config.toml" ||
+    k10_fail "dock2 change was not saved"
+cp "$K10_DIR/config.toml" "$K10_DIR/saved.out"
+k10_expect_line "$K10_DIR/saved.out" '[instance.dock2]'
+k10_expect_line "$K10_DIR/saved.out" '[instance.dup]'
+k10_expect_line "$K10_DIR/saved.out" 'local_name = "Dup"'
+k10_expect_line "$K10_DIR/saved.out" 'local_name = "Main"'
+if [ "$(grep -c '^adapter = "hci0"' "$K10_DIR/saved.out")" -ne 2 ]; then
+    k10_fail "dup lost its adapter on save"
+fi
+
+# Once dup has an adapter of its own it starts; dock2 moving onto hci0 stops it.
+sed -e '/^\[instance.dup\]/,$ s/^adapter = "hci0"/adapter = "hci2"/' \
+    -e '/^\[instance.dock2\]/,/^\[instance.dup\]/ s/^adapter = "hci1"/adapter = "hci0"/' \
+    "$K10_DIR/saved.out" >"$K10_DIR/config.new"
+mv "$K10_DIR/config.new" "$K10_DIR/config.toml"
+"$K10_CTL" config reload >/dev/null 2>&1
+
+"$K10_CTL" instances >"$K10_DIR/reloaded.out" 2>&1 || k10_fail "instances failed"
+cat >"$K10_DIR/reloaded.expected" <<EOF
+- hci0 /ro/vilt/SwitchbotBleEmulator
+dup hci2 /ro/vilt/SwitchbotBleEmulator/dup
+EOF
+cmp -s "$K10_DIR/reloaded.out" "$K10_DIR/reloaded.expected" ||
+    k10_fail "unexpected instance list after reload"
+
+"$K10_CTL" --instance dup config set fw_minor 4 --type uint >/dev/null ||
+    k10_fail "config set on dup failed"
+k10_wait_for grep -qxF 'fw_minor = 4' "$K10_DIR/config.toml" ||
+    k10_fail "dup change was not saved"
+cp "$K10_DIR/config.toml" "$K10_DIR/resaved.out"
+k10_expect_line "$K10_DIR/resaved.out" '[instance.dock2]'
+k10_expect_line "$K10_DIR/resaved.out" 'local_name = "Two"'
+
+k10_finish
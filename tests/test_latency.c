@@ -0,0 +1,120 @@
+#include "k10_barrel/latency.h"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static void k10_test_reset(struct k10_latency *latency) {
+    memset(latency, 0, sizeof(*latency));
+}
+
+static void test_empty(void) {
+    struct k10_latency latency;
+
+    k10_test_reset(&latency);
+    K10_CHECK_INT(k10_latency_average(&latency), 0);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 50), 0);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 100), 0);
+}
+
+static void test_small_values_are_exact(void) {
+    struct k10_latency latency;
+
+    k10_test_reset(&latency);
+    for (uint64_t ns = 0; ns < 16; ns++) {
+        k10_latency_record(&latency, ns);
+    }
+
+    K10_CHECK_INT(latency.count, 16);
+    K10_CHECK_INT(latency.max_ns, 15);
+    K10_CHECK_INT(k10_latency_average(&latency), 7);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 50), 7);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 100), 15);
+}
+
+/* A percentile is the upper edge of its bucket: never below the sample, at most 1/8 above. */
+static void test_percentile_bounds(void) {
+    struct k10_latency latency;
+
+    for (uint64_t ns = 16; ns < (1ULL << 36); ns += ns / 3 + 1) {
+        uint64_t p50 = 0;
+
+        k10_test_reset(&latency);
+        k10_latency_record(&latency, ns);
+        k10_latency_record(&latency, UINT64_MAX / 2);
+
+        p50 = k10_latency_percentile(&latency, 50);
+        K10_CHECK(p50 >= ns);
+        K10_CHECK(p50 <= ns + ns / 8);
+    }
+}
+
+static void test_percentile_clamped_to_max(void) {
+    struct k10_latency latency;
+
+    k10_test_reset(&latency);
+    k10_latency_record(&latency, 1000);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 50), 1000);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 99), 1000);
+
+    k10_latency_record(&latency, 1500);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 50), 1023);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 99), 1500);
+    K10_CHECK_INT(k10_latency_average(&latency), 1250);
+}
+
+static void test_rank_rounds_up(void) {
+    struct k10_latency latency;
+
+    k10_test_reset(&latency);
+    for (unsigned int i = 0; i < 99; i++) {
+        k10_latency_record(&latency, 10);
+    }
+    k10_latency_record(&latency, 5000);
+
+    K10_CHECK_INT(k10_latency_percentile(&latency, 99), 10);
+    K10_CHECK(k10_latency_percentile(&latency, 100) >= 5000);
+
+    /* One slow frame in 50 is already past the 99th percentile. */
+    k10_test_reset(&latency);
+    for (unsigned int i = 0; i < 49; i++) {
+        k10_latency_record(&latency, 10);
+    }
+    k10_latency_record(&latency, 5000);
+    K10_CHECK(k10_latency_percentile(&latency, 99) >= 5000);
+}
+
+/* Past ~64 s everything shares the last bucket, which reports the maximum rather than wrap. */
+static void test_overflow_bucket(void) {
+    struct k10_latency latency;
+
+    k10_test_reset(&latency);
+    k10_latency_record(&latency, 1ULL << 37);
+    K10_CHECK_INT(latency.buckets[K10_LATENCY_BUCKETS - 1], 1);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 50), 1ULL << 37);
+
+    k10_latency_record(&latency, UINT64_MAX / 4);
+    K10_CHECK_INT(latency.buckets[K10_LATENCY_BUCKETS - 1], 2);
+    K10_CHECK_INT(k10_latency_percentile(&latency, 100), UINT64_MAX / 4);
+}
+
+static void test_now_is_monotonic(void) {
+    uint64_t before = k10_latency_now_ns();
+    uint64_t after = k10_latency_now_ns();
+
+    K10_CHECK(before > 0);
+    K10_CHECK(after >= before);
+}
+
+int main(void) {
+    K10_TEST_RUN(test_empty);
+    K10_TEST_RUN(test_small_values_are_exact);
+    K10_TEST_RUN(test_percentile_bounds);
+    K10_TEST_RUN(test_percentile_clamped_to_max);
+    K10_TEST_RUN(test_rank_rounds_up);
+    K10_TEST_RUN(test_overflow_bucket);
+    K10_TEST_RUN(test_now_is_monotonic);
+
+    return k10_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+# k10-barrel-emulatorctl monitor following a daemon on a private bus.
+
+. "$(dirname "$0")/bus.sh"
+
+cat >"$K10_DIR/config.toml" <<EOF
+adapter = "hci0"
+local_name = "WoS1MB"
+fw_minor = 0
+EOF
+
+# Without timestamps, which differ on every run.
+k10_events() {
+    sed -e 's/^[^ ]* //' -e 's/^{"time":"[^"]*",/{/' "$K10_DIR/$1.out"
+}
+
+k10_seen() {
+    k10_events "$1" | grep -qxF -- "$2"
+}
+
+# Started before the daemon, so "daemon started" shows their matches are in place.
+"$K10_CTL" monitor >"$K10_DIR/all.out" 2>&1 &
+K10_PIDS="$K10_PIDS $!"
+"$K10_CTL" monitor --json --property fw_minor >"$K10_DIR/json.out" 2>&1 &
+K10_PIDS="$K10_PIDS $!"
+"$K10_CTL" monitor --interface status >"$K10_DIR/status.out" 2>&1 &
+K10_PIDS="$K10_PIDS $!"
+sleep 1
+
+k10_start_daemon
+for name in all json status; do
+    k10_wait_for grep -q 'daemon\|"owner":":' "$K10_DIR/$name.out" ||
+        k10_fail "$name: daemon start not reported"
+done
+
+"$K10_CTL" config set local_name Bar >/dev/null || k10_fail "config set local_name failed"
+"$K10_CTL" config set fw_minor 5 --type uint >/dev/null || k10_fail "config set fw_minor failed"
+"$K10_CTL" start >/dev/null || k10_fail "start failed"
+
+k10_wait_for k10_seen all "SweeperMiniBarrel running=true mode=barrel" ||
+    k10_fail "all: start not reported"
+k10_wait_for k10_seen status "SweeperMiniBarrel running=true mode=barrel" ||
+    k10_fail "status: start not reported"
+json='{"event":"properties","interface":"com.switchbot.SwitchbotBleEmulator.Config",'
+json="$json"'"changed":{"fw_minor":5},"invalidated":[]}'
+k10_wait_for k10_seen json "$json" || k10_fail "json: fw_minor change not reported"
+
+# Every change arrives as its own line, in the order it was made.
+k10_events all | grep -v '^daemon' >"$K10_DIR/changes.out"
+cat >"$K10_DIR/changes.expected" <<EOF
+Config local_name=Bar
+Config fw_minor=5
+SweeperMiniBarrel running=true mode=barrel
+EOF
+cmp -s "$K10_DIR/changes.out" "$K10_DIR/changes.expected" ||
+    k10_fail "all: unexpected change lines"
+
+# Filters: the JSON monitor only wants fw_minor, the status one no config at all.
+k10_events json | grep -q local_name && k10_fail "json: local_name passed the property filter"
+k10_events status | grep -q '^Config' && k10_fail "status: config passed the interface filter"
+
+k10_stop_daemon
+k10_wait_for k10_seen all "daemon stopped" || k10_fail "all: daemon stop not reported"
+k10_wait_for k10_seen json '{"event":"daemon","owner":""}' ||
+    k10_fail "json: daemon stop not reported"
+
+"$K10_CTL" monitor --interface "no-dots" >"$K10_DIR/invalid.out" 2>&1 &&
+    k10_fail "monitor accepted an invalid interface"
+k10_expect_line "$K10_DIR/invalid.out" "Invalid interface: no-dots"
+
+k10_finish
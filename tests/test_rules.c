@@ -0,0 +1,226 @@
+#include "k10_barrel/rules.h"
+
+#include "test.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char k10_test_rules_toml[] = "[rule.status]\n"
+                                          "characteristic = \"cba20002\"\n"
+                                          "match = \"57 0f\"\n"
+                                          "reply = \"01 02\"\n"
+                                          "\n"
+                                          "[rule.status-detail]\n"
+                                          "characteristic = \"cba20002\"\n"
+                                          "match = \"57:0f:01\"\n"
+                                          "reply = \"01 02 03\"\n"
+                                          "delay_ms = 250\n"
+                                          "\n"
+                                          "[rule.any-mode]\n"
+                                          "characteristic = \"CBA20002\"\n"
+                                          "match = \"57 01 00\"\n"
+                                          "mask = \"ff ff 00\"\n"
+                                          "reply = \"05\"\n"
+                                          "\n"
+                                          "[rule.sweeper]\n"
+                                          "characteristic = \"b002\"\n"
+                                          "match = \"aa\"\n"
+                                          "reply = \"bb\"\n";
+
+static struct k10_rules *k10_test_parse(const char *toml) {
+    struct k10_rules *rules = NULL;
+
+    if (k10_rules_parse(toml, strlen(toml), "test", &rules) < 0) {
+        return NULL;
+    }
+    return rules;
+}
+
+static const char *k10_test_match(const struct k10_rules *rules, enum k10_gatt_chrc chrc,
+                                  const uint8_t *data, size_t length) {
+    const struct k10_rule *rule = k10_rules_match(rules, chrc, data, length);
+
+    return rule != NULL ? rule->name : NULL;
+}
+
+static void test_parse_counts_rules(void) {
+    struct k10_rules *rules = k10_test_parse(k10_test_rules_toml);
+
+    K10_CHECK(rules != NULL);
+    K10_CHECK_INT(k10_rules_count(rules), 4);
+    K10_CHECK(k10_rules_node_count(rules) > 0);
+    k10_rules_free(rules);
+}
+
+static void test_longest_match_wins(void) {
+    static const uint8_t short_write[] = {0x57, 0x0f};
+    static const uint8_t detail[] = {0x57, 0x0f, 0x01};
+    static const uint8_t other[] = {0x57, 0x0f, 0x02, 0x09};
+    struct k10_rules *rules = k10_test_parse(k10_test_rules_toml);
+    const struct k10_rule *rule = NULL;
+
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, short_write,
+                                 sizeof(short_write)),
+                  "status");
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, detail, sizeof(detail)),
+                  "status-detail");
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, other, sizeof(other)),
+                  "status");
+
+    rule = k10_rules_match(rules, K10_GATT_CHRC_DOCK_WRITE, detail, sizeof(detail));
+    K10_CHECK(rule != NULL);
+    if (rule != NULL) {
+        K10_CHECK_INT(rule->reply_length, 3);
+        K10_CHECK_INT(rule->reply[2], 0x03);
+        K10_CHECK_INT(rule->delay_ms, 250);
+    }
+    k10_rules_free(rules);
+}
+
+static void test_mask_ignores_bytes(void) {
+    static const uint8_t mode_a[] = {0x57, 0x01, 0x00};
+    static const uint8_t mode_b[] = {0x57, 0x01, 0x7f, 0x33};
+    static const uint8_t wrong[] = {0x57, 0x02, 0x7f};
+    struct k10_rules *rules = k10_test_parse(k10_test_rules_toml);
+
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, mode_a, sizeof(mode_a)),
+                  "any-mode");
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, mode_b, sizeof(mode_b)),
+                  "any-mode");
+    K10_CHECK(k10_rules_match(rules, K10_GATT_CHRC_DOCK_WRITE, wrong, sizeof(wrong)) == NULL);
+    k10_rules_free(rules);
+}
+
+static void test_no_match(void) {
+    static const uint8_t prefix[] = {0x57};
+    static const uint8_t sweeper[] = {0xaa, 0x01};
+    struct k10_rules *rules = k10_test_parse(k10_test_rules_toml);
+
+    /* A write shorter than every rule, and rules bound to another characteristic. */
+    K10_CHECK(k10_rules_match(rules, K10_GATT_CHRC_DOCK_WRITE, prefix, sizeof(prefix)) == NULL);
+    K10_CHECK(k10_rules_match(rules, K10_GATT_CHRC_DOCK_WRITE, sweeper, sizeof(sweeper)) == NULL);
+    K10_CHECK(k10_rules_match(rules, K10_GATT_CHRC_SWEEPER_B001, sweeper, sizeof(sweeper)) ==
+              NULL);
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_SWEEPER_B002, sweeper, sizeof(sweeper)),
+                  "sweeper");
+    K10_CHECK(k10_rules_match(rules, K10_GATT_CHRC_COUNT, sweeper, sizeof(sweeper)) == NULL);
+    K10_CHECK(k10_rules_match(NULL, K10_GATT_CHRC_DOCK_WRITE, prefix, sizeof(prefix)) == NULL);
+    k10_rules_free(rules);
+}
+
+static void test_invalid_rules_are_skipped(void) {
+    static const char toml[] = "[rule.bad-chrc]\n"
+                               "characteristic = \"b009\"\n"
+                               "match = \"01\"\n"
+                               "\n"
+                               "[rule.bad-hex]\n"
+                               "characteristic = \"b001\"\n"
+                               "match = \"0g\"\n"
+                               "\n"
+                               "[rule.odd-hex]\n"
+                               "characteristic = \"b001\"\n"
+                               "match = \"012\"\n"
+                               "\n"
+                               "[rule.mask-length]\n"
+                               "characteristic = \"b001\"\n"
+                               "match = \"01 02\"\n"
+                               "mask = \"ff\"\n"
+                               "\n"
+                               "[rule.no-match]\n"
+                               "characteristic = \"b001\"\n"
+                               "reply = \"01\"\n"
+                               "\n"
+                               "[rule.slow]\n"
+                               "characteristic = \"b001\"\n"
+                               "match = \"01\"\n"
+                               "delay_ms = 60001\n"
+                               "\n"
+                               "[rule.good]\n"
+                               "characteristic = \"b001\"\n"
+                               "match = \"01\"\n";
+    static const uint8_t data[] = {0x01, 0x02};
+    struct k10_rules *rules = k10_test_parse(toml);
+
+    K10_CHECK(rules != NULL);
+    K10_CHECK_INT(k10_rules_count(rules), 1);
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_SWEEPER_B001, data, sizeof(data)), "good");
+    k10_rules_free(rules);
+}
+
+static void test_parse_rejects_bad_toml(void) {
+    static const char toml[] = "[rule.broken\n";
+    struct k10_rules *rules = NULL;
+
+    K10_CHECK(k10_rules_parse(toml, strlen(toml), "test", &rules) < 0);
+    K10_CHECK(rules == NULL);
+}
+
+static void test_compile_refcount(void) {
+    struct k10_rule rule;
+    struct k10_rules *rules = NULL;
+    static const uint8_t data[] = {0x57, 0x33};
+
+    memset(&rule, 0, sizeof(rule));
+    snprintf(rule.name, sizeof(rule.name), "compiled");
+    rule.chrc = K10_GATT_CHRC_DOCK_WRITE;
+    rule.length = 2;
+    rule.match[0] = 0x57;
+    rule.match[1] = 0xff;
+    rule.mask[0] = 0xff;
+    rule.mask[1] = 0x00;
+
+    K10_CHECK_INT(k10_rules_compile(NULL, 1, &rules), -EINVAL);
+    K10_CHECK_INT(k10_rules_compile(&rule, 1, &rules), 0);
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, data, sizeof(data)), "compiled");
+
+    /* Compiling applies the mask to its own copy, not the caller's rule. */
+    K10_CHECK_INT(rule.match[1], 0xff);
+
+    K10_CHECK(k10_rules_ref(rules) == rules);
+    k10_rules_free(rules);
+    K10_CHECK_STR(k10_test_match(rules, K10_GATT_CHRC_DOCK_WRITE, data, sizeof(data)), "compiled");
+    k10_rules_free(rules);
+}
+
+static void test_load_file(void) {
+    char path[] = "/tmp/k10-test-rules-XXXXXX";
+    struct k10_rules *rules = NULL;
+    int fd = mkstemp(path);
+
+    K10_CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    K10_CHECK(write(fd, k10_test_rules_toml, strlen(k10_test_rules_toml)) ==
+              (ssize_t)strlen(k10_test_rules_toml));
+    close(fd);
+
+    K10_CHECK_INT(k10_rules_load(path, &rules), 0);
+    K10_CHECK_INT(k10_rules_count(rules), 4);
+    k10_rules_free(rules);
+
+    /* A missing file is an empty set, not an error. */
+    unlink(path);
+    rules = NULL;
+    K10_CHECK_INT(k10_rules_load(path, &rules), 0);
+    K10_CHECK(rules != NULL);
+    K10_CHECK_INT(k10_rules_count(rules), 0);
+    k10_rules_free(rules);
+}
+
+int main(void) {
+    K10_TEST_RUN(test_parse_counts_rules);
+    K10_TEST_RUN(test_longest_match_wins);
+    K10_TEST_RUN(test_mask_ignores_bytes);
+    K10_TEST_RUN(test_no_match);
+    K10_TEST_RUN(test_invalid_rules_are_skipped);
+    K10_TEST_RUN(test_parse_rejects_bad_toml);
+    K10_TEST_RUN(test_compile_refcount);
+    K10_TEST_RUN(test_load_file);
+
+    return k10_test_failures == 0 ? 0 : 1;
+}